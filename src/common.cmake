@@ -19,6 +19,8 @@ elseif(APPLE)
   set(TARGET_OS "osx")
   set(TARGET_SYSTEM "posix")
   set(TARGET_EXT "m")
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -pthread")
+  set(LINK_FLAGS "${LINK_FLAGS} -pthread")
 
   set(CMAKE_C_FLAGS_DEBUG "-Werror -g")
   set(LINK_FLAGS_DEBUG "")
@@ -29,6 +31,8 @@ else()
   set(TARGET_OS "posix")
   set(TARGET_SYSTEM "posix")
   set(TARGET_EXT "c")
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -pthread")
+  set(LINK_FLAGS "${LINK_FLAGS} -pthread")
 
   set(CMAKE_C_FLAGS_DEBUG "-Werror -g")
   set(LINK_FLAGS_DEBUG "")
@@ -40,6 +44,7 @@ endif()
 set(SRC_COMMON
   ../../common/compat_${TARGET_OS}.c
   ../../common/strutil.c
+  ../../common/dtoa.c
 )
 
 if("${MODE}" STREQUAL "debug")
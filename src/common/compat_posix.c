@@ -1,5 +1,7 @@
 #include "fox.h"
 #include <sys/stat.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 
 int64_t get_file_size(FileHandle fh)
@@ -21,3 +23,62 @@ int64_t get_file_size(FileHandle fh)
         return -1;
     }
 }
+
+int get_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) {
+        return 1;
+    }
+    return (int)n;
+}
+
+typedef struct {
+    ParallelFunc fn;
+    void *arg;
+} ParallelArg;
+
+static void *parallel_entry(void *p)
+{
+    ParallelArg *pa = p;
+    pa->fn(pa->arg);
+    return NULL;
+}
+/**
+ * fn(args[0]) ... fn(args[n - 1]) を並列に実行し、全て終了するまで待つ
+ * スレッドを作成できなかった分は呼び出し元スレッドで実行する
+ */
+void run_parallel(ParallelFunc fn, void *args, int arg_size, int n)
+{
+    pthread_t *th;
+    ParallelArg *pa;
+    int *started;
+    int i;
+
+    if (n <= 1) {
+        if (n == 1) {
+            fn(args);
+        }
+        return;
+    }
+    th = malloc(sizeof(pthread_t) * n);
+    pa = malloc(sizeof(ParallelArg) * n);
+    started = malloc(sizeof(int) * n);
+
+    for (i = 1; i < n; i++) {
+        pa[i].fn = fn;
+        pa[i].arg = (char*)args + arg_size * i;
+        started[i] = (pthread_create(&th[i], NULL, parallel_entry, &pa[i]) == 0);
+    }
+    fn(args);
+    for (i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(th[i], NULL);
+        } else {
+            fn(pa[i].arg);
+        }
+    }
+    free(th);
+    free(pa);
+    free(started);
+}
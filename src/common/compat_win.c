@@ -336,3 +336,63 @@ void closedir_fox(DIR *d)
     FindClose((HANDLE)d->hDir);
     free(d);
 }
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+int get_cpu_count(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    if (si.dwNumberOfProcessors < 1) {
+        return 1;
+    }
+    return si.dwNumberOfProcessors;
+}
+
+typedef struct {
+    ParallelFunc fn;
+    void *arg;
+} ParallelArg;
+
+static DWORD WINAPI parallel_entry(LPVOID p)
+{
+    ParallelArg *pa = p;
+    pa->fn(pa->arg);
+    return 0;
+}
+/**
+ * fn(args[0]) ... fn(args[n - 1]) を並列に実行し、全て終了するまで待つ
+ * スレッドを作成できなかった分は呼び出し元スレッドで実行する
+ */
+void run_parallel(ParallelFunc fn, void *args, int arg_size, int n)
+{
+    HANDLE *th;
+    ParallelArg *pa;
+    int i;
+
+    if (n <= 1) {
+        if (n == 1) {
+            fn(args);
+        }
+        return;
+    }
+    th = malloc(sizeof(HANDLE) * n);
+    pa = malloc(sizeof(ParallelArg) * n);
+
+    for (i = 1; i < n; i++) {
+        pa[i].fn = fn;
+        pa[i].arg = (char*)args + arg_size * i;
+        th[i] = CreateThread(NULL, 0, parallel_entry, &pa[i], 0, NULL);
+    }
+    fn(args);
+    for (i = 1; i < n; i++) {
+        if (th[i] != NULL) {
+            WaitForSingleObject(th[i], INFINITE);
+            CloseHandle(th[i]);
+        } else {
+            fn(pa[i].arg);
+        }
+    }
+    free(th);
+    free(pa);
+}
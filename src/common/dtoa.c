@@ -0,0 +1,487 @@
+#include "fox.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+/*
+ * doubleと10進文字列の相互変換
+ *
+ * double -> 文字列 : Grisu2 (Loitsch)
+ *   戻すと必ず同じdoubleになる、(ほぼ)最短の桁列を生成する
+ * 文字列 -> double : 仮数部が2^53以下で、10の指数が小さい場合は浮動小数の演算1回で正確に求まる (Clinger)
+ *   それ以外はstrtodで変換する
+ */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k;
+} CachedPower;
+
+enum {
+    GRISU_ALPHA = -60,
+    GRISU_GAMMA = -32,
+    CACHED_POWERS_MIN_DEC_EXP = -300,
+    CACHED_POWERS_DEC_STEP = 8,
+};
+
+#define DOUBLE_HIDDEN_BIT     0x0010000000000000ULL
+#define DOUBLE_SIGNIFICAND    0x000FFFFFFFFFFFFFULL
+#define DOUBLE_EXPONENT_BIAS  (0x3FF + 52)
+
+// 10^k ≒ f * 2^e (fは正規化済み)
+static const CachedPower cached_powers[] = {
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL,  -980, -276 },
+    { 0xD3515C2831559A83ULL,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL,  -927, -260 },
+    { 0xEA9C227723EE8BCBULL,  -901, -252 },
+    { 0xAECC49914078536DULL,  -874, -244 },
+    { 0x823C12795DB6CE57ULL,  -847, -236 },
+    { 0xC21094364DFB5637ULL,  -821, -228 },
+    { 0x9096EA6F3848984FULL,  -794, -220 },
+    { 0xD77485CB25823AC7ULL,  -768, -212 },
+    { 0xA086CFCD97BF97F4ULL,  -741, -204 },
+    { 0xEF340A98172AACE5ULL,  -715, -196 },
+    { 0xB23867FB2A35B28EULL,  -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL,  -661, -180 },
+    { 0xC5DD44271AD3CDBAULL,  -635, -172 },
+    { 0x936B9FCEBB25C996ULL,  -608, -164 },
+    { 0xDBAC6C247D62A584ULL,  -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL,  -555, -148 },
+    { 0xF3E2F893DEC3F126ULL,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL,  -502, -132 },
+    { 0x87625F056C7C4A8BULL,  -475, -124 },
+    { 0xC9BCFF6034C13053ULL,  -449, -116 },
+    { 0x964E858C91BA2655ULL,  -422, -108 },
+    { 0xDFF9772470297EBDULL,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL,  -369,  -92 },
+    { 0xF8A95FCF88747D94ULL,  -343,  -84 },
+    { 0xB94470938FA89BCFULL,  -316,  -76 },
+    { 0x8A08F0F8BF0F156BULL,  -289,  -68 },
+    { 0xCDB02555653131B6ULL,  -263,  -60 },
+    { 0x993FE2C6D07B7FACULL,  -236,  -52 },
+    { 0xE45C10C42A2B3B06ULL,  -210,  -44 },
+    { 0xAA242499697392D3ULL,  -183,  -36 },
+    { 0xFD87B5F28300CA0EULL,  -157,  -28 },
+    { 0xBCE5086492111AEBULL,  -130,  -20 },
+    { 0x8CBCCC096F5088CCULL,  -103,  -12 },
+    { 0xD1B71758E219652CULL,   -77,   -4 },
+    { 0x9C40000000000000ULL,   -50,    4 },
+    { 0xE8D4A51000000000ULL,   -24,   12 },
+    { 0xAD78EBC5AC620000ULL,     3,   20 },
+    { 0x813F3978F8940984ULL,    30,   28 },
+    { 0xC097CE7BC90715B3ULL,    56,   36 },
+    { 0x8F7E32CE7BEA5C70ULL,    83,   44 },
+    { 0xD5D238A4ABE98068ULL,   109,   52 },
+    { 0x9F4F2726179A2245ULL,   136,   60 },
+    { 0xED63A231D4C4FB27ULL,   162,   68 },
+    { 0xB0DE65388CC8ADA8ULL,   189,   76 },
+    { 0x83C7088E1AAB65DBULL,   216,   84 },
+    { 0xC45D1DF942711D9AULL,   242,   92 },
+    { 0x924D692CA61BE758ULL,   269,  100 },
+    { 0xDA01EE641A708DEAULL,   295,  108 },
+    { 0xA26DA3999AEF774AULL,   322,  116 },
+    { 0xF209787BB47D6B85ULL,   348,  124 },
+    { 0xB454E4A179DD1877ULL,   375,  132 },
+    { 0x865B86925B9BC5C2ULL,   402,  140 },
+    { 0xC83553C5C8965D3DULL,   428,  148 },
+    { 0x952AB45CFA97A0B3ULL,   455,  156 },
+    { 0xDE469FBD99A05FE3ULL,   481,  164 },
+    { 0xA59BC234DB398C25ULL,   508,  172 },
+    { 0xF6C69A72A3989F5CULL,   534,  180 },
+    { 0xB7DCBF5354E9BECEULL,   561,  188 },
+    { 0x88FCF317F22241E2ULL,   588,  196 },
+    { 0xCC20CE9BD35C78A5ULL,   614,  204 },
+    { 0x98165AF37B2153DFULL,   641,  212 },
+    { 0xE2A0B5DC971F303AULL,   667,  220 },
+    { 0xA8D9D1535CE3B396ULL,   694,  228 },
+    { 0xFB9B7CD9A4A7443CULL,   720,  236 },
+    { 0xBB764C4CA7A44410ULL,   747,  244 },
+    { 0x8BAB8EEFB6409C1AULL,   774,  252 },
+    { 0xD01FEF10A657842CULL,   800,  260 },
+    { 0x9B10A4E5E9913129ULL,   827,  268 },
+    { 0xE7109BFBA19C0C9DULL,   853,  276 },
+    { 0xAC2820D9623BF429ULL,   880,  284 },
+    { 0x80444B5E7AA7CF85ULL,   907,  292 },
+    { 0xBF21E44003ACDD2DULL,   933,  300 },
+    { 0x8E679C2F5E44FF8FULL,   960,  308 },
+    { 0xD433179D9C8CB841ULL,   986,  316 },
+    { 0x9E19DB92B4E31BA9ULL,  1013,  324 },
+};
+
+// 浮動小数で正確に表せる10のべき乗
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22,
+};
+
+
+static DiyFp DiyFp_new(uint64_t f, int e)
+{
+    DiyFp r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+/*
+ * 上位64bitを丸めて返す
+ */
+static DiyFp DiyFp_mul(DiyFp x, DiyFp y)
+{
+    uint64_t u_lo = x.f & 0xFFFFFFFFULL;
+    uint64_t u_hi = x.f >> 32;
+    uint64_t v_lo = y.f & 0xFFFFFFFFULL;
+    uint64_t v_hi = y.f >> 32;
+
+    uint64_t p0 = u_lo * v_lo;
+    uint64_t p1 = u_lo * v_hi;
+    uint64_t p2 = u_hi * v_lo;
+    uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFULL) + (p2 & 0xFFFFFFFFULL);
+    q += 1ULL << 31;
+
+    return DiyFp_new(p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+static DiyFp DiyFp_normalize(DiyFp x)
+{
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/*
+ * vと、丸めるとvになる範囲の下限と上限を求める
+ */
+static void double_boundaries(DiyFp *w, DiyFp *w_minus, DiyFp *w_plus, double d)
+{
+    uint64_t bits;
+    uint64_t f;
+    int e;
+    DiyFp v, m_minus, m_plus;
+
+    memcpy(&bits, &d, sizeof(bits));
+    f = bits & DOUBLE_SIGNIFICAND;
+    e = (int)((bits >> 52) & 0x7FF);
+
+    if (e == 0) {
+        // 非正規化数
+        v = DiyFp_new(f, 1 - DOUBLE_EXPONENT_BIAS);
+    } else {
+        v = DiyFp_new(f + DOUBLE_HIDDEN_BIT, e - DOUBLE_EXPONENT_BIAS);
+    }
+    m_plus = DiyFp_new(v.f * 2 + 1, v.e - 1);
+    if (f == 0 && e > 1) {
+        // 2のべき乗の場合、下側の間隔は半分
+        m_minus = DiyFp_new(v.f * 4 - 1, v.e - 2);
+    } else {
+        m_minus = DiyFp_new(v.f * 2 - 1, v.e - 1);
+    }
+
+    *w = DiyFp_normalize(v);
+    *w_plus = DiyFp_normalize(m_plus);
+    w_minus->f = m_minus.f << (m_minus.e - w_plus->e);
+    w_minus->e = w_plus->e;
+}
+/*
+ * 掛けた結果の指数がALPHA - GAMMAの範囲に入る10のべき乗
+ */
+static const CachedPower *get_cached_power(int e)
+{
+    int f = GRISU_ALPHA - e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0);
+    int idx = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) / CACHED_POWERS_DEC_STEP;
+    return &cached_powers[idx];
+}
+
+static int find_largest_pow10(uint32_t n, uint32_t *pow10)
+{
+    static const uint32_t tbl[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    };
+    int i;
+
+    for (i = 9; i > 0; i--) {
+        if (n >= tbl[i]) {
+            break;
+        }
+    }
+    *pow10 = tbl[i];
+    return i + 1;
+}
+/*
+ * 最後の桁をwに近づける
+ */
+static void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k)
+{
+    while (rest < dist && delta - rest >= ten_k &&
+           (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buf[len - 1]--;
+        rest += ten_k;
+    }
+}
+static int grisu2_digit_gen(char *buf, int *pk, DiyFp m_minus, DiyFp w, DiyFp m_plus)
+{
+    uint64_t delta = m_plus.f - m_minus.f;
+    uint64_t dist = m_plus.f - w.f;
+    int sh = -m_plus.e;
+    uint64_t one = 1ULL << sh;
+    uint32_t p1 = (uint32_t)(m_plus.f >> sh);
+    uint64_t p2 = m_plus.f & (one - 1);
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, &pow10);
+    int len = 0;
+    int m = 0;
+
+    // 整数部
+    while (n > 0) {
+        uint64_t rest;
+        buf[len++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+
+        rest = ((uint64_t)p1 << sh) + p2;
+        if (rest <= delta) {
+            *pk += n;
+            grisu2_round(buf, len, dist, delta, rest, (uint64_t)pow10 << sh);
+            return len;
+        }
+        pow10 /= 10;
+    }
+    // 小数部
+    for (;;) {
+        p2 *= 10;
+        buf[len++] = (char)('0' + (p2 >> sh));
+        p2 &= one - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    *pk -= m;
+    grisu2_round(buf, len, dist, delta, p2, one);
+
+    return len;
+}
+
+/*
+ * dの絶対値を、戻すと同じ値になる短い10進の桁列に変換する
+ * dは有限の値
+ * buf : 18byte以上
+ * pex : 先頭の桁の指数 (d.ddd * 10^ex)
+ * 戻り値 : 桁数
+ */
+int double_to_digits(char *buf, int *pex, double d)
+{
+    DiyFp w, w_minus, w_plus;
+    DiyFp c, m_minus, m_plus;
+    const CachedPower *cp;
+    int len, k;
+
+    d = fabs(d);
+    if (d == 0.0) {
+        buf[0] = '0';
+        buf[1] = '\0';
+        *pex = 0;
+        return 1;
+    }
+    double_boundaries(&w, &w_minus, &w_plus, d);
+
+    cp = get_cached_power(w_plus.e);
+    c = DiyFp_new(cp->f, cp->e);
+
+    w = DiyFp_mul(w, c);
+    m_minus = DiyFp_mul(w_minus, c);
+    m_plus = DiyFp_mul(w_plus, c);
+    // 誤差の分だけ範囲を狭める
+    m_minus.f++;
+    m_plus.f--;
+
+    k = -cp->k;
+    len = grisu2_digit_gen(buf, &k, m_minus, w, m_plus);
+    buf[len] = '\0';
+    *pex = k + len - 1;
+
+    return len;
+}
+/*
+ * Float#to_strの書式指定なしと同じ形式
+ * 指数が-4未満または10より大きい場合は指数表記
+ * buf : 32byte以上
+ * 戻り値 : 文字列の長さ
+ */
+int double_to_str(char *buf, double d)
+{
+    char digits[24];
+    char *dst = buf;
+    int len, ex;
+
+    if (isnan(d)) {
+        strcpy(buf, "nan");
+        return 3;
+    }
+    if (signbit(d)) {
+        *dst++ = '-';
+    }
+    if (isinf(d)) {
+        strcpy(dst, "Inf");
+        return dst - buf + 3;
+    }
+    len = double_to_digits(digits, &ex, d);
+
+    if (ex < -4 || ex > 10) {
+        *dst++ = digits[0];
+        if (len > 1) {
+            *dst++ = '.';
+            memcpy(dst, digits + 1, len - 1);
+            dst += len - 1;
+        }
+        dst += sprintf(dst, "e%+d", ex);
+    } else if (ex < 0) {
+        *dst++ = '0';
+        *dst++ = '.';
+        memset(dst, '0', -ex - 1);
+        dst += -ex - 1;
+        memcpy(dst, digits, len);
+        dst += len;
+        *dst = '\0';
+    } else if (len > ex + 1) {
+        memcpy(dst, digits, ex + 1);
+        dst += ex + 1;
+        *dst++ = '.';
+        memcpy(dst, digits + ex + 1, len - ex - 1);
+        dst += len - ex - 1;
+        *dst = '\0';
+    } else {
+        memcpy(dst, digits, len);
+        dst += len;
+        memset(dst, '0', ex + 1 - len);
+        dst += ex + 1 - len;
+        *dst = '\0';
+    }
+    return dst - buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * strtodと同じ引数、戻り値
+ * 19桁以下の10進数で、浮動小数の演算1回で正確に求まる場合はstrtodを使わない
+ */
+double str_to_double(const char *src, char **end)
+{
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    const char *p = src;
+    uint64_t mant = 0;
+    int n_digit = 0;
+    int has_digit = FALSE;
+    int neg = FALSE;
+    int ex = 0;
+    double d;
+
+    if (*p == '-') {
+        neg = TRUE;
+        p++;
+    } else if (*p == '+') {
+        p++;
+    }
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        goto FALLBACK;
+    }
+    for (; isdigit_fox(*p); p++) {
+        has_digit = TRUE;
+        if (mant != 0 || *p != '0') {
+            if (n_digit >= 19) {
+                goto FALLBACK;
+            }
+            mant = mant * 10 + (*p - '0');
+            n_digit++;
+        }
+    }
+    if (*p == '.') {
+        p++;
+        for (; isdigit_fox(*p); p++) {
+            has_digit = TRUE;
+            if (mant != 0 || *p != '0') {
+                if (n_digit >= 19) {
+                    goto FALLBACK;
+                }
+                mant = mant * 10 + (*p - '0');
+                n_digit++;
+            }
+            ex--;
+        }
+    }
+    if (!has_digit) {
+        // inf, nanなど
+        goto FALLBACK;
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char *q = p + 1;
+        int e_neg = FALSE;
+        int e_val = 0;
+
+        if (*q == '-') {
+            e_neg = TRUE;
+            q++;
+        } else if (*q == '+') {
+            q++;
+        }
+        if (isdigit_fox(*q)) {
+            for (; isdigit_fox(*q); q++) {
+                if (e_val >= 10000) {
+                    goto FALLBACK;
+                }
+                e_val = e_val * 10 + (*q - '0');
+            }
+            ex += (e_neg ? -e_val : e_val);
+            p = q;
+        }
+    }
+
+    if (mant == 0) {
+        d = 0.0;
+    } else if (mant > (1ULL << 53)) {
+        goto FALLBACK;
+    } else if (ex >= 0 && ex <= 22) {
+        d = (double)mant * exact_pow10[ex];
+    } else if (ex < 0 && ex >= -22) {
+        d = (double)mant / exact_pow10[-ex];
+    } else if (ex > 22 && ex <= 22 + 15) {
+        // 仮数部を整数のまま大きくできる場合
+        uint64_t m2 = mant;
+        int i;
+        for (i = 22; i < ex; i++) {
+            m2 *= 10;
+            if (m2 > (1ULL << 53)) {
+                goto FALLBACK;
+            }
+        }
+        d = (double)m2 * 1e22;
+    } else {
+        goto FALLBACK;
+    }
+    if (end != NULL) {
+        *end = (char*)p;
+    }
+    return neg ? -d : d;
+
+FALLBACK:
+#endif
+    return strtod(src, end);
+}
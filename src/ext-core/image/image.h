@@ -11,6 +11,20 @@ enum {
     QUANT_MODE_RGBA,
     QUANT_MODE_KEY,
 };
+enum {
+    QUANT_ALGO_MEDIAN_CUT,
+    QUANT_ALGO_OCTREE,
+};
+enum {
+    DITHER_NONE,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ORDERED,
+};
+enum {
+    RESAMPLE_BILINEAR,
+    RESAMPLE_BICUBIC,
+    RESAMPLE_LANCZOS3,
+};
 
 #ifdef DEFINE_GLOBALS
 #define extern
@@ -41,11 +55,15 @@ void CopyParam_init(CopyParam *cp, RefImage *dst, const RefImage *src, int alpha
 void copy_image_line(uint8_t *pd, RefImage *dst, const uint8_t *ps, const RefImage *src, int w, const CopyParam *cp, int alpha);
 
 // quantize.c
-void quantize(RefImage *dst, const RefImage *src, int mode, int dither);
+void quantize(RefImage *dst, const RefImage *src, int mode, int dither, int algorithm);
 int get_palette_mode(uint32_t *palette);
 uint8_t *get_nearest_palette(uint32_t *palette, int mode);
 uint8_t *get_convert_palette_table(uint32_t *dst, const uint32_t *src);
 void quantize_palette(RefImage *dst, const RefImage *src, int dither);
 
+// resample.c
+int resample_filter_from_name(const char *name_p, int name_size);
+void copy_image_filtered_sub(RefImage *dst, const RefImage *src, int32_t *dst_rect, int32_t *src_rect, int alpha, int filter);
+
 
 #endif /* IMAGE_H_INCLUDED */
@@ -1806,7 +1806,8 @@ static int image_quantize(Value *vret, Value *v, RefNode *node)
     RefImage *dst;
     int mode = QUANT_MODE_RGB;
     int set_palette = FALSE;
-    int dither = FALSE;
+    int dither = DITHER_NONE;
+    int algorithm = QUANT_ALGO_MEDIAN_CUT;
 
     if (src->data == NULL) {
         throw_already_closed();
@@ -1857,12 +1858,39 @@ static int image_quantize(Value *vret, Value *v, RefNode *node)
         }
     }
     if (fg->stk_top > v + 2) {
-        dither = Value_bool(v[2]);
+        // true : Floyd-Steinberg
+        // "ordered" : Ordered dithering (Bayer)
+        if (fs->Value_type(v[2]) == fs->cls_str) {
+            RefStr *rs = Value_vp(v[2]);
+            if (str_eqi(rs->c, rs->size, "ordered", -1)) {
+                dither = DITHER_ORDERED;
+            } else if (str_eqi(rs->c, rs->size, "floyd-steinberg", -1)) {
+                dither = DITHER_FLOYD_STEINBERG;
+            } else if (str_eqi(rs->c, rs->size, "none", -1)) {
+                dither = DITHER_NONE;
+            } else {
+                fs->throw_errorf(fs->mod_lang, "ValueError", "Unknwon dither %q", rs->c);
+                return FALSE;
+            }
+        } else if (Value_bool(v[2])) {
+            dither = DITHER_FLOYD_STEINBERG;
+        }
+    }
+    if (fg->stk_top > v + 3) {
+        RefStr *rs = Value_vp(v[3]);
+        if (str_eqi(rs->c, rs->size, "median-cut", -1)) {
+            algorithm = QUANT_ALGO_MEDIAN_CUT;
+        } else if (str_eqi(rs->c, rs->size, "octree", -1)) {
+            algorithm = QUANT_ALGO_OCTREE;
+        } else {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Unknwon algorithm %q", rs->c);
+            return FALSE;
+        }
     }
     if (set_palette) {
         quantize_palette(dst, src, dither);
     } else {
-        quantize(dst, src, mode, dither);
+        quantize(dst, src, mode, dither, algorithm);
     }
     return TRUE;
 }
@@ -1941,6 +1969,54 @@ static int image_copy_resized(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+/**
+ * copy_filtered(src, filter, dst_rect, src_rect)
+ * filter : "bilinear", "bicubic", "lanczos3"
+ */
+static int image_copy_filtered(Value *vret, Value *v, RefNode *node)
+{
+    int alpha = FUNC_INT(node);
+    RefImage *src = Value_vp(v[1]);
+    RefImage *dst = Value_vp(*v);
+    RefStr *filter_name = Value_vp(v[2]);
+    int filter;
+    RefRect *dst_rect;
+    RefRect *src_rect;
+    RefRect dst_rect_v;
+    RefRect src_rect_v;
+
+    if (fg->stk_top > v + 3) {
+        dst_rect = Value_vp(v[3]);
+    } else {
+        dst_rect_v.i[INDEX_RECT_X] = 0;
+        dst_rect_v.i[INDEX_RECT_Y] = 0;
+        dst_rect_v.i[INDEX_RECT_W] = dst->width;
+        dst_rect_v.i[INDEX_RECT_H] = dst->height;
+        dst_rect = &dst_rect_v;
+    }
+    if (fg->stk_top > v + 4) {
+        src_rect = Value_vp(v[4]);
+    } else {
+        src_rect_v.i[INDEX_RECT_X] = 0;
+        src_rect_v.i[INDEX_RECT_Y] = 0;
+        src_rect_v.i[INDEX_RECT_W] = src->width;
+        src_rect_v.i[INDEX_RECT_H] = src->height;
+        src_rect = &src_rect_v;
+    }
+
+    filter = resample_filter_from_name(filter_name->c, filter_name->size);
+    if (filter < 0) {
+        fs->throw_errorf(fs->mod_lang, "ValueError", "Unknown filter name %q", filter_name->c);
+        return FALSE;
+    }
+    if (src->data == NULL || dst->data == NULL) {
+        throw_already_closed();
+        return FALSE;
+    }
+    copy_image_filtered_sub(dst, src, dst_rect->i, src_rect->i, alpha, filter);
+
+    return TRUE;
+}
 static int image_fill_rect(Value *vret, Value *v, RefNode *node)
 {
     RefImage *img = Value_vp(*v);
@@ -2271,19 +2347,23 @@ static void define_class(RefNode *m, RefNode *mod_math)
     n = fs->define_identifier(m, cls, "convert_self", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_convert_self, 1, 1, NULL, cls_matrix);
     n = fs->define_identifier(m, cls, "quantize", NODE_FUNC_N, 0);
-    fs->define_native_func_a(n, image_quantize, 0, 2, cls_palette, NULL, NULL);
+    fs->define_native_func_a(n, image_quantize, 0, 3, cls_palette, NULL, NULL, fs->cls_str);
     n = fs->define_identifier(m, cls, "copy", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy, 3, 4, (void*)FALSE, cls_image, fs->cls_int, fs->cls_int, cls_rect);
     n = fs->define_identifier(m, cls, "copy_resized", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy_resized, 1, 3, (void*)0, cls_image, cls_rect, cls_rect);
     n = fs->define_identifier(m, cls, "copy_resampled", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy_resized, 1, 3, (void*)FLAGS_RESAMPLED, cls_image, cls_rect, cls_rect);
+    n = fs->define_identifier(m, cls, "copy_filtered", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, image_copy_filtered, 2, 4, (void*)FALSE, cls_image, fs->cls_str, cls_rect, cls_rect);
     n = fs->define_identifier(m, cls, "blend", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy, 3, 4, (void*)TRUE, cls_image, fs->cls_int, fs->cls_int, cls_rect);
     n = fs->define_identifier(m, cls, "blend_resized", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy_resized, 1, 3, (void*)FLAGS_ALPHA, cls_image, cls_rect, cls_rect);
     n = fs->define_identifier(m, cls, "blend_resampled", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_copy_resized, 1, 3, (void*)(FLAGS_ALPHA|FLAGS_RESAMPLED), cls_image, cls_rect, cls_rect);
+    n = fs->define_identifier(m, cls, "blend_filtered", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, image_copy_filtered, 2, 4, (void*)TRUE, cls_image, fs->cls_str, cls_rect, cls_rect);
     n = fs->define_identifier(m, cls, "fill_rect", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, image_fill_rect, 1, 2, NULL, NULL, cls_rect);
     fs->extends_method(cls, fs->cls_obj);
@@ -12,6 +12,9 @@ enum {
     HIST_SIZE_RGB = 32 * 32 * 32,
     HIST_SIZE_RGBA = 32 * 32 * 32 * 8,
     TRANSPARENT_THRES = 64 >> A_SHIFT,
+
+    PARALLEL_MIN_ROWS = 64,
+    OCT_DEPTH = 5,
 };
 
 typedef struct {
@@ -23,10 +26,188 @@ typedef struct {
     int count;
 } QuantColor;
 
+/**
+ * パレットの最近傍探索用 k-d tree
+ * 配列を再帰的に中央値で分割したもので、pt[n / 2] が節になる
+ * c[3] はアルファ値の重み(x4)を掛けたもの
+ */
+typedef struct {
+    int c[4];
+    int idx;
+    int axis;
+} KdPoint;
+
+typedef struct OctNode {
+    struct OctNode *child[16];
+    struct OctNode *next;    // 同じ階層の節
+    uint32_t count;
+    uint64_t sum[4];
+    int n_child;
+    int leaf;
+} OctNode;
+
+typedef struct {
+    Mem mem;
+    OctNode *root;
+    OctNode *levels[OCT_DEPTH];
+    int n_levels[OCT_DEPTH];
+    int n_leaf;
+} OctTree;
+
+typedef struct {
+    KdPoint pt[PALETTE_NUM];
+    int pos[PALETTE_NUM];    // パレット番号 -> ptの添字
+} KdTree;
+
+typedef struct {
+    const RefImage *src;
+    RefImage *dst;
+    const uint8_t *table;
+    int mode;
+    int y1, y2;
+} QuantBand;
+
+typedef struct {
+    const KdTree *kd;
+    uint8_t *table;
+    int mode;
+    int z1, z2;
+} NearestBand;
+
 // RGBモードの場合は、v[3]は常に0
 #define RGBA_TO_INDEX(v) ((v)[0] | ((v)[1] << 5) | ((v)[2] << 10) | ((v)[3] << 15))
 
 
+static void kdtree_build(KdPoint *pt, int n)
+{
+    int min[4], max[4];
+    int axis = 0;
+    int i, j;
+    int m;
+
+    if (n <= 1) {
+        return;
+    }
+    for (j = 0; j < 4; j++) {
+        min[j] = pt[0].c[j];
+        max[j] = pt[0].c[j];
+    }
+    for (i = 1; i < n; i++) {
+        for (j = 0; j < 4; j++) {
+            int c = pt[i].c[j];
+            if (min[j] > c) {
+                min[j] = c;
+            }
+            if (max[j] < c) {
+                max[j] = c;
+            }
+        }
+    }
+    for (j = 1; j < 4; j++) {
+        if (max[j] - min[j] > max[axis] - min[axis]) {
+            axis = j;
+        }
+    }
+    // 点の数は高々256なので挿入ソートで十分
+    for (i = 1; i < n; i++) {
+        KdPoint tmp = pt[i];
+        for (j = i; j > 0 && pt[j - 1].c[axis] > tmp.c[axis]; j--) {
+            pt[j] = pt[j - 1];
+        }
+        pt[j] = tmp;
+    }
+    m = n / 2;
+    pt[m].axis = axis;
+    kdtree_build(pt, m);
+    kdtree_build(pt + m + 1, n - m - 1);
+}
+/**
+ * 距離が同じ場合は、インデックスの小さい方を優先する(全探索と同じ結果になる)
+ */
+static void kdtree_nearest(const KdPoint *pt, int n, const int *c, int *best_d, int *best_idx)
+{
+    while (n > 0) {
+        int m = n / 2;
+        const KdPoint *p = &pt[m];
+        int d0 = c[0] - p->c[0];
+        int d1 = c[1] - p->c[1];
+        int d2 = c[2] - p->c[2];
+        int d3 = c[3] - p->c[3];
+        int d = d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+        int diff;
+
+        if (d < *best_d || (d == *best_d && p->idx < *best_idx)) {
+            *best_d = d;
+            *best_idx = p->idx;
+        }
+        diff = c[p->axis] - p->c[p->axis];
+        if (diff < 0) {
+            kdtree_nearest(pt, m, c, best_d, best_idx);
+            if (diff * diff > *best_d) {
+                return;
+            }
+            pt += m + 1;
+            n -= m + 1;
+        } else {
+            kdtree_nearest(pt + m + 1, n - m - 1, c, best_d, best_idx);
+            if (diff * diff > *best_d) {
+                return;
+            }
+            n = m;
+        }
+    }
+}
+static KdTree *kdtree_new(const uint32_t *palette)
+{
+    KdTree *kd = malloc(sizeof(KdTree));
+    int i;
+
+    for (i = 0; i < PALETTE_NUM; i++) {
+        uint32_t c = palette[i];
+        KdPoint *p = &kd->pt[i];
+        p->c[0] = ((c & COLOR_R_MASK) >> COLOR_R_SHIFT) >> RGB_SHIFT;
+        p->c[1] = ((c & COLOR_G_MASK) >> COLOR_G_SHIFT) >> RGB_SHIFT;
+        p->c[2] = ((c & COLOR_B_MASK) >> COLOR_B_SHIFT) >> RGB_SHIFT;
+        p->c[3] = (((c & COLOR_A_MASK) >> COLOR_A_SHIFT) >> A_SHIFT) * 4;
+        p->idx = i;
+        p->axis = 0;
+    }
+    kdtree_build(kd->pt, PALETTE_NUM);
+    for (i = 0; i < PALETTE_NUM; i++) {
+        kd->pos[kd->pt[i].idx] = i;
+    }
+    return kd;
+}
+/**
+ * hint : 直前の結果
+ * 隣接する色はたいてい同じパレットになるので、初期値にすると枝刈りがよく効く
+ */
+static int kdtree_find(const KdTree *kd, const int *c, int hint)
+{
+    const KdPoint *p = &kd->pt[kd->pos[hint]];
+    int d0 = c[0] - p->c[0];
+    int d1 = c[1] - p->c[1];
+    int d2 = c[2] - p->c[2];
+    int d3 = c[3] - p->c[3];
+    int best_d = d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+    int best_idx = hint;
+
+    kdtree_nearest(kd->pt, PALETTE_NUM, c, &best_d, &best_idx);
+    return best_idx;
+}
+static int get_parallel_count(int rows, int min_rows)
+{
+    int n = get_cpu_count();
+    if (n > rows / min_rows) {
+        n = rows / min_rows;
+    }
+    if (n < 1) {
+        n = 1;
+    }
+    return n;
+}
+
+
 static void sample_color_distribution(uint32_t *dist, QuantColor *qc, const RefImage *src, int mode)
 {
     int x, y;
@@ -254,49 +435,116 @@ static void quant_color_to_palette(uint32_t *pal, uint8_t *table, QuantColor *qc
         }
     }
 }
+static int pixel_to_palette(const uint8_t *p, int mode, int has_alpha, const uint8_t *table)
+{
+    int v[4];
+
+    v[0] = p[0] >> RGB_SHIFT;
+    v[1] = p[1] >> RGB_SHIFT;
+    v[2] = p[2] >> RGB_SHIFT;
+    if (mode == QUANT_MODE_RGB) {
+        // RGBモードの場合は、v[3]は常に0
+        v[3] = 0;
+    } else {
+        if (has_alpha) {
+            v[3] = p[3] >> A_SHIFT;
+        } else {
+            v[3] = A_MAX;
+        }
+    }
+    if (mode == QUANT_MODE_KEY) {
+        if (has_alpha && v[3] < TRANSPARENT_THRES) {
+            return 255;
+        }
+        v[3] = 0;
+    }
+    return table[RGBA_TO_INDEX(v)];
+}
 // 最近傍
-static void truecolor_to_palette(RefImage *dst, const RefImage *src, int mode, uint8_t *table)
+static void truecolor_to_palette_band(void *arg)
 {
+    QuantBand *qb = arg;
+    const RefImage *src = qb->src;
+    RefImage *dst = qb->dst;
+    int width = dst->width;
+    int has_alpha = (src->bands == BAND_RGBA);
+    int channels = (has_alpha ? 4 : 3);
     int x, y;
+
+    for (y = qb->y1; y < qb->y2; y++) {
+        const uint8_t *p = src->data + src->pitch * y;
+        uint8_t *p_dst = dst->data + dst->pitch * y;
+        for (x = 0; x < width; x++) {
+            p_dst[x] = pixel_to_palette(p, qb->mode, has_alpha, qb->table);
+            p += channels;
+        }
+    }
+}
+/*
+ * 8x8 Bayer matrix
+ */
+static const uint8_t bayer_matrix[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+// Ordered dithering
+// 各画素が独立しているので、行単位で並列化できる
+static void truecolor_to_palette_ordered_band(void *arg)
+{
+    QuantBand *qb = arg;
+    const RefImage *src = qb->src;
+    RefImage *dst = qb->dst;
     int width = dst->width;
-    int height = dst->height;
     int has_alpha = (src->bands == BAND_RGBA);
     int channels = (has_alpha ? 4 : 3);
+    int x, y, i;
 
-    for (y = 0; y < height; y++) {
+    for (y = qb->y1; y < qb->y2; y++) {
         const uint8_t *p = src->data + src->pitch * y;
         uint8_t *p_dst = dst->data + dst->pitch * y;
+        const uint8_t *row = bayer_matrix[y & 7];
+
         for (x = 0; x < width; x++) {
-            int v[4];
+            // -16 ... +15
+            int bias = (row[x & 7] - 32) / 2;
+            uint8_t c[4];
 
-            v[0] = p[0] >> RGB_SHIFT;
-            v[1] = p[1] >> RGB_SHIFT;
-            v[2] = p[2] >> RGB_SHIFT;
-            if (mode == QUANT_MODE_RGB) {
-                // RGBモードの場合は、v[3]は常に0
-                v[3] = 0;
-            } else {
-                if (has_alpha) {
-                    v[3] = p[3] >> A_SHIFT;
-                } else {
-                    v[3] = A_MAX;
-                }
+            for (i = 0; i < 3; i++) {
+                int j = p[i] + bias;
+                c[i] = (j < 0 ? 0 : (j > 255 ? 255 : j));
             }
-            p += channels;
-
-            if (mode == QUANT_MODE_KEY) {
-                if (has_alpha && v[3] < TRANSPARENT_THRES) {
-                    p_dst[x] = 255;
-                } else {
-                    v[3] = 0;
-                    p_dst[x] = table[RGBA_TO_INDEX(v)];
-                }
-            } else {
-                p_dst[x] = table[RGBA_TO_INDEX(v)];
+            if (has_alpha) {
+                c[3] = p[3];
             }
+            p_dst[x] = pixel_to_palette(c, qb->mode, has_alpha, qb->table);
+            p += channels;
         }
     }
 }
+static void truecolor_to_palette(RefImage *dst, const RefImage *src, int mode, uint8_t *table, int ordered)
+{
+    int n = get_parallel_count(dst->height, PARALLEL_MIN_ROWS);
+    int rows = (dst->height + n - 1) / n;
+    QuantBand *qb = malloc(sizeof(QuantBand) * n);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        qb[i].src = src;
+        qb[i].dst = dst;
+        qb[i].table = table;
+        qb[i].mode = mode;
+        qb[i].y1 = rows * i;
+        qb[i].y2 = (rows * (i + 1) < dst->height ? rows * (i + 1) : dst->height);
+    }
+    run_parallel(ordered ? truecolor_to_palette_ordered_band : truecolor_to_palette_band, qb, sizeof(QuantBand), n);
+    free(qb);
+}
 // Floyd-Steinberg dithering
 static void truecolor_to_palette_dither(RefImage *dst, const RefImage *src, int mode, uint8_t *table)
 {
@@ -432,10 +680,163 @@ static void truecolor_to_palette_dither(RefImage *dst, const RefImage *src, int
     free(palette);
 }
 
+/**
+ * ヒストグラムを木に登録する
+ * 各階層でRGB(+A)の1bitずつを使うので、子は最大16個
+ */
+static void octree_insert(OctTree *ot, const int *v, uint32_t n)
+{
+    OctNode *node = ot->root;
+    int level;
+
+    for (level = 0; level < OCT_DEPTH; level++) {
+        int i = ((v[0] >> (OCT_DEPTH - 1 - level)) & 1)
+            | (((v[1] >> (OCT_DEPTH - 1 - level)) & 1) << 1)
+            | (((v[2] >> (OCT_DEPTH - 1 - level)) & 1) << 2);
+        OctNode *child;
+
+        if (level < 3) {
+            i |= ((v[3] >> (2 - level)) & 1) << 3;
+        }
+        node->count += n;
+        child = node->child[i];
+        if (child == NULL) {
+            child = fs->Mem_get(&ot->mem, sizeof(OctNode));
+            memset(child, 0, sizeof(OctNode));
+            node->child[i] = child;
+            node->n_child++;
+            if (level + 1 < OCT_DEPTH) {
+                child->next = ot->levels[level + 1];
+                ot->levels[level + 1] = child;
+                ot->n_levels[level + 1]++;
+            } else {
+                child->leaf = TRUE;
+                ot->n_leaf++;
+            }
+        }
+        node = child;
+    }
+    node->count += n;
+    node->sum[0] += (uint64_t)v[0] * n;
+    node->sum[1] += (uint64_t)v[1] * n;
+    node->sum[2] += (uint64_t)v[2] * n;
+    node->sum[3] += (uint64_t)v[3] * n;
+}
+static int octnode_cmp(const void *a, const void *b)
+{
+    const OctNode *n1 = *(const OctNode**)a;
+    const OctNode *n2 = *(const OctNode**)b;
+
+    if (n1->count < n2->count) {
+        return -1;
+    } else if (n1->count > n2->count) {
+        return 1;
+    }
+    return 0;
+}
+/**
+ * 深い階層の、画素数が少ない節から順に子を統合する
+ */
+static void octree_reduce(OctTree *ot, int max_leaf)
+{
+    int level;
+
+    for (level = OCT_DEPTH - 1; level >= 0 && ot->n_leaf > max_leaf; level--) {
+        OctNode **nodes = malloc(sizeof(OctNode*) * (ot->n_levels[level] + 1));
+        OctNode *node;
+        int n = 0;
+        int i, j;
+
+        for (node = ot->levels[level]; node != NULL; node = node->next) {
+            nodes[n++] = node;
+        }
+        if (level == 0) {
+            nodes[n++] = ot->root;
+        }
+        qsort(nodes, n, sizeof(OctNode*), octnode_cmp);
+
+        for (i = 0; i < n && ot->n_leaf > max_leaf; i++) {
+            node = nodes[i];
+            for (j = 0; j < 16; j++) {
+                OctNode *child = node->child[j];
+                if (child != NULL) {
+                    node->sum[0] += child->sum[0];
+                    node->sum[1] += child->sum[1];
+                    node->sum[2] += child->sum[2];
+                    node->sum[3] += child->sum[3];
+                    node->child[j] = NULL;
+                }
+            }
+            ot->n_leaf -= node->n_child - 1;
+            node->n_child = 0;
+            node->leaf = TRUE;
+        }
+        free(nodes);
+    }
+}
+static void octree_to_palette(OctNode *node, uint32_t *pal, int *n_pal, int mode)
+{
+    if (node->leaf) {
+        uint32_t half = node->count / 2;
+        int r5 = (node->sum[0] + half) / node->count;
+        int g5 = (node->sum[1] + half) / node->count;
+        int b5 = (node->sum[2] + half) / node->count;
+        int a3 = (node->sum[3] + half) / node->count;
+        int r = (r5 << RGB_SHIFT) | (r5 >> 2);
+        int g = (g5 << RGB_SHIFT) | (g5 >> 2);
+        int b = (b5 << RGB_SHIFT) | (b5 >> 2);
+        int a;
+
+        if (mode == QUANT_MODE_RGBA && a3 < A_MAX) {
+            a = (a3 << 5) | (a3 << 1) | (a3 >> 2);
+        } else {
+            a = 255;
+        }
+        pal[(*n_pal)++] = (r << COLOR_R_SHIFT) | (g << COLOR_G_SHIFT) | (b << COLOR_B_SHIFT) | (a << COLOR_A_SHIFT);
+    } else {
+        int i;
+        for (i = 0; i < 16; i++) {
+            if (node->child[i] != NULL) {
+                octree_to_palette(node->child[i], pal, n_pal, mode);
+            }
+        }
+    }
+}
+/**
+ * octreeでパレットを作る
+ * 画素を直接登録せず、sample_color_distributionのヒストグラムから作る
+ */
+static void octree_quantize(uint32_t *pal, uint32_t *dist, int n_distri_size, int max_pal, int mode)
+{
+    OctTree ot;
+    int n_pal = 0;
+    int i;
+
+    memset(&ot, 0, sizeof(ot));
+    fs->Mem_init(&ot.mem, 1024 * 16);
+    ot.root = fs->Mem_get(&ot.mem, sizeof(OctNode));
+    memset(ot.root, 0, sizeof(OctNode));
+
+    for (i = 0; i < n_distri_size; i++) {
+        if (dist[i] > 0) {
+            int v[4];
+            v[0] = i & RGB_MAX;
+            v[1] = (i >> 5) & RGB_MAX;
+            v[2] = (i >> 10) & RGB_MAX;
+            v[3] = (i >> 15) & A_MAX;
+            octree_insert(&ot, v, dist[i]);
+        }
+    }
+    octree_reduce(&ot, max_pal);
+    octree_to_palette(ot.root, pal, &n_pal, mode);
+
+    fs->Mem_close(&ot.mem);
+}
+
 /**
  * 256色に減色
  */
-void quantize(RefImage *dst, const RefImage *src, int mode, int dither)
+void quantize(RefImage *dst, const RefImage *src, int mode, int dither, int algorithm)
 {
     int n_distri_size = (mode == QUANT_MODE_RGBA ? HIST_SIZE_RGBA : HIST_SIZE_RGB);
     int n_qc = (mode == QUANT_MODE_KEY ? 255 : 256);
@@ -448,7 +849,21 @@ void quantize(RefImage *dst, const RefImage *src, int mode, int dither)
     memset(dist, 0, sizeof(uint32_t) * n_distri_size);
 
     sample_color_distribution(dist, qc, src, mode);
-    if (qc[0].count > 0) {
+    if (qc[0].count == 0) {
+        // QUANT_MODE_KEYで、すべて透明ピクセル
+        memset(dst->data, 255, dst->pitch * dst->height);
+    } else if (algorithm == QUANT_ALGO_OCTREE) {
+        uint8_t *npal;
+
+        octree_quantize(dst->palette, dist, n_distri_size, n_qc, mode);
+        npal = get_nearest_palette(dst->palette, mode);
+        if (dither == DITHER_FLOYD_STEINBERG) {
+            truecolor_to_palette_dither(dst, src, mode, npal);
+        } else {
+            truecolor_to_palette(dst, src, mode, npal, dither == DITHER_ORDERED);
+        }
+        free(npal);
+    } else {
         memset(qc[0].min, 0, sizeof(qc[0].min));
         qc[0].max[0] = RGB_MAX + 1;
         qc[0].max[1] = RGB_MAX + 1;
@@ -462,18 +877,20 @@ void quantize(RefImage *dst, const RefImage *src, int mode, int dither)
         calculate_quant_color(dist, qc);
         median_cut(dist, qc, &n_qc, mode);
         quant_color_to_palette(dst->palette, (uint8_t*)dist, qc, n_qc, mode);
-        if (dither) {
-            //truecolor_to_palette_dither(dst, src, mode, (uint8_t*)dist);
+        if (dither != DITHER_NONE) {
             uint8_t *npal = get_nearest_palette(dst->palette, mode);
-            truecolor_to_palette_dither(dst, src, mode, npal);
+            if (dither == DITHER_FLOYD_STEINBERG) {
+                truecolor_to_palette_dither(dst, src, mode, npal);
+            } else {
+                truecolor_to_palette(dst, src, mode, npal, TRUE);
+            }
             free(npal);
         } else {
-            truecolor_to_palette(dst, src, mode, (uint8_t*)dist);
+            truecolor_to_palette(dst, src, mode, (uint8_t*)dist, FALSE);
         }
-    } else {
-        // QUANT_MODE_KEYで、すべて透明ピクセル
-        memset(dst->data, 255, dst->pitch * dst->height);
     }
+    free(dist);
+    free(qc);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -499,58 +916,55 @@ int get_palette_mode(uint32_t *palette)
     }
     return mode;
 }
-uint8_t *get_nearest_palette(uint32_t *palette, int mode)
+static void nearest_palette_band(void *arg)
 {
-    int i;
-    double r, g, b, a;
-    double (*pal)[4] = malloc(sizeof(double) * PALETTE_NUM * 4);
+    NearestBand *nb = arg;
+    int hint = 0;
+    int z;
 
-    int n_dist_size = (mode == QUANT_MODE_RGBA ? QPAL_SIZE_RGBA : QPAL_SIZE_RGB);
-    uint8_t *p_dist = malloc(sizeof(uint8_t) * n_dist_size);
-    uint8_t *dist = p_dist;
-    memset(p_dist, 0, sizeof(uint8_t) * n_dist_size);
-
-    for (i = 0; i < PALETTE_NUM; i++) {
-        uint32_t c = palette[i];
-        pal[i][0] = (double)(((c & COLOR_R_MASK) >> COLOR_R_SHIFT) >> RGB_SHIFT);
-        pal[i][1] = (double)(((c & COLOR_G_MASK) >> COLOR_G_SHIFT) >> RGB_SHIFT);
-        pal[i][2] = (double)(((c & COLOR_B_MASK) >> COLOR_B_SHIFT) >> RGB_SHIFT);
-        pal[i][3] = (double)(((c & COLOR_A_MASK) >> COLOR_A_SHIFT) >> A_SHIFT);
-    }
+    for (z = nb->z1; z < nb->z2; z++) {
+        uint8_t *dist = nb->table + z * QPAL_SIZE * QPAL_SIZE;
+        int c[4];
 
-    if (mode == QUANT_MODE_RGBA) {
-        a = 0;
-    } else {
-        a = QPAL_SIZE_A - 1;
-    }
-    for (; a < QPAL_SIZE_A; a += 1.0) {
-        for (b = 0; b < QPAL_SIZE; b += 1.0) {
-            for (g = 0; g < QPAL_SIZE; g += 1.0) {
-                for (r = 0; r < QPAL_SIZE; r += 1.0) {
-                    int idx = 0;
-                    double min = 4294967296.0;
-                    // 最小距離を求める
-                    for (i = 0; i < PALETTE_NUM; i++) {
-                        double dr = r - pal[i][0];
-                        double dg = g - pal[i][1];
-                        double db = b - pal[i][2];
-                        double da = (a - pal[i][3]) * 4.0;
-                        double d = dr*dr + dg*dg + db*db + da*da;
-                        if (min > d) {
-                            min = d;
-                            idx = i;
-                            if (d == 0.0) {
-                                break;
-                            }
-                        }
-                    }
-                    *dist++ = idx;
-                }
+        c[2] = z % QPAL_SIZE;
+        if (nb->mode == QUANT_MODE_RGBA) {
+            c[3] = (z / QPAL_SIZE) * 4;
+        } else {
+            c[3] = (QPAL_SIZE_A - 1) * 4;
+        }
+        for (c[1] = 0; c[1] < QPAL_SIZE; c[1]++) {
+            for (c[0] = 0; c[0] < QPAL_SIZE; c[0]++) {
+                hint = kdtree_find(nb->kd, c, hint);
+                *dist++ = hint;
             }
         }
     }
+}
+/**
+ * 色(RGB各5bit, A 3bit)から最も近いパレットへの変換表を作る
+ */
+uint8_t *get_nearest_palette(uint32_t *palette, int mode)
+{
+    int n_dist_size = (mode == QUANT_MODE_RGBA ? QPAL_SIZE_RGBA : QPAL_SIZE_RGB);
+    int n_plane = n_dist_size / (QPAL_SIZE * QPAL_SIZE);
+    uint8_t *p_dist = malloc(sizeof(uint8_t) * n_dist_size);
+    KdTree *kd = kdtree_new(palette);
+    int n = get_parallel_count(n_plane, 8);
+    int planes = (n_plane + n - 1) / n;
+    NearestBand *nb = malloc(sizeof(NearestBand) * n);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        nb[i].kd = kd;
+        nb[i].table = p_dist;
+        nb[i].mode = mode;
+        nb[i].z1 = planes * i;
+        nb[i].z2 = (planes * (i + 1) < n_plane ? planes * (i + 1) : n_plane);
+    }
+    run_parallel(nearest_palette_band, nb, sizeof(NearestBand), n);
 
-    free(pal);
+    free(nb);
+    free(kd);
     return p_dist;
 }
 
@@ -558,54 +972,22 @@ uint8_t *get_nearest_palette(uint32_t *palette, int mode)
 uint8_t *get_convert_palette_table(uint32_t *dst, const uint32_t *src)
 {
     uint8_t *p = malloc(PALETTE_NUM);
-    double (*sd)[4] = malloc(sizeof(double) * 4 * PALETTE_NUM);
-    double (*dd)[4] = malloc(sizeof(double) * 4 * PALETTE_NUM);
+    KdTree *kd = kdtree_new(dst);
+    int hint = 0;
     int i;
 
-    // 浮動小数点数に変換
-    for (i = 0; i < PALETTE_NUM; i++) {
-        uint32_t c = src[i];
-        sd[i][0] = (double)(((c & COLOR_R_MASK) >> COLOR_R_SHIFT) >> RGB_SHIFT);
-        sd[i][1] = (double)(((c & COLOR_G_MASK) >> COLOR_G_SHIFT) >> RGB_SHIFT);
-        sd[i][2] = (double)(((c & COLOR_B_MASK) >> COLOR_B_SHIFT) >> RGB_SHIFT);
-        sd[i][3] = (double)(((c & COLOR_A_MASK) >> COLOR_A_SHIFT) >> A_SHIFT);
-    }
-    for (i = 0; i < PALETTE_NUM; i++) {
-        uint32_t c = dst[i];
-        dd[i][0] = (double)(((c & COLOR_R_MASK) >> COLOR_R_SHIFT) >> RGB_SHIFT);
-        dd[i][1] = (double)(((c & COLOR_G_MASK) >> COLOR_G_SHIFT) >> RGB_SHIFT);
-        dd[i][2] = (double)(((c & COLOR_B_MASK) >> COLOR_B_SHIFT) >> RGB_SHIFT);
-        dd[i][3] = (double)(((c & COLOR_A_MASK) >> COLOR_A_SHIFT) >> A_SHIFT);
-    }
-
     // もっとも近い色を探す
     for (i = 0; i < PALETTE_NUM; i++) {
-        int j;
-        int idx = 0;
-        double min = 4294967296.0;
-        double r = sd[i][0];
-        double g = sd[i][1];
-        double b = sd[i][2];
-        double a = sd[i][3];
-
-        for (j = 0; j < PALETTE_NUM; j++) {
-            double dr = r - dd[j][0];
-            double dg = g - dd[j][1];
-            double db = b - dd[j][2];
-            double da = (a - dd[j][3]) * 4.0;
-            double d = dr*dr + dg*dg + db*db + da*da;
-            if (min > d) {
-                min = d;
-                idx = j;
-                if (d == 0.0) {
-                    break;
-                }
-            }
-        }
-        p[i] = idx;
+        uint32_t c = src[i];
+        int v[4];
+        v[0] = ((c & COLOR_R_MASK) >> COLOR_R_SHIFT) >> RGB_SHIFT;
+        v[1] = ((c & COLOR_G_MASK) >> COLOR_G_SHIFT) >> RGB_SHIFT;
+        v[2] = ((c & COLOR_B_MASK) >> COLOR_B_SHIFT) >> RGB_SHIFT;
+        v[3] = (((c & COLOR_A_MASK) >> COLOR_A_SHIFT) >> A_SHIFT) * 4;
+        hint = kdtree_find(kd, v, hint);
+        p[i] = hint;
     }
-    free(sd);
-    free(dd);
+    free(kd);
 
     return p;
 }
@@ -617,12 +999,12 @@ void quantize_palette(RefImage *dst, const RefImage *src, int dither)
 {
     int mode = get_palette_mode(dst->palette);
     uint8_t *dist = get_nearest_palette(dst->palette, mode);
-    int src_mode = (src->bands == BAND_RGBA ? QUANT_MODE_RGBA : QUANT_MODE_RGB);
 
-    if (dither) {
-        truecolor_to_palette_dither(dst, src, src_mode, dist);
+    // 変換表の大きさはパレットのモードで決まるので、それに合わせて引く
+    if (dither == DITHER_FLOYD_STEINBERG) {
+        truecolor_to_palette_dither(dst, src, mode, dist);
     } else {
-        truecolor_to_palette(dst, src, src_mode, dist);
+        truecolor_to_palette(dst, src, mode, dist, dither == DITHER_ORDERED);
     }
 
     free(dist);
@@ -0,0 +1,466 @@
+#include "image.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+
+enum {
+    COEF_BITS = 14,
+    COEF_ROUND = 1 << (COEF_BITS - 1),
+    PARALLEL_MIN_PIXELS = 128 * 128,
+    PARALLEL_MIN_ROWS = 32,
+};
+
+typedef struct {
+    const char *name;
+    double support;
+    double (*fn)(double x);
+} ResampleFilter;
+
+/**
+ * 出力1画素分の係数
+ * src[start] ... src[start + n - 1] に coef[0] ... coef[n - 1] を掛けて足す
+ */
+typedef struct {
+    int n_max;
+    int *start;
+    int *n;
+    int16_t *coef;   // n_max * 出力画素数
+} CoefTable;
+
+typedef struct {
+    RefImage *dst;
+    const RefImage *src;
+    const CopyParam *cp;
+    const CoefTable *cx;
+    const CoefTable *cy;
+    int alpha;
+    int sc;
+
+    int sx1, sx2;    // 水平方向に読み込むソースの範囲
+    int ox, ow;      // 出力先の範囲(x)
+    int oy1, oy2;    // このスレッドが担当する範囲(y)
+    int y_base;      // cyの添字とoy1の差
+} ResampleBand;
+
+
+static double filter_bilinear(double x)
+{
+    if (x < 0.0) {
+        x = -x;
+    }
+    if (x < 1.0) {
+        return 1.0 - x;
+    }
+    return 0.0;
+}
+/*
+ * Catmull-Rom (a = -0.5)
+ */
+static double filter_bicubic(double x)
+{
+    const double a = -0.5;
+    if (x < 0.0) {
+        x = -x;
+    }
+    if (x < 1.0) {
+        return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+    }
+    if (x < 2.0) {
+        return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+    }
+    return 0.0;
+}
+static double sinc(double x)
+{
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+static double filter_lanczos3(double x)
+{
+    if (x > -3.0 && x < 3.0) {
+        return sinc(x) * sinc(x / 3.0);
+    }
+    return 0.0;
+}
+
+static const ResampleFilter filters[] = {
+    { "bilinear", 1.0, filter_bilinear },
+    { "bicubic", 2.0, filter_bicubic },
+    { "lanczos3", 3.0, filter_lanczos3 },
+};
+
+int resample_filter_from_name(const char *name_p, int name_size)
+{
+    int i;
+    for (i = 0; i < lengthof(filters); i++) {
+        if (str_eqi(name_p, name_size, filters[i].name, -1)) {
+            return i;
+        }
+    }
+    if (str_eqi(name_p, name_size, "linear", -1)) {
+        return RESAMPLE_BILINEAR;
+    }
+    if (str_eqi(name_p, name_size, "cubic", -1)) {
+        return RESAMPLE_BICUBIC;
+    }
+    if (str_eqi(name_p, name_size, "lanczos", -1)) {
+        return RESAMPLE_LANCZOS3;
+    }
+    return -1;
+}
+
+/**
+ * 出力座標 o1 ... o2 - 1 に対する係数表を作る
+ * src_pos, src_len : ソース矩形(はみ出してもよい)
+ * lo, hi : 実際に読める範囲
+ */
+static void CoefTable_init(CoefTable *ct, const ResampleFilter *flt, double scale, double src_pos, int o1, int o2, int lo, int hi)
+{
+    double fscale = (scale > 1.0 ? scale : 1.0);
+    double support = flt->support * fscale;
+    int n_out = o2 - o1;
+    double *wt;
+    int i;
+
+    ct->n_max = (int)ceil(support) * 2 + 1;
+    ct->start = malloc(sizeof(int) * n_out);
+    ct->n = malloc(sizeof(int) * n_out);
+    ct->coef = malloc(sizeof(int16_t) * ct->n_max * n_out);
+    wt = malloc(sizeof(double) * ct->n_max);
+
+    for (i = 0; i < n_out; i++) {
+        double center = src_pos + ((double)(o1 + i) + 0.5) * scale;
+        int xmin = (int)floor(center - support + 0.5);
+        int xmax = (int)floor(center + support + 0.5);
+        int16_t *coef = ct->coef + i * ct->n_max;
+        double total = 0.0;
+        int isum = 0;
+        int n, k, kmax;
+
+        if (xmin < lo) {
+            xmin = lo;
+        }
+        if (xmax > hi) {
+            xmax = hi;
+        }
+        if (xmax <= xmin) {
+            // 範囲外は端の画素を使う
+            xmin = (xmin >= hi ? hi - 1 : xmin);
+            xmax = xmin + 1;
+        }
+        n = xmax - xmin;
+        if (n > ct->n_max) {
+            n = ct->n_max;
+        }
+        for (k = 0; k < n; k++) {
+            double w = flt->fn(((double)(xmin + k) - center + 0.5) / fscale);
+            wt[k] = w;
+            total += w;
+        }
+        if (total == 0.0) {
+            total = 1.0;
+        }
+        // 合計が正確に 1 << COEF_BITS になるよう、最大の係数で誤差を吸収する
+        kmax = 0;
+        for (k = 0; k < n; k++) {
+            int c = (int)floor(wt[k] / total * (double)(1 << COEF_BITS) + 0.5);
+            coef[k] = c;
+            isum += c;
+            if (wt[k] > wt[kmax]) {
+                kmax = k;
+            }
+        }
+        coef[kmax] += (1 << COEF_BITS) - isum;
+        for (; k < ct->n_max; k++) {
+            coef[k] = 0;
+        }
+        ct->start[i] = xmin;
+        ct->n[i] = n;
+    }
+    free(wt);
+}
+static void CoefTable_close(CoefTable *ct)
+{
+    free(ct->start);
+    free(ct->n);
+    free(ct->coef);
+}
+
+static uint8_t clip_coef_sum(int32_t sum)
+{
+    sum = (sum + COEF_ROUND) >> COEF_BITS;
+    if (sum < 0) {
+        return 0;
+    } else if (sum > 255) {
+        return 255;
+    }
+    return sum;
+}
+/**
+ * パレット画像はRGBAに展開する
+ */
+static const uint8_t *get_source_row(uint8_t *buf, const RefImage *src, int y, int sx1, int sx2, int sc)
+{
+    const uint8_t *ps = src->data + y * src->pitch;
+
+    if (src->bands == BAND_P) {
+        const uint32_t *pal = src->palette;
+        uint8_t *p = buf;
+        int x;
+        for (x = sx1; x < sx2; x++) {
+            uint32_t c = pal[ps[x]];
+            *p++ = (c & COLOR_R_MASK) >> COLOR_R_SHIFT;
+            *p++ = (c & COLOR_G_MASK) >> COLOR_G_SHIFT;
+            *p++ = (c & COLOR_B_MASK) >> COLOR_B_SHIFT;
+            *p++ = (c & COLOR_A_MASK) >> COLOR_A_SHIFT;
+        }
+        return buf;
+    }
+    return ps + sx1 * sc;
+}
+/**
+ * 水平方向のフィルタ
+ * ps[0] がソースのx座標 sx1 に対応する
+ */
+static void resample_row_h(uint8_t *pd, const uint8_t *ps, const CoefTable *cx, int ow, int sx1, int sc)
+{
+    int x, k;
+
+    switch (sc) {
+    case 1:
+        for (x = 0; x < ow; x++) {
+            const int16_t *coef = cx->coef + x * cx->n_max;
+            const uint8_t *p = ps + (cx->start[x] - sx1);
+            int n = cx->n[x];
+            int32_t s0 = 0;
+            for (k = 0; k < n; k++) {
+                s0 += p[k] * coef[k];
+            }
+            *pd++ = clip_coef_sum(s0);
+        }
+        break;
+    case 2:
+        for (x = 0; x < ow; x++) {
+            const int16_t *coef = cx->coef + x * cx->n_max;
+            const uint8_t *p = ps + (cx->start[x] - sx1) * 2;
+            int n = cx->n[x];
+            int32_t s0 = 0, s1 = 0;
+            for (k = 0; k < n; k++) {
+                s0 += p[k * 2 + 0] * coef[k];
+                s1 += p[k * 2 + 1] * coef[k];
+            }
+            *pd++ = clip_coef_sum(s0);
+            *pd++ = clip_coef_sum(s1);
+        }
+        break;
+    case 3:
+        for (x = 0; x < ow; x++) {
+            const int16_t *coef = cx->coef + x * cx->n_max;
+            const uint8_t *p = ps + (cx->start[x] - sx1) * 3;
+            int n = cx->n[x];
+            int32_t s0 = 0, s1 = 0, s2 = 0;
+            for (k = 0; k < n; k++) {
+                s0 += p[k * 3 + 0] * coef[k];
+                s1 += p[k * 3 + 1] * coef[k];
+                s2 += p[k * 3 + 2] * coef[k];
+            }
+            *pd++ = clip_coef_sum(s0);
+            *pd++ = clip_coef_sum(s1);
+            *pd++ = clip_coef_sum(s2);
+        }
+        break;
+    case 4:
+        for (x = 0; x < ow; x++) {
+            const int16_t *coef = cx->coef + x * cx->n_max;
+            const uint8_t *p = ps + (cx->start[x] - sx1) * 4;
+            int n = cx->n[x];
+            int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (k = 0; k < n; k++) {
+                s0 += p[k * 4 + 0] * coef[k];
+                s1 += p[k * 4 + 1] * coef[k];
+                s2 += p[k * 4 + 2] * coef[k];
+                s3 += p[k * 4 + 3] * coef[k];
+            }
+            *pd++ = clip_coef_sum(s0);
+            *pd++ = clip_coef_sum(s1);
+            *pd++ = clip_coef_sum(s2);
+            *pd++ = clip_coef_sum(s3);
+        }
+        break;
+    }
+}
+/**
+ * 垂直方向のフィルタ
+ * 行をまたいで同じ係数を掛けるだけなので、コンパイラのベクトル化が効きやすい形にしておく
+ */
+static void resample_row_v(uint8_t *pd, int32_t *acc, uint8_t **rows, const int16_t *coef, int n, int len)
+{
+    int i, k;
+
+    for (i = 0; i < len; i++) {
+        acc[i] = COEF_ROUND;
+    }
+    for (k = 0; k < n; k++) {
+        const uint8_t *ps = rows[k];
+        int32_t c = coef[k];
+        for (i = 0; i < len; i++) {
+            acc[i] += ps[i] * c;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        int32_t v = acc[i] >> COEF_BITS;
+        pd[i] = (v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+}
+static void resample_band(void *p)
+{
+    ResampleBand *b = p;
+    const CoefTable *cy = b->cy;
+    int sc = b->sc;
+    int len = b->ow * sc;
+    int r1, r2;
+    int y, k;
+    uint8_t *tmp, *line, *expand;
+    uint8_t **rows;
+    int32_t *acc;
+
+    if (b->oy2 <= b->oy1) {
+        return;
+    }
+    // このバンドが必要とするソース行の範囲
+    r1 = cy->start[b->oy1 - b->y_base];
+    r2 = r1;
+    for (y = b->oy1; y < b->oy2; y++) {
+        int i = y - b->y_base;
+        if (cy->start[i] < r1) {
+            r1 = cy->start[i];
+        }
+        if (cy->start[i] + cy->n[i] > r2) {
+            r2 = cy->start[i] + cy->n[i];
+        }
+    }
+
+    tmp = malloc(len * (r2 - r1));
+    line = malloc(len);
+    acc = malloc(sizeof(int32_t) * len);
+    rows = malloc(sizeof(uint8_t*) * cy->n_max);
+    expand = (b->src->bands == BAND_P ? malloc((b->sx2 - b->sx1) * 4) : NULL);
+
+    for (y = r1; y < r2; y++) {
+        const uint8_t *ps = get_source_row(expand, b->src, y, b->sx1, b->sx2, sc);
+        resample_row_h(tmp + (y - r1) * len, ps, b->cx, b->ow, b->sx1, sc);
+    }
+    for (y = b->oy1; y < b->oy2; y++) {
+        int i = y - b->y_base;
+        int n = cy->n[i];
+        uint8_t *pd = b->dst->data + y * b->dst->pitch + b->ox * b->cp->dc;
+
+        for (k = 0; k < n; k++) {
+            rows[k] = tmp + (cy->start[i] + k - r1) * len;
+        }
+        resample_row_v(line, acc, rows, cy->coef + i * cy->n_max, n, len);
+        copy_image_line(pd, b->dst, line, b->src, b->ow, b->cp, b->alpha);
+    }
+
+    free(expand);
+    free(rows);
+    free(acc);
+    free(line);
+    free(tmp);
+}
+
+/**
+ * 分離可能なフィルタによる拡大縮小コピー
+ * 水平方向、垂直方向の順に2パスで処理する
+ * 出力の行を帯状に分割し、複数のスレッドで処理する
+ */
+void copy_image_filtered_sub(RefImage *dst, const RefImage *src, int32_t *dst_rect, int32_t *src_rect, int alpha, int filter)
+{
+    const ResampleFilter *flt = &filters[filter];
+    int sx = src_rect[0];
+    int sy = src_rect[1];
+    int sw = src_rect[2];
+    int sh = src_rect[3];
+    int dx = dst_rect[0];
+    int dy = dst_rect[1];
+    int dw = dst_rect[2];
+    int dh = dst_rect[3];
+
+    int ox1, ox2, oy1, oy2;
+    int sx1, sx2, sy1, sy2;
+    double scale_x, scale_y;
+    CopyParam cp;
+    CoefTable cx, cy;
+    ResampleBand *band;
+    int n_band, rows_per_band;
+    int i;
+
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) {
+        return;
+    }
+    // 出力先のクリッピング
+    ox1 = (dx < 0 ? -dx : 0);
+    oy1 = (dy < 0 ? -dy : 0);
+    ox2 = (dx + dw > dst->width ? dst->width - dx : dw);
+    oy2 = (dy + dh > dst->height ? dst->height - dy : dh);
+    // ソースのクリッピング
+    sx1 = (sx < 0 ? 0 : sx);
+    sy1 = (sy < 0 ? 0 : sy);
+    sx2 = (sx + sw > src->width ? src->width : sx + sw);
+    sy2 = (sy + sh > src->height ? src->height : sy + sh);
+
+    if (ox2 <= ox1 || oy2 <= oy1 || sx2 <= sx1 || sy2 <= sy1) {
+        return;
+    }
+    scale_x = (double)sw / (double)dw;
+    scale_y = (double)sh / (double)dh;
+
+    CopyParam_init(&cp, dst, src, alpha, TRUE);
+    CoefTable_init(&cx, flt, scale_x, sx, ox1, ox2, sx1, sx2);
+    CoefTable_init(&cy, flt, scale_y, sy, oy1, oy2, sy1, sy2);
+
+    n_band = 1;
+    if ((ox2 - ox1) * (oy2 - oy1) >= PARALLEL_MIN_PIXELS) {
+        n_band = get_cpu_count();
+        if (n_band > (oy2 - oy1) / PARALLEL_MIN_ROWS) {
+            n_band = (oy2 - oy1) / PARALLEL_MIN_ROWS;
+        }
+        if (n_band < 1) {
+            n_band = 1;
+        }
+    }
+    rows_per_band = (oy2 - oy1 + n_band - 1) / n_band;
+    band = malloc(sizeof(ResampleBand) * n_band);
+
+    for (i = 0; i < n_band; i++) {
+        ResampleBand *b = &band[i];
+        b->dst = dst;
+        b->src = src;
+        b->cp = &cp;
+        b->cx = &cx;
+        b->cy = &cy;
+        b->alpha = alpha;
+        b->sc = cp.sc;
+        b->sx1 = sx1;
+        b->sx2 = sx2;
+        b->ox = dx + ox1;
+        b->ow = ox2 - ox1;
+        b->y_base = dy + oy1;
+        b->oy1 = dy + oy1 + rows_per_band * i;
+        b->oy2 = b->oy1 + rows_per_band;
+        if (b->oy2 > dy + oy2) {
+            b->oy2 = dy + oy2;
+        }
+    }
+    run_parallel(resample_band, band, sizeof(ResampleBand), n_band);
+
+    free(band);
+    CoefTable_close(&cx);
+    CoefTable_close(&cy);
+    free(cp.pal_conv);
+    free(cp.pal_conv_rgba);
+}
@@ -0,0 +1,338 @@
+#include "media.h"
+#include "compat.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * サンプリングレート・ビット数・チャンネル数の変換
+ *
+ * レート比 L:M (出力:入力) のポリフェーズFIRで再標本化する
+ * フィルタは窓関数(Blackman)付きsincで、低い方のナイキスト周波数で帯域制限する
+ * 出力はブロックごとに独立して計算できるので、長い入力は並列に処理する
+ *
+ * ワーカースレッドからfs->の関数は呼ばないこと
+ */
+
+enum {
+    CONV_ZERO_CROSSINGS = 16,   // sincの片側のゼロ交差数
+    CONV_PHASE_MAX = 1024,      // 位相の最大分割数
+    CONV_HALF_MAX = 2048,       // 片側のタップ数の上限
+    CONV_BLOCK_SIZE = 16384,    // 1ブロックの出力サンプル数
+    CONV_PARALLEL_MIN = 65536,  // これ以上の出力サンプル数なら並列に処理する
+};
+
+typedef struct {
+    int L, M;       // 出力:入力 = L:M
+    int taps;       // 1位相のタップ数 (4の倍数)
+    int half;       // 中心より前 (中心を含む) のタップ数
+    int phases;
+    float *coef;    // phases * taps
+} ConvFilter;
+
+typedef struct {
+    const ConvFilter *flt;
+    const RefAudio *src;
+    RefAudio *dst;
+    int begin;      // 出力サンプルの範囲
+    int end;
+    int dither;     // 16bit -> 8bitの場合にディザを加える
+    uint32_t seed;
+} ConvBlock;
+
+
+static int gcd_int(int a, int b)
+{
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+static double sinc(double x)
+{
+    if (x == 0.0) {
+        return 1.0;
+    }
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+static void conv_filter_init(ConvFilter *flt, int dst_rate, int src_rate)
+{
+    int g = gcd_int(dst_rate, src_rate);
+    double fc, width;
+    int p, k;
+
+    flt->L = dst_rate / g;
+    flt->M = src_rate / g;
+
+    if (flt->L == flt->M) {
+        // 再標本化しない
+        flt->taps = 4;
+        flt->half = 1;
+        flt->phases = 1;
+        flt->coef = malloc(sizeof(float) * 4);
+        memset(flt->coef, 0, sizeof(float) * 4);
+        flt->coef[0] = 1.0f;
+        return;
+    }
+
+    // 入力サンプル単位の遮断周波数 (遷移帯域の分だけ下げる)
+    fc = 0.5 * 0.95;
+    if (flt->L < flt->M) {
+        fc = fc * flt->L / flt->M;
+    }
+    width = CONV_ZERO_CROSSINGS / (2.0 * fc);
+    if (width > CONV_HALF_MAX) {
+        width = CONV_HALF_MAX;
+    }
+    flt->half = (int)ceil(width);
+    flt->taps = (flt->half * 2 + 3) & ~3;
+    flt->phases = (flt->L < CONV_PHASE_MAX ? flt->L : CONV_PHASE_MAX);
+    flt->coef = malloc(sizeof(float) * flt->phases * flt->taps);
+
+    for (p = 0; p < flt->phases; p++) {
+        float *c = flt->coef + p * flt->taps;
+        double frac = (double)p / flt->phases;
+        double sum = 0.0;
+
+        for (k = 0; k < flt->taps; k++) {
+            // 出力位置からタップの入力位置までの距離
+            double d = k - flt->half + 1 - frac;
+            double h = 0.0;
+            if (fabs(d) < width) {
+                double w = 0.42 + 0.5 * cos(M_PI * d / width) + 0.08 * cos(2.0 * M_PI * d / width);
+                h = 2.0 * fc * sinc(2.0 * fc * d) * w;
+            }
+            c[k] = (float)h;
+            sum += h;
+        }
+        // 直流成分の利得を1にする
+        for (k = 0; k < flt->taps; k++) {
+            c[k] = (float)(c[k] / sum);
+        }
+    }
+}
+
+/*
+ * 4つの部分和に分けて、ベクトル化できるようにする
+ * nは4の倍数
+ */
+static float dot_product(const float *a, const float *b, int n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i;
+
+    for (i = 0; i < n; i += 4) {
+        s0 += a[i + 0] * b[i + 0];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+/*
+ * 入力のbegin..endをfloatに変換する
+ * 範囲外は0
+ * mix: ステレオをモノラルにまとめる
+ */
+static void conv_load_input(float *out, const RefAudio *src, int ch, int mix, int begin, int end)
+{
+    int i = 0;
+    int pos;
+
+    for (pos = begin; pos < end && pos < 0; pos++) {
+        out[i++] = 0.0f;
+    }
+    if (src->width == 2) {
+        const int16_t *p = src->u.i16;
+        if (mix) {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = (p[pos * 2] + p[pos * 2 + 1]) * (1.0f / 65536.0f);
+            }
+        } else if (src->channels == 2) {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = p[pos * 2 + ch] * (1.0f / 32768.0f);
+            }
+        } else {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = p[pos] * (1.0f / 32768.0f);
+            }
+        }
+    } else {
+        const uint8_t *p = src->u.u8;
+        if (mix) {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = (p[pos * 2] + p[pos * 2 + 1] - 256) * (1.0f / 256.0f);
+            }
+        } else if (src->channels == 2) {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = (p[pos * 2 + ch] - 128) * (1.0f / 128.0f);
+            }
+        } else {
+            for (; pos < end && pos < src->length; pos++) {
+                out[i++] = (p[pos] - 128) * (1.0f / 128.0f);
+            }
+        }
+    }
+    for (; pos < end; pos++) {
+        out[i++] = 0.0f;
+    }
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+/*
+ * 三角分布 (-1.0 - 1.0)
+ */
+static float tpdf_noise(uint32_t *state)
+{
+    float a = (xorshift32(state) >> 8) * (1.0f / 16777216.0f);
+    float b = (xorshift32(state) >> 8) * (1.0f / 16777216.0f);
+    return a - b;
+}
+
+static void conv_store(RefAudio *dst, int pos, float y, int dither, uint32_t *seed)
+{
+    if (dst->width == 2) {
+        float f = floorf(y * 32768.0f + 0.5f);
+        int16_t val;
+        if (f < -32768.0f) {
+            val = -32768;
+        } else if (f > 32767.0f) {
+            val = 32767;
+        } else {
+            val = (int16_t)f;
+        }
+        dst->u.i16[pos] = val;
+    } else {
+        float f;
+        uint8_t val;
+        if (dither) {
+            y += tpdf_noise(seed) * (1.0f / 128.0f);
+        }
+        f = floorf(y * 128.0f + 128.5f);
+        if (f < 0.0f) {
+            val = 0;
+        } else if (f > 255.0f) {
+            val = 255;
+        } else {
+            val = (uint8_t)f;
+        }
+        dst->u.u8[pos] = val;
+    }
+}
+
+static void conv_block(void *arg)
+{
+    ConvBlock *b = arg;
+    const ConvFilter *flt = b->flt;
+    const RefAudio *src = b->src;
+    RefAudio *dst = b->dst;
+    // 入力と出力のどちらかがモノラルなら1チャンネルだけ計算する
+    int n_ch = (src->channels == 2 && dst->channels == 2) ? 2 : 1;
+    int mix = (src->channels == 2 && dst->channels == 1);
+    int64_t first = (int64_t)b->begin * flt->M / flt->L;
+    int64_t last = (int64_t)(b->end - 1) * flt->M / flt->L;
+    int in_begin = (int)(first - flt->half + 1);
+    int in_end = (int)(last - flt->half + 1 + flt->taps);
+    int in_size = in_end - in_begin;
+    float *in = malloc(sizeof(float) * in_size);
+    uint32_t seed = b->seed;
+    int ch, n;
+
+    for (ch = 0; ch < n_ch; ch++) {
+        conv_load_input(in, src, ch, mix, in_begin, in_end);
+
+        for (n = b->begin; n < b->end; n++) {
+            int64_t t = (int64_t)n * flt->M;
+            int c = (int)(t / flt->L);
+            int p = (int)((t % flt->L) * flt->phases / flt->L);
+            const float *x = in + (c - flt->half + 1 - in_begin);
+            float y = dot_product(flt->coef + p * flt->taps, x, flt->taps);
+
+            if (dst->channels == 2) {
+                if (n_ch == 2) {
+                    conv_store(dst, n * 2 + ch, y, b->dither, &seed);
+                } else {
+                    conv_store(dst, n * 2, y, b->dither, &seed);
+                    if (dst->width == 2) {
+                        dst->u.i16[n * 2 + 1] = dst->u.i16[n * 2];
+                    } else {
+                        dst->u.u8[n * 2 + 1] = dst->u.u8[n * 2];
+                    }
+                }
+            } else {
+                conv_store(dst, n, y, b->dither, &seed);
+            }
+        }
+    }
+    free(in);
+}
+
+/*
+ * srcをdstのsamples, width, channelsに変換する
+ * dstのバッファはこの関数で確保する
+ */
+int audio_convert_to(RefAudio *dst, const RefAudio *src)
+{
+    ConvFilter flt;
+    ConvBlock *blk;
+    int64_t length;
+    int n_blk;
+    int i;
+
+    conv_filter_init(&flt, dst->samples, src->samples);
+
+    // round(src->length * L / M)
+    length = ((int64_t)src->length * flt.L + flt.M / 2) / flt.M;
+    if (length > INT32_MAX / 4) {
+        free(flt.coef);
+        fs->throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+        return FALSE;
+    }
+    if (!Audio_set_size(dst, (int)length)) {
+        free(flt.coef);
+        return FALSE;
+    }
+    if (length == 0) {
+        free(flt.coef);
+        return TRUE;
+    }
+
+    n_blk = (int)((length + CONV_BLOCK_SIZE - 1) / CONV_BLOCK_SIZE);
+    blk = malloc(sizeof(ConvBlock) * n_blk);
+    for (i = 0; i < n_blk; i++) {
+        ConvBlock *b = &blk[i];
+        b->flt = &flt;
+        b->src = src;
+        b->dst = dst;
+        b->begin = i * CONV_BLOCK_SIZE;
+        b->end = (i == n_blk - 1) ? (int)length : b->begin + CONV_BLOCK_SIZE;
+        b->dither = (src->width == 2 && dst->width == 1);
+        b->seed = 2463534242U + i * 2654435761U;
+        if (b->seed == 0) {
+            b->seed = 1;
+        }
+    }
+    if (length >= CONV_PARALLEL_MIN && n_blk > 1) {
+        run_parallel(conv_block, blk, sizeof(ConvBlock), n_blk);
+    } else {
+        for (i = 0; i < n_blk; i++) {
+            conv_block(&blk[i]);
+        }
+    }
+    free(blk);
+    free(flt.coef);
+
+    return TRUE;
+}
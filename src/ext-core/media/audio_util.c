@@ -0,0 +1,359 @@
+#include "media.h"
+#include "compat.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * Audioの一括処理 (音量、ミックス、ピーク・RMS、スペクトログラム)
+ *
+ * サンプルは -1.0 - 1.0 の範囲のfloatとして扱う
+ * ワーカースレッドからfs->の関数は呼ばないこと
+ */
+
+enum {
+    SPECTRO_ROWS_PER_TASK = 64,
+};
+
+typedef struct {
+    const RefAudio *snd;
+    int size;
+    int hop;
+    int cols;
+    const float *window;
+    const double *tw_cos;   // size / 2 点
+    const double *tw_sin;
+    double scale;
+    double *out;            // rows * cols
+    int row_begin;
+    int row_end;
+} SpectroTask;
+
+
+static float sample_get(const RefAudio *snd, int pos)
+{
+    if (snd->width == 2) {
+        return snd->u.i16[pos] * (1.0f / 32768.0f);
+    } else {
+        return (snd->u.u8[pos] - 128) * (1.0f / 128.0f);
+    }
+}
+static void sample_set(RefAudio *snd, int pos, float y)
+{
+    if (snd->width == 2) {
+        float f = floorf(y * 32768.0f + 0.5f);
+        if (f < -32768.0f) {
+            f = -32768.0f;
+        } else if (f > 32767.0f) {
+            f = 32767.0f;
+        }
+        snd->u.i16[pos] = (int16_t)f;
+    } else {
+        float f = floorf(y * 128.0f + 128.5f);
+        if (f < 0.0f) {
+            f = 0.0f;
+        } else if (f > 255.0f) {
+            f = 255.0f;
+        }
+        snd->u.u8[pos] = (uint8_t)f;
+    }
+}
+
+/*
+ * begin - endのサンプルにg0からg1まで直線的に変化する倍率を掛ける
+ */
+void audio_apply_gain(RefAudio *snd, int begin, int end, double g0, double g1)
+{
+    int ch = snd->channels;
+    double step = (end - begin > 1) ? (g1 - g0) / (end - begin - 1) : 0.0;
+    int i, c;
+
+    if (g0 == g1 && snd->width == 2) {
+        // 一定倍率 (ベクトル化しやすい形)
+        float g = (float)g0;
+        int16_t *p = snd->u.i16 + begin * ch;
+        int n = (end - begin) * ch;
+        for (i = 0; i < n; i++) {
+            float f = floorf(p[i] * g + 0.5f);
+            f = f < -32768.0f ? -32768.0f : f;
+            f = f > 32767.0f ? 32767.0f : f;
+            p[i] = (int16_t)f;
+        }
+        return;
+    }
+    for (i = begin; i < end; i++) {
+        float g = (float)(g0 + step * (i - begin));
+        for (c = 0; c < ch; c++) {
+            int pos = i * ch + c;
+            sample_set(snd, pos, sample_get(snd, pos) * g);
+        }
+    }
+}
+
+/*
+ * dstのoffsetからsrcをgain倍して加える
+ * dstの長さは呼び出し元で確保する
+ */
+void audio_mix_into(RefAudio *dst, const RefAudio *src, int offset, double gain)
+{
+    float g = (float)gain;
+    int begin = offset < 0 ? -offset : 0;
+    int end = src->length;
+    int i;
+
+    if (end > dst->length - offset) {
+        end = dst->length - offset;
+    }
+    for (i = begin; i < end; i++) {
+        int d = i + offset;
+        if (dst->channels == src->channels) {
+            int c;
+            for (c = 0; c < src->channels; c++) {
+                int ps = i * src->channels + c;
+                int pd = d * dst->channels + c;
+                sample_set(dst, pd, sample_get(dst, pd) + sample_get(src, ps) * g);
+            }
+        } else if (dst->channels == 2) {
+            // モノラル -> ステレオ
+            float y = sample_get(src, i) * g;
+            sample_set(dst, d * 2, sample_get(dst, d * 2) + y);
+            sample_set(dst, d * 2 + 1, sample_get(dst, d * 2 + 1) + y);
+        } else {
+            // ステレオ -> モノラル
+            float y = (sample_get(src, i * 2) + sample_get(src, i * 2 + 1)) * 0.5f * g;
+            sample_set(dst, d, sample_get(dst, d) + y);
+        }
+    }
+}
+
+/*
+ * 無音で埋める
+ */
+void audio_fill_silence(RefAudio *snd, int begin, int end)
+{
+    int n = snd->width * snd->channels;
+
+    if (snd->width == 2) {
+        memset(snd->u.u8 + begin * n, 0, (end - begin) * n);
+    } else {
+        memset(snd->u.u8 + begin * n, 128, (end - begin) * n);
+    }
+}
+
+/*
+ * begin - endのチャンネルごとのピーク(rms=FALSE)またはRMS(rms=TRUE)をout[ch]に格納
+ */
+void audio_level(double *out, const RefAudio *snd, int begin, int end, int rms)
+{
+    int ch = snd->channels;
+    int c, i;
+
+    for (c = 0; c < ch; c++) {
+        double acc = 0.0;
+
+        if (snd->width == 2) {
+            const int16_t *p = snd->u.i16;
+            if (rms) {
+                int64_t sum = 0;
+                for (i = begin; i < end; i++) {
+                    int x = p[i * ch + c];
+                    sum += x * x;
+                }
+                acc = (double)sum;
+            } else {
+                int peak = 0;
+                for (i = begin; i < end; i++) {
+                    int x = p[i * ch + c];
+                    x = x < 0 ? -x : x;
+                    peak = x > peak ? x : peak;
+                }
+                acc = peak;
+            }
+            acc /= rms ? 32768.0 * 32768.0 : 32768.0;
+        } else {
+            const uint8_t *p = snd->u.u8;
+            if (rms) {
+                int64_t sum = 0;
+                for (i = begin; i < end; i++) {
+                    int x = p[i * ch + c] - 128;
+                    sum += x * x;
+                }
+                acc = (double)sum;
+            } else {
+                int peak = 0;
+                for (i = begin; i < end; i++) {
+                    int x = p[i * ch + c] - 128;
+                    x = x < 0 ? -x : x;
+                    peak = x > peak ? x : peak;
+                }
+                acc = peak;
+            }
+            acc /= rms ? 128.0 * 128.0 : 128.0;
+        }
+        if (rms) {
+            acc = (end > begin) ? sqrt(acc / (end - begin)) : 0.0;
+        }
+        out[c] = acc;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * n点の複素FFT (nは2のべき乗、in-place)
+ * tw_cos, tw_sinはnfft点の回転因子で、stride間隔で参照する
+ */
+static void fft_complex(double *re, double *im, int n, const double *tw_cos, const double *tw_sin, int stride)
+{
+    int i, j, len;
+
+    // ビット反転の並べ替え
+    for (i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    for (len = 2; len <= n; len <<= 1) {
+        int half = len >> 1;
+        int step = (n / len) * stride;
+        for (i = 0; i < n; i += len) {
+            int k;
+            for (k = 0; k < half; k++) {
+                double wr = tw_cos[k * step];
+                double wi = tw_sin[k * step];
+                int a = i + k;
+                int b = a + half;
+                double xr = re[b] * wr - im[b] * wi;
+                double xi = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+            }
+        }
+    }
+}
+
+/*
+ * 実数列x (size点) のFFTの振幅を out[0 .. size/2] に格納する
+ * 偶数番目を実部、奇数番目を虚部としてsize/2点の複素FFTを行い、分離する
+ */
+static void fft_real_magnitude(double *out, const double *x, int size, double *re, double *im,
+        const double *tw_cos, const double *tw_sin, double scale)
+{
+    int n = size / 2;
+    int k;
+
+    for (k = 0; k < n; k++) {
+        re[k] = x[k * 2];
+        im[k] = x[k * 2 + 1];
+    }
+    // size/2点のFFTには、size点の回転因子を2つおきに使う
+    fft_complex(re, im, n, tw_cos, tw_sin, 2);
+
+    for (k = 0; k <= n; k++) {
+        int k1 = (k == n) ? 0 : k;
+        int k2 = (k == 0 || k == n) ? 0 : n - k;
+        {
+            // E = (Z[k] + conj(Z[n-k])) / 2, O = (Z[k] - conj(Z[n-k])) / 2i
+            double er = (re[k1] + re[k2]) * 0.5;
+            double ei = (im[k1] - im[k2]) * 0.5;
+            double or_ = (im[k1] + im[k2]) * 0.5;
+            double oi = -(re[k1] - re[k2]) * 0.5;
+            // X = E + W^k * O  (W = exp(-2πi/size))
+            double wr = (k < n) ? tw_cos[k] : -1.0;
+            double wi = (k < n) ? tw_sin[k] : 0.0;
+            double xr = er + (or_ * wr - oi * wi);
+            double xi = ei + (or_ * wi + oi * wr);
+            out[k] = sqrt(xr * xr + xi * xi) * scale;
+        }
+    }
+}
+
+static void spectro_task(void *arg)
+{
+    SpectroTask *t = arg;
+    const RefAudio *snd = t->snd;
+    int size = t->size;
+    double *x = malloc(sizeof(double) * size * 2);
+    double *re = x + size;
+    double *im = re + size / 2;
+    int row, i;
+
+    for (row = t->row_begin; row < t->row_end; row++) {
+        int begin = row * t->hop;
+
+        // チャンネルを平均して窓関数を掛ける
+        for (i = 0; i < size; i++) {
+            int pos = begin + i;
+            double y = 0.0;
+            if (pos < snd->length) {
+                if (snd->channels == 2) {
+                    y = (sample_get(snd, pos * 2) + sample_get(snd, pos * 2 + 1)) * 0.5;
+                } else {
+                    y = sample_get(snd, pos);
+                }
+            }
+            x[i] = y * t->window[i];
+        }
+        fft_real_magnitude(t->out + row * t->cols, x, size, re, im, t->tw_cos, t->tw_sin, t->scale);
+    }
+    free(x);
+}
+
+/*
+ * 振幅スペクトログラム
+ * out: rows * (size / 2 + 1)
+ * 各行はhopサンプルずつずらしたsize点のハン窓の振幅で、振幅1.0の正弦波が1.0になるように正規化する
+ */
+void audio_spectrogram(double *out, const RefAudio *snd, int size, int hop, int rows)
+{
+    int n = size / 2;
+    float *window = malloc(sizeof(float) * size);
+    double *tw = malloc(sizeof(double) * n * 2);
+    double wsum = 0.0;
+    int n_task = (rows + SPECTRO_ROWS_PER_TASK - 1) / SPECTRO_ROWS_PER_TASK;
+    SpectroTask *task = malloc(sizeof(SpectroTask) * n_task);
+    int i;
+
+    for (i = 0; i < size; i++) {
+        window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / size));
+        wsum += window[i];
+    }
+    for (i = 0; i < n; i++) {
+        tw[i] = cos(2.0 * M_PI * i / size);
+        tw[n + i] = -sin(2.0 * M_PI * i / size);
+    }
+    for (i = 0; i < n_task; i++) {
+        SpectroTask *t = &task[i];
+        t->snd = snd;
+        t->size = size;
+        t->hop = hop;
+        t->cols = n + 1;
+        t->window = window;
+        t->tw_cos = tw;
+        t->tw_sin = tw + n;
+        t->scale = 2.0 / wsum;
+        t->out = out;
+        t->row_begin = i * SPECTRO_ROWS_PER_TASK;
+        t->row_end = (i == n_task - 1) ? rows : t->row_begin + SPECTRO_ROWS_PER_TASK;
+    }
+    if (n_task > 1) {
+        run_parallel(spectro_task, task, sizeof(SpectroTask), n_task);
+    } else if (n_task == 1) {
+        spectro_task(&task[0]);
+    }
+    free(task);
+    free(tw);
+    free(window);
+}
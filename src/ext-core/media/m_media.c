@@ -12,6 +12,7 @@ enum {
 
 static RefNode *cls_fileio;
 static RefNode *cls_timedelta;
+static RefNode *cls_matrix;
 
 
 static void throw_already_closed(void)
@@ -277,7 +278,7 @@ static int audio_hash(Value *vret, Value *v, RefNode *node)
 static int audio_eq(Value *vret, Value *v, RefNode *node)
 {
     RefAudio *sn1 = Value_vp(*v);
-    RefAudio *sn2 = Value_vp(*v);
+    RefAudio *sn2 = Value_vp(v[1]);
     int len;
 
     if (sn1->u.u8 == NULL || sn2->u.u8 == NULL) {
@@ -506,10 +507,8 @@ static int audio_push(Value *vret, Value *v, RefNode *node)
         return FALSE;
     }
 
-    snd->length++;
-    if (snd->alloc_size < snd->length) {
-        snd->alloc_size *= 2;
-        snd->u.u8 = realloc(snd->u.u8, snd->alloc_size);
+    if (!Audio_set_size(snd, pos + 1)) {
+        return FALSE;
     }
 
     if (snd->channels == 2) {
@@ -548,6 +547,7 @@ static int audio_write(Value *vret, Value *v, RefNode *node)
     const char *data = mb->buf.p;
     int data_size = mb->buf.size;
     int n = snd->width * snd->channels;
+    int pos;
 
     if (snd->u.u8 == NULL) {
         throw_already_closed();
@@ -557,16 +557,13 @@ static int audio_write(Value *vret, Value *v, RefNode *node)
         fs->throw_errorf(fs->mod_lang, "ValueError", "Data length must be %d * n", n);
         return FALSE;
     }
-    if (snd->alloc_size < snd->length + data_size) {
-        while (snd->alloc_size < snd->length + data_size) {
-            snd->alloc_size *= 2;
-        }
-        snd->u.u8 = realloc(snd->u.u8, snd->alloc_size);
+    pos = snd->length;
+    if (!Audio_set_size(snd, pos + data_size / n)) {
+        return FALSE;
     }
-    memcpy(snd->u.u8 + snd->length * n, data, data_size);
-    snd->length += data_size / n;
+    memcpy(snd->u.u8 + pos * n, data, data_size);
 
-    return 0;
+    return TRUE;
 }
 static int audio_convert(Value *vret, Value *v, RefNode *node)
 {
@@ -574,14 +571,13 @@ static int audio_convert(Value *vret, Value *v, RefNode *node)
     RefAudio *snd;
     int samples = fs->Value_int64(v[1], NULL);
     int bits = fs->Value_int64(v[2], NULL);
-    int channels = 1;
-    int data_size;
+    int channels = src->channels;
 
     if (src->u.u8 == NULL) {
         throw_already_closed();
         return FALSE;
     }
-    if (samples < 1 && samples > 1000000) {
+    if (samples < 1 || samples > 1000000) {
         fs->throw_errorf(fs->mod_lang, "ValueError", "Must be >=1 and <=1000000 (argument #1)");
         return FALSE;
     }
@@ -602,40 +598,358 @@ static int audio_convert(Value *vret, Value *v, RefNode *node)
     snd->samples = samples;
     snd->width = bits / 8;
     snd->channels = channels;
-    snd->alloc_size = SOUND_INIT_SIZE;
+    snd->alloc_size = 0;
     snd->length = 0;
-    data_size = SOUND_INIT_SIZE * snd->width * snd->channels;
-    snd->u.u8 = malloc(data_size);
-    memset(snd->u.u8, 0, data_size);
+
+    if (!audio_convert_to(snd, src)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * begin, endの範囲を取り出す (省略時は全体)
+ */
+static void audio_get_range(int *pbegin, int *pend, RefAudio *snd, Value *v, int argc)
+{
+    int64_t begin = 0;
+    int64_t end = snd->length;
+
+    if (fg->stk_top > v + argc) {
+        begin = fs->Value_int64(v[argc], NULL);
+        if (begin < 0) {
+            begin += snd->length;
+        }
+    }
+    if (fg->stk_top > v + argc + 1) {
+        end = fs->Value_int64(v[argc + 1], NULL);
+        if (end < 0) {
+            end += snd->length;
+        }
+    }
+    if (begin < 0) {
+        begin = 0;
+    } else if (begin > snd->length) {
+        begin = snd->length;
+    }
+    if (end < begin) {
+        end = begin;
+    } else if (end > snd->length) {
+        end = snd->length;
+    }
+    *pbegin = (int)begin;
+    *pend = (int)end;
+}
+/*
+ * gain(g, [begin, end])
+ * envelope(g0, g1, [begin, end])
+ */
+static int audio_gain(Value *vret, Value *v, RefNode *node)
+{
+    RefAudio *snd = Value_vp(*v);
+    int envelope = FUNC_INT(node);
+    double g0 = fs->Value_float(v[1]);
+    double g1 = envelope ? fs->Value_float(v[2]) : g0;
+    int begin, end;
+
+    if (snd->u.u8 == NULL) {
+        throw_already_closed();
+        return FALSE;
+    }
+    audio_get_range(&begin, &end, snd, v, envelope ? 3 : 2);
+    audio_apply_gain(snd, begin, end, g0, g1);
+
+    return TRUE;
+}
+/*
+ * mix(audio, [offset, gain])
+ * offsetサンプル目から重ねる。足りない分は延長する
+ */
+static int audio_mix(Value *vret, Value *v, RefNode *node)
+{
+    RefAudio *snd = Value_vp(*v);
+    RefAudio *src = Value_vp(v[1]);
+    int64_t offset = 0;
+    double gain = 1.0;
+    int length;
+
+    if (snd->u.u8 == NULL || src->u.u8 == NULL) {
+        throw_already_closed();
+        return FALSE;
+    }
+    if (snd->samples != src->samples) {
+        fs->throw_errorf(mod_media, "AudioError", "Sample rate mismatch (%d, %d)", snd->samples, src->samples);
+        return FALSE;
+    }
+    if (fg->stk_top > v + 2) {
+        offset = fs->Value_int64(v[2], NULL);
+        if (offset < -(int64_t)src->length || offset > INT32_MAX - (int64_t)src->length) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Invalid position");
+            return FALSE;
+        }
+    }
+    if (fg->stk_top > v + 3) {
+        gain = fs->Value_float(v[3]);
+    }
+    length = snd->length;
+    if (offset + src->length > length) {
+        if (!Audio_set_size(snd, (int)(offset + src->length))) {
+            return FALSE;
+        }
+        audio_fill_silence(snd, length, snd->length);
+    }
+    audio_mix_into(snd, src, (int)offset, gain);
+
+    return TRUE;
+}
+/*
+ * peak(), rms() : 全チャンネルの最大値
+ * peak(window), rms(window) : window個ごと、チャンネルごとのMatrix
+ */
+static int audio_level_func(Value *vret, Value *v, RefNode *node)
+{
+    RefAudio *snd = Value_vp(*v);
+    int rms = FUNC_INT(node);
+
+    if (snd->u.u8 == NULL) {
+        throw_already_closed();
+        return FALSE;
+    }
+    if (fg->stk_top > v + 1) {
+        int64_t window = fs->Value_int64(v[1], NULL);
+        int rows, i;
+        RefMatrix *mat;
+
+        if (window < 1 || window > INT32_MAX) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Must be >=1 (argument #1)");
+            return FALSE;
+        }
+        rows = (int)((snd->length + window - 1) / window);
+        if ((int64_t)rows * snd->channels * sizeof(double) > fs->max_alloc) {
+            fs->throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+            return FALSE;
+        }
+        mat = fs->buf_new(cls_matrix, sizeof(RefMatrix) + sizeof(double) * rows * snd->channels);
+        *vret = vp_Value(mat);
+        mat->rows = rows;
+        mat->cols = snd->channels;
+        for (i = 0; i < rows; i++) {
+            int begin = (int)(i * window);
+            int end = (int)(begin + window < snd->length ? begin + window : snd->length);
+            audio_level(mat->d + i * snd->channels, snd, begin, end, rms);
+        }
+    } else {
+        double d[2];
+        audio_level(d, snd, 0, snd->length, rms);
+        if (snd->channels == 2 && d[1] > d[0]) {
+            d[0] = d[1];
+        }
+        *vret = fs->float_Value(fs->cls_float, d[0]);
+    }
+    return TRUE;
+}
+/*
+ * spectrogram(size, [hop])
+ * 行: hopサンプルごとの時刻、列: 周波数 (k * samples / size Hz)
+ */
+static int audio_spectrogram_func(Value *vret, Value *v, RefNode *node)
+{
+    RefAudio *snd = Value_vp(*v);
+    int64_t size = fs->Value_int64(v[1], NULL);
+    int64_t hop = size / 2;
+    int64_t rows;
+    RefMatrix *mat;
+
+    if (snd->u.u8 == NULL) {
+        throw_already_closed();
+        return FALSE;
+    }
+    if (size < 4 || size > 65536 || (size & (size - 1)) != 0) {
+        fs->throw_errorf(fs->mod_lang, "ValueError", "Must be power of 2 (4 - 65536) (argument #1)");
+        return FALSE;
+    }
+    if (fg->stk_top > v + 2) {
+        hop = fs->Value_int64(v[2], NULL);
+        if (hop < 1 || hop > INT32_MAX) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Must be >=1 (argument #2)");
+            return FALSE;
+        }
+    }
+    if (snd->length <= size) {
+        rows = 1;
+    } else {
+        rows = 1 + (snd->length - size + hop - 1) / hop;
+    }
+    if (rows * (size / 2 + 1) * (int64_t)sizeof(double) > fs->max_alloc) {
+        fs->throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+        return FALSE;
+    }
+    mat = fs->buf_new(cls_matrix, sizeof(RefMatrix) + sizeof(double) * rows * (size / 2 + 1));
+    *vret = vp_Value(mat);
+    mat->rows = (int)rows;
+    mat->cols = (int)(size / 2 + 1);
+    audio_spectrogram(mat->d, snd, (int)size, (int)hop, (int)rows);
 
     return TRUE;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef struct {
+    RefAudio info;  // samples, width, channels, length(全体のサンプル数)
+    int remain;     // 残りのサンプル数
+} MediaReaderState;
+
+static MediaReaderState *get_mediareader(Value v)
+{
+    Ref *r = Value_ref(v);
+    MediaReaderState *mr = Value_ptr(r->v[INDEX_MEDIAREADER_STATE]);
+
+    if (mr == NULL) {
+        fs->throw_error_select(THROW_NOT_OPENED_FOR_READ);
+    }
+    return mr;
+}
+
+/*
+ * WAVはヘッダだけ読み込み、dataチャンクはread, nextで少しずつ読み込む
+ */
 static int mediareader_new(Value *vret, Value *v, RefNode *node)
 {
+    Ref *r = fs->ref_new(cls_mediareader);
+    MediaReaderState *mr;
     Value reader;
     RefStr *type = NULL;
 
+    *vret = vp_Value(r);
     if (!fs->value_to_streamio(&reader, v[1], FALSE, 0, FALSE)) {
         return FALSE;
     }
+    r->v[INDEX_MEDIAREADER_STREAM] = reader;
+
     if (fg->stk_top > v + 2) {
         type = Value_vp(v[2]);
     }
-
     if (type == NULL && !detect_file_type(&type, reader)) {
-        fs->unref(reader);
+        return FALSE;
+    }
+    if (type == NULL) {
+        fs->throw_errorf(mod_media, "AudioError", "Unknown media type");
+        return FALSE;
+    }
+    if (strcmp(type->c, "audio/x-wav") != 0) {
+        fs->throw_errorf(mod_media, "AudioError", "Unsupported media type %r", type);
         return FALSE;
     }
 
+    mr = malloc(sizeof(MediaReaderState));
+    memset(mr, 0, sizeof(MediaReaderState));
+    if (!audio_load_wav(&mr->info, reader, TRUE)) {
+        free(mr);
+        return FALSE;
+    }
+    mr->remain = mr->info.length;
+    r->v[INDEX_MEDIAREADER_STATE] = ptr_Value(mr);
 
-    fs->unref(reader);
     return TRUE;
 }
 static int mediareader_close(Value *vret, Value *v, RefNode *node)
 {
+    Ref *r = Value_ref(*v);
+    MediaReaderState *mr = Value_ptr(r->v[INDEX_MEDIAREADER_STATE]);
+
+    if (mr != NULL) {
+        free(mr);
+        r->v[INDEX_MEDIAREADER_STATE] = VALUE_NULL;
+    }
+    return TRUE;
+}
+/*
+ * 最大framesサンプル読み込んで、Audioを返す
+ * 終端に達した場合はnull
+ */
+static int mediareader_read_sub(Value *vret, Value v, int frames)
+{
+    Ref *r = Value_ref(v);
+    MediaReaderState *mr = get_mediareader(v);
+    RefAudio *snd;
+
+    if (mr == NULL) {
+        return FALSE;
+    }
+    if (frames > mr->remain) {
+        frames = mr->remain;
+    }
+    if (frames <= 0) {
+        *vret = VALUE_NULL;
+        return TRUE;
+    }
+    snd = fs->buf_new(cls_audio, sizeof(RefAudio));
+    *vret = vp_Value(snd);
+    snd->samples = mr->info.samples;
+    snd->width = mr->info.width;
+    snd->channels = mr->info.channels;
+
+    if (!audio_read_wav_frames(snd, r->v[INDEX_MEDIAREADER_STREAM], frames)) {
+        return FALSE;
+    }
+    if (snd->length < frames) {
+        // dataチャンクが途中で終わっている
+        mr->remain = 0;
+    } else {
+        mr->remain -= frames;
+    }
+    if (snd->length == 0) {
+        fs->unref(*vret);
+        *vret = VALUE_NULL;
+    }
+    return TRUE;
+}
+static int mediareader_read(Value *vret, Value *v, RefNode *node)
+{
+    int64_t frames = SOUND_INIT_SIZE;
+
+    if (fg->stk_top > v + 1) {
+        frames = fs->Value_int64(v[1], NULL);
+        if (frames < 1 || frames > INT32_MAX) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Must be >=1 (argument #1)");
+            return FALSE;
+        }
+    }
+    return mediareader_read_sub(vret, *v, (int)frames);
+}
+static int mediareader_next(Value *vret, Value *v, RefNode *node)
+{
+    if (!mediareader_read_sub(vret, *v, SOUND_INIT_SIZE)) {
+        return FALSE;
+    }
+    if (*vret == VALUE_NULL) {
+        fs->throw_stopiter();
+        return FALSE;
+    }
+    return TRUE;
+}
+static int mediareader_info(Value *vret, Value *v, RefNode *node)
+{
+    MediaReaderState *mr = get_mediareader(*v);
+
+    if (mr == NULL) {
+        return FALSE;
+    }
+    switch (FUNC_INT(node)) {
+    case 0:
+        *vret = int32_Value(mr->info.samples);
+        break;
+    case 1:
+        *vret = int32_Value(mr->info.width * 8);
+        break;
+    case 2:
+        *vret = int32_Value(mr->info.channels);
+        break;
+    case 3:
+        *vret = int32_Value(mr->info.length);
+        break;
+    }
     return TRUE;
 }
 
@@ -646,7 +960,7 @@ static void define_class(RefNode *m)
     RefNode *cls;
     RefNode *n;
 
-    cls_mediareader = fs->define_identifier(m, m, "MediaReader", NODE_CLASS, NODEOPT_ABSTRACT);
+    cls_mediareader = fs->define_identifier(m, m, "MediaReader", NODE_CLASS, 0);
     cls_mediawriter = fs->define_identifier(m, m, "MediaWriter", NODE_CLASS, NODEOPT_ABSTRACT);
     cls_audio = fs->define_identifier(m, m, "Audio", NODE_CLASS, 0);
 
@@ -700,16 +1014,43 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, audio_write, 1, 1, NULL, fs->cls_bytesio);
     n = fs->define_identifier(m, cls, "convert", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, audio_convert, 2, 3, NULL, fs->cls_int, fs->cls_int, fs->cls_int);
+    n = fs->define_identifier(m, cls, "gain", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_gain, 1, 3, (void*)FALSE, fs->cls_number, fs->cls_int, fs->cls_int);
+    n = fs->define_identifier(m, cls, "envelope", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_gain, 2, 4, (void*)TRUE, fs->cls_number, fs->cls_number, fs->cls_int, fs->cls_int);
+    n = fs->define_identifier(m, cls, "mix", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_mix, 1, 3, NULL, cls_audio, fs->cls_int, fs->cls_number);
+    n = fs->define_identifier(m, cls, "peak", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_level_func, 0, 1, (void*)FALSE, fs->cls_int);
+    n = fs->define_identifier(m, cls, "rms", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_level_func, 0, 1, (void*)TRUE, fs->cls_int);
+    n = fs->define_identifier(m, cls, "spectrogram", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, audio_spectrogram_func, 1, 2, NULL, fs->cls_int, fs->cls_int);
     fs->extends_method(cls, fs->cls_obj);
 
 
     cls = cls_mediareader;
     n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
-    fs->define_native_func_a(n, mediareader_new, 1, 1, NULL, NULL, fs->cls_mimetype);
+    fs->define_native_func_a(n, mediareader_new, 1, 2, NULL, NULL, fs->cls_mimetype);
 
     n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
     fs->define_native_func_a(n, mediareader_close, 0, 0, NULL);
-    fs->extends_method(cls, fs->cls_obj);
+    n = fs->define_identifier(m, cls, "close", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, mediareader_close, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "read", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, mediareader_read, 0, 1, NULL, fs->cls_int);
+    n = fs->define_identifier(m, cls, "next", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, mediareader_next, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "samples", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, mediareader_info, 0, 0, (void*)0);
+    n = fs->define_identifier(m, cls, "bits", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, mediareader_info, 0, 0, (void*)1);
+    n = fs->define_identifier(m, cls, "channels", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, mediareader_info, 0, 0, (void*)2);
+    n = fs->define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, mediareader_info, 0, 0, (void*)3);
+    cls->u.c.n_memb = INDEX_MEDIAREADER_NUM;
+    fs->extends_method(cls, fs->cls_iterator);
 
 
     cls = cls_mediawriter;
@@ -724,6 +1065,7 @@ static void define_class(RefNode *m)
 void define_module(RefNode *m, const FoxStatic *a_fs, FoxGlobal *a_fg)
 {
     RefNode *mod_time;
+    RefNode *mod_math;
 
     fs = a_fs;
     fg = a_fg;
@@ -732,6 +1074,8 @@ void define_module(RefNode *m, const FoxStatic *a_fs, FoxGlobal *a_fg)
     mod_time = fs->get_module_by_name("time", -1, FALSE, FALSE);
     cls_timedelta = fs->Hash_get(&mod_time->u.m.h, "TimeDelta", -1);
     cls_fileio = fs->Hash_get(&fs->mod_io->u.m.h, "FileIO", -1);
+    mod_math = fs->get_module_by_name("math", 4, TRUE, FALSE);
+    cls_matrix = fs->Hash_get(&mod_math->u.m.h, "Matrix", -1);
 
     define_class(m);
 }
@@ -5,6 +5,12 @@
 #include "m_media.h"
 
 
+enum {
+    INDEX_MEDIAREADER_STREAM,
+    INDEX_MEDIAREADER_STATE,
+    INDEX_MEDIAREADER_NUM,
+};
+
 #ifdef DEFINE_GLOBALS
 #define extern
 #endif
@@ -23,8 +29,19 @@ extern RefNode *cls_mediawriter;
 // m_media.c
 int Audio_set_size(RefAudio *snd, int size);
 
-// codec.c
+// wav_io.c
 int audio_load_wav(RefAudio *snd, Value r, int info_only);
+int audio_read_wav_frames(RefAudio *snd, Value r, int frames);
 int audio_save_wav(RefAudio *snd, Value w);
 
+// audio_conv.c
+int audio_convert_to(RefAudio *dst, const RefAudio *src);
+
+// audio_util.c
+void audio_apply_gain(RefAudio *snd, int begin, int end, double g0, double g1);
+void audio_mix_into(RefAudio *dst, const RefAudio *src, int offset, double gain);
+void audio_fill_silence(RefAudio *snd, int begin, int end);
+void audio_level(double *out, const RefAudio *snd, int begin, int end, int rms);
+void audio_spectrogram(double *out, const RefAudio *snd, int size, int hop, int rows);
+
 #endif /* MEDIA_H_INCLUDED */
@@ -147,6 +147,39 @@ ERROR_INVALID_FORMAT:
     return FALSE;
 }
 
+/**
+ * dataチャンクの続きからframes個読み込む
+ * audio_load_wav(info_only=TRUE)の後で呼び出す
+ * 終端に達した場合は読み込めた分だけになる
+ */
+int audio_read_wav_frames(RefAudio *snd, Value r, int frames)
+{
+    int n = snd->width * snd->channels;
+    int size = 0;
+
+    if (!Audio_set_size(snd, frames)) {
+        return FALSE;
+    }
+    while (size < frames * n) {
+        int read_size = frames * n - size;
+        if (!fs->stream_read_data(r, NULL, (char*)snd->u.u8 + size, &read_size, FALSE, FALSE)) {
+            return FALSE;
+        }
+        if (read_size <= 0) {
+            break;
+        }
+        size += read_size;
+    }
+    snd->length = size / n;
+#ifdef FOX_BIG_ENDIAN
+    if (snd->width == 2) {
+        reverse_endian(snd->u.i16, snd->length * snd->channels);
+    }
+#endif
+
+    return TRUE;
+}
+
 int audio_save_wav(RefAudio *snd, Value w)
 {
     enum {
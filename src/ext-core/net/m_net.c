@@ -329,6 +329,23 @@ static int socket_write(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+#ifndef WIN32
+/*
+ * ストリーム間の直接コピーに使うOSのハンドル
+ */
+static int socket_handle(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefFileHandle *fh = Value_vp(r->v[INDEX_FILEIO_HANDLE]);
+    int fd = (Value_bool(v[1]) ? fh->fd_write : fh->fd_read);
+
+    if (fd != -1) {
+        *vret = int32_Value(fd);
+    }
+
+    return TRUE;
+}
+#endif
 static int socket_close(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
@@ -885,6 +902,10 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, socket_read, 2, 2, NULL, fs->cls_bytesio, fs->cls_int);
     n = fs->define_identifier(m, cls, "_write", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, socket_write, 1, 1, NULL, fs->cls_bytesio);
+#ifndef WIN32
+    n = fs->define_identifier(m, cls, "_handle", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, socket_handle, 1, 1, NULL, fs->cls_bool);
+#endif
     n = fs->define_identifier(m, cls, "ipaddr", NODE_FUNC_N, NODEOPT_PROPERTY);
     fs->define_native_func_a(n, socket_ipaddr, 0, 0, NULL);
 
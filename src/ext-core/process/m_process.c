@@ -165,12 +165,27 @@ static int pipeio_write(Value *vret, Value *v, RefNode *node)
     RefProcessHandle *ph = Value_vp(r->v[INDEX_P_HANDLE]);
     RefBytesIO *mb = Value_vp(v[1]);
 
-    if (!ph->valid || ph->fd_out) {
+    if (!ph->valid || ph->fd_out == -1) {
         return TRUE;
     }
     write_pipe(ph, mb->buf.p, mb->buf.size);
     return TRUE;
 }
+/*
+ * ストリーム間の直接コピーに使うOSのハンドル
+ */
+static int pipeio_handle(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefProcessHandle *ph = Value_vp(r->v[INDEX_P_HANDLE]);
+    FileHandle fd = (Value_bool(v[1]) ? ph->fd_out : ph->fd_in);
+
+    if (ph->valid && fd != -1) {
+        *vret = fs->int64_Value(fd);
+    }
+
+    return TRUE;
+}
 static int pipeio_close(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
@@ -288,6 +303,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, pipeio_read, 2, 2, NULL, fs->cls_bytesio, fs->cls_int);
     n = fs->define_identifier(m, cls, "_write", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, pipeio_write, 1, 1, NULL, fs->cls_bytesio);
+    n = fs->define_identifier(m, cls, "_handle", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, pipeio_handle, 1, 1, NULL, fs->cls_bool);
 
     n = fs->define_identifier(m, cls, "wait", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, process_wait, 0, 0, NULL);
@@ -2,18 +2,27 @@
 #include "m_number.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sqlite3.h>
 
 
 enum {
     INDEX_SQLITE_CONN,
     INDEX_SQLITE_FUNC,
+    INDEX_SQLITE_CACHE,
     INDEX_SQLITE_NUM,
 };
 enum {
     SQLITE_ERROR_USER = 201,
+    STMT_CACHE_SIZE = 16,
 };
 
+// SQL文字列をキーとしたprepared statementのLRUキャッシュ
+typedef struct {
+    sqlite3_stmt *stmt[STMT_CACHE_SIZE];   // 先頭が最近使用したもの
+    int num;
+} StmtCache;
+
 typedef struct RefCursor {
     RefHeader rh;
 
@@ -91,6 +100,61 @@ static Value cursor_get_sub(sqlite3_stmt *stmt, int i)
 
 /////////////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * キャッシュから取り出す (使用中は他から使われない)
+ */
+static sqlite3_stmt *stmt_cache_get(StmtCache *sc, const char *sql)
+{
+    int i;
+
+    for (i = 0; i < sc->num; i++) {
+        sqlite3_stmt *stmt = sc->stmt[i];
+        if (strcmp(sqlite3_sql(stmt), sql) == 0) {
+            memmove(&sc->stmt[i], &sc->stmt[i + 1], sizeof(sqlite3_stmt*) * (sc->num - i - 1));
+            sc->num--;
+            return stmt;
+        }
+    }
+    return NULL;
+}
+/*
+ * 使い終わったstatementをキャッシュに戻す
+ * 溢れた場合は最も古いものを破棄
+ */
+static void stmt_cache_put(StmtCache *sc, sqlite3_stmt *stmt)
+{
+    if (sc == NULL) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    if (sc->num >= STMT_CACHE_SIZE) {
+        sc->num--;
+        sqlite3_finalize(sc->stmt[sc->num]);
+    }
+    memmove(&sc->stmt[1], &sc->stmt[0], sizeof(sqlite3_stmt*) * sc->num);
+    sc->stmt[0] = stmt;
+    sc->num++;
+}
+static void stmt_cache_clear(StmtCache *sc)
+{
+    int i;
+    for (i = 0; i < sc->num; i++) {
+        sqlite3_finalize(sc->stmt[i]);
+    }
+    sc->num = 0;
+}
+static StmtCache *stmt_cache_new(void)
+{
+    StmtCache *sc = malloc(sizeof(StmtCache));
+    sc->num = 0;
+    return sc;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
 static int conn_new(Value *vret, Value *v, RefNode *node)
 {
     int flag = SQLITE_OPEN_READONLY;
@@ -127,6 +191,7 @@ static int conn_new(Value *vret, Value *v, RefNode *node)
     }
     r->v[INDEX_SQLITE_CONN] = ptr_Value(conn);
     r->v[INDEX_SQLITE_FUNC] = vp_Value(fs->refarray_new(0));
+    r->v[INDEX_SQLITE_CACHE] = ptr_Value(stmt_cache_new());
     free(path);
 
     return TRUE;
@@ -145,6 +210,7 @@ static int conn_memory(Value *vret, Value *v, RefNode *node)
     }
     r->v[INDEX_SQLITE_CONN] = ptr_Value(conn);
     r->v[INDEX_SQLITE_FUNC] = vp_Value(fs->refarray_new(0));
+    r->v[INDEX_SQLITE_CACHE] = ptr_Value(stmt_cache_new());
 
     return TRUE;
 }
@@ -152,7 +218,13 @@ static int conn_close(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
+    StmtCache *sc = Value_ptr(r->v[INDEX_SQLITE_CACHE]);
 
+    if (sc != NULL) {
+        stmt_cache_clear(sc);
+        free(sc);
+        r->v[INDEX_SQLITE_CACHE] = VALUE_NULL;
+    }
     if (conn != NULL) {
         sqlite3_close(conn);
         r->v[INDEX_SQLITE_CONN] = VALUE_NULL;
@@ -161,19 +233,82 @@ static int conn_close(Value *vret, Value *v, RefNode *node)
     return TRUE;
 }
 
-static int conn_prepare_sub(sqlite3_stmt **stmt, sqlite3 *conn, Value *v)
+/*
+ * List : 位置パラメータ
+ * Map  : 名前付きパラメータ
+ */
+static int stmt_bind_args(sqlite3_stmt *stmt, Value v)
 {
-    Value *v1 = v + 1;
-    int argc = fg->stk_top - v1;
-    RefStr *sql;
+    const RefNode *type = fs->Value_type(v);
+    int i;
+
+    if (type == fs->cls_list) {
+        RefArray *ra = Value_vp(v);
+        for (i = 0; i < ra->size; i++) {
+            if (!sqlite_bind(stmt, i + 1, ra->p[i])) {
+                return FALSE;
+            }
+        }
+    } else if (type == fs->cls_map) {
+        RefMap *rm = Value_vp(v);
+        for (i = 0; i < rm->entry_num; i++) {
+            HashValueEntry *ep = rm->entry[i];
+            for (; ep != NULL; ep = ep->next) {
+                RefStr *rs;
+                int idx;
+                if (fs->Value_type(ep->key) != fs->cls_str) {
+                    fs->throw_errorf(fs->mod_lang, "TypeError", "Map {Str:*, Str:* ...} required");
+                    return FALSE;
+                }
+                rs = Value_vp(ep->key);
+                if (rs->size > 0 && !str_has0(rs->c, rs->size)) {
+                    // 先頭が記号で始まらない場合は、:を補う
+                    char ch = rs->c[0];
+                    if (isdigit_fox(ch) || isupper_fox(ch) || islower_fox(ch)) {
+                        char *ptr = malloc(rs->size + 2);
+                        sprintf(ptr, ":%.*s", rs->size, rs->c);
+                        idx = sqlite3_bind_parameter_index(stmt, ptr);
+                        free(ptr);
+                    } else {
+                        idx = sqlite3_bind_parameter_index(stmt, rs->c);
+                    }
+                } else {
+                    idx = 0;
+                }
+                if (idx == 0) {
+                    fs->throw_errorf(mod_sqlite, "SQLiteError", "No parameters names %r", rs);
+                    return FALSE;
+                }
+                if (!sqlite_bind(stmt, idx, ep->val)) {
+                    return FALSE;
+                }
+            }
+        }
+    } else {
+        if (!sqlite_bind(stmt, 1, v)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+/*
+ * キャッシュにあればそれを使い、なければprepareする
+ */
+static int conn_prepare_stmt(sqlite3_stmt **stmt, Ref *r, RefStr *sql)
+{
+    sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
+    StmtCache *sc = Value_ptr(r->v[INDEX_SQLITE_CACHE]);
     int result;
 
     if (conn == NULL) {
         fs->throw_errorf(mod_sqlite, "SQLiteError", "Connection is not opened");
         return FALSE;
     }
+    *stmt = stmt_cache_get(sc, sql->c);
+    if (*stmt != NULL) {
+        return TRUE;
+    }
 
-    sql = Value_vp(*v1);
     result = sqlite3_prepare_v2(conn, sql->c, -1, stmt, NULL);
     if (result != SQLITE_OK){
         if (result != SQLITE_ERROR_USER) {
@@ -185,75 +320,52 @@ static int conn_prepare_sub(sqlite3_stmt **stmt, sqlite3 *conn, Value *v)
         fs->throw_errorf(mod_sqlite, "SQLiteError", "SQL string is empty");
         return FALSE;
     }
+    return TRUE;
+}
+static int conn_prepare_sub(sqlite3_stmt **stmt, Ref *r, Value *v)
+{
+    Value *v1 = v + 1;
+    int argc = fg->stk_top - v1;
+
+    if (!conn_prepare_stmt(stmt, r, Value_vp(*v1))) {
+        return FALSE;
+    }
 
     if (argc > 1) {
         int i;
         if (argc == 2) {
             const RefNode *type = fs->Value_type(v[2]);
-            if (type == fs->cls_list) {
-                RefArray *ra = Value_vp(v[2]);
-                for (i = 0; i < ra->size; i++) {
-                    if (!sqlite_bind(*stmt, i + 1, ra->p[i])) {
-                        return FALSE;
-                    }
-                }
-                return TRUE;
-            } else if (type == fs->cls_map) {
-                RefMap *rm = Value_vp(v[2]);
-                for (i = 0; i < rm->entry_num; i++) {
-                    HashValueEntry *ep = rm->entry[i];
-                    for (; ep != NULL; ep = ep->next) {
-                        RefStr *rs;
-                        int idx;
-                        if (fs->Value_type(ep->key) != fs->cls_str) {
-                            fs->throw_errorf(fs->mod_lang, "TypeError", "Map {Str:*, Str:* ...} required");
-                            return FALSE;
-                        }
-                        rs = Value_vp(ep->key);
-                        if (rs->size > 0 && !str_has0(rs->c, rs->size)) {
-                            // 先頭が記号で始まらない場合は、:を補う
-                            char ch = rs->c[0];
-                            if (isdigit_fox(ch) || isupper_fox(ch) || islower_fox(ch)) {
-                                char *ptr = malloc(rs->size + 2);
-                                sprintf(ptr, ":%.*s", rs->size, rs->c);
-                                idx = sqlite3_bind_parameter_index(*stmt, ptr);
-                                free(ptr);
-                            } else {
-                                idx = sqlite3_bind_parameter_index(*stmt, rs->c);
-                            }
-                        } else {
-                            idx = 0;
-                        }
-                        if (idx == 0) {
-                            fs->throw_errorf(mod_sqlite, "SQLiteError", "No parameters names %r", rs);
-                            return FALSE;
-                        }
-                        if (!sqlite_bind(*stmt, idx, ep->val)) {
-                            return FALSE;
-                        }
-                    }
+            if (type == fs->cls_list || type == fs->cls_map) {
+                if (!stmt_bind_args(*stmt, v[2])) {
+                    goto ERROR_END;
                 }
                 return TRUE;
             }
         }
         for (i = 1; i < argc; i++) {
             if (!sqlite_bind(*stmt, i, v1[i])) {
-                return FALSE;
+                goto ERROR_END;
             }
         }
     }
 
     return TRUE;
+
+ERROR_END:
+    stmt_cache_put(Value_ptr(r->v[INDEX_SQLITE_CACHE]), *stmt);
+    *stmt = NULL;
+    return FALSE;
 }
 static int conn_exec(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
+    StmtCache *sc = Value_ptr(r->v[INDEX_SQLITE_CACHE]);
     int result;
     int count;
 
     sqlite3_stmt *stmt = NULL;
-    if (!conn_prepare_sub(&stmt, conn, v)) {
+    if (!conn_prepare_sub(&stmt, r, v)) {
         return FALSE;
     }
 
@@ -262,12 +374,13 @@ static int conn_exec(Value *vret, Value *v, RefNode *node)
         // ???
         if (result != SQLITE_ERROR_USER) {
             fs->throw_errorf(mod_sqlite, "SQLiteError", "%s", sqlite3_errmsg(conn));
+            stmt_cache_put(sc, stmt);
             return FALSE;
         }
         //return FALSE;
     }
     count = sqlite3_changes(conn);
-    sqlite3_finalize(stmt);
+    stmt_cache_put(sc, stmt);
 
     *vret = int32_Value(count);
 
@@ -277,10 +390,9 @@ static int conn_exec(Value *vret, Value *v, RefNode *node)
 static int conn_query(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
-    sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
 
     sqlite3_stmt *stmt = NULL;
-    if (!conn_prepare_sub(&stmt, conn, v)) {
+    if (!conn_prepare_sub(&stmt, r, v)) {
         return FALSE;
     }
 
@@ -294,6 +406,77 @@ static int conn_query(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+static int conn_exec_simple(sqlite3 *conn, const char *sql)
+{
+    if (sqlite3_exec(conn, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        fs->throw_errorf(mod_sqlite, "SQLiteError", "%s", sqlite3_errmsg(conn));
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * 1つのstatementに行ごとにbindして実行する
+ * トランザクション外で呼ばれた場合は、全体を1つのトランザクションで実行する
+ */
+static int conn_exec_many(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
+    StmtCache *sc = Value_ptr(r->v[INDEX_SQLITE_CACHE]);
+    RefArray *rows = Value_vp(v[2]);
+    int in_transaction = FALSE;
+    int64_t count = 0;
+    int i;
+
+    sqlite3_stmt *stmt = NULL;
+    if (!conn_prepare_stmt(&stmt, r, Value_vp(v[1]))) {
+        return FALSE;
+    }
+    if (sqlite3_get_autocommit(conn)) {
+        if (!conn_exec_simple(conn, "BEGIN")) {
+            goto ERROR_END;
+        }
+        in_transaction = TRUE;
+    }
+
+    for (i = 0; i < rows->size; i++) {
+        int result;
+
+        if (!stmt_bind_args(stmt, rows->p[i])) {
+            goto ERROR_END;
+        }
+        result = sqlite3_step(stmt);
+        if (result != SQLITE_DONE && result != SQLITE_ROW) {
+            if (result != SQLITE_ERROR_USER) {
+                fs->throw_errorf(mod_sqlite, "SQLiteError", "%s (row %d)", sqlite3_errmsg(conn), i);
+            }
+            goto ERROR_END;
+        }
+        count += sqlite3_changes(conn);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+    stmt_cache_put(sc, stmt);
+    stmt = NULL;
+
+    if (in_transaction) {
+        if (!conn_exec_simple(conn, "COMMIT")) {
+            goto ERROR_END;
+        }
+    }
+    *vret = fs->int64_Value(count);
+
+    return TRUE;
+
+ERROR_END:
+    if (stmt != NULL) {
+        stmt_cache_put(sc, stmt);
+    }
+    if (in_transaction) {
+        sqlite3_exec(conn, "ROLLBACK", NULL, NULL, NULL);
+    }
+    return FALSE;
+}
 /*
  * 最初の行の最初の列だけ取得
  */
@@ -301,9 +484,10 @@ static int conn_single(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     sqlite3 *conn = Value_ptr(r->v[INDEX_SQLITE_CONN]);
+    StmtCache *sc = Value_ptr(r->v[INDEX_SQLITE_CACHE]);
 
     sqlite3_stmt *stmt = NULL;
-    if (!conn_prepare_sub(&stmt, conn, v)) {
+    if (!conn_prepare_sub(&stmt, r, v)) {
         return FALSE;
     }
 
@@ -313,9 +497,10 @@ static int conn_single(Value *vret, Value *v, RefNode *node)
             *vret = cursor_get_sub(stmt, 0);
         } else if (result == SQLITE_ERROR_USER) {
             fs->throw_errorf(mod_sqlite, "SQLiteError", "%s", sqlite3_errmsg(conn));
+            stmt_cache_put(sc, stmt);
             return FALSE;
         }
-        sqlite3_finalize(stmt);
+        stmt_cache_put(sc, stmt);
     }
 
     return TRUE;
@@ -518,7 +703,8 @@ static int cursor_close(Value *vret, Value *v, RefNode *node)
     RefCursor *rc = Value_vp(*v);
 
     if (rc->stmt != NULL) {
-        sqlite3_finalize(rc->stmt);
+        Ref *r = Value_ref(rc->connect);
+        stmt_cache_put(Value_ptr(r->v[INDEX_SQLITE_CACHE]), rc->stmt);
         rc->stmt = NULL;
     }
     fs->unref(rc->connect);
@@ -608,6 +794,74 @@ static int cursor_next(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+/*
+ * 残りの行をすべて読み込み、列ごとのListにして返す
+ * query_mapの場合は{列名:List}
+ */
+static int cursor_fetch_columns(Value *vret, Value *v, RefNode *node)
+{
+    RefCursor *rc = Value_vp(*v);
+    int num = sqlite3_column_count(rc->stmt);
+    RefArray **cols = malloc(sizeof(RefArray*) * (num + 1));
+    int i;
+
+    if (rc->is_map) {
+        RefMap *rm = fs->refmap_new(num);
+        *vret = vp_Value(rm);
+
+        for (i = 0; i < num; i++) {
+            const char *key_p = sqlite3_column_name(rc->stmt, i);
+            Value key = fs->cstr_Value(NULL, key_p, -1);
+            HashValueEntry *ve = fs->refmap_add(rm, key, FALSE, FALSE);
+
+            cols[i] = NULL;
+            if (ve != NULL) {
+                if (ve->val != VALUE_NULL) {
+                    // 同じ列名は後の列で上書き
+                    int j;
+                    for (j = 0; j < i; j++) {
+                        if (cols[j] != NULL && vp_Value(cols[j]) == ve->val) {
+                            cols[i] = cols[j];
+                            cols[j] = NULL;
+                        }
+                    }
+                } else {
+                    cols[i] = fs->refarray_new(0);
+                    ve->val = vp_Value(cols[i]);
+                }
+            }
+            fs->unref(key);
+        }
+    } else {
+        RefArray *ra = fs->refarray_new(num);
+        *vret = vp_Value(ra);
+        for (i = 0; i < num; i++) {
+            cols[i] = fs->refarray_new(0);
+            ra->p[i] = vp_Value(cols[i]);
+        }
+    }
+
+    for (;;) {
+        int result = sqlite3_step(rc->stmt);
+
+        if (result == SQLITE_DONE) {
+            break;
+        } else if (result != SQLITE_ROW) {
+            fs->throw_errorf(mod_sqlite, "SQLiteError", "sqlite3_step error (%d)", result);
+            free(cols);
+            return FALSE;
+        }
+        for (i = 0; i < num; i++) {
+            if (cols[i] != NULL) {
+                Value *vp = fs->refarray_push(cols[i]);
+                *vp = cursor_get_sub(rc->stmt, i);
+            }
+        }
+    }
+    free(cols);
+
+    return TRUE;
+}
 static int cursor_columns(Value *vret, Value *v, RefNode *node)
 {
     int i;
@@ -661,6 +915,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, conn_query, 1, -1, (void*) FALSE, fs->cls_str);
     n = fs->define_identifier(m, cls, "query_map", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, conn_query, 1, -1, (void*) TRUE, fs->cls_str);
+    n = fs->define_identifier(m, cls, "exec_many", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, conn_exec_many, 2, 2, NULL, fs->cls_str, fs->cls_list);
     n = fs->define_identifier(m, cls, "single", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, conn_single, 1, -1, NULL, fs->cls_str);
     n = fs->define_identifier(m, cls, "create_function", NODE_FUNC_N, 0);
@@ -677,6 +933,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, cursor_bind, 2, 2, NULL, NULL, NULL);
     n = fs->define_identifier(m, cls, "next", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, cursor_next, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "fetch_columns", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, cursor_fetch_columns, 0, 0, NULL);
     n = fs->define_identifier(m, cls, "columns", NODE_FUNC_N, NODEOPT_PROPERTY);
     fs->define_native_func_a(n, cursor_columns, 0, 0, NULL);
     fs->extends_method(cls, fs->cls_iterator);
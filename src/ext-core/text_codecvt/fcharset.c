@@ -44,6 +44,12 @@ typedef struct {
     uint8_t sign;
 } FEscape;
 
+// 一括変換用の表の1文字 (len == 0 の場合は1文字ずつ変換する)
+typedef struct {
+    uint8_t len;
+    uint8_t c[3];
+} FBulkChar;
+
 struct FCharset {
     RefCharset *rc;
     int type;
@@ -51,6 +57,15 @@ struct FCharset {
     FToU8Table **t;
     int esc_num;
     FEscape *esc;
+
+    // 一括変換用の表 (最初に使うときに作成)
+    int to_ready;
+    int to_ascii;           // 00 - 7FがASCIIと同じ
+    FBulkChar *to_single;   // [1バイト目]
+    FBulkChar **to_double;  // [1バイト目][2バイト目]
+    int from_ready;
+    int from_ascii;
+    FBulkChar **from_bmp;   // [上位8bit][下位8bit]
 };
 
 static int32_t fread_int32(FileHandle fh)
@@ -219,6 +234,7 @@ FCharset *FCharset_new(RefCharset *rc)
 
     fs->Mem_init(&mem, 1024);
     cs = (FCharset*)fs->Mem_get(&fg->st_mem, sizeof(FCharset));
+    memset(cs, 0, sizeof(FCharset));
     cs->rc = rc;
     cs->type = rc->type;
 
@@ -228,6 +244,7 @@ FCharset *FCharset_new(RefCharset *rc)
 
         switch (rc->type) {
         case FCHARSET_SINGLE_BYTE:
+        case FCHARSET_BIG5:
             num_t = 2;
             break;
         case FCHARSET_EUC:
@@ -377,7 +394,7 @@ int FCharset_from_utf8(FCharset *cs, const char **psrc, char **pdst)
         return TRUE;
     }
     default: {
-        FFromU8 *ftable = findFromU8(cs->f, (const char**)&src);
+        FFromU8 *ftable = (cs->f != NULL ? findFromU8(cs->f, (const char**)&src) : NULL);
         if (ftable != NULL) {
             switch (cs->type) {
             case FCHARSET_SINGLE_BYTE:
@@ -427,6 +444,8 @@ int FCharset_from_utf8(FCharset *cs, const char **psrc, char **pdst)
                 } else {
                     *dst++ = (char)ftable->code;
                 }
+                *psrc = (const char*)src;
+                *pdst = (char*)dst;
                 return TRUE;
             case FCHARSET_EUC:
                 if (ftable->tbl == cs->t[0]) {
@@ -582,12 +601,12 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
             break;
         }
         case FCHARSET_UTF16LE:
-            if (src_len >= 2) {
+            if (((const uint8_t*)src_end - src) >= 2) {
                 int c = src[0] | (src[1] << 8);
-                if (c < SURROGATE_U_BEGIN) {
+                if (c < SURROGATE_U_BEGIN || c >= SURROGATE_END) {
                     code = c;
                     src_len = 2;
-                } else if (c < SURROGATE_L_BEGIN && src_len >= 4) {
+                } else if (c < SURROGATE_L_BEGIN && ((const uint8_t*)src_end - src) >= 4) {
                     int c2 = src[2] | (src[3] << 8);
                     if (c2 >= SURROGATE_L_BEGIN && c2 < SURROGATE_END) {
                         code = (((c - SURROGATE_U_BEGIN) << 10) | (c2 - SURROGATE_L_BEGIN)) + 0x10000;
@@ -597,12 +616,12 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
             }
             break;
         case FCHARSET_UTF16BE:
-            if (src_len >= 2) {
+            if (((const uint8_t*)src_end - src) >= 2) {
                 int c = src[1] | (src[0] << 8);
-                if (c < SURROGATE_U_BEGIN) {
+                if (c < SURROGATE_U_BEGIN || c >= SURROGATE_END) {
                     code = c;
                     src_len = 2;
-                } else if (c < SURROGATE_L_BEGIN && src_len >= 4) {
+                } else if (c < SURROGATE_L_BEGIN && ((const uint8_t*)src_end - src) >= 4) {
                     int c2 = src[3] | (src[2] << 8);
                     if (c2 >= SURROGATE_L_BEGIN && c2 < SURROGATE_END) {
                         code = (((c - SURROGATE_U_BEGIN) << 10) | (c2 - SURROGATE_L_BEGIN)) + 0x10000;
@@ -612,7 +631,7 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
             }
             break;
         case FCHARSET_UTF32LE:
-            if (src_len >= 4 && src[3] == 0) {
+            if (((const uint8_t*)src_end - src) >= 4 && src[3] == 0) {
                 int c = src[0] | (src[1] << 8) | (src[2] << 16);
                 if (c < SURROGATE_U_BEGIN || (c >= SURROGATE_END && c < CODEPOINT_END)) {
                     code = c;
@@ -621,7 +640,7 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
             }
             break;
         case FCHARSET_UTF32BE:
-            if (src_len >= 4 && src[0] == 0) {
+            if (((const uint8_t*)src_end - src) >= 4 && src[0] == 0) {
                 int c = src[3] | (src[2] << 8) | (src[1] << 16);
                 if (c < SURROGATE_U_BEGIN || (c >= SURROGATE_END && c < CODEPOINT_END)) {
                     code = c;
@@ -677,8 +696,10 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
                 u8 = cs->t[0];
                 index = c;
                 src += 1;
-            } else if (c < 0x9F) {
-                // 80 - 9F
+            } else if (c < 0x81) {
+                // 80
+            } else if (c < 0xA0) {
+                // 81 - 9F
                 if (((const uint8_t*)src_end - src) >= 2) {
                     int c2 = src[1];
                     if (c2 >= 0x40 && c2 < 0xFF && c2 != 0x7F) {
@@ -767,7 +788,7 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
                 if (((const uint8_t*)src_end - src) >= 2) {
                     int c2 = src[1];
                     if (c2 >= 0x40 && c2 < 0xFF) {
-                        u8 = cs->t[0];
+                        u8 = cs->t[1];
                         index = (c - 0xA0) * 192 + (c2 - 0x40);
                         src += 2;
                     }
@@ -822,6 +843,413 @@ int FCharset_to_utf8(FCharset *cs, const char **psrc, const char *src_end, char
     return FALSE;
 }
 
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * 一括変換
+ *
+ * 1バイト・2バイト文字セットは1文字ずつの変換結果から表を作り、1回の参照で変換する
+ * 表で変換できない文字(結合文字列、3バイト以上の文字など)があれば、そこで止めて1文字ずつの変換に任せる
+ * 文字の先頭がsrc_limitに達するか、出力がdst_limitに達したら終了する
+ */
+
+/*
+ * ASCIIの連続をまとめてコピーする
+ * 8バイト単位で最上位ビットを調べる
+ */
+static int copy_ascii_run(const uint8_t *src, int n, uint8_t *dst)
+{
+    int i = 0;
+
+    while (i + 8 <= n) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        if ((w & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+        memcpy(dst + i, &w, 8);
+        i += 8;
+    }
+    while (i < n && src[i] < 0x80) {
+        dst[i] = src[i];
+        i++;
+    }
+    return i;
+}
+static int bulk_ascii_count(const uint8_t *src, const char *src_limit, const uint8_t *dst, const char *dst_limit)
+{
+    int n = (const uint8_t*)src_limit - src;
+    int m = (const uint8_t*)dst_limit - dst;
+    return n < m ? n : m;
+}
+static void bulk_char_set(FBulkChar *bc, const char *p, int len)
+{
+    if (len >= 1 && len <= 3) {
+        bc->len = len;
+        memcpy(bc->c, p, len);
+    }
+}
+static int bulk_ascii_identity(const FBulkChar *tbl)
+{
+    int i;
+    for (i = 0; i < 0x80; i++) {
+        if (tbl[i].len != 1 || tbl[i].c[0] != i) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void make_to_utf8_table(FCharset *cs)
+{
+    char src[4];
+    char buf[FCONV_MAX_CHAR_LENGTH];
+    int c1, c2;
+
+    cs->to_ready = TRUE;
+    if (cs->t == NULL) {
+        return;
+    }
+    cs->to_single = fs->Mem_get(&fg->st_mem, sizeof(FBulkChar) * 256);
+    cs->to_double = fs->Mem_get(&fg->st_mem, sizeof(FBulkChar*) * 256);
+    memset(cs->to_single, 0, sizeof(FBulkChar) * 256);
+    memset(cs->to_double, 0, sizeof(FBulkChar*) * 256);
+
+    for (c1 = 0; c1 < 256; c1++) {
+        const char *psrc = src;
+        char *pdst = buf;
+        FBulkChar *row = NULL;
+
+        src[0] = c1;
+        if (FCharset_to_utf8(cs, &psrc, src + 1, &pdst)) {
+            bulk_char_set(&cs->to_single[c1], buf, pdst - buf);
+            continue;
+        }
+        for (c2 = 0; c2 < 256; c2++) {
+            psrc = src;
+            pdst = buf;
+            src[1] = c2;
+            if (FCharset_to_utf8(cs, &psrc, src + 2, &pdst) && psrc == src + 2) {
+                if (row == NULL) {
+                    row = fs->Mem_get(&fg->st_mem, sizeof(FBulkChar) * 256);
+                    memset(row, 0, sizeof(FBulkChar) * 256);
+                    cs->to_double[c1] = row;
+                }
+                bulk_char_set(&row[c2], buf, pdst - buf);
+            }
+        }
+    }
+    cs->to_ascii = bulk_ascii_identity(cs->to_single);
+}
+static void make_from_utf8_table(FCharset *cs)
+{
+    int code;
+
+    cs->from_ready = TRUE;
+    if (cs->f == NULL) {
+        return;
+    }
+    cs->from_bmp = fs->Mem_get(&fg->st_mem, sizeof(FBulkChar*) * 256);
+    memset(cs->from_bmp, 0, sizeof(FBulkChar*) * 256);
+
+    for (code = 0; code < 0x10000; code++) {
+        char src[8];
+        char buf[FCONV_MAX_CHAR_LENGTH];
+        const char *psrc = src;
+        char *pdst = buf;
+        int len;
+
+        if (code >= SURROGATE_U_BEGIN && code < SURROGATE_END) {
+            continue;
+        }
+        memset(src, 0, sizeof(src));
+        if (code < 0x80) {
+            src[0] = code;
+            len = 1;
+        } else if (code < 0x800) {
+            src[0] = 0xC0 | (code >> 6);
+            src[1] = 0x80 | (code & 0x3F);
+            len = 2;
+        } else {
+            output_utf8_3bytes((uint8_t*)src, code);
+            len = 3;
+        }
+        if (FCharset_from_utf8(cs, &psrc, &pdst) && psrc == src + len) {
+            // 後に続く文字と合わせて1文字になる場合は表に入れない
+            const char *p = src;
+            FFromU8 *u8 = findFromU8(cs->f, &p);
+            if (u8 == NULL || u8->next == NULL) {
+                FBulkChar *row = cs->from_bmp[code >> 8];
+                if (row == NULL) {
+                    row = fs->Mem_get(&fg->st_mem, sizeof(FBulkChar) * 256);
+                    memset(row, 0, sizeof(FBulkChar) * 256);
+                    cs->from_bmp[code >> 8] = row;
+                }
+                bulk_char_set(&row[code & 0xFF], buf, pdst - buf);
+            }
+        }
+    }
+    if (cs->from_bmp[0] != NULL) {
+        cs->from_ascii = bulk_ascii_identity(cs->from_bmp[0]);
+    }
+}
+
+static void to_utf8_bulk_table(FCharset *cs, const uint8_t **psrc, const char *src_limit, const char *src_end, uint8_t **pdst, const char *dst_limit)
+{
+    const uint8_t *src = *psrc;
+    uint8_t *dst = *pdst;
+    const FBulkChar *single = cs->to_single;
+    FBulkChar **dbl = cs->to_double;
+
+    while (src < (const uint8_t*)src_limit && dst < (const uint8_t*)dst_limit) {
+        const FBulkChar *bc;
+        int c = *src;
+
+        if (c < 0x80 && cs->to_ascii) {
+            int n = copy_ascii_run(src, bulk_ascii_count(src, src_limit, dst, dst_limit), dst);
+            src += n;
+            dst += n;
+            continue;
+        }
+        if (single[c].len > 0) {
+            bc = &single[c];
+            src++;
+        } else if (dbl[c] != NULL && (const uint8_t*)src_end - src >= 2 && dbl[c][src[1]].len > 0) {
+            bc = &dbl[c][src[1]];
+            src += 2;
+        } else {
+            break;
+        }
+        memcpy(dst, bc->c, 3);
+        dst += bc->len;
+    }
+    *psrc = src;
+    *pdst = dst;
+}
+static uint8_t *put_utf8(uint8_t *dst, int code)
+{
+    if (code < 0x80) {
+        *dst++ = code;
+    } else if (code < 0x800) {
+        *dst++ = 0xC0 | (code >> 6);
+        *dst++ = 0x80 | (code & 0x3F);
+    } else if (code < 0x10000) {
+        *dst++ = 0xE0 | (code >> 12);
+        *dst++ = 0x80 | ((code >> 6) & 0x3F);
+        *dst++ = 0x80 | (code & 0x3F);
+    } else {
+        *dst++ = 0xF0 | (code >> 18);
+        *dst++ = 0x80 | ((code >> 12) & 0x3F);
+        *dst++ = 0x80 | ((code >> 6) & 0x3F);
+        *dst++ = 0x80 | (code & 0x3F);
+    }
+    return dst;
+}
+static void utf16_to_utf8_bulk(int be, const uint8_t **psrc, const char *src_limit, const char *src_end, uint8_t **pdst, const char *dst_limit)
+{
+    const uint8_t *src = *psrc;
+    uint8_t *dst = *pdst;
+    int lo = be ? 1 : 0;
+    int hi = 1 - lo;
+
+    while (src < (const uint8_t*)src_limit && dst < (const uint8_t*)dst_limit && (const uint8_t*)src_end - src >= 2) {
+        int c = src[lo] | (src[hi] << 8);
+
+        if (c < 0x80) {
+            *dst++ = c;
+            src += 2;
+        } else if (c < SURROGATE_U_BEGIN || c >= SURROGATE_END) {
+            dst = put_utf8(dst, c);
+            src += 2;
+        } else if (c < SURROGATE_L_BEGIN && (const uint8_t*)src_end - src >= 4) {
+            int c2 = src[2 + lo] | (src[2 + hi] << 8);
+            if (c2 < SURROGATE_L_BEGIN || c2 >= SURROGATE_END) {
+                break;
+            }
+            dst = put_utf8(dst, (((c - SURROGATE_U_BEGIN) << 10) | (c2 - SURROGATE_L_BEGIN)) + 0x10000);
+            src += 4;
+        } else {
+            break;
+        }
+    }
+    *psrc = src;
+    *pdst = dst;
+}
+static void utf32_to_utf8_bulk(int be, const uint8_t **psrc, const char *src_limit, const char *src_end, uint8_t **pdst, const char *dst_limit)
+{
+    const uint8_t *src = *psrc;
+    uint8_t *dst = *pdst;
+
+    while (src < (const uint8_t*)src_limit && dst < (const uint8_t*)dst_limit && (const uint8_t*)src_end - src >= 4) {
+        int c;
+        if (be) {
+            c = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3];
+        } else {
+            c = src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
+        }
+        if (c < 0 || c >= CODEPOINT_END || (c >= SURROGATE_U_BEGIN && c < SURROGATE_END)) {
+            break;
+        }
+        dst = put_utf8(dst, c);
+        src += 4;
+    }
+    *psrc = src;
+    *pdst = dst;
+}
+
+/*
+ * 変換できるところまで一括で変換する
+ * src_endまでは読み出せる
+ * 1文字ずつの変換と同じ結果になる
+ */
+void FCharset_to_utf8_bulk(FCharset *cs, const char **psrc, const char *src_limit, const char *src_end, char **pdst, const char *dst_limit)
+{
+    const uint8_t *src = (const uint8_t*)*psrc;
+    uint8_t *dst = (uint8_t*)*pdst;
+
+    switch (cs->type) {
+    case FCHARSET_ASCII:
+    case FCHARSET_UTF8:
+    case FCHARSET_UTF8_LOOSE:
+    case FCHARSET_CESU8: {
+        // ASCII以外は1文字ずつ
+        int n = copy_ascii_run(src, bulk_ascii_count(src, src_limit, dst, dst_limit), dst);
+        src += n;
+        dst += n;
+        break;
+    }
+    case FCHARSET_SINGLE_BYTE:
+    case FCHARSET_EUC:
+    case FCHARSET_SHIFTJIS:
+    case FCHARSET_BIG5:
+        if (!cs->to_ready) {
+            make_to_utf8_table(cs);
+        }
+        if (cs->to_single != NULL) {
+            to_utf8_bulk_table(cs, &src, src_limit, src_end, &dst, dst_limit);
+        }
+        break;
+    case FCHARSET_UTF16LE:
+    case FCHARSET_UTF16BE:
+        utf16_to_utf8_bulk(cs->type == FCHARSET_UTF16BE, &src, src_limit, src_end, &dst, dst_limit);
+        break;
+    case FCHARSET_UTF32LE:
+    case FCHARSET_UTF32BE:
+        utf32_to_utf8_bulk(cs->type == FCHARSET_UTF32BE, &src, src_limit, src_end, &dst, dst_limit);
+        break;
+    }
+    *psrc = (const char*)src;
+    *pdst = (char*)dst;
+}
+
+/*
+ * UTF-8を一括で変換する (入力は正しいUTF-8)
+ */
+void FCharset_from_utf8_bulk(FCharset *cs, const char **psrc, const char *src_limit, char **pdst, const char *dst_limit)
+{
+    const uint8_t *src = (const uint8_t*)*psrc;
+    uint8_t *dst = (uint8_t*)*pdst;
+
+    switch (cs->type) {
+    case FCHARSET_ASCII: {
+        int n = copy_ascii_run(src, bulk_ascii_count(src, src_limit, dst, dst_limit), dst);
+        src += n;
+        dst += n;
+        break;
+    }
+    case FCHARSET_UTF8:
+    case FCHARSET_UTF8_LOOSE: {
+        // 文字の境界までそのままコピー
+        int n = bulk_ascii_count(src, src_limit, dst, dst_limit);
+        while (n > 0 && (src[n] & 0xC0) == 0x80) {
+            n--;
+        }
+        memcpy(dst, src, n);
+        src += n;
+        dst += n;
+        break;
+    }
+    case FCHARSET_SINGLE_BYTE:
+    case FCHARSET_EUC:
+    case FCHARSET_SHIFTJIS:
+    case FCHARSET_BIG5: {
+        FBulkChar **bmp;
+
+        if (!cs->from_ready) {
+            make_from_utf8_table(cs);
+        }
+        bmp = cs->from_bmp;
+        if (bmp == NULL) {
+            break;
+        }
+        while (src < (const uint8_t*)src_limit && dst < (const uint8_t*)dst_limit) {
+            const FBulkChar *row;
+            int c = *src;
+            int code, len;
+
+            if (c < 0x80 && cs->from_ascii) {
+                int n = copy_ascii_run(src, bulk_ascii_count(src, src_limit, dst, dst_limit), dst);
+                src += n;
+                dst += n;
+                continue;
+            }
+            if (c < 0x80) {
+                code = c;
+                len = 1;
+            } else if ((c & 0xE0) == 0xC0) {
+                code = ((c & 0x1F) << 6) | (src[1] & 0x3F);
+                len = 2;
+            } else if ((c & 0xF0) == 0xE0) {
+                code = ((c & 0x0F) << 12) | ((src[1] & 0x3F) << 6) | (src[2] & 0x3F);
+                len = 3;
+            } else {
+                break;
+            }
+            row = bmp[code >> 8];
+            if (row == NULL || row[code & 0xFF].len == 0) {
+                break;
+            }
+            memcpy(dst, row[code & 0xFF].c, 3);
+            dst += row[code & 0xFF].len;
+            src += len;
+        }
+        break;
+    }
+    case FCHARSET_UTF16LE:
+    case FCHARSET_UTF16BE: {
+        int be = (cs->type == FCHARSET_UTF16BE);
+        while (src < (const uint8_t*)src_limit && dst < (const uint8_t*)dst_limit) {
+            int c = *src;
+            int code;
+            if (c < 0x80) {
+                code = c;
+                src += 1;
+            } else if ((c & 0xE0) == 0xC0) {
+                code = ((c & 0x1F) << 6) | (src[1] & 0x3F);
+                src += 2;
+            } else if ((c & 0xF0) == 0xE0) {
+                code = ((c & 0x0F) << 12) | ((src[1] & 0x3F) << 6) | (src[2] & 0x3F);
+                src += 3;
+            } else {
+                // サロゲートペアは1文字ずつ
+                break;
+            }
+            if (be) {
+                dst[0] = code >> 8;
+                dst[1] = code & 0xFF;
+            } else {
+                dst[0] = code & 0xFF;
+                dst[1] = code >> 8;
+            }
+            dst += 2;
+        }
+        break;
+    }
+    }
+    *psrc = (const char*)src;
+    *pdst = (char*)dst;
+}
+
 void FCharset_from_ascii_string(FCharset *cs, char *src, const char *end)
 {
     if (cs->f != NULL && cs->type == CODESET_256) {
@@ -839,7 +1267,9 @@ void FCharset_from_ascii_string(FCharset *cs, char *src, const char *end)
 void FConv_throw_convert_error(FConv *fc)
 {
     if (fc->to_utf8) {
-        fs->throw_errorf(fs->mod_lang, "CharsetError", "Cannot convert %02X to %r", fc->error_charcode, fc->cs->rc->name);
+        char hex[8];
+        sprintf(hex, "%02X", fc->error_charcode & 0xFF);
+        fs->throw_errorf(fs->mod_lang, "CharsetError", "Cannot convert %s to %r", hex, fc->cs->rc->name);
     } else {
         fs->throw_errorf(fs->mod_lang, "CharsetError", "Cannot convert %U to %r", fc->error_charcode, fc->cs->rc->name);
     }
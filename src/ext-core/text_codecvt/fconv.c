@@ -84,6 +84,60 @@ static void output_alter_string(char **pdst, const char *fmt, int code, FCharset
     }
     *pdst = dst;
 }
+/*
+ * 1文字変換する
+ * 変換できない文字は代替文字列を出力するか、エラーにする
+ */
+static int fconv_char(FConv *fc, const char **psrc, const char *src_end, char **pdst, int throw_error)
+{
+    if (fc->to_utf8) {
+        if (!FCharset_to_utf8(fc->cs, psrc, src_end, pdst)) {
+            if (fc->alter != NULL) {
+                output_alter_string(pdst, fc->alter, **psrc, NULL);
+                (*psrc)++;
+            } else {
+                fc->status = FCONV_ERROR;
+                fc->error_charcode = **psrc & 0xFF;
+                if (throw_error) {
+                    FConv_throw_convert_error(fc);
+                }
+                return FALSE;
+            }
+        }
+    } else {
+        if (!FCharset_from_utf8(fc->cs, psrc, pdst)) {
+            int code;
+            int n = utf8_codepoint(*psrc, &code);
+            if (fc->alter != NULL) {
+                output_alter_string(pdst, fc->alter, code, fc->cs);
+                (*psrc) += n;
+            } else {
+                fc->status = FCONV_ERROR;
+                fc->error_charcode = code;
+                if (throw_error) {
+                    FConv_throw_convert_error(fc);
+                }
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+/*
+ * 表などを使って変換できるところまでまとめて変換する
+ * 短い入力では表を作る手間の方が大きいので何もしない
+ */
+static void fconv_bulk(FConv *fc, const char **psrc, const char *src_limit, const char *src_end, char **pdst, const char *dst_limit)
+{
+    if (src_limit - *psrc < FCONV_BULK_MIN_LENGTH) {
+        return;
+    }
+    if (fc->to_utf8) {
+        FCharset_to_utf8_bulk(fc->cs, psrc, src_limit, src_end, pdst, dst_limit);
+    } else {
+        FCharset_from_utf8_bulk(fc->cs, psrc, src_limit, pdst, dst_limit);
+    }
+}
 int FConv_next(FConv *fc, int throw_error)
 {
     for (;;) {
@@ -111,8 +165,12 @@ int FConv_next(FConv *fc, int throw_error)
 
         if (fc->src_tmp_last > 0) {
             if ((fc->src_tmp_end - fc->src_tmp_buf) < FCONV_MAX_CHAR_LENGTH) {
-                memcpy(fc->src_tmp_end, fc->src, FCONV_MAX_CHAR_LENGTH);
-                fc->src_tmp_end += FCONV_MAX_CHAR_LENGTH;
+                int n = fc->src_end - fc->src;
+                if (n > FCONV_MAX_CHAR_LENGTH) {
+                    n = FCONV_MAX_CHAR_LENGTH;
+                }
+                memcpy(fc->src_tmp_end, fc->src, n);
+                fc->src_tmp_end += n;
             }
         } else if (fc->src_terminate) {
             if (fc->src >= fc->src_end) {
@@ -132,6 +190,14 @@ int FConv_next(FConv *fc, int throw_error)
                 return TRUE;
             }
         }
+        if (fc->src_tmp_last == 0 && fc->dst != NULL) {
+            const char *src_limit = fc->src_terminate ? fc->src_end : fc->src_end - FCONV_MAX_CHAR_LENGTH;
+            src_prev = fc->src;
+            fconv_bulk(fc, &fc->src, src_limit, fc->src_end, &fc->dst, fc->dst_end - FCONV_MAX_CHAR_LENGTH);
+            if (fc->src != src_prev) {
+                continue;
+            }
+        }
         {
             const char **psrc;
             const char *src_end;
@@ -155,36 +221,8 @@ int FConv_next(FConv *fc, int throw_error)
             } else {
                 pdst = &fc->dst;
             }
-            if (fc->to_utf8) {
-                if (!FCharset_to_utf8(fc->cs, psrc, src_end, pdst)) {
-                    if (fc->alter != NULL) {
-                        output_alter_string(pdst, fc->alter, **psrc, NULL);
-                        (*psrc)++;
-                    } else {
-                        fc->status = FCONV_ERROR;
-                        fc->error_charcode = **psrc & 0xFF;
-                        if (throw_error) {
-                            FConv_throw_convert_error(fc);
-                        }
-                        return FALSE;
-                    }
-                }
-            } else {
-                if (!FCharset_from_utf8(fc->cs, psrc, pdst)) {
-                    int code;
-                    int n = utf8_codepoint(fc->src, &code);
-                    if (fc->alter != NULL) {
-                        output_alter_string(pdst, fc->alter, code, fc->cs);
-                        (*psrc) += n;
-                    } else {
-                        fc->status = FCONV_ERROR;
-                        fc->error_charcode = code;
-                        if (throw_error) {
-                            FConv_throw_convert_error(fc);
-                        }
-                        return FALSE;
-                    }
-                }
+            if (!fconv_char(fc, psrc, src_end, pdst, throw_error)) {
+                return FALSE;
             }
         }
         if (fc->src_tmp_last > 0) {
@@ -197,23 +235,46 @@ int FConv_next(FConv *fc, int throw_error)
         }
     }
 }
-int FConv_conv_strbuf(FConv *fc, StrBuf *sb, const char *src, int src_len, int throw_error)
+/*
+ * 先頭がsrc + limitより前にある文字を変換してsbに追加する
+ * src + src_lenまでは読み出せる
+ * 変換した入力のバイト数を返す (エラーの場合は-1)
+ */
+int FConv_conv_strbuf_part(FConv *fc, StrBuf *sb, const char *src, int src_len, int limit, int throw_error)
 {
-    FConv_set_src(fc, src, src_len, TRUE);
+    const char *p = src;
+    const char *src_end = src + src_len;
+    const char *src_limit = src + limit;
 
-    for (;;) {
-        int prev_size = sb->size;
-        fs->StrBuf_alloc(sb, prev_size + BUFFER_SIZE);
-        FConv_set_dst(fc, sb->p + prev_size, BUFFER_SIZE);
-        sb->size = fc->dst - sb->p;
+    while (p < src_limit) {
+        int size = sb->size;
+        char *dst;
+        const char *dst_limit;
 
-        if (!FConv_next(fc, throw_error)) {
+        // 足りなくなったら倍々で増やす
+        if (!fs->StrBuf_alloc(sb, size + (src_limit - p) + FCONV_MAX_CHAR_LENGTH * 2)) {
             fc->status = FCONV_ERROR;
-            return FALSE;
+            return -1;
         }
-        if (fc->status != FCONV_OUTPUT_REQUIRED) {
-            sb->size = fc->dst - sb->p;
-            return TRUE;
+        dst = sb->p + size;
+        dst_limit = sb->p + sb->alloc_size - FCONV_MAX_CHAR_LENGTH;
+
+        while (p < src_limit && dst < dst_limit) {
+            fconv_bulk(fc, &p, src_limit, src_end, &dst, dst_limit);
+            if (p >= src_limit || dst >= dst_limit) {
+                break;
+            }
+            if (!fconv_char(fc, &p, src_end, &dst, throw_error)) {
+                sb->size = dst - sb->p;
+                return -1;
+            }
         }
+        sb->size = dst - sb->p;
     }
+    fc->status = FCONV_OK;
+    return p - src;
+}
+int FConv_conv_strbuf(FConv *fc, StrBuf *sb, const char *src, int src_len, int throw_error)
+{
+    return FConv_conv_strbuf_part(fc, sb, src, src_len, src_len, throw_error) >= 0;
 }
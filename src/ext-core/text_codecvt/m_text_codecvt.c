@@ -13,6 +13,10 @@ enum {
     INDEX_CONVIO_FCONV = INDEX_TEXTIO_NUM,
     INDEX_CONVIO_NUM,
 };
+enum {
+    INDEX_DECODER_STATE,
+    INDEX_DECODER_NUM,
+};
 enum {
     TEXTIO_M_GETS,
     TEXTIO_M_GETLN,
@@ -26,6 +30,14 @@ typedef struct {
     FConv out;
 } FConvIO;
 
+typedef struct {
+    RefCharset *cs;
+    int trans;
+    FConv in;
+    char rest[FCONV_MAX_CHAR_LENGTH * 3];  // 前回の入力の変換していない部分
+    int rest_size;
+} FConvDecoder;
+
 
 const FoxStatic *fs;
 FoxGlobal *fg;
@@ -68,7 +80,7 @@ static int convio_new(Value *vret, Value *v, RefNode *node)
     }
 
     FConv_init(&cio->in, fc, TRUE, cio->trans ? UTF8_ALTER_CHAR : NULL);
-    FConv_init(&cio->out, fc, TRUE, cio->trans ? "?" : NULL);
+    FConv_init(&cio->out, fc, FALSE, cio->trans ? "?" : NULL);
 
     return TRUE;
 }
@@ -144,7 +156,7 @@ static int convio_write(Value *vret, Value *v, RefNode *node)
 
     {
         Value vmb;
-        if (fs->stream_get_write_memio(stream, &vmb, &max)) {
+        if (!fs->stream_get_write_memio(stream, &vmb, &max)) {
             return FALSE;
         }
         mb = Value_vp(vmb);
@@ -203,6 +215,134 @@ static int convio_translit(Value *vret, Value *v, RefNode *node)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * 分割して入力されるバイト列を順に変換する
+ * 末尾の文字が途中で切れている可能性があるので、最後のFCONV_MAX_CHAR_LENGTHバイト未満は次回に回す
+ */
+static int decoder_new(Value *vret, Value *v, RefNode *node)
+{
+    RefNode *cls_decoder = FUNC_VP(node);
+    FConvDecoder *dec;
+    FCharset *fc;
+    Ref *r = fs->ref_new(cls_decoder);
+    *vret = vp_Value(r);
+
+    dec = (FConvDecoder*)malloc(sizeof(FConvDecoder));
+    memset(dec, 0, sizeof(FConvDecoder));
+    r->v[INDEX_DECODER_STATE] = ptr_Value(dec);
+
+    dec->cs = Value_vp(v[1]);
+    fc = RefCharset_get_fcharset(dec->cs, TRUE);
+    if (fc == NULL) {
+        return FALSE;
+    }
+    if (fg->stk_top > v + 2 && Value_bool(v[2])) {
+        dec->trans = TRUE;
+    }
+    FConv_init(&dec->in, fc, TRUE, dec->trans ? UTF8_ALTER_CHAR : NULL);
+
+    return TRUE;
+}
+static int decoder_dispose(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    FConvDecoder *dec = Value_ptr(r->v[INDEX_DECODER_STATE]);
+
+    if (dec != NULL) {
+        free(dec);
+        r->v[INDEX_DECODER_STATE] = VALUE_NULL;
+    }
+    return TRUE;
+}
+static int decoder_conv(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    FConvDecoder *dec = Value_ptr(r->v[INDEX_DECODER_STATE]);
+    RefStr *rs = Value_vp(v[1]);
+    const char *src = rs->c;
+    int size = rs->size;
+    int pos = 0;
+    StrBuf buf;
+
+    fs->StrBuf_init_refstr(&buf, 0);
+
+    if (dec->rest_size > 0) {
+        // 前回の残りと今回の先頭をつなげて、つなぎ目の文字を変換する
+        int n = (size < FCONV_MAX_CHAR_LENGTH * 2 ? size : FCONV_MAX_CHAR_LENGTH * 2);
+        int prev = dec->rest_size;
+        int total = prev + n;
+        int limit = (n == size ? total - FCONV_MAX_CHAR_LENGTH : prev);
+        int done = 0;
+
+        memcpy(dec->rest + prev, src, n);
+        if (limit > 0) {
+            done = FConv_conv_strbuf_part(&dec->in, &buf, dec->rest, total, limit, TRUE);
+            if (done < 0) {
+                goto ERROR;
+            }
+        }
+        if (n == size) {
+            memmove(dec->rest, dec->rest + done, total - done);
+            dec->rest_size = total - done;
+            goto FINISH;
+        }
+        pos = done - prev;
+        dec->rest_size = 0;
+    }
+    if (pos < size - FCONV_MAX_CHAR_LENGTH) {
+        int done = FConv_conv_strbuf_part(&dec->in, &buf, src + pos, size - pos, size - FCONV_MAX_CHAR_LENGTH - pos, TRUE);
+        if (done < 0) {
+            goto ERROR;
+        }
+        pos += done;
+    }
+    memcpy(dec->rest, src + pos, size - pos);
+    dec->rest_size = size - pos;
+
+FINISH:
+    *vret = fs->StrBuf_str_Value(&buf, fs->cls_str);
+    return TRUE;
+
+ERROR:
+    StrBuf_close(&buf);
+    return FALSE;
+}
+/*
+ * 残りをすべて変換する
+ */
+static int decoder_flush(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    FConvDecoder *dec = Value_ptr(r->v[INDEX_DECODER_STATE]);
+    int size = dec->rest_size;
+    StrBuf buf;
+
+    fs->StrBuf_init_refstr(&buf, 0);
+    dec->rest_size = 0;
+    if (FConv_conv_strbuf_part(&dec->in, &buf, dec->rest, size, size, TRUE) < 0) {
+        StrBuf_close(&buf);
+        return FALSE;
+    }
+    *vret = fs->StrBuf_str_Value(&buf, fs->cls_str);
+    return TRUE;
+}
+static int decoder_charset(Value *vret, Value *v, RefNode *node)
+{
+    Ref *ref = Value_ref(*v);
+    FConvDecoder *dec = Value_ptr(ref->v[INDEX_DECODER_STATE]);
+    *vret = vp_Value(dec->cs);
+    return TRUE;
+}
+static int decoder_translit(Value *vret, Value *v, RefNode *node)
+{
+    Ref *ref = Value_ref(*v);
+    FConvDecoder *dec = Value_ptr(ref->v[INDEX_DECODER_STATE]);
+    *vret = bool_Value(dec->trans);
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 static int conv_tobytes(Value *vret, Value *v, RefNode *node)
 {
     RefStr *rs = Value_vp(v[1]);
@@ -316,6 +456,7 @@ static void define_class(RefNode *m)
     RefNode *n;
 
     RefNode *cls_convio = fs->define_identifier(m, m, "ConvIO", NODE_CLASS, 0);
+    RefNode *cls_decoder = fs->define_identifier(m, m, "ConvDecoder", NODE_CLASS, 0);
 
 
     // ConvIO
@@ -338,8 +479,28 @@ static void define_class(RefNode *m)
     n = fs->define_identifier(m, cls, "translit", NODE_FUNC_N, NODEOPT_PROPERTY);
     fs->define_native_func_a(n, convio_translit, 0, 0, NULL);
 
-    cls->u.c.n_memb = INDEX_TEXTIO_NUM;
+    cls->u.c.n_memb = INDEX_CONVIO_NUM;
     fs->extends_method(cls, fs->cls_textio);
+
+
+    // ConvDecoder
+    cls = cls_decoder;
+    n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
+    fs->define_native_func_a(n, decoder_new, 1, 2, cls_decoder, fs->cls_charset, fs->cls_bool);
+
+    n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, decoder_dispose, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "conv", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, decoder_conv, 1, 1, NULL, fs->cls_bytes);
+    n = fs->define_identifier(m, cls, "flush", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, decoder_flush, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "charset", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, decoder_charset, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "translit", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, decoder_translit, 0, 0, NULL);
+
+    cls->u.c.n_memb = INDEX_DECODER_NUM;
+    fs->extends_method(cls, fs->cls_obj);
 }
 
 static CodeCVTStatic *CodeCVTStatic_new(void)
@@ -35,7 +35,7 @@ static char *read_hilight_file(RefStr *type)
 static void add_hilight_state(Hilight *h, RefStr *name, int word, int icase)
 {
     State *state = fs->Mem_get(&h->mem, sizeof(State));
-    memset(state->left, 0, sizeof(state->left));
+    memset(state, 0, sizeof(State));
     state->name = name;
     state->word = word;
     state->icase = icase;
@@ -72,29 +72,6 @@ static void set_word_char_range(Hilight *h, int c1, int c2)
         h->word_char[ch / 8] |= 1 << (ch % 8);
     }
 }
-static int streq_n(const char *p1, const char *p2, int len, int icase)
-{
-    int i;
-
-    if (icase) {
-        for (i = 0; i < len; i++) {
-            if (tolower_fox(*p1) != *p2) {
-                return FALSE;
-            }
-            p1++;
-            p2++;
-        }
-    } else {
-        for (i = 0; i < len; i++) {
-            if (*p1 != *p2) {
-                return FALSE;
-            }
-            p1++;
-            p2++;
-        }
-    }
-    return TRUE;
-}
 
 static void parse_word_chars(Hilight *h, const char *p, const char *end)
 {
@@ -200,7 +177,12 @@ static int load_hilight_sub(Hilight *h, char *buf, RefStr *type)
                 int i;
 
                 word->len = tk.str_val.size;
+                word->seq = h->n_word++;
+                word->match_next = NULL;
                 memcpy(word->c, tk.str_val.p, tk.str_val.size);
+                if (h->max_len < word->len) {
+                    h->max_len = word->len;
+                }
                 fs->Tok_simple_next(&tk);
                 if (tk.v.type != T_LET) {
                     goto SYNTAX_ERROR;
@@ -252,6 +234,81 @@ SYNTAX_ERROR:
     fs->throw_errorf(fs->mod_lang, "InternalError", "Syntax error at line %d (%r)", tk.v.line, type);
     return FALSE;
 }
+/*
+ * 状態ごとに、単語の木を作る
+ * 入力1バイトにつき1回の表引きで遷移する
+ */
+static int word_usable(State *st, Word *w)
+{
+    int i;
+
+    // 大文字小文字を区別しない場合、入力を小文字にして比較するので大文字を含む単語は一致しない
+    if (st->icase) {
+        for (i = 0; i < w->len; i++) {
+            if (isupper_fox(w->c[i])) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+static void compile_state(Hilight *h, State *st)
+{
+    int n_node = 1;
+    int n_class = 1;
+    int next_node = 1;
+    int i, j;
+
+    memset(st->cmap, 0, sizeof(st->cmap));
+    for (i = 0; i < STATE_WORD_SIZE; i++) {
+        Word *w;
+        for (w = st->left[i]; w != NULL; w = w->next) {
+            if (word_usable(st, w)) {
+                for (j = 0; j < w->len; j++) {
+                    int c = w->c[j] & 0xFF;
+                    if (st->cmap[c] == 0) {
+                        st->cmap[c] = n_class++;
+                    }
+                }
+                n_node += w->len;
+            }
+        }
+    }
+    if (st->icase) {
+        for (i = 'A'; i <= 'Z'; i++) {
+            st->cmap[i] = st->cmap[i | ('A' ^ 'a')];
+        }
+    }
+    st->n_class = n_class;
+    st->trie = fs->Mem_get(&h->mem, sizeof(int32_t) * n_node * n_class);
+    st->trie_match = fs->Mem_get(&h->mem, sizeof(Word*) * n_node);
+    memset(st->trie, 0, sizeof(int32_t) * n_node * n_class);
+    memset(st->trie_match, 0, sizeof(Word*) * n_node);
+
+    for (i = 0; i < STATE_WORD_SIZE; i++) {
+        Word *w;
+        for (w = st->left[i]; w != NULL; w = w->next) {
+            int node = 0;
+            Word **pw;
+
+            if (!word_usable(st, w)) {
+                continue;
+            }
+            for (j = 0; j < w->len; j++) {
+                int32_t *pn = &st->trie[node * n_class + st->cmap[w->c[j] & 0xFF]];
+                if (*pn == 0) {
+                    *pn = next_node++;
+                }
+                node = *pn;
+            }
+            // 優先順位の高い順に並べる
+            for (pw = &st->trie_match[node]; *pw != NULL && (*pw)->seq > w->seq; pw = &(*pw)->match_next) {
+            }
+            w->match_next = *pw;
+            *pw = w;
+        }
+    }
+}
 int load_hilight(Hilight *h, RefStr *type)
 {
     char *buf = read_hilight_file(type);
@@ -265,15 +322,78 @@ int load_hilight(Hilight *h, RefStr *type)
 
     // 0-9A-Za-z_
     memcpy(h->word_char, "\0\0\0\0\0\0\xff\x03\xfe\xff\xff\x87\xfe\xff\xff\x07", 128 / 8);
+    h->n_word = 0;
+    h->max_len = 0;
     ret = load_hilight_sub(h, buf, type);
     free(buf);
 
+    if (ret) {
+        int i;
+        for (i = 0; i < h->state.entry_num; i++) {
+            HashEntry *e;
+            for (e = h->state.entry[i]; e != NULL; e = e->next) {
+                compile_state(h, e->p);
+            }
+        }
+    }
     return ret;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
 
-int hilight_code_next(HilightIter *it)
+void hilight_scan_init(HilightScan *sc, Hilight *h, const char *src, int size)
+{
+    sc->h = h;
+    sc->src_end = src + size;
+    sc->ptr = src;
+    sc->end = src;
+    sc->word = NULL;
+    sc->next_word = NULL;
+    sc->state = fs->Hash_get(&h->state, "_", 1);
+    sc->next_state = sc->state;
+    sc->state_next1 = sc->state;
+    sc->state_next2 = sc->state;
+}
+
+/*
+ * ptrから始まる単語のうち、優先順位が最も高いものを返す
+ */
+static Word *match_word(Hilight *h, State *st, const char *ptr, const char *seg_begin, const char *src_end)
+{
+    const char *p = ptr;
+    int prev_word = (ptr > seg_begin && is_word_char(h, ptr[-1]));
+    int node = 0;
+    Word *found = NULL;
+
+    while (p < src_end) {
+        Word *w;
+
+        node = st->trie[node * st->n_class + st->cmap[*p & 0xFF]];
+        if (node == 0) {
+            break;
+        }
+        p++;
+        for (w = st->trie_match[node]; w != NULL; w = w->match_next) {
+            if (found != NULL && w->seq < found->seq) {
+                break;
+            }
+            if (w->self->word) {
+                // 単語単位で検索
+                if (prev_word) {
+                    continue;
+                }
+                if (p < src_end && is_word_char(h, *p)) {
+                    continue;
+                }
+            }
+            found = w;
+            break;
+        }
+    }
+    return found;
+}
+
+int hilight_code_next(HilightScan *it)
 {
     Hilight *h = it->h;
     const char *ptr = it->end;
@@ -296,34 +416,28 @@ NEXT:
         }
     }
 
-    while (ptr < it->src_end) {
-        Word *w;
-        for (w = it->next_state->left[*ptr & (STATE_WORD_SIZE - 1)]; w != NULL; w = w->next) {
-            if (ptr + w->len > it->src_end) {
-                continue;
-            }
-            if (w->self->word) {
-                // 単語単位で検索
-                if (ptr > it->ptr && is_word_char(h, ptr[-1])) {
-                    continue;
-                }
-                if (ptr + w->len < it->src_end && is_word_char(h, ptr[w->len])) {
-                    continue;
+    {
+        State *st = it->next_state;
+        const int32_t *root = st->trie;
+        const uint8_t *cmap = st->cmap;
+
+        while (ptr < it->src_end) {
+            // 単語の先頭にならない文字は読み飛ばす
+            if (root[cmap[*ptr & 0xFF]] != 0) {
+                Word *w = match_word(h, st, ptr, it->ptr, it->src_end);
+                if (w != NULL) {
+                    it->state = it->state_next1;
+                    it->state_next1 = w->self;
+                    it->state_next2 = w->right;
+
+                    it->word = it->next_word;
+                    it->next_word = w;
+                    it->next_state = w->right;
+                    goto BREAK;
                 }
             }
-            if (!streq_n(ptr, w->c, w->len, it->next_state->icase)) {
-                continue;
-            }
-            it->state = it->state_next1;
-            it->state_next1 = w->self;
-            it->state_next2 = w->right;
-            
-            it->word = it->next_word;
-            it->next_word = w;
-            it->next_state = w->right;
-            goto BREAK;
+            ptr++;
         }
-        ptr++;
     }
 
     it->state = it->state_next1;
@@ -342,3 +456,240 @@ BREAK:
         goto NEXT;
     }
 }
+/*
+ * 同じ状態が続く部分をまとめて返す
+ * spanの状態はsc->state
+ */
+int hilight_span_next(HilightScan *sc, const char **pbegin, const char **pend)
+{
+    const char *begin = NULL;
+    const char *end = NULL;
+
+    while (hilight_code_next(sc)) {
+        if (begin == NULL) {
+            begin = sc->ptr;
+        }
+        end = sc->end;
+        if (sc->state != sc->state_next1) {
+            break;
+        }
+    }
+    if (begin == NULL) {
+        return FALSE;
+    }
+    *pbegin = begin;
+    *pend = end;
+    return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 一括解析と差分の再解析
+ *
+ * HILIGHT_CHECKPOINT_SPANS個ごとに解析の状態を保存しておき、
+ * 変更された位置より前で、変更箇所を読んでいない状態から解析し直す
+ * 変更箇所より後で、保存した状態と同じ状態になったら、残りは前回の結果をずらして使う
+ */
+
+static int count_chars(const char *p, const char *end)
+{
+    int n = 0;
+    for (; p < end; p++) {
+        if ((*p & 0xC0) != 0x80) {
+            n++;
+        }
+    }
+    return n;
+}
+static void spans_push(HilightSpans *sp, int pos, int cpos, State *state)
+{
+    HilightSpan *s;
+
+    if (sp->n_span >= sp->max_span) {
+        sp->max_span = (sp->max_span > 0 ? sp->max_span * 2 : 256);
+        sp->span = realloc(sp->span, sizeof(HilightSpan) * sp->max_span);
+    }
+    s = &sp->span[sp->n_span++];
+    s->pos = pos;
+    s->cpos = cpos;
+    s->state = state;
+}
+static HilightCheckpoint *spans_push_cp(HilightSpans *sp)
+{
+    if (sp->n_cp >= sp->max_cp) {
+        sp->max_cp = (sp->max_cp > 0 ? sp->max_cp * 2 : 16);
+        sp->cp = realloc(sp->cp, sizeof(HilightCheckpoint) * sp->max_cp);
+    }
+    return &sp->cp[sp->n_cp++];
+}
+static void spans_save_cp(HilightSpans *sp, const HilightScan *sc, const char *src, int cpos)
+{
+    HilightCheckpoint *cp = spans_push_cp(sp);
+
+    cp->span = sp->n_span;
+    cp->cpos = cpos;
+    cp->ptr = sc->ptr - src;
+    cp->end = sc->end - src;
+    // 単語の一致を調べるために先読みした範囲
+    cp->limit = (sp->n_span > 0 ? cp->end + sc->h->max_len + 1 : 0);
+    cp->sc = *sc;
+}
+static int scan_equal(const HilightCheckpoint *cp, const HilightScan *sc)
+{
+    return cp->sc.state == sc->state && cp->sc.state_next1 == sc->state_next1 &&
+        cp->sc.state_next2 == sc->state_next2 && cp->sc.next_state == sc->next_state &&
+        cp->sc.next_word == sc->next_word;
+}
+
+/*
+ * scの位置から解析してspを作る
+ * old_cp != NULLなら、old_edit_end以降で前回と同じ状態になった時点で前回の結果を使う
+ */
+static void spans_scan_sub(HilightSpans *sp, HilightScan *sc, RefStr *src, int cpos,
+        const HilightSpan *old_span, int old_n_span, const HilightCheckpoint *old_cp, int old_n_cp,
+        int old_edit_end, int d, int dc)
+{
+    const char *begin, *end;
+    int j = 0;
+
+    while (hilight_span_next(sc, &begin, &end)) {
+        int pos = end - src->c;
+
+        spans_push(sp, begin - src->c, cpos, sc->state);
+        cpos += count_chars(begin, end);
+        if (sp->n_span % HILIGHT_CHECKPOINT_SPANS == 0) {
+            spans_save_cp(sp, sc, src->c, cpos);
+        }
+
+        if (old_cp != NULL && pos - d >= old_edit_end) {
+            while (j < old_n_cp && old_cp[j].end < pos - d) {
+                j++;
+            }
+            if (j < old_n_cp && old_cp[j].end == pos - d && old_cp[j].span > 0 && scan_equal(&old_cp[j], sc)) {
+                // 前回と同じ状態になったので、残りは位置をずらして使う
+                int first = old_cp[j].span;
+                int shift = sp->n_span - first;
+                int i;
+
+                for (i = first; i < old_n_span; i++) {
+                    spans_push(sp, old_span[i].pos + d, old_span[i].cpos + dc, old_span[i].state);
+                }
+                if (sp->n_cp > 0 && sp->cp[sp->n_cp - 1].end == pos) {
+                    j++;
+                }
+                for (; j < old_n_cp; j++) {
+                    HilightCheckpoint *cp = spans_push_cp(sp);
+                    *cp = old_cp[j];
+                    cp->span += shift;
+                    cp->cpos += dc;
+                    cp->ptr += d;
+                    cp->end += d;
+                    cp->limit += d;
+                }
+                sp->n_char += dc;
+                return;
+            }
+        }
+    }
+    sp->n_char = cpos;
+}
+
+void hilight_spans_scan(HilightSpans *sp, RefStr *src)
+{
+    HilightScan sc;
+    Hilight *h = Value_vp(sp->h_val);
+
+    hilight_scan_init(&sc, h, src->c, src->size);
+    sp->n_span = 0;
+    sp->n_cp = 0;
+    sp->n_char = 0;
+    spans_save_cp(sp, &sc, src->c, 0);
+    spans_scan_sub(sp, &sc, src, 0, NULL, 0, NULL, 0, 0, 0, 0);
+}
+
+/*
+ * srcに変更した結果に更新する
+ * 再解析した最初のspanの番号を返す
+ */
+int hilight_spans_update(HilightSpans *sp, RefStr *src)
+{
+    RefStr *old = Value_vp(sp->src_val);
+    int min_size = (old->size < src->size ? old->size : src->size);
+    int prefix = 0;
+    int suffix = 0;
+    int old_edit_end, new_edit_end;
+    int d, dc;
+    int lo, hi, k;
+    HilightSpan *old_span = sp->span;
+    HilightCheckpoint *old_cp = sp->cp;
+    int old_n_span = sp->n_span;
+    int old_n_cp = sp->n_cp;
+    const HilightCheckpoint *cp;
+    HilightScan sc;
+
+    // 先頭と末尾の一致する部分 (文字の境界に合わせる)
+    while (prefix + 64 <= min_size && memcmp(old->c + prefix, src->c + prefix, 64) == 0) {
+        prefix += 64;
+    }
+    while (prefix < min_size && old->c[prefix] == src->c[prefix]) {
+        prefix++;
+    }
+    if (prefix == old->size && prefix == src->size) {
+        return sp->n_span;
+    }
+    while (prefix > 0 && ((old->c[prefix] & 0xC0) == 0x80 || (src->c[prefix] & 0xC0) == 0x80)) {
+        prefix--;
+    }
+    while (suffix + 64 <= min_size - prefix && memcmp(old->c + old->size - suffix - 64, src->c + src->size - suffix - 64, 64) == 0) {
+        suffix += 64;
+    }
+    while (suffix < min_size - prefix && old->c[old->size - 1 - suffix] == src->c[src->size - 1 - suffix]) {
+        suffix++;
+    }
+    while (suffix > 0 && (old->c[old->size - suffix] & 0xC0) == 0x80) {
+        suffix--;
+    }
+    old_edit_end = old->size - suffix;
+    new_edit_end = src->size - suffix;
+    d = src->size - old->size;
+    dc = count_chars(src->c + prefix, src->c + new_edit_end) - count_chars(old->c + prefix, old->c + old_edit_end);
+
+    // 変更箇所を読まずに得られた最後の状態 (cp[0]は先頭なので必ずある)
+    lo = 0;
+    hi = old_n_cp;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (old_cp[mid].limit <= prefix) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    k = lo;
+    cp = &old_cp[k];
+
+    sc = cp->sc;
+    sc.src_end = src->c + src->size;
+    sc.ptr = src->c + cp->ptr;
+    sc.end = src->c + cp->end;
+
+    sp->span = malloc(sizeof(HilightSpan) * (old_n_span > 16 ? old_n_span : 16));
+    sp->max_span = (old_n_span > 16 ? old_n_span : 16);
+    sp->n_span = cp->span;
+    memcpy(sp->span, old_span, sizeof(HilightSpan) * cp->span);
+    sp->cp = malloc(sizeof(HilightCheckpoint) * old_n_cp);
+    sp->max_cp = old_n_cp;
+    sp->n_cp = k + 1;
+    memcpy(sp->cp, old_cp, sizeof(HilightCheckpoint) * (k + 1));
+    spans_scan_sub(sp, &sc, src, cp->cpos, old_span, old_n_span, old_cp + k + 1, old_n_cp - k - 1, old_edit_end, d, dc);
+
+    k = old_cp[k].span;
+    free(old_span);
+    free(old_cp);
+
+    fs->unref(sp->src_val);
+    sp->src_val = fs->Value_cp(vp_Value(src));
+
+    return k;
+}
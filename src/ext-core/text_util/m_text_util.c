@@ -6,23 +6,45 @@
 #include <stdlib.h>
 
 
-typedef struct MapRepl {
-    struct MapRepl *next;
+typedef struct {
     Str key;
     Str val;
 } MapRepl;
 
+/*
+ * Aho-Corasickオートマトン
+ * node[0]がroot
+ */
+typedef struct {
+    int32_t fail;   // 失敗時の遷移先
+    int32_t out;    // failを辿って最初に見つかる終端ノード (なければ0)
+    int32_t edge;   // edge[]の開始位置
+    int32_t n_edge;
+    int32_t depth;
+    int32_t key;    // 終端ならrepl[]の番号、それ以外は-1
+} ACNode;
+
+typedef struct {
+    int32_t next;
+    uint8_t c;
+} ACEdge;
+
 typedef struct {
     RefHeader rh;
 
     Mem mem;
-    MapRepl *map[256];
-} RefMapReplace;
+    MapRepl *repl;
+    int n_repl;
 
+    ACNode *node;
+    ACEdge *edge;
+    int32_t root_next[256];
+} RefMapReplace;
 
 static RefNode *cls_replacer;
 static RefNode *cls_hilighter;
 static RefNode *cls_hilight_iter;
+static RefNode *cls_hilight_spans;
 static RefNode *cls_elem;
 static RefNode *cls_text;
 
@@ -59,7 +81,17 @@ static char *init_mem_and_read_file(const char *path, Mem *mem)
 
     return buf;
 }
-static void read_replacer_sub(RefMapReplace *rp, char *src)
+static void map_repl_add(MapRepl **list, int *n, int *max, Str key, Str val)
+{
+    if (*n >= *max) {
+        *max = (*max == 0 ? 64 : *max * 2);
+        *list = realloc(*list, sizeof(MapRepl) * *max);
+    }
+    (*list)[*n].key = key;
+    (*list)[*n].val = val;
+    (*n)++;
+}
+static void read_replacer_sub(MapRepl **list, int *n, int *max, char *src)
 {
     while (*src != '\0') {
         const char *top = src;
@@ -80,22 +112,7 @@ static void read_replacer_sub(RefMapReplace *rp, char *src)
             val.size = src - val.p;
 
             if (key.size > 0) {
-                MapRepl **pp = &rp->map[key.p[0] & 0xFF];
-                MapRepl *p = /* *pp;
-
-                // keyが長い順に並べる
-                while (p != NULL) {
-                    if (p->key.size <= key.size) {
-                        break;
-                    }
-                    pp = &p->next;
-                    p = *pp;
-                }
-                p =*/ fs->Mem_get(&rp->mem, sizeof(MapRepl));
-                p->next = *pp;
-                p->key = key;
-                p->val = val;
-                *pp = p;
+                map_repl_add(list, n, max, key, val);
             }
         } else {
         }
@@ -105,16 +122,240 @@ static void read_replacer_sub(RefMapReplace *rp, char *src)
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int32_t child;     // 最初の子 (バイト順)
+    int32_t sibling;
+    int32_t depth;
+    int32_t key;
+    uint8_t c;
+} TrieNode;
+
+static int ac_goto(const RefMapReplace *rp, int s, int c)
+{
+    if (s == 0) {
+        return rp->root_next[c];
+    } else {
+        const ACEdge *e = rp->edge + rp->node[s].edge;
+        int lo = 0;
+        int hi = rp->node[s].n_edge;
+
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (e[mid].c < c) {
+                lo = mid + 1;
+            } else if (e[mid].c > c) {
+                hi = mid;
+            } else {
+                return e[mid].next;
+            }
+        }
+        return 0;
+    }
+}
+static int ac_next(const RefMapReplace *rp, int s, int c)
+{
+    for (;;) {
+        int t = ac_goto(rp, s, c);
+        if (t > 0) {
+            return t;
+        }
+        if (s == 0) {
+            return 0;
+        }
+        s = rp->node[s].fail;
+    }
+}
+/*
+ * キーからトライを作り、失敗遷移を付けてオートマトンにする
+ * 同じキーが複数ある場合は後のものを使う
+ */
+static void ac_build(RefMapReplace *rp)
+{
+    int n_node = 1;
+    int max_node = 64;
+    TrieNode *tn = malloc(sizeof(TrieNode) * max_node);
+    int32_t *queue;
+    int n_edge = 0;
+    int head, tail;
+    int i, j;
+
+    tn[0].child = -1;
+    tn[0].sibling = -1;
+    tn[0].depth = 0;
+    tn[0].key = -1;
+    tn[0].c = 0;
+
+    for (i = 0; i < rp->n_repl; i++) {
+        Str key = rp->repl[i].key;
+        int s = 0;
+
+        for (j = 0; j < key.size; j++) {
+            int c = key.p[j] & 0xFF;
+            int prev = -1;
+            int cur = tn[s].child;
+
+            // 兄弟はバイト順に並べる
+            while (cur >= 0 && tn[cur].c < c) {
+                prev = cur;
+                cur = tn[cur].sibling;
+            }
+            if (cur < 0 || tn[cur].c != c) {
+                if (n_node >= max_node) {
+                    max_node *= 2;
+                    tn = realloc(tn, sizeof(TrieNode) * max_node);
+                }
+                tn[n_node].child = -1;
+                tn[n_node].sibling = cur;
+                tn[n_node].depth = j + 1;
+                tn[n_node].key = -1;
+                tn[n_node].c = c;
+                if (prev < 0) {
+                    tn[s].child = n_node;
+                } else {
+                    tn[prev].sibling = n_node;
+                }
+                cur = n_node;
+                n_node++;
+                n_edge++;
+            }
+            s = cur;
+        }
+        tn[s].key = i;
+    }
+
+    rp->node = malloc(sizeof(ACNode) * n_node);
+    rp->edge = malloc(sizeof(ACEdge) * (n_edge + 1));
+    queue = malloc(sizeof(int32_t) * n_node);
+    n_edge = 0;
+
+    // 幅優先で辺を並べ、失敗遷移を求める
+    memset(rp->root_next, 0, sizeof(rp->root_next));
+    for (i = tn[0].child; i >= 0; i = tn[i].sibling) {
+        rp->root_next[tn[i].c] = i;
+    }
+    rp->node[0].fail = 0;
+    rp->node[0].out = 0;
+    rp->node[0].depth = 0;
+    rp->node[0].key = -1;
+    rp->node[0].edge = 0;
+    rp->node[0].n_edge = 0;
+
+    head = 0;
+    tail = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int u = queue[head++];
+        ACNode *nu = &rp->node[u];
+
+        if (u != 0) {
+            nu->edge = n_edge;
+            nu->n_edge = 0;
+            for (i = tn[u].child; i >= 0; i = tn[i].sibling) {
+                rp->edge[n_edge].c = tn[i].c;
+                rp->edge[n_edge].next = i;
+                n_edge++;
+                nu->n_edge++;
+            }
+        }
+        for (i = tn[u].child; i >= 0; i = tn[i].sibling) {
+            ACNode *nv = &rp->node[i];
+
+            nv->depth = tn[i].depth;
+            nv->key = tn[i].key;
+            if (u == 0) {
+                nv->fail = 0;
+            } else {
+                nv->fail = ac_next(rp, nu->fail, tn[i].c);
+            }
+            if (rp->node[nv->fail].key >= 0) {
+                nv->out = nv->fail;
+            } else {
+                nv->out = rp->node[nv->fail].out;
+            }
+            queue[tail++] = i;
+        }
+    }
+
+    free(queue);
+    free(tn);
+}
+static void ac_close(RefMapReplace *rp)
+{
+    free(rp->node);
+    free(rp->edge);
+    free(rp->repl);
+    rp->node = NULL;
+    rp->edge = NULL;
+    rp->repl = NULL;
+}
+
+/*
+ * 最も左から始まり、その中で最長のキーを探す
+ * 見つかった場合はrepl[]の番号を返す
+ */
+static int ac_find_leftmost_longest(const RefMapReplace *rp, const char *p, int size, int *pbegin, int *pend)
+{
+    int best = -1;
+    int best_begin = 0;
+    int best_end = 0;
+    int s = 0;
+    int i = 0;
+
+    while (i < size) {
+        int m;
+
+        s = ac_next(rp, s, p[i] & 0xFF);
+        i++;
+        m = (rp->node[s].key >= 0 ? s : rp->node[s].out);
+        if (m > 0) {
+            int begin = i - rp->node[m].depth;
+            if (best < 0 || begin <= best_begin) {
+                best = m;
+                best_begin = begin;
+                best_end = i;
+            }
+        }
+        // これより前から始まる一致はもう現れない
+        if (best >= 0 && best_begin < i - rp->node[s].depth) {
+            break;
+        }
+    }
+    if (best < 0) {
+        return -1;
+    }
+    *pbegin = best_begin;
+    *pend = best_end;
+    return rp->node[best].key;
+}
+
+static int utf8_count(const char *p, const char *end)
+{
+    int n = 0;
+    for (; p < end; p++) {
+        if ((*p & 0xC0) != 0x80) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
 static int replacer_new(Value *vret, Value *v, RefNode *node)
 {
     const RefNode *v1_type = fs->Value_type(v[1]);
+    MapRepl *list = NULL;
+    int n = 0;
+    int max = 0;
+    RefMapReplace *rp;
 
     if (v1_type == fs->cls_str) {
         // ファイルから読む
         RefStr *path = Value_vp(v[1]);
         char *path_p = fs->resource_to_path(Str_new(path->c, path->size), ".txt");
         char *data;
-        RefMapReplace *rp;
 
         if (path_p == NULL) {
             return FALSE;
@@ -126,12 +367,12 @@ static int replacer_new(Value *vret, Value *v, RefNode *node)
         if (data == NULL) {
             return FALSE;
         }
-        read_replacer_sub(rp, data);
+        read_replacer_sub(&list, &n, &max, data);
     } else if (v1_type == fs->cls_map) {
-        // 引数のMapをそのまま使う
+        // 引数のMapをコピーする
         int i;
         RefMap *rm = Value_vp(v[1]);
-        RefMapReplace *rp = fs->buf_new(cls_replacer, sizeof(RefMapReplace));
+        rp = fs->buf_new(cls_replacer, sizeof(RefMapReplace));
         *vret = vp_Value(rp);
 
         fs->Mem_init(&rp->mem, 1024);
@@ -143,29 +384,16 @@ static int replacer_new(Value *vret, Value *v, RefNode *node)
                 // キー・値がStrまたはBytesでなければエラー
                 if (fs->Value_type(et->key) != fs->cls_str || fs->Value_type(et->val) != fs->cls_str) {
                     fs->throw_errorf(fs->mod_lang, "TypeError", "{\"key\":\"value\", ...} required");
-                    return TRUE;
+                    free(list);
+                    return FALSE;
                 }
 
-                // 検索用のデータ構造
                 key = Value_vp(et->key);
                 val = Value_vp(et->val);
                 if (key->size > 0) {
-                    MapRepl **pp = &rp->map[key->c[0] & 0xFF];
-                    MapRepl *p = *pp;
-
-                    // keyが長い順に並べる
-                    while (p != NULL) {
-                        if (p->key.size <= key->size) {
-                            break;
-                        }
-                        pp = &p->next;
-                        p = *pp;
-                    }
-                    p = fs->Mem_get(&rp->mem, sizeof(MapRepl));
-                    p->next = *pp;
-                    p->key = Str_new(key->c, key->size);
-                    p->val = Str_new(val->c, val->size);
-                    *pp = p;
+                    Str k = Str_new(fs->str_dup_p(key->c, key->size, &rp->mem), key->size);
+                    Str vl = Str_new(fs->str_dup_p(val->c, val->size, &rp->mem), val->size);
+                    map_repl_add(&list, &n, &max, k, vl);
                 }
             }
         }
@@ -174,11 +402,17 @@ static int replacer_new(Value *vret, Value *v, RefNode *node)
         return FALSE;
     }
 
+    // 検索用のデータ構造
+    rp->repl = list;
+    rp->n_repl = n;
+    ac_build(rp);
+
     return TRUE;
 }
 static int replacer_close(Value *vret, Value *v, RefNode *node)
 {
     RefMapReplace *rp = Value_vp(*v);
+    ac_close(rp);
     fs->Mem_close(&rp->mem);
     return TRUE;
 }
@@ -192,33 +426,84 @@ static int replacer_replace(Value *vret, Value *v, RefNode *node)
     fs->StrBuf_init_refstr(&buf, src->size);
 
     while (i < src->size) {
-        int c = src->c[i] & 0xFF;
-        MapRepl *p;
-        int last = src->size - i;
-        int ret;
-        for (p = rp->map[c]; p != NULL; p = p->next) {
-            // 残りの文字列長とkeyの長さを比較
-            if (last >= p->key.size) {
-                if (memcmp(src->c + i, p->key.p, p->key.size) == 0) {
-                    break;
-                }
-            }
+        int begin, end;
+        int k = ac_find_leftmost_longest(rp, src->c + i, src->size - i, &begin, &end);
+
+        if (k < 0) {
+            break;
         }
-        if (p != NULL) {
-            ret = fs->StrBuf_add(&buf, p->val.p, p->val.size);
-            i += p->key.size;
-        } else {
-            ret = fs->StrBuf_add_c(&buf, c);
-            i++;
+        if (!fs->StrBuf_add(&buf, src->c + i, begin)) {
+            return FALSE;
         }
-        if (!ret) {
+        if (!fs->StrBuf_add(&buf, rp->repl[k].val.p, rp->repl[k].val.size)) {
             return FALSE;
         }
+        i += end;
+    }
+    if (!fs->StrBuf_add(&buf, src->c + i, src->size - i)) {
+        return FALSE;
     }
     *vret = fs->StrBuf_str_Value(&buf, fs->cls_str);
 
     return TRUE;
 }
+static void find_all_push(RefArray *ra, int idx, Str key)
+{
+    RefArray *r1 = fs->refarray_new(2);
+    r1->p[0] = int32_Value(idx);
+    r1->p[1] = fs->cstr_Value(fs->cls_str, key.p, key.size);
+    *fs->refarray_push(ra) = vp_Value(r1);
+}
+/*
+ * キーが現れる位置(文字単位)とキーの組を返す
+ * [[index, key], ...]
+ * overlapped=falseの場合は、replaceで置換される部分のみ
+ * overlapped=trueの場合は、重なり合うものも含めて終了位置の順
+ */
+static int replacer_find_all(Value *vret, Value *v, RefNode *node)
+{
+    RefMapReplace *rp = Value_vp(*v);
+    RefStr *src = Value_vp(v[1]);
+    int overlapped = (fg->stk_top > v + 2 && Value_bool(v[2]));
+    RefArray *ra = fs->refarray_new(0);
+    int n_char = 0;
+    int i = 0;
+
+    *vret = vp_Value(ra);
+
+    if (overlapped) {
+        int s = 0;
+        for (i = 0; i < src->size; i++) {
+            int m;
+
+            if ((src->c[i] & 0xC0) != 0x80) {
+                n_char++;
+            }
+            s = ac_next(rp, s, src->c[i] & 0xFF);
+            for (m = (rp->node[s].key >= 0 ? s : rp->node[s].out); m > 0; m = rp->node[m].out) {
+                Str key = rp->repl[rp->node[m].key].key;
+                // 終了位置から開始位置を求める
+                int idx = n_char - utf8_count(key.p, key.p + key.size);
+                find_all_push(ra, idx, key);
+            }
+        }
+    } else {
+        while (i < src->size) {
+            int begin, end;
+            int k = ac_find_leftmost_longest(rp, src->c + i, src->size - i, &begin, &end);
+
+            if (k < 0) {
+                break;
+            }
+            n_char += utf8_count(src->c + i, src->c + i + begin);
+            find_all_push(ra, n_char, rp->repl[k].key);
+            n_char += utf8_count(src->c + i + begin, src->c + i + end);
+            i += end;
+        }
+    }
+
+    return TRUE;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -278,23 +563,26 @@ static int hilighter_parse(Value *vret, Value *v, RefNode *node)
 
     it->h_val = fs->Value_cp(v[0]);
     it->src_val = fs->Value_cp(v[1]);
-    it->h = h;
-    it->src_end = src->c + src->size;
-    it->ptr = src->c;
-    it->end = src->c;
-    it->word = NULL;
-    it->next_word = NULL;
-    it->state = fs->Hash_get(&h->state, "_", 1);
-    it->next_state = it->state;
-    it->state_next1 = it->state;
-    it->state_next2 = it->state;
+    hilight_scan_init(&it->sc, h, src->c, src->size);
 
     *vret = vp_Value(it);
     return TRUE;
 }
+static int hilighter_spans(Value *vret, Value *v, RefNode *node)
+{
+    HilightSpans *sp = fs->buf_new(cls_hilight_spans, sizeof(HilightSpans));
+    *vret = vp_Value(sp);
+
+    sp->h_val = fs->Value_cp(v[0]);
+    sp->src_val = fs->Value_cp(v[1]);
+    hilight_spans_scan(sp, Value_vp(v[1]));
+
+    return TRUE;
+}
 static int hilighter_close(Value *vret, Value *v, RefNode *node)
 {
     Hilight *h = Value_vp(v[0]);
+    fs->unref(h->mimetype);
     fs->Mem_close(&h->mem);
     return TRUE;
 }
@@ -323,27 +611,16 @@ static Ref *xmlspan_new(RefStr *klass, const char *src, int src_len)
 static int hilight_iter_next(Value *vret, Value *v, RefNode *node)
 {
     HilightIter *it = Value_vp(v[0]);
-    const char *begin = NULL;
-    const char *end = NULL;
+    const char *begin, *end;
 
     // 同じ色をまとめる
-    while (hilight_code_next(it)) {
-        if (begin == NULL) {
-            begin = it->ptr;
-        }
-        end = it->end;
-        if (it->state != it->state_next1) {
-            break;
-        }
-    }
-
-    if (begin == NULL) {
+    if (!hilight_span_next(&it->sc, &begin, &end)) {
         fs->throw_stopiter();
         return FALSE;
     }
 
-    if (it->state->name != str__) {
-        Ref *r = xmlspan_new(it->state->name, begin, (int)(end - begin));
+    if (it->sc.state->name != str__) {
+        Ref *r = xmlspan_new(it->sc.state->name, begin, (int)(end - begin));
         *vret = vp_Value(r);
     } else {
         *vret = fs->cstr_Value(cls_text, begin, (int)(end - begin));
@@ -358,6 +635,64 @@ static int hilight_iter_close(Value *vret, Value *v, RefNode *node)
     return TRUE;
 }
 
+static int hilight_spans_close(Value *vret, Value *v, RefNode *node)
+{
+    HilightSpans *sp = Value_vp(v[0]);
+    free(sp->span);
+    free(sp->cp);
+    fs->unref(sp->src_val);
+    fs->unref(sp->h_val);
+    return TRUE;
+}
+static int hilight_spans_size(Value *vret, Value *v, RefNode *node)
+{
+    HilightSpans *sp = Value_vp(v[0]);
+    *vret = int32_Value(sp->n_span);
+    return TRUE;
+}
+/*
+ * 0: 開始位置 (文字)
+ * 1: 長さ (文字)
+ * 2: 状態名
+ */
+static int hilight_spans_get(Value *vret, Value *v, RefNode *node)
+{
+    HilightSpans *sp = Value_vp(v[0]);
+    int type = FUNC_INT(node);
+    RefArray *ra = fs->refarray_new(sp->n_span);
+    int i;
+
+    *vret = vp_Value(ra);
+    for (i = 0; i < sp->n_span; i++) {
+        const HilightSpan *s = &sp->span[i];
+        switch (type) {
+        case 0:
+            ra->p[i] = int32_Value(s->cpos);
+            break;
+        case 1: {
+            int next = (i + 1 < sp->n_span ? s[1].cpos : sp->n_char);
+            ra->p[i] = int32_Value(next - s->cpos);
+            break;
+        }
+        case 2:
+            ra->p[i] = fs->Value_cp(vp_Value(s->state->name));
+            break;
+        }
+    }
+    return TRUE;
+}
+/*
+ * 変更後の文字列を渡して、変更された部分以降を解析し直す
+ * 再解析した最初のspanの番号を返す
+ */
+static int hilight_spans_update_src(Value *vret, Value *v, RefNode *node)
+{
+    HilightSpans *sp = Value_vp(v[0]);
+    int first = hilight_spans_update(sp, Value_vp(v[1]));
+    *vret = int32_Value(first);
+    return TRUE;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void define_class(RefNode *m)
@@ -368,6 +703,7 @@ static void define_class(RefNode *m)
     cls_replacer = fs->define_identifier(m, m, "Replacer", NODE_CLASS, 0);
     cls_hilighter = fs->define_identifier(m, m, "Hilighter", NODE_CLASS, 0);
     cls_hilight_iter = fs->define_identifier(m, m, "HilightIter", NODE_CLASS, 0);
+    cls_hilight_spans = fs->define_identifier(m, m, "HilightSpans", NODE_CLASS, 0);
 
 
     cls = cls_replacer;
@@ -378,6 +714,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, replacer_close, 0, 0, NULL);
     n = fs->define_identifier(m, cls, "replace", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, replacer_replace, 1, 1, NULL, fs->cls_str);
+    n = fs->define_identifier(m, cls, "find_all", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, replacer_find_all, 1, 2, NULL, fs->cls_str, fs->cls_bool);
     fs->extends_method(cls, fs->cls_obj);
 
 
@@ -391,6 +729,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, hilighter_get_mime, 0, 0, NULL);
     n = fs->define_identifier(m, cls, "parse", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, hilighter_parse, 1, 1, NULL, fs->cls_str);
+    n = fs->define_identifier(m, cls, "spans", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, hilighter_spans, 1, 1, NULL, fs->cls_str);
     fs->extends_method(cls, fs->cls_obj);
 
     cls = cls_hilight_iter;
@@ -399,6 +739,21 @@ static void define_class(RefNode *m)
     n = fs->define_identifier(m, cls, "next", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, hilight_iter_next, 0, 0, NULL);
     fs->extends_method(cls, fs->cls_iterator);
+
+    cls = cls_hilight_spans;
+    n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, hilight_spans_close, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, hilight_spans_size, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "starts", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, hilight_spans_get, 0, 0, (void*) 0);
+    n = fs->define_identifier(m, cls, "lengths", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, hilight_spans_get, 0, 0, (void*) 1);
+    n = fs->define_identifier(m, cls, "states", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, hilight_spans_get, 0, 0, (void*) 2);
+    n = fs->define_identifier(m, cls, "update", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, hilight_spans_update_src, 1, 1, NULL, fs->cls_str);
+    fs->extends_method(cls, fs->cls_obj);
 }
 
 void define_module(RefNode *m, const FoxStatic *a_fs, FoxGlobal *a_fg)
@@ -10,12 +10,15 @@ typedef struct State State;
 
 enum {
     STATE_WORD_SIZE = 32,
+    HILIGHT_CHECKPOINT_SPANS = 256,
 };
 
 struct Word {
     Word *next;
+    Word *match_next;   // 同じ位置で終わる単語 (優先順位順)
     State *self;
     State *right;
+    int32_t seq;        // 後から追加したほうが優先
     int32_t len;
     char c[0];
 };
@@ -25,6 +28,12 @@ struct State {
     RefStr *name;
     int8_t word;
     int8_t icase;
+
+    // 単語の木 (読み込み後に作成)
+    int32_t n_class;
+    uint8_t cmap[256];      // バイト -> 文字クラス (0は単語に含まれない文字)
+    int32_t *trie;          // [ノード * n_class + 文字クラス] -> 次のノード (0はなし)
+    Word **trie_match;      // [ノード] -> そこで終わる単語
 };
 
 typedef struct {
@@ -35,14 +44,11 @@ typedef struct {
 
     Hash state; // Hash<State>
     uint8_t word_char[128 / 8];
+    int32_t n_word;
+    int32_t max_len;
 } Hilight;
 
 typedef struct {
-    RefHeader rh;
-
-    Value src_val;
-    Value h_val;
-
     Hilight *h;
     const char *src_end;
     const char *ptr;
@@ -55,8 +61,47 @@ typedef struct {
 
     Word *word;
     Word *next_word;
+} HilightScan;
+
+typedef struct {
+    RefHeader rh;
+
+    Value src_val;
+    Value h_val;
+
+    HilightScan sc;
 } HilightIter;
 
+typedef struct {
+    int32_t pos;        // 開始位置 (バイト)
+    int32_t cpos;       // 開始位置 (文字)
+    State *state;
+} HilightSpan;
+
+typedef struct {
+    int32_t span;       // 次のspanの番号
+    int32_t cpos;       // 次のspanの開始位置 (文字)
+    int32_t limit;      // この状態になるまでに読んだ範囲 (バイト)
+    int32_t ptr;
+    int32_t end;
+    HilightScan sc;     // ptr, endは無効
+} HilightCheckpoint;
+
+typedef struct {
+    RefHeader rh;
+
+    Value src_val;
+    Value h_val;
+
+    HilightSpan *span;
+    int32_t n_char;
+    int32_t n_span;
+    int32_t max_span;
+    HilightCheckpoint *cp;
+    int32_t n_cp;
+    int32_t max_cp;
+} HilightSpans;
+
 
 
 #ifdef DEFINE_GLOBALS
@@ -73,7 +118,11 @@ extern RefNode *mod_util;
 #endif
 
 int load_hilight(Hilight *h, RefStr *type);
-int hilight_code_next(HilightIter *it);
+void hilight_scan_init(HilightScan *sc, Hilight *h, const char *src, int size);
+int hilight_code_next(HilightScan *sc);
+int hilight_span_next(HilightScan *sc, const char **pbegin, const char **pend);
+void hilight_spans_scan(HilightSpans *sp, RefStr *src);
+int hilight_spans_update(HilightSpans *sp, RefStr *src);
 
 
 #endif /* M_TEXT_UTIL_H_INCLUDED */
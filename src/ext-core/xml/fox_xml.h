@@ -46,6 +46,24 @@ enum {
     INDEX_DOCUMENT_NUM,
 };
 
+enum {
+    XML_NAME_CACHE_SIZE = 256,
+    XML_ATTR_INLINE_MAX = 8,    // これを超えたら属性をMapで保持する
+};
+enum {
+    XEV_SKIP,
+    XEV_START,
+    XEV_END,
+    XEV_TEXT,
+    XEV_COMMENT,
+};
+enum {
+    INDEX_XMLREADER_STREAM,
+    INDEX_XMLREADER_STATE,
+    INDEX_XMLREADER_ATTR,   // 属性のMap (attrsを参照した時に生成)
+    INDEX_XMLREADER_NUM,
+};
+
 typedef struct {
     int type;
     Str val;
@@ -56,6 +74,23 @@ typedef struct {
     int loose;
 } XMLTok;
 
+// XMLReaderが返す1つのイベント
+typedef struct {
+    int type;
+    int empty;      // <tag />
+    Str val;        // タグ名、テキスト、コメント
+    Str *attr;      // 属性名と値を交互に格納
+    int attr_num;
+    int attr_max;
+} XMLEvent;
+
+// 要素の属性を順に取り出す
+typedef struct {
+    Value v;
+    int i;
+    HashValueEntry *he;
+} XMLAttrIter;
+
 
 #ifdef DEFINE_GLOBALS
 #define extern
@@ -73,6 +108,10 @@ extern RefNode *cls_elem;
 extern RefNode *cls_decl;
 extern RefNode *cls_text;
 extern RefNode *cls_comment;
+extern RefNode *cls_xmlreader;
+extern RefNode *cls_xmlindex;
+
+extern int xml_modify_count;    // 要素を変更するたびに増やす
 
 #ifdef DEFINE_GLOBALS
 #undef extern
@@ -91,9 +130,34 @@ int parse_html_body(Value *html, RefArray *ra, XMLTok *tk);
 int parse_xml_begin(Ref *r, XMLTok *tk);
 int parse_xml_body(Value *v, XMLTok *tk);
 int parse_doctype_declaration(Ref *r, XMLTok *tk);
+Value xml_name_Value(const char *p, int size);
+void xml_elem_init(Value *v, RefArray **p_ra, Value **p_vm, const char *name_p, int name_size);
+Value *xml_attr_get(Value v_attr, const char *key_p, int key_size);
+int xml_attr_count(Value v_attr);
+int xml_attr_next(XMLAttrIter *it, Value *key, Value *val);
+RefMap *xml_attr_to_map(Value *v_attr);
+void xml_attr_set(Value *v_attr, Value key, Value val);
+void xml_attr_del(Value *val, Value *v_attr, Value key);
+int xml_elem_add_attr(Value *v, Str skey, Str sval, int loose);
+int parse_xml_event(XMLEvent *ev, XMLTok *tk, Str raw_tag);
+
+// xml_reader.c
+int xmlreader_new(Value *vret, Value *v, RefNode *node);
+int xmlreader_close(Value *vret, Value *v, RefNode *node);
+int xmlreader_next(Value *vret, Value *v, RefNode *node);
+int xmlreader_expand(Value *vret, Value *v, RefNode *node);
+int xmlreader_event(Value *vret, Value *v, RefNode *node);
+int xmlreader_name(Value *vret, Value *v, RefNode *node);
+int xmlreader_text(Value *vret, Value *v, RefNode *node);
+int xmlreader_depth(Value *vret, Value *v, RefNode *node);
+int xmlreader_line(Value *vret, Value *v, RefNode *node);
+int xmlreader_attr(Value *vret, Value *v, RefNode *node);
+int xmlreader_attrs(Value *vret, Value *v, RefNode *node);
 
 // xml_select.c
 int select_css(Value *vret, Value *v, int num, Str sel);
+int select_css_many(Value *vret, Value *v, int num, RefArray *sels);
+int xmlindex_dispose(Value *vret, Value *v, RefNode *node);
 int delete_css(Value *vret, Value *v, int num, Str sel);
 int delete_nodelist(Value *vret, Value *v, int num, RefArray *ra);
 
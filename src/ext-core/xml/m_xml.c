@@ -697,8 +697,9 @@ static int node_tostr_xml(StrBuf *buf, Value dst, Value v, XMLOutputFormat *xof,
     } else {
         Ref *r = Value_ref(v);
         RefArray *ra = Value_vp(r->v[INDEX_ELEM_CHILDREN]);
-        RefMap *rm = Value_vp(r->v[INDEX_ELEM_ATTR]);
         RefStr *tag_name = Value_vp(r->v[INDEX_ELEM_NAME]);
+        XMLAttrIter it = {r->v[INDEX_ELEM_ATTR], 0, NULL};
+        Value v_key, v_val;
         int i;
 
         if (xof->ascii && !Str_isascii(tag_name->c, tag_name->size)) {
@@ -710,29 +711,24 @@ static int node_tostr_xml(StrBuf *buf, Value dst, Value v, XMLOutputFormat *xof,
             return FALSE;
         }
 
-        if (rm != NULL) {
-            for (i = 0; i < rm->entry_num; i++) {
-                HashValueEntry *h = rm->entry[i];
-                for (; h != NULL; h = h->next) {
-                    Str key = Value_str(h->key);
-                    if (xof->html && html_attr_no_value(key)) {
-                        if (!fs->StrBuf_add_c(buf, ' ') ||
-                            !fs->StrBuf_add(buf, key.p, key.size)) {
-                            return FALSE;
-                        }
-                    } else {
-                        if (!fs->StrBuf_add_c(buf, ' ') ||
-                            !fs->StrBuf_add(buf, key.p, key.size) ||
-                            !fs->StrBuf_add(buf, "=\"", 2)) {
-                            return FALSE;
-                        }
-                        if (!text_convert_html(buf, Value_str(h->val), TRUE, xof)) {
-                            return FALSE;
-                        }
-                        if (!fs->StrBuf_add_c(buf, '"')) {
-                            return FALSE;
-                        }
-                    }
+        while (xml_attr_next(&it, &v_key, &v_val)) {
+            Str key = Value_str(v_key);
+            if (xof->html && html_attr_no_value(key)) {
+                if (!fs->StrBuf_add_c(buf, ' ') ||
+                    !fs->StrBuf_add(buf, key.p, key.size)) {
+                    return FALSE;
+                }
+            } else {
+                if (!fs->StrBuf_add_c(buf, ' ') ||
+                    !fs->StrBuf_add(buf, key.p, key.size) ||
+                    !fs->StrBuf_add(buf, "=\"", 2)) {
+                    return FALSE;
+                }
+                if (!text_convert_html(buf, Value_str(v_val), TRUE, xof)) {
+                    return FALSE;
+                }
+                if (!fs->StrBuf_add_c(buf, '"')) {
+                    return FALSE;
                 }
             }
         }
@@ -1274,21 +1270,20 @@ static int xml_elem_set_index_key(Value *vret, Value *v, RefNode *node)
     return TRUE;
 }
 
-static int xml_attr_eq_sub(RefMap *r1, RefMap *r2)
+static int xml_attr_eq_sub(Value v1, Value v2)
 {
-    int i;
-    for (i = 0; i < r1->entry_num; i++) {
-        HashValueEntry *ve1 = r1->entry[i];
-        for (; ve1 != NULL; ve1 = ve1->next) {
-            HashValueEntry *ve2 = NULL;
-            fs->refmap_get(&ve2, r2, ve1->key);
+    XMLAttrIter it = {v1, 0, NULL};
+    Value key, val;
 
-            if (ve2 == NULL) {
-                return FALSE;
-            }
-            if (!refstr_eq(Value_vp(ve1->val), Value_vp(ve2->val))) {
-                return FALSE;
-            }
+    while (xml_attr_next(&it, &key, &val)) {
+        RefStr *rs_key = Value_vp(key);
+        Value *vp2 = xml_attr_get(v2, rs_key->c, rs_key->size);
+
+        if (vp2 == NULL) {
+            return FALSE;
+        }
+        if (!refstr_eq(Value_vp(val), Value_vp(*vp2))) {
+            return FALSE;
         }
     }
     return TRUE;
@@ -1314,30 +1309,18 @@ static int xml_node_eq_sub(Value *v1, int v1_size, Value *v2, int v2_size)
             Ref *r1 = Value_vp(v1[i]);
             Ref *r2 = Value_vp(v2[i]);
             if (r1 != r2) {
-                RefMap *rm1 = Value_vp(r1->v[INDEX_ELEM_ATTR]);
-                RefMap *rm2 = Value_vp(r2->v[INDEX_ELEM_ATTR]);
                 RefArray *ra1 = Value_vp(r1->v[INDEX_ELEM_CHILDREN]);
                 RefArray *ra2 = Value_vp(r2->v[INDEX_ELEM_CHILDREN]);
-                int rm1_count, rm2_count;
+                int attr_count = xml_attr_count(r1->v[INDEX_ELEM_ATTR]);
 
                 if (!refstr_eq(Value_vp(r1->v[INDEX_ELEM_NAME]), Value_vp(r2->v[INDEX_ELEM_NAME]))) {
                     return FALSE;
                 }
-                if (rm1 != NULL) {
-                    rm1_count = rm1->count;
-                } else {
-                    rm1_count = 0;
-                }
-                if (rm2 != NULL) {
-                    rm2_count = rm2->count;
-                } else {
-                    rm2_count = 0;
-                }
-                if (rm1_count != rm2_count) {
+                if (attr_count != xml_attr_count(r2->v[INDEX_ELEM_ATTR])) {
                     return FALSE;
                 }
-                if (rm1_count > 0) {
-                    if (!xml_attr_eq_sub(rm1, rm2)) {
+                if (attr_count > 0) {
+                    if (!xml_attr_eq_sub(r1->v[INDEX_ELEM_ATTR], r2->v[INDEX_ELEM_ATTR])) {
                         return FALSE;
                     }
                 }
@@ -1403,6 +1386,7 @@ static int xml_elem_push(Value *vret, Value *v, RefNode *node)
         return FALSE;
     }
 
+    xml_modify_count++;
     {
         Ref *r = Value_ref(*v);
         RefArray *ra = Value_vp(r->v[INDEX_ELEM_CHILDREN]);
@@ -1500,23 +1484,14 @@ static int xml_elem_attr(Value *vret, Value *v, RefNode *node)
 
     if (fg->stk_top > v + 2) {
         RefNode *v_type = fs->Value_type(v[2]);
+        xml_modify_count++;
         if (v_type == fs->cls_str) {
             // 追加
             for (i = 0; i < v_size; i++) {
                 Value p = vp[i];
                 if (fs->Value_type(p) == cls_elem) {
-                    HashValueEntry *ve;
                     Ref *pr = Value_ref(p);
-                    Value *v_rm = &pr->v[INDEX_ELEM_ATTR];
-
-                    if (!Value_isref(*v_rm)) {
-                        *v_rm = vp_Value(fs->refmap_new(0));
-                    }
-                    ve = fs->refmap_add(Value_vp(*v_rm), v[1], TRUE, FALSE);
-                    if (ve == NULL) {
-                        return TRUE;
-                    }
-                    ve->val = fs->Value_cp(v[2]);
+                    xml_attr_set(&pr->v[INDEX_ELEM_ATTR], fs->Value_cp(v[1]), fs->Value_cp(v[2]));
                 }
             }
         } else if (v_type == fs->cls_null) {
@@ -1525,17 +1500,8 @@ static int xml_elem_attr(Value *vret, Value *v, RefNode *node)
                 Value p = vp[i];
                 if (fs->Value_type(p) == cls_elem) {
                     Ref *pr = Value_ref(p);
-                    Value v_rm = pr->v[INDEX_ELEM_ATTR];
-                    if (Value_isref(v_rm)) {
-                        RefMap *rm = Value_vp(v_rm);
-                        if (!fs->refmap_del(vret, rm, v[1])) {
-                            return FALSE;
-                        }
-                        if (rm->count == 0) {
-                            fs->unref(pr->v[INDEX_ELEM_ATTR]);
-                            pr->v[INDEX_ELEM_ATTR] = VALUE_NULL;
-                        }
-                    }
+                    fs->unref(*vret);
+                    xml_attr_del(vret, &pr->v[INDEX_ELEM_ATTR], v[1]);
                 }
             }
         } else {
@@ -1544,31 +1510,26 @@ static int xml_elem_attr(Value *vret, Value *v, RefNode *node)
         }
     } else {
         // 取得
-        HashValueEntry *he_found = NULL;
+        RefStr *key = Value_vp(v[1]);
+        Value *found = NULL;
 
         for (i = 0; i < v_size; i++) {
             Value p = vp[i];
             if (fs->Value_type(p) == cls_elem) {
                 Ref *pr = Value_ref(p);
-                Value v_rm = pr->v[INDEX_ELEM_ATTR];
+                Value *val = xml_attr_get(pr->v[INDEX_ELEM_ATTR], key->c, key->size);
 
-                if (Value_isref(v_rm)) {
-                    HashValueEntry *he;
-                    if (!fs->refmap_get(&he, Value_vp(v_rm), v[1])) {
+                if (val != NULL) {
+                    if (found != NULL) {
+                        fs->throw_errorf(fs->mod_lang, "ValueError", "More than 2 elements matches");
                         return FALSE;
                     }
-                    if (he != NULL) {
-                        if (he_found != NULL) {
-                            fs->throw_errorf(fs->mod_lang, "ValueError", "More than 2 elements matches");
-                            return FALSE;
-                        }
-                        he_found = he;
-                    }
+                    found = val;
                 }
             }
         }
-        if (he_found != NULL) {
-            *vret = fs->Value_cp(he_found->val);
+        if (found != NULL) {
+            *vret = fs->Value_cp(*found);
         }
     }
 
@@ -1642,6 +1603,13 @@ static int xml_elem_css(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+static int xml_elem_css_many(Value *vret, Value *v, RefNode *node)
+{
+    if (!select_css_many(vret, v, 1, Value_vp(v[1]))) {
+        return FALSE;
+    }
+    return TRUE;
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -1730,6 +1698,25 @@ static int xml_node_list_css(Value *vret, Value *v, RefNode *node)
     }
     return TRUE;
 }
+static int xml_node_list_css_many(Value *vret, Value *v, RefNode *node)
+{
+    RefArray *ra = Value_vp(*v);
+
+    if (!select_css_many(vret, ra->p, ra->size, Value_vp(v[1]))) {
+        return FALSE;
+    }
+    return TRUE;
+}
+static int xml_node_list_set_index(Value *vret, Value *v, RefNode *node)
+{
+    static NativeFunc array_set_index;
+
+    if (array_set_index == NULL) {
+        array_set_index = get_function_ptr(fs->cls_list, fs->symbol_stock[T_LET_B]);
+    }
+    xml_modify_count++;
+    return array_set_index(vret, v, node);
+}
 static int xml_node_remove_css(Value *vret, Value *v, RefNode *node)
 {
     RefArray *ra = Value_vp(*v);
@@ -2112,6 +2099,8 @@ static void define_class(RefNode *m)
     cls_decl = fs->define_identifier(m, m, "XMLDeclaration", NODE_CLASS, 0);
     cls_text = fs->define_identifier(m, m, "XMLText", NODE_CLASS, NODEOPT_STRCLASS);
     cls_comment = fs->define_identifier(m, m, "XMLComment", NODE_CLASS, NODEOPT_STRCLASS);
+    cls_xmlreader = fs->define_identifier(m, m, "XMLReader", NODE_CLASS, 0);
+    cls_xmlindex = fs->define_identifier(m, m, "_XMLIndex", NODE_CLASS, 0);
 
     // XMLDocument
     cls = cls_document;
@@ -2188,13 +2177,15 @@ static void define_class(RefNode *m)
     n = fs->define_identifier_p(m, cls, fs->symbol_stock[T_EQ], NODE_FUNC_N, 0);
     fs->define_native_func_a(n, xml_node_list_eq, 1, 1, NULL, cls_nodelist);
     n = fs->define_identifier_p(m, cls, fs->symbol_stock[T_LET_B], NODE_FUNC_N, 0);
-    fs->define_native_func_a(n, get_function_ptr(fs->cls_list, fs->symbol_stock[T_LET_B]), 2, 2, NULL, fs->cls_int, cls_node);
+    fs->define_native_func_a(n, xml_node_list_set_index, 2, 2, NULL, fs->cls_int, cls_node);
     n = fs->define_identifier_p(m, cls, fs->str_iterator, NODE_FUNC_N, 0);
     fs->define_native_func_a(n, get_function_ptr(fs->cls_list, fs->str_iterator), 0, 0, NULL);
     n = fs->define_identifier(m, cls, "attr", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, xml_elem_attr, 1, 2, (void*) TRUE, fs->cls_str, NULL);
     n = fs->define_identifier(m, cls, "select", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, xml_node_list_css, 1, 1, NULL, fs->cls_str);
+    n = fs->define_identifier(m, cls, "select_many", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xml_node_list_css_many, 1, 1, NULL, fs->cls_list);
     n = fs->define_identifier(m, cls, "remove", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, xml_node_remove_css, 1, 1, NULL, NULL);
     n = fs->define_identifier(m, cls, "save", NODE_FUNC_N, 0);
@@ -2248,6 +2239,8 @@ static void define_class(RefNode *m)
     fs->define_native_func_a(n, xml_elem_attr, 1, 2, (void*) FALSE, fs->cls_str, NULL);
     n = fs->define_identifier(m, cls, "select", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, xml_elem_css, 1, 1, NULL, fs->cls_str);
+    n = fs->define_identifier(m, cls, "select_many", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xml_elem_css_many, 1, 1, NULL, fs->cls_list);
     cls->u.c.n_memb = INDEX_ELEM_NUM;
     fs->extends_method(cls, cls_node);
 
@@ -2277,6 +2270,46 @@ static void define_class(RefNode *m)
     fs->extends_method(cls, cls_node);
 
 
+    // XMLReader
+    cls = cls_xmlreader;
+    n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
+    fs->define_native_func_a(n, xmlreader_new, 1, 2, (void*) FALSE, NULL, fs->cls_bool);
+    n = fs->define_identifier(m, cls, "html", NODE_NEW_N, 0);
+    fs->define_native_func_a(n, xmlreader_new, 1, 1, (void*) TRUE, NULL);
+    n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlreader_close, 0, 0, NULL);
+
+    n = fs->define_identifier(m, cls, "close", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlreader_close, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "next", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlreader_next, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "expand", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlreader_expand, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "event", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_event, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "name", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_name, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "text", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_text, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "depth", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_depth, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "line", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_line, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "attr", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlreader_attr, 1, 1, NULL, fs->cls_str);
+    n = fs->define_identifier(m, cls, "attrs", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, xmlreader_attrs, 0, 0, NULL);
+    cls->u.c.n_memb = INDEX_XMLREADER_NUM;
+    fs->extends_method(cls, fs->cls_iterator);
+
+
+    // _XMLIndex
+    cls = cls_xmlindex;
+    n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, xmlindex_dispose, 0, 0, NULL);
+    fs->extends_method(cls, fs->cls_obj);
+
+
     cls = fs->define_identifier(m, m, "XMLError", NODE_CLASS, NODEOPT_ABSTRACT);
     cls2 = cls;
     cls->u.c.n_memb = 2;
@@ -758,10 +758,12 @@ static void XMLTok_parse_text(XMLTok *tk)
             } else if (tk->xml) {
                 // <![CDATA[が出現したら ]]>まで飛ばす
                 if (memcmp(tk->p + 1, "![CDATA[", 8) == 0) {
+                    int closed = FALSE;
                     tk->p += 9;
                     while (*tk->p != '\0') {
                         if (tk->p[0] == ']' && tk->p[1] == ']' && tk->p[2] == '>') {
                             tk->p += 3;
+                            closed = TRUE;
                             break;
                         }
                         if (*tk->p == '\n') {
@@ -770,7 +772,7 @@ static void XMLTok_parse_text(XMLTok *tk)
                         *dst++ = *tk->p;
                         tk->p++;
                     }
-                    if (*tk->p == '\0' && !tk->loose) {
+                    if (!closed && !tk->loose) {
                         // 閉じていない
                         tk->type = TK_ERROR;
                         return;
@@ -1068,7 +1070,33 @@ static int XMLTok_isspace(XMLTok *tk)
 
 ////////////////////////////////////////////////////////////////////////////////////
 
-static void xml_elem_init(Value *v, RefArray **p_ra, Value **p_vm, const char *name_p, int name_size)
+/**
+ * 要素名・属性名
+ * 同じ名前の文字列を共有する
+ */
+Value xml_name_Value(const char *p, int size)
+{
+    static Value cache[XML_NAME_CACHE_SIZE];
+    uint32_t hash = 0;
+    Value *vp;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        hash = hash * 31 + (uint8_t)p[i];
+    }
+    vp = &cache[hash & (XML_NAME_CACHE_SIZE - 1)];
+    if (*vp != VALUE_NULL) {
+        RefStr *rs = Value_vp(*vp);
+        if (str_eq(rs->c, rs->size, p, size)) {
+            return fs->Value_cp(*vp);
+        }
+        fs->unref(*vp);
+    }
+    *vp = fs->cstr_Value(fs->cls_str, p, size);
+    return fs->Value_cp(*vp);
+}
+
+void xml_elem_init(Value *v, RefArray **p_ra, Value **p_vm, const char *name_p, int name_size)
 {
     Ref *r = fs->ref_new(cls_elem);
     RefArray *ra = fs->refarray_new(0);
@@ -1083,28 +1111,200 @@ static void xml_elem_init(Value *v, RefArray **p_ra, Value **p_vm, const char *n
     if (p_vm != NULL) {
         *p_vm = &r->v[INDEX_ELEM_ATTR];
     }
-    r->v[INDEX_ELEM_NAME] = fs->cstr_Value(fs->cls_str, name_p, name_size);
+    r->v[INDEX_ELEM_NAME] = xml_name_Value(name_p, name_size);
 }
-static int xml_elem_add_attr(Value *v, Str skey, Str sval, int loose)
+
+/*
+ * 属性はXML_ATTR_INLINE_MAX個まで、名前と値を交互に並べたListで保持する
+ * それを超えたらMapに移す
+ */
+static RefArray *xml_attr_list_new(void)
+{
+    RefArray *ra = fs->buf_new(fs->cls_list, sizeof(RefArray));
+    // 文字列しか保持しないので、循環参照の追跡対象にしない
+    ra->alloc_size = 4;
+    ra->p = malloc(sizeof(Value) * ra->alloc_size);
+    return ra;
+}
+static void xml_attr_list_add(RefArray *ra, Value key, Value val)
+{
+    if (ra->size + 2 > ra->alloc_size) {
+        ra->alloc_size *= 2;
+        ra->p = realloc(ra->p, sizeof(Value) * ra->alloc_size);
+    }
+    ra->p[ra->size++] = key;
+    ra->p[ra->size++] = val;
+}
+/**
+ * 属性の値を返す
+ * 見つからなければNULL
+ */
+Value *xml_attr_get(Value v_attr, const char *key_p, int key_size)
+{
+    if (!Value_isref(v_attr)) {
+        return NULL;
+    }
+    if (fs->Value_type(v_attr) == fs->cls_list) {
+        RefArray *ra = Value_vp(v_attr);
+        int i;
+        for (i = 0; i < ra->size; i += 2) {
+            RefStr *rs = Value_vp(ra->p[i]);
+            if (str_eq(rs->c, rs->size, key_p, key_size)) {
+                return &ra->p[i + 1];
+            }
+        }
+    } else {
+        HashValueEntry *he;
+        Value key = fs->cstr_Value(fs->cls_str, key_p, key_size);
+        // Str#_op_eqでは、例外が発生しないのでチェックを省略
+        fs->refmap_get(&he, Value_vp(v_attr), key);
+        fs->unref(key);
+        if (he != NULL) {
+            return &he->val;
+        }
+    }
+    return NULL;
+}
+int xml_attr_count(Value v_attr)
+{
+    if (!Value_isref(v_attr)) {
+        return 0;
+    }
+    if (fs->Value_type(v_attr) == fs->cls_list) {
+        RefArray *ra = Value_vp(v_attr);
+        return ra->size / 2;
+    } else {
+        RefMap *rm = Value_vp(v_attr);
+        return rm->count;
+    }
+}
+/**
+ * 属性を順に取り出す
+ * 終端に達したらFALSE
+ */
+int xml_attr_next(XMLAttrIter *it, Value *key, Value *val)
+{
+    if (!Value_isref(it->v)) {
+        return FALSE;
+    }
+    if (fs->Value_type(it->v) == fs->cls_list) {
+        RefArray *ra = Value_vp(it->v);
+        if (it->i >= ra->size) {
+            return FALSE;
+        }
+        *key = ra->p[it->i];
+        *val = ra->p[it->i + 1];
+        it->i += 2;
+        return TRUE;
+    } else {
+        RefMap *rm = Value_vp(it->v);
+        while (it->he == NULL) {
+            if (it->i >= rm->entry_num) {
+                return FALSE;
+            }
+            it->he = rm->entry[it->i++];
+        }
+        *key = it->he->key;
+        *val = it->he->val;
+        it->he = it->he->next;
+        return TRUE;
+    }
+}
+/**
+ * 属性をMapに移す
+ * 属性が無ければ空のMapを作る
+ */
+RefMap *xml_attr_to_map(Value *v_attr)
 {
     RefMap *rm;
 
-    if (Value_isref(*v)) {
-        rm = Value_vp(*v);
-    } else {
-        rm = fs->refmap_new(0);
-        *v = vp_Value(rm);
+    if (Value_isref(*v_attr) && fs->Value_type(*v_attr) != fs->cls_list) {
+        return Value_vp(*v_attr);
     }
-    {
-        Value key = fs->cstr_Value(fs->cls_str, skey.p, skey.size);
-        HashValueEntry *ve = fs->refmap_add(rm, key, loose, TRUE);
-        if (ve == NULL) {
+    rm = fs->refmap_new(0);
+    if (Value_isref(*v_attr)) {
+        RefArray *ra = Value_vp(*v_attr);
+        int i;
+        for (i = 0; i < ra->size; i += 2) {
+            HashValueEntry *ve = fs->refmap_add(rm, ra->p[i], TRUE, FALSE);
+            ve->val = fs->Value_cp(ra->p[i + 1]);
+        }
+        fs->unref(*v_attr);
+    }
+    *v_attr = vp_Value(rm);
+    return rm;
+}
+/**
+ * 属性を追加または上書きする
+ * keyとvalの参照は引き継ぐ
+ */
+void xml_attr_set(Value *v_attr, Value key, Value val)
+{
+    RefStr *rs_key = Value_vp(key);
+
+    if (!Value_isref(*v_attr)) {
+        *v_attr = vp_Value(xml_attr_list_new());
+    }
+    if (fs->Value_type(*v_attr) == fs->cls_list) {
+        Value *vp = xml_attr_get(*v_attr, rs_key->c, rs_key->size);
+        if (vp != NULL) {
+            fs->unref(*vp);
+            *vp = val;
             fs->unref(key);
-            return FALSE;
+            return;
         }
-        ve->val = fs->cstr_Value(fs->cls_str, sval.p, sval.size);
+        if (xml_attr_count(*v_attr) < XML_ATTR_INLINE_MAX) {
+            xml_attr_list_add(Value_vp(*v_attr), key, val);
+            return;
+        }
+        xml_attr_to_map(v_attr);
+    }
+    {
+        HashValueEntry *ve = fs->refmap_add(Value_vp(*v_attr), key, TRUE, FALSE);
+        ve->val = val;
         fs->unref(key);
     }
+}
+/**
+ * 属性を削除する
+ * 削除した値をvalに返す
+ */
+void xml_attr_del(Value *val, Value *v_attr, Value key)
+{
+    *val = VALUE_NULL;
+    if (!Value_isref(*v_attr)) {
+        return;
+    }
+    if (fs->Value_type(*v_attr) == fs->cls_list) {
+        RefArray *ra = Value_vp(*v_attr);
+        RefStr *rs_key = Value_vp(key);
+        int i;
+        for (i = 0; i < ra->size; i += 2) {
+            RefStr *rs = Value_vp(ra->p[i]);
+            if (str_eq(rs->c, rs->size, rs_key->c, rs_key->size)) {
+                fs->unref(ra->p[i]);
+                *val = ra->p[i + 1];
+                memmove(&ra->p[i], &ra->p[i + 2], sizeof(Value) * (ra->size - i - 2));
+                ra->size -= 2;
+                break;
+            }
+        }
+    } else {
+        // Str#_op_eqでは、例外が発生しないのでチェックを省略
+        fs->refmap_del(val, Value_vp(*v_attr), key);
+    }
+    if (xml_attr_count(*v_attr) == 0) {
+        fs->unref(*v_attr);
+        *v_attr = VALUE_NULL;
+    }
+}
+int xml_elem_add_attr(Value *v, Str skey, Str sval, int loose)
+{
+    if (!loose && xml_attr_get(*v, skey.p, skey.size) != NULL) {
+        fs->throw_errorf(fs->mod_lang, "IndexError", "Duplicate key detected");
+        return FALSE;
+    }
+    xml_attr_set(v, xml_name_Value(skey.p, skey.size), fs->cstr_Value(fs->cls_str, sval.p, sval.size));
     return TRUE;
 }
 
@@ -1656,3 +1856,138 @@ int parse_xml_body(Value *v, XMLTok *tk)
 BREAK_ALL:
     return TRUE;
 }
+
+////////////////////////////////////////////////////////////////////////////////////
+
+static void xml_event_add_attr(XMLEvent *ev, Str skey, Str sval)
+{
+    if (ev->attr_num * 2 >= ev->attr_max) {
+        ev->attr_max = (ev->attr_max > 0 ? ev->attr_max * 2 : 16);
+        ev->attr = realloc(ev->attr, sizeof(Str) * ev->attr_max);
+    }
+    ev->attr[ev->attr_num * 2] = skey;
+    ev->attr[ev->attr_num * 2 + 1] = sval;
+    ev->attr_num++;
+}
+static int xml_event_has_attr(XMLEvent *ev, Str skey)
+{
+    int i;
+
+    for (i = 0; i < ev->attr_num; i++) {
+        Str s = ev->attr[i * 2];
+        if (str_eq(s.p, s.size, skey.p, skey.size)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+static int parse_xml_event_tag(XMLEvent *ev, XMLTok *tk)
+{
+    ev->type = XEV_START;
+    ev->val = tk->val;
+    XMLTok_next_tag(tk);
+
+    for (;;) {
+        switch (tk->type) {
+        case TK_EOS:
+            if (tk->loose) {
+                return TRUE;
+            }
+            fs->throw_errorf(mod_xml, "XMLParseError", "Missing '>' at line %d", tk->line);
+            return FALSE;
+        case TK_TAG_END:
+            return TRUE;
+        case TK_TAG_END_CLOSE:
+            ev->empty = TRUE;
+            return TRUE;
+        case TK_ATTR_NAME: {
+            Str skey;
+            if (!tk->xml) {
+                XMLTok_tolower(tk);
+            }
+            skey = tk->val;
+
+            XMLTok_next_tag(tk);
+            if (!tk->loose && xml_event_has_attr(ev, skey)) {
+                fs->throw_errorf(mod_xml, "XMLParseError", "Duplicate attribute %Q at line %d", skey, tk->line);
+                return FALSE;
+            }
+            if (tk->type == TK_EQUAL) {
+                XMLTok_next_tag(tk);
+                if (tk->type == TK_STRING || (tk->loose && tk->type == TK_ATTR_NAME)) {
+                    xml_event_add_attr(ev, skey, tk->val);
+                    XMLTok_next_tag(tk);
+                } else {
+                    fs->throw_errorf(mod_xml, "XMLParseError", "Missing string after '=' at line %d", tk->line);
+                    return FALSE;
+                }
+            } else if (tk->loose) {
+                // 値のない属性
+                xml_event_add_attr(ev, skey, skey);
+            } else {
+                fs->throw_errorf(mod_xml, "XMLParseError", "Missing '=' at line %d", tk->line);
+                return FALSE;
+            }
+            break;
+        }
+        default:
+            if (tk->loose) {
+                return TRUE;
+            }
+            throw_unexpected_token(tk);
+            return FALSE;
+        }
+    }
+}
+/**
+ * XMLReader用
+ * tkは1つの単位(タグ、テキスト、コメントなど)だけを含む
+ * raw_tagを指定した場合は、</raw_tag>までをテキストとする
+ */
+int parse_xml_event(XMLEvent *ev, XMLTok *tk, Str raw_tag)
+{
+    ev->empty = FALSE;
+    ev->attr_num = 0;
+
+    if (raw_tag.size > 0) {
+        XMLTok_next_raw(tk, raw_tag);
+        ev->type = XEV_TEXT;
+        ev->val = tk->val;
+        return TRUE;
+    }
+
+    XMLTok_next(tk);
+    switch (tk->type) {
+    case TK_TAG_START:
+        return parse_xml_event_tag(ev, tk);
+    case TK_TAG_CLOSE:
+        ev->type = XEV_END;
+        ev->val = tk->val;
+        break;
+    case TK_TEXT:
+        ev->type = XEV_TEXT;
+        ev->val = tk->val;
+        break;
+    case TK_COMMENT:
+        ev->type = XEV_COMMENT;
+        ev->val = tk->val;
+        break;
+    case TK_EOS:
+    case TK_DECL_START:
+    case TK_DOCTYPE:
+        // 処理命令、DOCTYPEは無視
+        ev->type = XEV_SKIP;
+        break;
+    case TK_ERROR:
+        if (tk->loose) {
+            ev->type = XEV_SKIP;
+            break;
+        }
+        fs->throw_errorf(mod_xml, "XMLParseError", "Unknown token at line %d", tk->line);
+        return FALSE;
+    default:
+        throw_unexpected_token(tk);
+        return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,657 @@
+#include "fox_xml.h"
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * XMLReader
+ *
+ * StreamIOから少しずつ読み込み、開始タグ・終了タグ・テキスト・コメントを1つずつ返す
+ * 入力はタグやテキストなどの単位ごとに切り出してXMLTokで解析するので、
+ * 保持するのは1単位分と、開いているタグ名のみ
+ * 属性はattrsを参照した時にMapを生成する
+ */
+
+enum {
+    XMLREADER_READ_SIZE = 64 * 1024,
+};
+
+typedef struct {
+    StrBuf buf;     // 未解析の入力
+    int pos;        // 次に解析する位置
+    int eos;        // 入力の終端に達した
+    int bom_done;
+    int xml;
+    int loose;
+    int line;
+
+    int event;      // 現在のイベント
+    XMLEvent ev;
+    int n_end;      // <tag />などで、続けて返すENDの数
+    int raw;        // 次はscript,styleの中身
+
+    StrBuf tags;    // 開いているタグ名
+    int *tag_pos;   // tags内のタグ名の位置
+    int depth;
+    int tag_max;
+} XMLReader;
+
+
+static XMLReader *get_xmlreader(Value v)
+{
+    Ref *r = Value_ref(v);
+    XMLReader *xr = Value_ptr(r->v[INDEX_XMLREADER_STATE]);
+
+    if (xr == NULL) {
+        fs->throw_error_select(THROW_NOT_OPENED_FOR_READ);
+    }
+    return xr;
+}
+static Str xmlreader_top_tag(XMLReader *xr)
+{
+    int pos = xr->tag_pos[xr->depth - 1];
+    return Str_new(xr->tags.p + pos, xr->tags.size - pos);
+}
+static void xmlreader_push_tag(XMLReader *xr, Str name)
+{
+    if (xr->depth >= xr->tag_max) {
+        xr->tag_max = (xr->tag_max > 0 ? xr->tag_max * 2 : 32);
+        xr->tag_pos = realloc(xr->tag_pos, sizeof(int) * xr->tag_max);
+    }
+    xr->tag_pos[xr->depth++] = xr->tags.size;
+    fs->StrBuf_add(&xr->tags, name.p, name.size);
+}
+/**
+ * 終了タグのイベントにする
+ * タグ名は次にpushするまで有効
+ */
+static void xmlreader_pop_tag(XMLReader *xr)
+{
+    xr->ev.type = XEV_END;
+    xr->ev.val = xmlreader_top_tag(xr);
+    xr->ev.attr_num = 0;
+    xr->tags.size = xr->tag_pos[--xr->depth];
+}
+
+/**
+ * 解析済みの部分を捨てて、続きを読み込む
+ */
+static int xmlreader_fill(XMLReader *xr, Value stream)
+{
+    StrBuf *buf = &xr->buf;
+    int prev_size;
+    int size = XMLREADER_READ_SIZE;
+
+    if (xr->pos > 0) {
+        memmove(buf->p, buf->p + xr->pos, buf->size - xr->pos);
+        buf->size -= xr->pos;
+        xr->pos = 0;
+    }
+    prev_size = buf->size;
+    // 末尾に番兵を置くため1バイト余分に確保
+    if (!fs->StrBuf_alloc(buf, prev_size + size + 1)) {
+        return FALSE;
+    }
+    buf->size = prev_size;
+    if (!fs->stream_read_data(stream, NULL, buf->p + prev_size, &size, FALSE, FALSE)) {
+        return FALSE;
+    }
+    if (size <= 0) {
+        xr->eos = TRUE;
+    } else {
+        buf->size += size;
+    }
+
+    if (!xr->bom_done && (buf->size >= 3 || xr->eos)) {
+        if (buf->size >= 3 && memcmp(buf->p, "\xEF\xBB\xBF", 3) == 0) {
+            xr->pos = 3;
+        }
+        xr->bom_done = TRUE;
+    }
+    return TRUE;
+}
+
+static int find_terminator(const char *p, int n, int *scan, int start, const char *term)
+{
+    int len = strlen(term);
+    int i = (*scan > start ? *scan : start);
+
+    for (; i <= n - len; i++) {
+        if (p[i] == term[0] && memcmp(p + i, term, len) == 0) {
+            return i + len;
+        }
+    }
+    *scan = (n - len + 1 > start ? n - len + 1 : start);
+    return -1;
+}
+static int find_tag_end(const char *p, int n)
+{
+    int quot = '\0';
+    int bracket = 0;
+    int i;
+
+    for (i = 1; i < n; i++) {
+        int ch = p[i];
+        if (quot != '\0') {
+            if (ch == quot) {
+                quot = '\0';
+            }
+        } else if (ch == '"' || ch == '\'') {
+            quot = ch;
+        } else if (ch == '[') {
+            // <!DOCTYPE [...]>
+            bracket++;
+        } else if (ch == ']') {
+            bracket--;
+        } else if (ch == '>' && bracket <= 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+static int find_raw_end(const char *p, int n, int *scan, Str tag)
+{
+    int i;
+
+    for (i = *scan; i < n - 1; i++) {
+        if (p[i] == '<' && p[i + 1] == '/') {
+            int j;
+            if (i + 2 + tag.size > n) {
+                break;
+            }
+            for (j = 0; j < tag.size; j++) {
+                if (tolower_fox(p[i + 2 + j]) != tolower_fox(tag.p[j])) {
+                    break;
+                }
+            }
+            if (j == tag.size) {
+                const char *q = memchr(p + i, '>', n - i);
+                if (q != NULL) {
+                    return q - p + 1;
+                }
+                break;
+            }
+        }
+    }
+    *scan = i;
+    return -1;
+}
+/**
+ * 現在位置から始まる1単位の長さを返す
+ * 入力の終端に達した場合は0を返す
+ */
+static int xmlreader_unit(int *plen, XMLReader *xr, Value stream)
+{
+    int scan = 0;
+
+    for (;;) {
+        const char *p = xr->buf.p + xr->pos;
+        int n = xr->buf.size - xr->pos;
+        int len = -1;
+
+        if (xr->raw) {
+            len = find_raw_end(p, n, &scan, xmlreader_top_tag(xr));
+        } else if (n > 0 && p[0] != '<') {
+            const char *q = memchr(p + scan, '<', n - scan);
+            if (q != NULL) {
+                len = q - p;
+            } else {
+                scan = n;
+            }
+        } else if (n < 9 && !xr->eos) {
+            // 種類を判定できない
+        } else if (n >= 4 && memcmp(p, "<!--", 4) == 0) {
+            len = find_terminator(p, n, &scan, 4, "-->");
+        } else if (xr->xml && n >= 9 && memcmp(p, "<![CDATA[", 9) == 0) {
+            len = find_terminator(p, n, &scan, 9, "]]>");
+        } else if (n >= 2 && p[1] == '?') {
+            len = find_terminator(p, n, &scan, 2, "?>");
+        } else if (n > 0) {
+            len = find_tag_end(p, n);
+        }
+
+        if (len >= 0) {
+            *plen = len;
+            return TRUE;
+        }
+        if (xr->eos) {
+            if (n > 0 && !xr->loose && !xr->raw && p[0] == '<') {
+                fs->throw_errorf(mod_xml, "XMLParseError", "Unexpected end of input at line %d", xr->line);
+                return FALSE;
+            }
+            *plen = n;
+            return TRUE;
+        }
+        if (!xmlreader_fill(xr, stream)) {
+            return FALSE;
+        }
+    }
+}
+static int xmlreader_parse_unit(XMLReader *xr, int len)
+{
+    char *p = xr->buf.p + xr->pos;
+    char *end = p + len;
+    char c = *end;
+    Str raw_tag;
+    XMLTok tk;
+    int ret;
+
+    if (xr->raw) {
+        raw_tag = xmlreader_top_tag(xr);
+    } else {
+        raw_tag.p = NULL;
+        raw_tag.size = 0;
+    }
+
+    *end = '\0';
+    XMLTok_init(&tk, p, end, xr->xml, xr->loose);
+    tk.line = xr->line;
+    while (p < end) {
+        const char *q = memchr(p, '\n', end - p);
+        if (q == NULL) {
+            break;
+        }
+        xr->line++;
+        p = (char*)q + 1;
+    }
+    ret = parse_xml_event(&xr->ev, &tk, raw_tag);
+    *end = c;
+
+    xr->pos += len;
+    return ret;
+}
+static int str_isspace(Str s)
+{
+    int i;
+    for (i = 0; i < s.size; i++) {
+        if (!isspace_fox(s.p[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+static int xmlreader_find_tag(XMLReader *xr, Str name)
+{
+    int i;
+
+    for (i = xr->depth - 1; i >= 0; i--) {
+        int pos = xr->tag_pos[i];
+        int end = (i + 1 < xr->depth ? xr->tag_pos[i + 1] : xr->tags.size);
+        if (str_eq(xr->tags.p + pos, end - pos, name.p, name.size)) {
+            return i;
+        }
+    }
+    return -1;
+}
+/**
+ * 次のイベントに進める
+ * 終端に達した場合はXEV_SKIPを返す
+ */
+static int xmlreader_next_sub(XMLReader *xr, Value stream)
+{
+    for (;;) {
+        int len;
+
+        if (xr->n_end > 0) {
+            xr->n_end--;
+            xmlreader_pop_tag(xr);
+            xr->event = XEV_END;
+            return TRUE;
+        }
+        if (!xmlreader_unit(&len, xr, stream)) {
+            return FALSE;
+        }
+        if (len == 0) {
+            if (xr->depth > 0) {
+                if (!xr->loose) {
+                    fs->throw_errorf(mod_xml, "XMLParseError", "Missing end tag </%S>", xmlreader_top_tag(xr));
+                    return FALSE;
+                }
+                // 閉じていないタグを閉じる
+                xr->n_end = xr->depth;
+                continue;
+            }
+            xr->event = XEV_SKIP;
+            return TRUE;
+        }
+        if (xr->raw) {
+            // </script>まで読んだ
+            if (!xmlreader_parse_unit(xr, len)) {
+                return FALSE;
+            }
+            xr->raw = FALSE;
+            xr->n_end = 1;
+            if (xr->ev.val.size == 0) {
+                continue;
+            }
+            xr->event = XEV_TEXT;
+            return TRUE;
+        }
+        if (!xmlreader_parse_unit(xr, len)) {
+            return FALSE;
+        }
+
+        switch (xr->ev.type) {
+        case XEV_TEXT:
+        case XEV_COMMENT:
+            if (xr->depth == 0 && xr->ev.type == XEV_TEXT) {
+                // ルート要素の外
+                if (str_isspace(xr->ev.val) || xr->loose) {
+                    break;
+                }
+                fs->throw_errorf(mod_xml, "XMLParseError", "Illigal text found (%d)", xr->line);
+                return FALSE;
+            }
+            xr->event = xr->ev.type;
+            return TRUE;
+        case XEV_START:
+            xmlreader_push_tag(xr, xr->ev.val);
+            if (xr->ev.empty) {
+                xr->n_end = 1;
+            } else if (!xr->xml) {
+                int tag_type = get_tag_type_icase(xr->ev.val.p, xr->ev.val.size);
+                if ((tag_type & TTYPE_NO_ENDTAG) != 0) {
+                    xr->n_end = 1;
+                } else if ((tag_type & TTYPE_RAW) != 0) {
+                    xr->raw = TRUE;
+                }
+            }
+            xr->event = XEV_START;
+            return TRUE;
+        case XEV_END: {
+            int idx = xmlreader_find_tag(xr, xr->ev.val);
+
+            if (idx >= 0 && idx == xr->depth - 1) {
+                xmlreader_pop_tag(xr);
+                xr->event = XEV_END;
+                return TRUE;
+            }
+            if (!xr->loose) {
+                if (xr->depth > 0) {
+                    fs->throw_errorf(mod_xml, "XMLParseError", "Tag name mismatch (<%S>...</%S>) at line %d",
+                            xmlreader_top_tag(xr), xr->ev.val, xr->line);
+                } else {
+                    fs->throw_errorf(mod_xml, "XMLParseError", "Unexpected end tag </%S> at line %d", xr->ev.val, xr->line);
+                }
+                return FALSE;
+            }
+            if (idx >= 0) {
+                // 閉じタグが省略されている
+                xr->n_end = xr->depth - idx;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * XMLReader(stream, loose=false)
+ * XMLReader.html(stream)
+ */
+int xmlreader_new(Value *vret, Value *v, RefNode *node)
+{
+    int html = FUNC_INT(node);
+    Ref *r = fs->ref_new(cls_xmlreader);
+    XMLReader *xr;
+    Value stream;
+
+    *vret = vp_Value(r);
+    if (!fs->value_to_streamio(&stream, v[1], FALSE, 0, FALSE)) {
+        return FALSE;
+    }
+    r->v[INDEX_XMLREADER_STREAM] = stream;
+
+    xr = malloc(sizeof(XMLReader));
+    memset(xr, 0, sizeof(XMLReader));
+    fs->StrBuf_init(&xr->buf, 0);
+    fs->StrBuf_init(&xr->tags, 0);
+    xr->xml = !html;
+    xr->loose = html || (fg->stk_top > v + 2 && Value_bool(v[2]));
+    xr->line = 1;
+    xr->event = XEV_SKIP;
+    r->v[INDEX_XMLREADER_STATE] = ptr_Value(xr);
+
+    return TRUE;
+}
+int xmlreader_close(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    XMLReader *xr = Value_ptr(r->v[INDEX_XMLREADER_STATE]);
+
+    if (xr != NULL) {
+        StrBuf_close(&xr->buf);
+        StrBuf_close(&xr->tags);
+        free(xr->tag_pos);
+        free(xr->ev.attr);
+        free(xr);
+        r->v[INDEX_XMLREADER_STATE] = VALUE_NULL;
+    }
+    return TRUE;
+}
+static Value event_name_Value(int event)
+{
+    switch (event) {
+    case XEV_START:
+        return fs->cstr_Value(fs->cls_str, "start", 5);
+    case XEV_END:
+        return fs->cstr_Value(fs->cls_str, "end", 3);
+    case XEV_TEXT:
+        return fs->cstr_Value(fs->cls_str, "text", 4);
+    case XEV_COMMENT:
+        return fs->cstr_Value(fs->cls_str, "comment", 7);
+    }
+    return VALUE_NULL;
+}
+/**
+ * 次のイベントに進み、"start", "end", "text", "comment"のいずれかを返す
+ */
+int xmlreader_next(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    fs->unref(r->v[INDEX_XMLREADER_ATTR]);
+    r->v[INDEX_XMLREADER_ATTR] = VALUE_NULL;
+
+    if (!xmlreader_next_sub(xr, r->v[INDEX_XMLREADER_STREAM])) {
+        return FALSE;
+    }
+    if (xr->event == XEV_SKIP) {
+        fs->throw_stopiter();
+        return FALSE;
+    }
+    *vret = event_name_Value(xr->event);
+    return TRUE;
+}
+/**
+ * 現在の開始タグから対応する終了タグまでをXMLElemにする
+ * 終了後は、その終了タグのイベントに位置する
+ */
+int xmlreader_expand(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    XMLReader *xr = get_xmlreader(*v);
+    RefArray **stack;
+    int stack_max = 16;
+    int n = 0;
+    int base;
+    int i;
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (xr->event != XEV_START) {
+        fs->throw_errorf(mod_xml, "XMLError", "Current event is not a start tag");
+        return FALSE;
+    }
+    fs->unref(r->v[INDEX_XMLREADER_ATTR]);
+    r->v[INDEX_XMLREADER_ATTR] = VALUE_NULL;
+
+    stack = malloc(sizeof(RefArray*) * stack_max);
+    base = xr->depth;
+
+    for (;;) {
+        switch (xr->event) {
+        case XEV_START: {
+            Value *ve;
+            Value *vm;
+            if (n == 0) {
+                ve = vret;
+            } else {
+                ve = fs->refarray_push(stack[n - 1]);
+            }
+            if (n >= stack_max) {
+                stack_max *= 2;
+                stack = realloc(stack, sizeof(RefArray*) * stack_max);
+            }
+            xml_elem_init(ve, &stack[n], &vm, xr->ev.val.p, xr->ev.val.size);
+            n++;
+            for (i = 0; i < xr->ev.attr_num; i++) {
+                if (!xml_elem_add_attr(vm, xr->ev.attr[i * 2], xr->ev.attr[i * 2 + 1], TRUE)) {
+                    goto ERROR_END;
+                }
+            }
+            break;
+        }
+        case XEV_END:
+            n--;
+            break;
+        case XEV_TEXT:
+            *fs->refarray_push(stack[n - 1]) = fs->cstr_Value(cls_text, xr->ev.val.p, xr->ev.val.size);
+            break;
+        case XEV_COMMENT:
+            *fs->refarray_push(stack[n - 1]) = fs->cstr_Value(cls_comment, xr->ev.val.p, xr->ev.val.size);
+            break;
+        }
+        if (xr->depth < base) {
+            break;
+        }
+        if (!xmlreader_next_sub(xr, r->v[INDEX_XMLREADER_STREAM])) {
+            goto ERROR_END;
+        }
+    }
+    free(stack);
+    return TRUE;
+
+ERROR_END:
+    free(stack);
+    return FALSE;
+}
+int xmlreader_event(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    *vret = event_name_Value(xr->event);
+    return TRUE;
+}
+int xmlreader_name(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (xr->event == XEV_START || xr->event == XEV_END) {
+        *vret = fs->cstr_Value(fs->cls_str, xr->ev.val.p, xr->ev.val.size);
+    }
+    return TRUE;
+}
+int xmlreader_text(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (xr->event == XEV_TEXT || xr->event == XEV_COMMENT) {
+        *vret = fs->cstr_Value(fs->cls_str, xr->ev.val.p, xr->ev.val.size);
+    }
+    return TRUE;
+}
+/**
+ * 現在のイベントを囲んでいる要素の数
+ */
+int xmlreader_depth(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (xr->event == XEV_START) {
+        *vret = int32_Value(xr->depth - 1);
+    } else {
+        *vret = int32_Value(xr->depth);
+    }
+    return TRUE;
+}
+int xmlreader_line(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    *vret = int32_Value(xr->line);
+    return TRUE;
+}
+/**
+ * Mapを生成せずに、属性を1つ取得する
+ */
+int xmlreader_attr(Value *vret, Value *v, RefNode *node)
+{
+    XMLReader *xr = get_xmlreader(*v);
+    RefStr *key = Value_vp(v[1]);
+    int i;
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (xr->event != XEV_START) {
+        return TRUE;
+    }
+    for (i = 0; i < xr->ev.attr_num; i++) {
+        Str k = xr->ev.attr[i * 2];
+        if (str_eq(k.p, k.size, key->c, key->size)) {
+            Str val = xr->ev.attr[i * 2 + 1];
+            *vret = fs->cstr_Value(fs->cls_str, val.p, val.size);
+            break;
+        }
+    }
+    return TRUE;
+}
+int xmlreader_attrs(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    XMLReader *xr = get_xmlreader(*v);
+
+    if (xr == NULL) {
+        return FALSE;
+    }
+    if (r->v[INDEX_XMLREADER_ATTR] == VALUE_NULL) {
+        Value vm = vp_Value(fs->refmap_new(0));
+        int i;
+
+        if (xr->event == XEV_START) {
+            for (i = 0; i < xr->ev.attr_num; i++) {
+                if (!xml_elem_add_attr(&vm, xr->ev.attr[i * 2], xr->ev.attr[i * 2 + 1], TRUE)) {
+                    fs->unref(vm);
+                    return FALSE;
+                }
+            }
+        }
+        r->v[INDEX_XMLREADER_ATTR] = vm;
+    }
+    *vret = fs->Value_cp(r->v[INDEX_XMLREADER_ATTR]);
+    return TRUE;
+}
@@ -63,17 +63,67 @@ typedef struct XMLAttrPattern {
 typedef struct XMLPattern {
     struct XMLPattern *or;
     struct XMLPattern *next;
-    int index;
     int subnode;           // TRUE:子孫, FALSE:子のみ
     XMLAttrPattern *attr;  // NULLの場合、子孫セレクタ
 } XMLPattern;
 
+// ,で区切られた1つのセレクタ
+typedef struct {
+    XMLPattern **chain;    // 左から順に並べたもの
+    int size;
+} XMLSelector;
+
 typedef struct {
     XMLPattern *root;
-    XMLPattern **p;
+    XMLSelector *sel;
     int num;
 } XMLPatternList;
 
+typedef struct {
+    Ref *r;
+    int parent;     // 親要素の位置 (無ければ-1)
+    int end;        // 子孫の次の位置 (索引のみ)
+} XMLSelectNode;
+
+// 要素名・id・classから要素の位置を引く
+typedef struct {
+    const char *p;
+    int size;
+    uint32_t hash;
+    int *pos;
+    int num;
+    int max;
+} XMLIndexEntry;
+
+typedef struct {
+    XMLIndexEntry *entry;
+    int entry_num;
+    int count;
+} XMLIndexTable;
+
+typedef struct {
+    RefHeader rh;
+
+    int modify_count;   // 作成時のxml_modify_count
+    int built;
+    XMLSelectNode *node;    // 文書順
+    int node_num;
+    int node_max;
+    XMLIndexTable name;
+    XMLIndexTable id;
+    XMLIndexTable klass;
+} RefXMLIndex;
+
+// 索引を使わずに辿る場合の状態
+typedef struct {
+    XMLPatternList *pl;
+    RefArray **ra;
+    int num;
+    XMLSelectNode *stack;
+    int depth;
+    int max;
+} XMLSelectState;
+
 static void SelectorTok_init(SelectorTok *tk, const char *src_p, int src_size, Mem *mem)
 {
     tk->p = fs->str_dup_p(src_p, src_size, mem);
@@ -220,39 +270,6 @@ static void SelectorTok_next(SelectorTok *tk)
     }
 }
 
-static void XMLPatternList_set_p_sub(XMLPattern ***ppp, XMLPattern *node)
-{
-    for (; node != NULL; node = node->next) {
-        XMLPattern **pp = *ppp;
-        *pp++ = node;
-        *ppp = pp;
-        if (node->or != NULL) {
-            XMLPatternList_set_p_sub(ppp, node->or);
-        }
-    }
-}
-static void XMLPatternList_set_p(XMLPatternList *pl, Mem *mem)
-{
-    XMLPattern **pp;
-
-    if (pl->num == 0) {
-        pl->p = NULL;
-        return;
-    }
-    pl->p = malloc(sizeof(XMLPattern*) * pl->num);
-    pp = pl->p;
-    XMLPatternList_set_p_sub(&pp, pl->root);
-}
-static void XMLPatternList_mark(XMLPatternList *pl, uint8_t *mask, int index)
-{
-    XMLPattern *pat = pl->p[index];
-
-    mask[index] = TRUE;
-    for (pat = pat->or; pat != NULL; pat = pat->or) {
-        mask[pat->index] = TRUE;
-    }
-}
-
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -270,7 +287,7 @@ DIV.warning     クラスセレクタ   DIV[class~="warning"]
 E#myid  IDセレクタ  E[id="myid"]
 
  */
-static int parse_css_selector_sub(XMLPattern **pp, int *pnum, SelectorTok *tk, Mem *mem)
+static int parse_css_selector_sub(XMLPattern **pp, SelectorTok *tk, Mem *mem)
 {
     XMLPattern *pat = NULL;
     XMLPattern **ppat = NULL;
@@ -291,8 +308,6 @@ static int parse_css_selector_sub(XMLPattern **pp, int *pnum, SelectorTok *tk, M
             *ppat = pat;
             ppat = &pat->next;
             pattr = &pat->attr;
-            pat->index = *pnum;
-            (*pnum)++;
 
             if (*pp == NULL) {
                 *pp = pat;
@@ -430,9 +445,11 @@ static int parse_css_selector(XMLPatternList *pl, Str sel, Mem *mem)
 {
     SelectorTok tk;
     XMLPattern **pp = &pl->root;
+    XMLPattern *alt;
+    int i;
 
     pl->root = NULL;
-    pl->p = NULL;
+    pl->sel = NULL;
     pl->num = 0;
 
     SelectorTok_init(&tk, sel.p, sel.size, mem);
@@ -440,10 +457,11 @@ static int parse_css_selector(XMLPatternList *pl, Str sel, Mem *mem)
 
     for (;;) {
         *pp = NULL;
-        if (!parse_css_selector_sub(pp, &pl->num, &tk, mem)) {
+        if (!parse_css_selector_sub(pp, &tk, mem)) {
             return FALSE;
         }
         pp = &(*pp)->or;
+        pl->num++;
         if (tk.type == STK_COMMA) {
             SelectorTok_next(&tk);
             if (tk.type == STK_SPACE) {
@@ -457,11 +475,49 @@ static int parse_css_selector(XMLPatternList *pl, Str sel, Mem *mem)
         }
     }
     *pp = NULL;
-    XMLPatternList_set_p(pl, mem);
+
+    // 右から照合するため、配列にする
+    pl->sel = fs->Mem_get(mem, sizeof(XMLSelector) * pl->num);
+    for (alt = pl->root, i = 0; alt != NULL; alt = alt->or, i++) {
+        XMLSelector *xs = &pl->sel[i];
+        XMLPattern *pat;
+        int j = 0;
+
+        xs->size = 0;
+        for (pat = alt; pat != NULL; pat = pat->next) {
+            xs->size++;
+        }
+        xs->chain = fs->Mem_get(mem, sizeof(XMLPattern*) * xs->size);
+        for (pat = alt; pat != NULL; pat = pat->next) {
+            xs->chain[j++] = pat;
+        }
+    }
 
     return TRUE;
 }
 
+/**
+ * 空白で区切られた次の語を取り出す
+ */
+static int get_next_word(Str *word, const char **pp, const char *end)
+{
+    const char *p = *pp;
+
+    while (p < end && isspace_fox(*p)) {
+        p++;
+    }
+    if (p >= end) {
+        *pp = p;
+        return FALSE;
+    }
+    word->p = p;
+    while (p < end && !isspace_fox(*p)) {
+        p++;
+    }
+    word->size = p - word->p;
+    *pp = p;
+    return TRUE;
+}
 /**
  * XMLPatternListから、XMLNodeを選択
  */
@@ -480,24 +536,17 @@ static int select_xml_match_node(Ref *r, XMLPattern *pat)
             }
             break;
         }
+        case XT_ATTR_EXIST:
         case XT_ATTR_EQ:
         case XT_ATTR_MATCH:
         case XT_ATTR_FIRST: {
-            HashValueEntry *he;
-            Value key;
+            Value *vp = xml_attr_get(r->v[INDEX_ELEM_ATTR], attr->key.p, attr->key.size);
             RefStr *val;
-            Value v_rm = r->v[INDEX_ELEM_ATTR];
 
-            key = fs->cstr_Value(fs->cls_str, attr->key.p, attr->key.size);
-            // Str#_op_eqでは、例外が発生しないのでチェックを省略
-            if (!Value_isref(v_rm)) {
-                break;
-            }
-            fs->refmap_get(&he, Value_vp(v_rm), key);
-            if (he == NULL) {
+            if (vp == NULL) {
                 return FALSE;
             }
-            val = Value_vp(he->val);
+            val = Value_vp(*vp);
             switch (attr->type) {
             case XT_ATTR_EXIST:
                 break;
@@ -507,23 +556,13 @@ static int select_xml_match_node(Ref *r, XMLPattern *pat)
                 }
                 break;
             case XT_ATTR_MATCH: {
-                int i = 0;
-                int asize = attr->val.size;
+                const char *p = val->c;
+                const char *end = p + val->size;
                 int found = FALSE;
-                for (;;) {
-                    while (i < val->size - asize && isspace_fox(val->c[i])) {
-                        i++;
-                    }
-                    if (memcmp(val->c, attr->val.p + i, asize) == 0) {
-                        if (i + asize == val->size || isspace_fox(val->c[i + asize])) {
-                            found = TRUE;
-                            break;
-                        }
-                    }
-                    while (i < val->size - asize && !isspace_fox(val->c[i])) {
-                        i++;
-                    }
-                    if (i >= val->size - asize) {
+                Str word;
+                while (get_next_word(&word, &p, end)) {
+                    if (str_eq(word.p, word.size, attr->val.p, attr->val.size)) {
+                        found = TRUE;
                         break;
                     }
                 }
@@ -555,76 +594,454 @@ static int select_xml_match_node(Ref *r, XMLPattern *pat)
     return TRUE;
 }
 /**
- * v : 探索対象のXML
- * ra : 結果のXMLElem配列
+ * nodeのidx番目の要素が、xsのpos番目までに一致するか、右から照合する
  */
-static void select_xml_nodes_sub(RefArray *ra, XMLPatternList *pl, uint8_t *mask, Value v)
+static int select_match_chain(XMLSelectNode *node, int idx, XMLSelector *xs, int pos)
+{
+    XMLPattern *pat = xs->chain[pos];
+
+    if (!select_xml_match_node(node[idx].r, pat)) {
+        return FALSE;
+    }
+    if (pos == 0) {
+        return TRUE;
+    }
+    idx = node[idx].parent;
+    if (pat->subnode) {
+        for (; idx >= 0; idx = node[idx].parent) {
+            if (select_match_chain(node, idx, xs, pos - 1)) {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    } else {
+        return idx >= 0 && select_match_chain(node, idx, xs, pos - 1);
+    }
+}
+static int select_match_list(XMLSelectNode *node, int idx, XMLPatternList *pl)
 {
     int i;
-    int num = pl->num;
+    for (i = 0; i < pl->num; i++) {
+        XMLSelector *xs = &pl->sel[i];
+        if (select_match_chain(node, idx, xs, xs->size - 1)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/**
+ * v : 探索対象のXML
+ * st->ra : 結果のXMLElem配列
+ */
+static void select_xml_nodes_sub(XMLSelectState *st, Value v)
+{
+    int depth = st->depth;
     Ref *r;
-    uint8_t *mask2 = mask;
+    int i;
+
     if (fs->Value_type(v) != cls_elem) {
         return;
     }
-
     r = Value_vp(v);
-    for (i = 0; i < num; i++) {
-        if (mask[i]) {
-            XMLPattern *pat = pl->p[i];
-            if (select_xml_match_node(r, pat)) {
-                if (pat->next == NULL) {
-                    Value *ve = fs->refarray_push(ra);
-                    *ve = fs->Value_cp(v);
-                }
-                if (pat->next != NULL) {
-                    if (mask2 == mask) {
-                        int j;
-                        mask2 = malloc(num);
-                        for (j = 0; j < num; j++) {
-                            if (mask[j] && pl->p[j]->subnode) {
-                                mask2[j] = TRUE;
-                            } else {
-                                mask2[j] = FALSE;
-                            }
-                        }
-                    }
-                    XMLPatternList_mark(pl, mask, pat->next->index);
-                }
-            }
+
+    if (depth >= st->max) {
+        st->max = (st->max > 0 ? st->max * 2 : 32);
+        st->stack = realloc(st->stack, sizeof(XMLSelectNode) * st->max);
+    }
+    st->stack[depth].r = r;
+    st->stack[depth].parent = depth - 1;
+
+    for (i = 0; i < st->num; i++) {
+        if (select_match_list(st->stack, depth, &st->pl[i])) {
+            Value *ve = fs->refarray_push(st->ra[i]);
+            *ve = fs->Value_cp(v);
         }
     }
 
     {
         RefArray *ra2 = Value_vp(r->v[INDEX_ELEM_CHILDREN]);
+        st->depth = depth + 1;
         for (i = 0; i < ra2->size; i++) {
-            select_xml_nodes_sub(ra, pl, mask2, ra2->p[i]);
+            select_xml_nodes_sub(st, ra2->p[i]);
+        }
+        st->depth = depth;
+    }
+}
+/**
+ * 1回の走査で、num個のセレクタの結果をそれぞれraに追加する
+ */
+static void select_xml_nodes(RefArray **ra, XMLPatternList *pl, int num, Value *v, int v_num)
+{
+    XMLSelectState st;
+    int i;
+
+    st.pl = pl;
+    st.ra = ra;
+    st.num = num;
+    st.stack = NULL;
+    st.depth = 0;
+    st.max = 0;
+
+    for (i = 0; i < v_num; i++) {
+        select_xml_nodes_sub(&st, v[i]);
+    }
+    free(st.stack);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t xml_index_hash(const char *p, int size)
+{
+    uint32_t hash = 0;
+    int i;
+    for (i = 0; i < size; i++) {
+        hash = hash * 31 + (uint8_t)p[i];
+    }
+    return hash;
+}
+static XMLIndexEntry *XMLIndexTable_find(XMLIndexTable *t, const char *p, int size, uint32_t hash)
+{
+    uint32_t mask = t->entry_num - 1;
+    uint32_t i;
+
+    if (t->entry_num == 0) {
+        return NULL;
+    }
+    for (i = hash & mask; t->entry[i].p != NULL; i = (i + 1) & mask) {
+        XMLIndexEntry *e = &t->entry[i];
+        if (e->hash == hash && str_eq(e->p, e->size, p, size)) {
+            return e;
         }
-        if (mask != mask2) {
-            free(mask2);
+    }
+    return &t->entry[i];
+}
+static void XMLIndexTable_grow(XMLIndexTable *t)
+{
+    XMLIndexEntry *old = t->entry;
+    int old_num = t->entry_num;
+    int i;
+
+    t->entry_num = (old_num > 0 ? old_num * 2 : 64);
+    t->entry = malloc(sizeof(XMLIndexEntry) * t->entry_num);
+    memset(t->entry, 0, sizeof(XMLIndexEntry) * t->entry_num);
+
+    for (i = 0; i < old_num; i++) {
+        if (old[i].p != NULL) {
+            XMLIndexEntry *e = XMLIndexTable_find(t, old[i].p, old[i].size, old[i].hash);
+            *e = old[i];
         }
     }
+    free(old);
 }
-static void select_xml_nodes(RefArray *ra, XMLPatternList *pl, Value *v, Mem *mem)
+/**
+ * p, sizeは索引を破棄するまで有効であること
+ */
+static void XMLIndexTable_add(XMLIndexTable *t, const char *p, int size, int pos)
 {
-    uint8_t *mask = NULL;
+    uint32_t hash = xml_index_hash(p, size);
+    XMLIndexEntry *e;
 
-    if (pl->root == NULL || pl->num == 0) {
+    if ((t->count + 1) * 2 > t->entry_num) {
+        XMLIndexTable_grow(t);
+    }
+    e = XMLIndexTable_find(t, p, size, hash);
+    if (e->p == NULL) {
+        e->p = p;
+        e->size = size;
+        e->hash = hash;
+        t->count++;
+    } else if (e->pos[e->num - 1] == pos) {
+        // class="a a"
         return;
     }
-    mask = malloc(pl->num);
-    memset(mask, 0, pl->num);
-    XMLPatternList_mark(pl, mask, 0);
+    if (e->num >= e->max) {
+        e->max = (e->max > 0 ? e->max * 2 : 4);
+        e->pos = realloc(e->pos, sizeof(int) * e->max);
+    }
+    e->pos[e->num++] = pos;
+}
+static void XMLIndexTable_close(XMLIndexTable *t)
+{
+    int i;
+    for (i = 0; i < t->entry_num; i++) {
+        free(t->entry[i].pos);
+    }
+    free(t->entry);
+    t->entry = NULL;
+    t->entry_num = 0;
+    t->count = 0;
+}
+
+static void xml_index_build_sub(RefXMLIndex *xi, Value v, int parent)
+{
+    Ref *r;
+    RefStr *name;
+    Value *vp;
+    int pos;
+
+    if (fs->Value_type(v) != cls_elem) {
+        return;
+    }
+    r = Value_vp(v);
+    if (xi->node_num >= xi->node_max) {
+        xi->node_max = (xi->node_max > 0 ? xi->node_max * 2 : 256);
+        xi->node = realloc(xi->node, sizeof(XMLSelectNode) * xi->node_max);
+    }
+    pos = xi->node_num++;
+    xi->node[pos].r = r;
+    xi->node[pos].parent = parent;
+
+    name = Value_vp(r->v[INDEX_ELEM_NAME]);
+    XMLIndexTable_add(&xi->name, name->c, name->size, pos);
+
+    vp = xml_attr_get(r->v[INDEX_ELEM_ATTR], "id", 2);
+    if (vp != NULL) {
+        RefStr *rs = Value_vp(*vp);
+        XMLIndexTable_add(&xi->id, rs->c, rs->size, pos);
+    }
+    vp = xml_attr_get(r->v[INDEX_ELEM_ATTR], "class", 5);
+    if (vp != NULL) {
+        RefStr *rs = Value_vp(*vp);
+        const char *p = rs->c;
+        Str word;
+        while (get_next_word(&word, &p, rs->c + rs->size)) {
+            XMLIndexTable_add(&xi->klass, word.p, word.size, pos);
+        }
+    }
+
+    {
+        RefArray *ra = Value_vp(r->v[INDEX_ELEM_CHILDREN]);
+        int i;
+        for (i = 0; i < ra->size; i++) {
+            xml_index_build_sub(xi, ra->p[i], pos);
+        }
+    }
+    xi->node[pos].end = xi->node_num;
+}
+static void xml_index_clear(RefXMLIndex *xi)
+{
+    free(xi->node);
+    xi->node = NULL;
+    xi->node_num = 0;
+    xi->node_max = 0;
+    XMLIndexTable_close(&xi->name);
+    XMLIndexTable_close(&xi->id);
+    XMLIndexTable_close(&xi->klass);
+    xi->built = FALSE;
+}
+int xmlindex_dispose(Value *vret, Value *v, RefNode *node)
+{
+    RefXMLIndex *xi = Value_vp(*v);
+    xml_index_clear(xi);
+    return TRUE;
+}
+/**
+ * 要素の索引を返す
+ * 同じ要素に対して、変更されないまま2回以上selectを呼んだ時に作成する
+ * 索引が使えない場合はNULL
+ */
+static RefXMLIndex *xml_index_get(Value v)
+{
+    Ref *r = Value_vp(v);
+    RefXMLIndex *xi;
+
+    if (!Value_isref(r->v[INDEX_ELEM_INDEX])) {
+        xi = fs->buf_new(cls_xmlindex, sizeof(RefXMLIndex));
+        xi->modify_count = xml_modify_count;
+        r->v[INDEX_ELEM_INDEX] = vp_Value(xi);
+        return NULL;
+    }
+    xi = Value_vp(r->v[INDEX_ELEM_INDEX]);
+    if (xi->modify_count != xml_modify_count) {
+        xml_index_clear(xi);
+        xi->modify_count = xml_modify_count;
+        return NULL;
+    }
+    if (!xi->built) {
+        xml_index_build_sub(xi, v, -1);
+        xi->built = TRUE;
+    }
+    return xi;
+}
+/**
+ * id, class, 要素名のうち、一致する要素が最も少ないものを返す
+ * 手がかりが無ければNULL
+ */
+static XMLIndexEntry *xml_index_anchor(RefXMLIndex *xi, XMLPattern *pat)
+{
+    static XMLIndexEntry empty;
+    XMLIndexEntry *found = NULL;
+    XMLAttrPattern *attr;
+
+    for (attr = pat->attr; attr != NULL; attr = attr->next) {
+        XMLIndexTable *t;
+        XMLIndexEntry *e;
+
+        if (attr->type == XT_ATTR_EQ && str_eq(attr->key.p, attr->key.size, "id", 2)) {
+            t = &xi->id;
+        } else if (attr->type == XT_ATTR_MATCH && str_eq(attr->key.p, attr->key.size, "class", 5)) {
+            t = &xi->klass;
+        } else if (attr->type == XT_NAME) {
+            t = &xi->name;
+        } else {
+            continue;
+        }
+        e = XMLIndexTable_find(t, attr->val.p, attr->val.size, xml_index_hash(attr->val.p, attr->val.size));
+        if (e == NULL || e->p == NULL) {
+            // 一致する要素が無い
+            return &empty;
+        }
+        if (found == NULL || e->num < found->num) {
+            found = e;
+        }
+    }
+    return found;
+}
+/**
+ * 照合する要素の位置を絞り込む
+ * 一番右の要素の手がかりか、祖先の手がかりの子孫のうち、少ない方を使う
+ * *pallocがTRUEの場合、戻り値をfreeする
+ * 絞り込めない場合はNULLを返し、*pnumに全要素数を設定
+ */
+static int *xml_index_candidate(RefXMLIndex *xi, XMLSelector *xs, int *pnum, int *palloc)
+{
+    XMLIndexEntry *e_subj = xml_index_anchor(xi, xs->chain[xs->size - 1]);
+    XMLIndexEntry *e_anc = NULL;
+    int n_subj = (e_subj != NULL ? e_subj->num : xi->node_num);
+    int i;
+
+    *palloc = FALSE;
+    for (i = 0; i < xs->size - 1; i++) {
+        XMLIndexEntry *e = xml_index_anchor(xi, xs->chain[i]);
+        if (e != NULL && (e_anc == NULL || e->num < e_anc->num)) {
+            e_anc = e;
+        }
+    }
+
+    if (e_anc != NULL && e_anc->num < n_subj) {
+        // 祖先の範囲内にある要素
+        int *cand = NULL;
+        int num = 0;
+        int max = 0;
+        int done = 0;
+
+        for (i = 0; i < e_anc->num; i++) {
+            int lo = e_anc->pos[i] + 1;
+            int hi = xi->node[e_anc->pos[i]].end;
+            int j;
+
+            if (lo < done) {
+                lo = done;
+            }
+            if (lo >= hi) {
+                continue;
+            }
+            done = hi;
 
-    select_xml_nodes_sub(ra, pl, mask, *v);
-    free(mask);
+            if (e_subj != NULL) {
+                // 二分探索でlo以上の最初の位置を探す
+                int l = 0, r = e_subj->num;
+                while (l < r) {
+                    int m = (l + r) / 2;
+                    if (e_subj->pos[m] < lo) {
+                        l = m + 1;
+                    } else {
+                        r = m;
+                    }
+                }
+                for (j = l; j < e_subj->num && e_subj->pos[j] < hi; j++) {
+                    if (num >= max) {
+                        max = (max > 0 ? max * 2 : 32);
+                        cand = realloc(cand, sizeof(int) * max);
+                    }
+                    cand[num++] = e_subj->pos[j];
+                }
+            } else {
+                if (num + (hi - lo) > max) {
+                    max = num + (hi - lo) + 32;
+                    cand = realloc(cand, sizeof(int) * max);
+                }
+                for (j = lo; j < hi; j++) {
+                    cand[num++] = j;
+                }
+            }
+        }
+        *pnum = num;
+        *palloc = TRUE;
+        return cand;
+    }
+    if (e_subj != NULL) {
+        *pnum = e_subj->num;
+        return e_subj->pos;
+    }
+    *pnum = xi->node_num;
+    return NULL;
+}
+static int int_cmp(const void *p1, const void *p2)
+{
+    int i1 = *(const int*)p1;
+    int i2 = *(const int*)p2;
+    return (i1 > i2) - (i1 < i2);
+}
+static void select_xml_index(RefArray *ra, XMLPatternList *pl, RefXMLIndex *xi)
+{
+    int *found = NULL;
+    int n_found = 0;
+    int max_found = 0;
+    int i, j;
+
+    for (i = 0; i < pl->num; i++) {
+        XMLSelector *xs = &pl->sel[i];
+        int num, alloc;
+        int *cand = xml_index_candidate(xi, xs, &num, &alloc);
+
+        for (j = 0; j < num; j++) {
+            int pos = (cand != NULL ? cand[j] : j);
+            if (select_match_chain(xi->node, pos, xs, xs->size - 1)) {
+                if (n_found >= max_found) {
+                    max_found = (max_found > 0 ? max_found * 2 : 32);
+                    found = realloc(found, sizeof(int) * max_found);
+                }
+                found[n_found++] = pos;
+            }
+        }
+        if (alloc) {
+            free(cand);
+        }
+    }
+    // 複数のセレクタに一致したものを除いて、文書順に並べる
+    if (pl->num > 1 && n_found > 1) {
+        int n = 1;
+        qsort(found, n_found, sizeof(int), int_cmp);
+        for (i = 1; i < n_found; i++) {
+            if (found[i] != found[n - 1]) {
+                found[n++] = found[i];
+            }
+        }
+        n_found = n;
+    }
+    for (i = 0; i < n_found; i++) {
+        Value *ve = fs->refarray_push(ra);
+        *ve = fs->Value_cp(vp_Value(xi->node[found[i]].r));
+    }
+    free(found);
 }
 
+/**
+ * 1つの要素から探索する場合は索引を使う
+ */
+static RefXMLIndex *select_css_index(Value *v, int num)
+{
+    if (num == 1 && fs->Value_type(v[0]) == cls_elem) {
+        return xml_index_get(v[0]);
+    }
+    return NULL;
+}
 int select_css(Value *vret, Value *v, int num, Str sel)
 {
     Mem mem;
-    int i;
     XMLPatternList pl;
+    RefXMLIndex *xi;
     RefArray *ra = fs->refarray_new(0);
 
     *vret = vp_Value(ra);
@@ -635,8 +1052,60 @@ int select_css(Value *vret, Value *v, int num, Str sel)
         fs->Mem_close(&mem);
         return FALSE;
     }
-    for (i = 0; i < num; i++) {
-        select_xml_nodes(ra, &pl, &v[i], &mem);
+    xi = select_css_index(v, num);
+    if (xi != NULL) {
+        select_xml_index(ra, &pl, xi);
+    } else {
+        select_xml_nodes(&ra, &pl, 1, v, num);
+    }
+    fs->Mem_close(&mem);
+    return TRUE;
+}
+/**
+ * 複数のセレクタの結果をまとめて返す
+ * 索引が無い場合は、1回の走査ですべてのセレクタを評価する
+ */
+int select_css_many(Value *vret, Value *v, int num, RefArray *sels)
+{
+    Mem mem;
+    XMLPatternList *pl;
+    RefArray **ra;
+    RefXMLIndex *xi;
+    RefArray *ret = fs->refarray_new(sels->size);
+    int i;
+
+    *vret = vp_Value(ret);
+    for (i = 0; i < sels->size; i++) {
+        RefNode *type = fs->Value_type(sels->p[i]);
+        if (type != fs->cls_str) {
+            fs->throw_errorf(fs->mod_lang, "TypeError", "List of Str required but %n found", type);
+            return FALSE;
+        }
+    }
+
+    fs->Mem_init(&mem, 512);
+    pl = fs->Mem_get(&mem, sizeof(XMLPatternList) * (sels->size + 1));
+    ra = fs->Mem_get(&mem, sizeof(RefArray*) * (sels->size + 1));
+    for (i = 0; i < sels->size; i++) {
+        RefStr *rs = Value_vp(sels->p[i]);
+        if (!parse_css_selector(&pl[i], Str_new(rs->c, rs->size), &mem)) {
+            fs->Mem_close(&mem);
+            return FALSE;
+        }
+    }
+    for (i = 0; i < sels->size; i++) {
+        ra[i] = fs->refarray_new(0);
+        ra[i]->rh.type = cls_nodelist;
+        ret->p[i] = vp_Value(ra[i]);
+    }
+
+    xi = select_css_index(v, num);
+    if (xi != NULL) {
+        for (i = 0; i < sels->size; i++) {
+            select_xml_index(ra[i], &pl[i], xi);
+        }
+    } else {
+        select_xml_nodes(ra, pl, sels->size, v, num);
     }
     fs->Mem_close(&mem);
     return TRUE;
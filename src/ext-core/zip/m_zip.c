@@ -2,6 +2,7 @@
 #include "zipfile.h"
 #include "m_number.h"
 #include "m_codecvt.h"
+#include "compat.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -33,7 +34,7 @@ void CodeCVTStatic_init()
 }
 
 
-static int get_reader_file_size(int *pret, Value reader)
+static int get_reader_file_size(int64_t *pret, Value reader)
 {
     RefNode *ret_type;
     int64_t ret;
@@ -51,7 +52,7 @@ static int get_reader_file_size(int *pret, Value reader)
     ret = fs->Value_int64(fg->stk_top[-1], NULL);
     fs->Value_pop();
 
-    if (ret > INT32_MAX || ret < 0) {
+    if (ret < 0) {
         fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
         return FALSE;
     }
@@ -66,10 +67,23 @@ static int deflateio_new(Value *vret, Value *v, RefNode *node)
 {
     int flags = 0;
     int level = 6; // default
+    int n_thread = 0;
     Value v1 = v[1];
     Ref *r = fs->ref_new(FUNC_VP(node));
     *vret = vp_Value(r);
 
+    // 同時に圧縮するブロック数 (0:CPU数)
+    if (fg->stk_top > v + 4) {
+        int64_t th = fs->Value_int64(v[4], NULL);
+        if (th < 0 || th > 256) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Illigal threads value %v (0 - 256)", v[4]);
+            return FALSE;
+        }
+        n_thread = th;
+    }
+    if (n_thread == 0) {
+        n_thread = get_cpu_count();
+    }
     // modeの解析
     if (fg->stk_top > v + 3) {
         int lv = fs->Value_int64(v[3], NULL);
@@ -91,7 +105,9 @@ static int deflateio_new(Value *vret, Value *v, RefNode *node)
     }
 
     if (fs->Value_type(v1) == fs->cls_bytesio) {
-        flags = STREAM_READ|STREAM_WRITE;
+        RefBytesIO *mb = Value_vp(v1);
+        // マップしたファイルは読み込みのみ
+        flags = mb->mapped ? STREAM_READ : STREAM_READ|STREAM_WRITE;
     } else {
         Ref *r1 = Value_ref(v1);
         // 引数のStreamに応じて読み書き可能モードを設定する
@@ -106,6 +122,7 @@ static int deflateio_new(Value *vret, Value *v, RefNode *node)
 
     r->v[INDEX_Z_STREAM] = fs->Value_cp(v1);
     r->v[INDEX_Z_LEVEL] = int32_Value(level);
+    r->v[INDEX_Z_THREAD] = int32_Value(n_thread);
 
     return TRUE;
 }
@@ -115,6 +132,7 @@ static void deflateio_close_all(Ref *r)
     void *p_z_in = Value_ptr(r->v[INDEX_Z_IN_BUF]);
     z_stream *zs_in = Value_ptr(r->v[INDEX_Z_IN]);
     z_stream *zs_out = Value_ptr(r->v[INDEX_Z_OUT]);
+    PDeflate *pd = Value_ptr(r->v[INDEX_Z_PDEFLATE]);
 
     if (zs_in != NULL) {
         inflateEnd(zs_in);
@@ -126,6 +144,10 @@ static void deflateio_close_all(Ref *r)
         free(zs_out);
         r->v[INDEX_Z_OUT] = VALUE_NULL;
     }
+    if (pd != NULL) {
+        pdeflate_free(pd);
+        r->v[INDEX_Z_PDEFLATE] = VALUE_NULL;
+    }
     if (p_z_in != NULL) {
         free(p_z_in);
         r->v[INDEX_Z_IN_BUF] = VALUE_NULL;
@@ -163,10 +185,25 @@ static int deflateio_close(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     z_stream *zs = Value_ptr(r->v[INDEX_Z_OUT]);
+    PDeflate *pd = Value_ptr(r->v[INDEX_Z_PDEFLATE]);
     int out_len = Value_integral(r->v[INDEX_WRITE_MAX]);
     char *mb_buf = malloc(out_len);
 
-    if (zs != NULL) {
+    if (pd != NULL) {
+        StrBuf out;
+        fs->StrBuf_init(&out, 0);
+        if (!pdeflate_finish(pd, &out, TRUE)) {
+            fs->throw_errorf(mod_zip, "DeflateError", "%s", pdeflate_error(pd));
+            StrBuf_close(&out);
+            goto ERROR_END;
+        }
+        if (!fs->stream_write_data(r->v[INDEX_Z_STREAM], out.p, out.size)) {
+            StrBuf_close(&out);
+            goto ERROR_END;
+        }
+        StrBuf_close(&out);
+        free(mb_buf);
+    } else if (zs != NULL) {
         zs->next_in = (Bytef*)"";
         zs->avail_in = 0;
         zs->next_out = (Bytef*)mb_buf;
@@ -201,6 +238,38 @@ ERROR_END:
     free(mb_buf);
     return FALSE;
 }
+// ブロックに分けて並列に圧縮しながら書き込み
+static int deflateio_write_parallel(Ref *r, Str data)
+{
+    PDeflate *pd = Value_ptr(r->v[INDEX_Z_PDEFLATE]);
+    StrBuf out;
+
+    if (pd == NULL) {
+        int level = Value_integral(r->v[INDEX_Z_LEVEL]);
+        int wrap = PDEFLATE_ZLIB;
+        if ((level & Z_MODE_GZIP) != 0) {
+            level &= ~Z_MODE_GZIP;
+            wrap = PDEFLATE_GZIP;
+        }
+        pd = pdeflate_new(level, wrap, Value_integral(r->v[INDEX_Z_THREAD]));
+        r->v[INDEX_Z_PDEFLATE] = ptr_Value(pd);
+    }
+
+    fs->StrBuf_init(&out, 0);
+    if (!pdeflate_write(pd, &out, data.p, data.size)) {
+        fs->throw_errorf(mod_zip, "DeflateError", "%s", pdeflate_error(pd));
+        goto ERROR_END;
+    }
+    if (out.size > 0 && !fs->stream_write_data(r->v[INDEX_Z_STREAM], out.p, out.size)) {
+        goto ERROR_END;
+    }
+    StrBuf_close(&out);
+    return TRUE;
+
+ERROR_END:
+    StrBuf_close(&out);
+    return FALSE;
+}
 // 圧縮しながら書き込み
 static int deflateio_write(Value *vret, Value *v, RefNode *node)
 {
@@ -209,8 +278,17 @@ static int deflateio_write(Value *vret, Value *v, RefNode *node)
     int out_len = Value_integral(r->v[INDEX_WRITE_MAX]);
     RefBytesIO *mb = Value_vp(v[1]);
     Str data = Str_new(mb->buf.p, mb->buf.size);
-    char *mb_buf = malloc(out_len);
+    char *mb_buf;
+
+    if (Value_integral(r->v[INDEX_Z_THREAD]) > 1) {
+        if (!deflateio_write_parallel(r, data)) {
+            return FALSE;
+        }
+        *vret = int32_Value(data.size);
+        return TRUE;
+    }
 
+    mb_buf = malloc(out_len);
     if (zs == NULL) {
         if (!deflateio_init_write(r, mb_buf, out_len, data)) {
             goto ERROR_END;
@@ -371,7 +449,7 @@ static int zip_randomreader_new(Value *vret, Value *v, RefNode *node)
     CentralDirEnd *cdir = NULL;
     RefCharset *cs;
     RefTimeZone *tz;
-    int file_size;
+    int64_t file_size;
 
     Value v1 = v[1];
     Ref *r = fs->ref_new(cls_zipreader);
@@ -476,42 +554,37 @@ static int zip_randomreader_index(Value *vret, Value *v, RefNode *node)
         Ref *r = Value_ref(*v);
         CentralDirEnd *cdir = Value_ptr(r->v[INDEX_ZIPREADER_CDIR]);
         RefStr *name = Value_vp(v[1]);
-        StrBuf sb;
-        int i;
-        int local_str = FALSE;
+        int idx = -1;
+        int idx2;
 
-        fs->StrBuf_init(&sb, 0);
-        // 文字コードを変換
+        if (cdir == NULL) {
+            fs->throw_errorf(mod_zip, "ZipError", "Already closed");
+            return FALSE;
+        }
+        // 文字コードを変換して、UTF-8フラグが立っていないエントリから探す
         if (v_type == fs->cls_str && cdir->cs != fs->cs_utf8) {
             FConv cv;
             FCharset *fc;
+            StrBuf sb;
             CodeCVTStatic_init();
             fc = codecvt->RefCharset_get_fcharset(cdir->cs, TRUE);
             if (fc == NULL) {
                 return FALSE;
             }
+            fs->StrBuf_init(&sb, 0);
             codecvt->FConv_init(&cv, fc, FALSE, "?");
             codecvt->FConv_conv_strbuf(&cv, &sb, name->c, name->size, FALSE);
-            local_str = TRUE;
+            idx = CentralDirEnd_find(cdir, sb.p, sb.size, TRUE);
+            StrBuf_close(&sb);
         }
-        for (i = 0; i < cdir->cdir_size; i++) {
-            CentralDir *cd = &cdir->cdir[i];
-            // 設定された文字コードがUTF-8以外で、ファイル名にUTF-8フラグが立っていない
-            if (cdir->cs != fs->cs_utf8 && (cd->flags & CDIR_FLAG_UTF8) == 0) {
-                if (local_str) {
-                    if (sb.size == cd->filename.size && memcmp(sb.p, cd->filename.p, sb.size) == 0) {
-                        zipentry_new_sub(vret, *v, cd);
-                        break;
-                    }
-                }
-            } else {
-                if (name->size == cd->filename.size && memcmp(name->c, cd->filename.p, name->size) == 0) {
-                    zipentry_new_sub(vret, *v, cd);
-                    break;
-                }
-            }
+        // 同じ名前があれば、前にある方を返す
+        idx2 = CentralDirEnd_find(cdir, name->c, name->size, FALSE);
+        if (idx2 >= 0 && (idx < 0 || idx2 < idx)) {
+            idx = idx2;
+        }
+        if (idx >= 0) {
+            zipentry_new_sub(vret, *v, &cdir->cdir[idx]);
         }
-        StrBuf_close(&sb);
     } else {
         fs->throw_errorf(fs->mod_lang, "TypeError", "Int or Sequence required but %n", v_type);
         return FALSE;
@@ -574,7 +647,10 @@ static int zipreader_next(Value *vret, Value *v, RefNode *node)
         return FALSE;
     }
     if (cd != NULL) {
+        // ZipEntryにコピーする
         zipentry_new_sub(vret, VALUE_NULL, cd);
+        StrBuf_close(&cd->filename);
+        free(cd);
     } else {
         fs->throw_stopiter();
         return FALSE;
@@ -640,22 +716,15 @@ static int zipwriter_close(Value *vret, Value *v, RefNode *node)
 }
 
 static int zipentry_finish_sub(CentralDir *cd);
+static int zipentry_finish_deflate(CentralDir *cd, int parallel);
 
-static int zipwriter_write(Value *vret, Value *v, RefNode *node)
+static int zipwriter_write_sub(Value dest, CentralDirEnd *cdir, Value v1)
 {
-    Ref *r = Value_ref(*v);
-    CentralDirEnd *cdir = Value_ptr(r->v[INDEX_ZIPWRITER_CDIR]);
-    Value v1 = v[1];
     RefNode *v1_type = fs->Value_type(v1);
 
-    if (cdir == NULL) {
-        fs->throw_errorf(fs->mod_lang, "ZipError", "ZipWriter already closed");
-        return FALSE;
-    }
-
     if (v1_type == fs->cls_bytes) {
         RefStr *data = Value_vp(v1);
-        if (!write_bin_data(cdir, r->v[INDEX_ZIPWRITER_DEST], data->c, data->size)) {
+        if (!write_bin_data(cdir, dest, data->c, data->size)) {
             return FALSE;
         }
     } else if (v1_type == cls_zipentry) {
@@ -674,61 +743,158 @@ static int zipwriter_write(Value *vret, Value *v, RefNode *node)
             }
             cd->z_finish = TRUE;
         }
-        if (!write_local_data(cdir, r->v[INDEX_ZIPWRITER_DEST], r1)) {
+        if (!write_local_data(cdir, dest, r1)) {
             return FALSE;
         }
     } else {
         fs->throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, cls_zipentry, fs->cls_bytes, v1_type, 1);
         return FALSE;
     }
+    return TRUE;
+}
+static int zipwriter_write(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    CentralDirEnd *cdir = Value_ptr(r->v[INDEX_ZIPWRITER_CDIR]);
+
+    if (cdir == NULL) {
+        fs->throw_errorf(fs->mod_lang, "ZipError", "ZipWriter already closed");
+        return FALSE;
+    }
+    if (!zipwriter_write_sub(r->v[INDEX_ZIPWRITER_DEST], cdir, v[1])) {
+        return FALSE;
+    }
 
     return TRUE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    CentralDir **cd;
+    int n_cd;
+    int step;
+    int parallel;
+} ZipFinishBand;
 
-static int zipentry_finish_sub(CentralDir *cd)
+static void zipwriter_finish_band(void *arg)
 {
-    int size_prev = cd->data.size;
-    fs->StrBuf_alloc(&cd->data, size_prev + BUFFER_SIZE);
-    cd->data.size = size_prev;
+    ZipFinishBand *b = arg;
+    int i;
 
-    cd->z.next_in = NULL;
-    cd->z.avail_in = 0;
-    cd->z.next_out = (Bytef*)&cd->data.p[size_prev];
-    cd->z.avail_out = cd->data.alloc_size - size_prev;
+    for (i = 0; i < b->n_cd; i += b->step) {
+        zipentry_finish_deflate(b->cd[i], b->parallel);
+    }
+}
+/*
+ * 複数のエントリを書き込む
+ * 圧縮が終わっていないエントリは、エントリごとに別のスレッドで圧縮する
+ */
+static int zipwriter_write_all(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    CentralDirEnd *cdir = Value_ptr(r->v[INDEX_ZIPWRITER_CDIR]);
+    RefArray *ra = Value_vp(v[1]);
+    CentralDir **cd_list;
+    int n_cd = 0;
+    int i;
 
-    if (cd->z_init != Z_STREAM_DEFLATE) {
-        int ret = deflateInit2(&cd->z, cd->level, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL, 0);
-        if (ret != Z_OK) {
-            fs->throw_errorf(mod_zip, "DeflateError", "%s", zError(ret));
-            return FALSE;
-        }
-        cd->z_init = Z_STREAM_DEFLATE;
+    if (cdir == NULL) {
+        fs->throw_errorf(fs->mod_lang, "ZipError", "ZipWriter already closed");
+        return FALSE;
     }
-    for (;;) {  // 終端処理をしないので、入力がなくなったら終了
-        int ret = deflate(&cd->z, Z_FINISH);
 
-        if (ret == Z_BUF_ERROR || ret == Z_STREAM_END){   // 出力してバッファを空にする
-            cd->data.size = cd->z.next_out - (Bytef*)cd->data.p;
-            if (ret == Z_STREAM_END) {
-                break;
+    cd_list = malloc(sizeof(CentralDir*) * (ra->size + 1));
+    for (i = 0; i < ra->size; i++) {
+        Value v1 = ra->p[i];
+        RefNode *v1_type = fs->Value_type(v1);
+
+        if (v1_type == cls_zipentry) {
+            Ref *r1 = Value_ref(v1);
+            CentralDir *cd = Value_ptr(r1->v[INDEX_ZIPENTRY_CDIR]);
+            if (cd == NULL) {
+                fs->throw_errorf(fs->mod_lang, "ZipError", "ZipEntry already closed");
+                goto ERROR_END;
+            }
+            if (!fs->stream_flush_sub(v1)) { 
+                goto ERROR_END;
             }
+            if (cd->method == ZIP_CM_DEFLATE && cd->z_init == Z_STREAM_DEFLATE && !cd->z_finish) {
+                cd_list[n_cd++] = cd;
+            }
+        } else if (v1_type != fs->cls_bytes) {
+            fs->throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, cls_zipentry, fs->cls_bytes, v1_type, 1);
+            goto ERROR_END;
+        }
+    }
 
-            size_prev = cd->data.size;
-            fs->StrBuf_alloc(&cd->data, size_prev + BUFFER_SIZE);
-            cd->data.size = size_prev;
+    if (n_cd > 1) {
+        int n_band = get_cpu_count();
+        ZipFinishBand *band;
 
-            cd->z.avail_out = cd->data.alloc_size - size_prev;
-            cd->z.next_out = (Bytef*)&cd->data.p[size_prev];
-        } else if (ret != Z_OK) {
-            fs->throw_errorf(mod_zip, "DeflateError", "%s", cd->z.msg);
+        if (n_band > n_cd) {
+            n_band = n_cd;
+        }
+        band = malloc(sizeof(ZipFinishBand) * n_band);
+        for (i = 0; i < n_band; i++) {
+            band[i].cd = cd_list + i;
+            band[i].n_cd = n_cd - i;
+            band[i].step = n_band;
+            band[i].parallel = (n_band == 1);
+        }
+        run_parallel(zipwriter_finish_band, band, sizeof(ZipFinishBand), n_band);
+        free(band);
+
+        for (i = 0; i < n_cd; i++) {
+            CentralDir *cd = cd_list[i];
+            if (cd->pd != NULL) {
+                fs->throw_errorf(mod_zip, "DeflateError", "%s", pdeflate_error(cd->pd));
+                goto ERROR_END;
+            }
+            cd->z_finish = TRUE;
+        }
+    }
+    free(cd_list);
+
+    for (i = 0; i < ra->size; i++) {
+        if (!zipwriter_write_sub(r->v[INDEX_ZIPWRITER_DEST], cdir, ra->p[i])) {
             return FALSE;
         }
     }
+
+    return TRUE;
+
+ERROR_END:
+    free(cd_list);
+    return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 残りの入力を圧縮する
+ * ワーカースレッドからも呼ばれるので、fs->の関数を使わないこと
+ */
+static int zipentry_finish_deflate(CentralDir *cd, int parallel)
+{
+    if (cd->pd == NULL) {
+        cd->pd = pdeflate_new(cd->level, PDEFLATE_RAW, cd->n_thread);
+        cd->z_init = Z_STREAM_DEFLATE;
+    }
+    if (!pdeflate_finish(cd->pd, &cd->data, parallel)) {
+        return FALSE;
+    }
+    pdeflate_free(cd->pd);
+    cd->pd = NULL;
     cd->size_compressed = cd->data.size;
     return TRUE;
 }
+static int zipentry_finish_sub(CentralDir *cd)
+{
+    if (!zipentry_finish_deflate(cd, TRUE)) {
+        fs->throw_errorf(mod_zip, "DeflateError", "%s", pdeflate_error(cd->pd));
+        return FALSE;
+    }
+    return TRUE;
+}
 
 static int zipentry_new(Value *vret, Value *v, RefNode *node)
 {
@@ -752,19 +918,29 @@ static int zipentry_new(Value *vret, Value *v, RefNode *node)
             return FALSE;
         }
     }
+    cd->crc32 = crc32(0, Z_NULL, 0);
+    cd->z_init = Z_STREAM_NONE;
+    cd->level = 6;
+    cd->n_thread = 0;
+    r->v[INDEX_ZIPENTRY_CDIR] = ptr_Value(cd);
+
     if (fg->stk_top > v + 2) {
         int64_t level = fs->Value_int64(v[2], NULL);
         if (level < 0 || level > 9) {
-            fs->throw_errorf(fs->mod_lang, "ValueError", "Invalid compress level %v (0 - 9)", &v[2]);
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Invalid compress level %v (0 - 9)", v[2]);
             return FALSE;
         }
         cd->level = level;
     }
-
-    cd->crc32 = crc32(0, Z_NULL, 0);
-    cd->z_init = Z_STREAM_NONE;
-    cd->level = 6;
-    r->v[INDEX_ZIPENTRY_CDIR] = ptr_Value(cd);
+    // 同時に圧縮するブロック数 (0:CPU数)
+    if (fg->stk_top > v + 3) {
+        int64_t th = fs->Value_int64(v[3], NULL);
+        if (th < 0 || th > 256) {
+            fs->throw_errorf(fs->mod_lang, "ValueError", "Invalid threads value %v (0 - 256)", v[3]);
+            return FALSE;
+        }
+        cd->n_thread = th;
+    }
 
     return TRUE;
 }
@@ -784,7 +960,8 @@ static int zipentry_close(Value *vret, Value *v, RefNode *node)
             cd->z_init = Z_STREAM_NONE;
             break;
         case Z_STREAM_DEFLATE:
-            deflateEnd(&cd->z);
+            pdeflate_free(cd->pd);
+            cd->pd = NULL;
             cd->z_init = Z_STREAM_NONE;
             break;
         }
@@ -906,42 +1083,14 @@ static int zipentry_read(Value *vret, Value *v, RefNode *node)
 }
 static int zipentry_write_deflate(CentralDir *cd, const char *s_p, int s_size)
 {
-    int size_prev = cd->data.size;
-    fs->StrBuf_alloc(&cd->data, size_prev + BUFFER_SIZE);
-    cd->data.size = size_prev;
-
-    cd->z.next_in = (Bytef*)s_p;
-    cd->z.avail_in = s_size;
-    cd->z.next_out = (Bytef*)&cd->data.p[size_prev];
-    cd->z.avail_out = cd->data.alloc_size - size_prev;
-
     if (cd->z_init != Z_STREAM_DEFLATE) {
         // deflateヘッダを出力しない
-        int ret = deflateInit2(&cd->z, cd->level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, 0);
-        if (ret != Z_OK) {
-            fs->throw_errorf(mod_zip, "DeflateError", "%s", zError(ret));
-            return FALSE;
-        }
+        cd->pd = pdeflate_new(cd->level, PDEFLATE_RAW, cd->n_thread);
         cd->z_init = Z_STREAM_DEFLATE;
     }
-    for (;;) {  // 終端処理をしないので、入力がなくなったら終了
-        int ret = deflate(&cd->z, Z_NO_FLUSH);
-
-        if (cd->z.avail_in == 0 || ret == Z_BUF_ERROR || ret == Z_STREAM_END){   // 出力してバッファを空にする
-            cd->data.size = cd->z.next_out - (Bytef*)cd->data.p;
-            if (cd->z.avail_in == 0 || ret == Z_STREAM_END) {
-                break;
-            }
-
-            size_prev = cd->data.size;
-            fs->StrBuf_alloc(&cd->data, size_prev + BUFFER_SIZE);
-
-            cd->z.avail_out = cd->data.alloc_size - size_prev;
-            cd->z.next_out = (Bytef*)&cd->data.p[size_prev];
-        } else if (ret != Z_OK) {
-            fs->throw_errorf(mod_zip, "DeflateError", "%s", cd->z.msg);
-            return FALSE;
-        }
+    if (!pdeflate_write(cd->pd, &cd->data, s_p, s_size)) {
+        fs->throw_errorf(mod_zip, "DeflateError", "%s", pdeflate_error(cd->pd));
+        return FALSE;
     }
     return TRUE;
 }
@@ -1016,7 +1165,7 @@ static int zipentry_size(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     CentralDir *cd = Value_ptr(r->v[INDEX_ZIPENTRY_CDIR]);
-    int val;
+    int64_t val;
 
     if (cd->data.p != NULL && !cd->z_finish) {
         fs->throw_errorf(mod_zip, "ZipError", "Cannot determine size until finish()");
@@ -1027,7 +1176,7 @@ static int zipentry_size(Value *vret, Value *v, RefNode *node)
     } else {
         val = cd->size;
     }
-    *vret = int32_Value(val);
+    *vret = fs->int64_Value(val);
 
     return TRUE;
 }
@@ -1145,7 +1294,7 @@ static int zipentryiter_next(Value *vret, Value *v, RefNode *node)
     Ref *r = Value_ref(*v);
     Ref *rref = Value_ref(r->v[INDEX_ZIPENTRYITER_REF]);
 
-    CentralDirEnd *cdir = Value_vp(rref->v[INDEX_ZIPREADER_CDIR]);
+    CentralDirEnd *cdir = Value_ptr(rref->v[INDEX_ZIPREADER_CDIR]);
     int32_t idx = Value_integral(r->v[INDEX_ZIPENTRYITER_INDEX]);
 
     if (cdir == NULL) {
@@ -1173,7 +1322,7 @@ static void define_class(RefNode *m)
 
     cls = fs->define_identifier(m, m, "DeflateIO", NODE_CLASS, 0);
     n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
-    fs->define_native_func_a(n, deflateio_new, 1, 3, cls, fs->cls_streamio, fs->cls_str, fs->cls_int);
+    fs->define_native_func_a(n, deflateio_new, 1, 4, cls, fs->cls_streamio, fs->cls_str, fs->cls_int, fs->cls_int);
 
     n = fs->define_identifier(m, cls, "_close", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, deflateio_close, 0, 0, NULL);
@@ -1239,6 +1388,8 @@ static void define_class(RefNode *m)
 
     n = fs->define_identifier(m, cls, "write", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, zipwriter_write, 1, 1, NULL, NULL);
+    n = fs->define_identifier(m, cls, "write_all", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, zipwriter_write_all, 1, 1, NULL, fs->cls_list);
     n = fs->define_identifier(m, cls, "close", NODE_FUNC_N, 0);
     fs->define_native_func_a(n, zipwriter_close, 0, 0, NULL);
 
@@ -1250,7 +1401,7 @@ static void define_class(RefNode *m)
     cls_zipentry = cls;
 
     n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
-    fs->define_native_func_a(n, zipentry_new, 1, 2, NULL, fs->cls_str, fs->cls_int);
+    fs->define_native_func_a(n, zipentry_new, 1, 3, NULL, fs->cls_str, fs->cls_int, fs->cls_int);
 
     n = fs->define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
     fs->define_native_func_a(n, zipentry_close, 0, 0, NULL);
@@ -0,0 +1,343 @@
+#include "zipfile.h"
+#include "compat.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * 並列deflate (pigz方式)
+ *
+ * 入力をPDEFLATE_BLOCK_SIZE単位のブロックに分け、ブロックごとに独立した
+ * z_streamで圧縮する。各ブロックは直前32KBの入力を辞書として与え、
+ * 最後以外はZ_SYNC_FLUSHでバイト境界に揃えて終えるため、
+ * 出力を順に連結すると1つの正しいdeflateストリームになる。
+ *
+ * ワーカースレッドからfs->の関数は呼ばないこと
+ */
+
+enum {
+    PDEFLATE_BLOCK_SIZE = 256 * 1024,
+    PDEFLATE_DICT_SIZE = 32 * 1024,
+};
+
+struct PDeflate {
+    int level;
+    int wrap;
+    int n_thread;
+    int header_done;
+    int ret;
+
+    char *in;       // 未圧縮の入力 (最大n_threadブロック分)
+    int in_size;
+    int in_max;
+    char dict[PDEFLATE_DICT_SIZE];   // 直前に圧縮した入力の末尾
+    int dict_size;
+
+    uLong check;    // ZLIB:adler32 GZIP:crc32
+    uint32_t total_in;
+};
+
+typedef struct {
+    int level;
+    int last;
+    const char *in;
+    int in_size;
+    const char *dict;
+    int dict_size;
+
+    char *out;
+    int out_size;
+    int ret;
+} PDeflateBlock;
+
+
+static void ptr_write_uint32_le(char *p, uint32_t val)
+{
+    p[0] = val & 0xFF;
+    p[1] = (val >> 8) & 0xFF;
+    p[2] = (val >> 16) & 0xFF;
+    p[3] = (val >> 24) & 0xFF;
+}
+static void ptr_write_uint32_be(char *p, uint32_t val)
+{
+    p[0] = (val >> 24) & 0xFF;
+    p[1] = (val >> 16) & 0xFF;
+    p[2] = (val >> 8) & 0xFF;
+    p[3] = val & 0xFF;
+}
+
+static void out_add(StrBuf *out, const char *p, int size)
+{
+    if (out->size + size > out->alloc_size) {
+        int alloc_size = out->alloc_size > 32 ? out->alloc_size : 32;
+        while (alloc_size < out->size + size) {
+            alloc_size *= 2;
+        }
+        out->p = realloc(out->p, alloc_size);
+        out->alloc_size = alloc_size;
+    }
+    memcpy(out->p + out->size, p, size);
+    out->size += size;
+}
+
+static void pdeflate_block(void *arg)
+{
+    PDeflateBlock *b = arg;
+    int flush = b->last ? Z_FINISH : Z_SYNC_FLUSH;
+    int alloc_size;
+    z_stream z;
+
+    memset(&z, 0, sizeof(z));
+    b->out = NULL;
+    b->out_size = 0;
+    b->ret = deflateInit2(&z, b->level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (b->ret != Z_OK) {
+        return;
+    }
+    if (b->dict_size > 0) {
+        b->ret = deflateSetDictionary(&z, (const Bytef*)b->dict, b->dict_size);
+        if (b->ret != Z_OK) {
+            deflateEnd(&z);
+            return;
+        }
+    }
+
+    // sync flushの空ブロック分を加える
+    alloc_size = deflateBound(&z, b->in_size) + 16;
+    b->out = malloc(alloc_size);
+    z.next_in = (Bytef*)b->in;
+    z.avail_in = b->in_size;
+    z.next_out = (Bytef*)b->out;
+    z.avail_out = alloc_size;
+
+    for (;;) {
+        int ret = deflate(&z, flush);
+
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            b->ret = ret;
+            break;
+        }
+        if (z.avail_out > 0) {
+            if (z.avail_in == 0 && flush == Z_SYNC_FLUSH) {
+                break;
+            }
+        } else {
+            int size = alloc_size - z.avail_out;
+            alloc_size *= 2;
+            b->out = realloc(b->out, alloc_size);
+            z.next_out = (Bytef*)b->out + size;
+            z.avail_out = alloc_size - size;
+        }
+    }
+    b->out_size = alloc_size - z.avail_out;
+    deflateEnd(&z);
+}
+
+static void pdeflate_header(PDeflate *pd, StrBuf *out)
+{
+    int level_flags;
+    char buf[10];
+
+    if (pd->header_done) {
+        return;
+    }
+    pd->header_done = TRUE;
+
+    if (pd->level < 2) {
+        level_flags = 0;
+    } else if (pd->level < 6) {
+        level_flags = 1;
+    } else if (pd->level == 6) {
+        level_flags = 2;
+    } else {
+        level_flags = 3;
+    }
+
+    switch (pd->wrap) {
+    case PDEFLATE_ZLIB: {
+        int header = ((Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8) | (level_flags << 6);
+        header += 31 - (header % 31);
+        buf[0] = header >> 8;
+        buf[1] = header & 0xFF;
+        out_add(out, buf, 2);
+        break;
+    }
+    case PDEFLATE_GZIP:
+        memset(buf, 0, sizeof(buf));
+        buf[0] = 0x1F;
+        buf[1] = 0x8B;
+        buf[2] = Z_DEFLATED;
+        buf[8] = (pd->level == 9 ? 2 : (pd->level < 2 ? 4 : 0));
+        buf[9] = 0xFF;   // OS: unknown
+        out_add(out, buf, 10);
+        break;
+    }
+}
+static void pdeflate_trailer(PDeflate *pd, StrBuf *out)
+{
+    char buf[8];
+
+    switch (pd->wrap) {
+    case PDEFLATE_ZLIB:
+        ptr_write_uint32_be(buf, pd->check);
+        out_add(out, buf, 4);
+        break;
+    case PDEFLATE_GZIP:
+        ptr_write_uint32_le(buf, pd->check);
+        ptr_write_uint32_le(buf + 4, pd->total_in);
+        out_add(out, buf, 8);
+        break;
+    }
+}
+
+/*
+ * 溜まっている入力をブロックごとに圧縮してoutに追加する
+ * parallel=FALSEの場合は呼び出し元のスレッドで順に圧縮する
+ */
+static int pdeflate_flush(PDeflate *pd, StrBuf *out, int last, int parallel)
+{
+    int n = (pd->in_size + PDEFLATE_BLOCK_SIZE - 1) / PDEFLATE_BLOCK_SIZE;
+    PDeflateBlock *blk;
+    int i;
+
+    if (n == 0) {
+        if (!last) {
+            return TRUE;
+        }
+        n = 1;
+    }
+    blk = malloc(sizeof(PDeflateBlock) * n);
+
+    for (i = 0; i < n; i++) {
+        PDeflateBlock *b = &blk[i];
+        int pos = i * PDEFLATE_BLOCK_SIZE;
+
+        b->level = pd->level;
+        b->last = (last && i == n - 1);
+        b->in = pd->in + pos;
+        b->in_size = pd->in_size - pos;
+        if (b->in_size > PDEFLATE_BLOCK_SIZE) {
+            b->in_size = PDEFLATE_BLOCK_SIZE;
+        }
+        if (i == 0) {
+            b->dict = pd->dict;
+            b->dict_size = pd->dict_size;
+        } else {
+            b->dict = b->in - PDEFLATE_DICT_SIZE;
+            b->dict_size = PDEFLATE_DICT_SIZE;
+        }
+    }
+    if (parallel && n > 1) {
+        run_parallel(pdeflate_block, blk, sizeof(PDeflateBlock), n);
+    } else {
+        for (i = 0; i < n; i++) {
+            pdeflate_block(&blk[i]);
+        }
+    }
+
+    pdeflate_header(pd, out);
+    for (i = 0; i < n; i++) {
+        PDeflateBlock *b = &blk[i];
+        if (b->ret != Z_OK && b->ret != Z_STREAM_END && pd->ret == Z_OK) {
+            pd->ret = b->ret;
+        }
+        if (b->out != NULL) {
+            out_add(out, b->out, b->out_size);
+            free(b->out);
+        }
+    }
+    free(blk);
+
+    if (pd->in_size >= PDEFLATE_DICT_SIZE) {
+        memcpy(pd->dict, pd->in + pd->in_size - PDEFLATE_DICT_SIZE, PDEFLATE_DICT_SIZE);
+        pd->dict_size = PDEFLATE_DICT_SIZE;
+    }
+    pd->in_size = 0;
+
+    if (last && pd->ret == Z_OK) {
+        pdeflate_trailer(pd, out);
+    }
+    return pd->ret == Z_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * n_thread: 同時に圧縮するブロック数 (0以下の場合はCPU数)
+ */
+PDeflate *pdeflate_new(int level, int wrap, int n_thread)
+{
+    PDeflate *pd = malloc(sizeof(PDeflate));
+
+    if (n_thread <= 0) {
+        n_thread = get_cpu_count();
+    }
+    memset(pd, 0, sizeof(*pd));
+    pd->level = level;
+    pd->wrap = wrap;
+    pd->n_thread = n_thread;
+    pd->ret = Z_OK;
+    pd->in_max = PDEFLATE_BLOCK_SIZE * n_thread;
+    pd->in = malloc(pd->in_max);
+
+    if (wrap == PDEFLATE_ZLIB) {
+        pd->check = adler32(0, Z_NULL, 0);
+    } else {
+        pd->check = crc32(0, Z_NULL, 0);
+    }
+    return pd;
+}
+void pdeflate_free(PDeflate *pd)
+{
+    if (pd != NULL) {
+        free(pd->in);
+        free(pd);
+    }
+}
+const char *pdeflate_error(PDeflate *pd)
+{
+    return zError(pd->ret);
+}
+/*
+ * 入力を追加する
+ * n_threadブロック分溜まるごとに並列に圧縮してoutに追加する
+ */
+int pdeflate_write(PDeflate *pd, StrBuf *out, const char *p, int size)
+{
+    switch (pd->wrap) {
+    case PDEFLATE_ZLIB:
+        pd->check = adler32(pd->check, (const Bytef*)p, size);
+        break;
+    case PDEFLATE_GZIP:
+        pd->check = crc32(pd->check, (const Bytef*)p, size);
+        break;
+    }
+    pd->total_in += size;
+
+    while (size > 0) {
+        int n;
+        if (pd->in_size == pd->in_max) {
+            if (!pdeflate_flush(pd, out, FALSE, TRUE)) {
+                return FALSE;
+            }
+        }
+        n = pd->in_max - pd->in_size;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(pd->in + pd->in_size, p, n);
+        pd->in_size += n;
+        p += n;
+        size -= n;
+    }
+    return TRUE;
+}
+/*
+ * 残りを圧縮して終端を出力する
+ */
+int pdeflate_finish(PDeflate *pd, StrBuf *out, int parallel)
+{
+    return pdeflate_flush(pd, out, TRUE, parallel);
+}
@@ -8,13 +8,23 @@
 #define LOCAL_MAGIC   "PK\x03\x04"
 #define EOCD_MAGIC    "PK\x05\x06"
 #define DATADES_MAGIC "PK\x07\x08"
+#define EOCD64_MAGIC  "PK\x06\x06"
+#define EOCD64_LOCATOR_MAGIC "PK\x06\x07"
 
 enum {
     CENTRAL_SIZE = 46,
     LOCAL_SIZE = 30,
     EOCD_SIZE = 22,
+    EOCD64_SIZE = 56,
+    EOCD64_LOCATOR_SIZE = 20,
     MAX_ZIP_BUF = 64*1024,
 };
+// Zip64拡張フィールドに含まれる値
+enum {
+    ZIP64_SIZE = 1,
+    ZIP64_SIZE_COMPRESSED = 2,
+    ZIP64_OFFSET = 4,
+};
 
 static uint16_t ptr_read_uint16_le(const char *p)
 {
@@ -22,7 +32,11 @@ static uint16_t ptr_read_uint16_le(const char *p)
 }
 static uint32_t ptr_read_uint32_le(const char *p)
 {
-    return ((uint8_t)p[0]) | ((uint8_t)p[1] << 8) | ((uint8_t)p[2] << 16) | ((uint8_t)p[3] << 24);
+    return ((uint8_t)p[0]) | ((uint8_t)p[1] << 8) | ((uint8_t)p[2] << 16) | ((uint32_t)(uint8_t)p[3] << 24);
+}
+static uint64_t ptr_read_uint64_le(const char *p)
+{
+    return (uint64_t)ptr_read_uint32_le(p) | ((uint64_t)ptr_read_uint32_le(p + 4) << 32);
 }
 
 static void ptr_write_uint16_le(char *p, uint16_t val)
@@ -37,10 +51,15 @@ static void ptr_write_uint32_le(char *p, uint32_t val)
     p[2] = (val >> 16) & 0xFF;
     p[3] = (val >> 24) & 0xFF;
 }
+static void ptr_write_uint64_le(char *p, uint64_t val)
+{
+    ptr_write_uint32_le(p, (uint32_t)val);
+    ptr_write_uint32_le(p + 4, (uint32_t)(val >> 32));
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
-void CentralDirEnd_add(CentralDirEnd *cdir, CentralDir *cd, int32_t offset)
+static CentralDir *CentralDirEnd_new_entry(CentralDirEnd *cdir)
 {
     CentralDir *p;
     if (cdir->cdir_size >= cdir->cdir_max) {
@@ -54,6 +73,11 @@ void CentralDirEnd_add(CentralDirEnd *cdir, CentralDir *cd, int32_t offset)
     }
     p = &cdir->cdir[cdir->cdir_size];
     cdir->cdir_size++;
+    return p;
+}
+void CentralDirEnd_add(CentralDirEnd *cdir, CentralDir *cd, int64_t offset)
+{
+    CentralDir *p = CentralDirEnd_new_entry(cdir);
 
     *p = *cd;
     fs->StrBuf_init(&p->filename, cd->filename.size);
@@ -71,6 +95,7 @@ void CentralDirEnd_free(CentralDirEnd *cdir)
         }
         free(cdir->cdir);
     }
+    free(cdir->name_index);
     free(cdir);
 }
 
@@ -109,7 +134,10 @@ static void parse_ntfs_field(CentralDir *cdir, const char *p, int p_size, int *t
         p += len + 4;
     }
 }
-static void parse_ext_field(CentralDir *cdir, const char *p, int p_size)
+/**
+ * zip64: ヘッダの値が0xFFFFFFFFで、Zip64拡張フィールドから読む値 (ZIP64_*)
+ */
+static void parse_ext_field(CentralDir *cdir, const char *p, int p_size, int zip64)
 {
     const char *end = p + p_size;
     int time_ntfs = FALSE;  // NTFS Time優先
@@ -118,6 +146,24 @@ static void parse_ext_field(CentralDir *cdir, const char *p, int p_size)
         int len = ptr_read_uint16_le(p + 2);
 
         switch (p[0] | (p[1] << 8)) {
+        case 0x0001: { // Zip64
+            // 非圧縮サイズ、圧縮サイズ、オフセットの順で、必要なものだけ並ぶ
+            const char *q = p + 4;
+            const char *q_end = (p + 4 + len < end ? p + 4 + len : end);
+            if ((zip64 & ZIP64_SIZE) != 0 && q + 8 <= q_end) {
+                cdir->size = ptr_read_uint64_le(q);
+                q += 8;
+            }
+            if ((zip64 & ZIP64_SIZE_COMPRESSED) != 0 && q + 8 <= q_end) {
+                cdir->size_compressed = ptr_read_uint64_le(q);
+                q += 8;
+            }
+            if ((zip64 & ZIP64_OFFSET) != 0 && q + 8 <= q_end) {
+                cdir->offset = ptr_read_uint64_le(q);
+                q += 8;
+            }
+            break;
+        }
         case 'U' | ('T' << 8):
             if (len >= 5 && !time_ntfs) {
                 // 更新時刻(Unix epoch UTC)
@@ -182,7 +228,7 @@ static int move_next_file_entry(int *result, Value reader)
         StrBuf *sb = &mb->buf;
         int pos;
         for (pos = mb->cur; pos + 4 <= sb->size; pos++) {
-            if (sb->p[pos] == 'P' && memcmp(sb->p + 1, "K\x03\x04", 3) == 0) {
+            if (sb->p[pos] == 'P' && memcmp(sb->p + pos + 1, "K\x03\x04", 3) == 0) {
                 *result = TRUE;
                 mb->cur = pos + 4;
                 break;
@@ -255,7 +301,12 @@ static int read_local_dir(CentralDir **cdir, Value reader, RefCharset *cs, RefTi
     p->size_compressed = ptr_read_uint32_le(cbuf + 18 - 4);
     p->size = ptr_read_uint32_le(cbuf + 22 - 4);
 
-    parse_ext_field(p, ext_field.p, ext_len);
+    // ローカルヘッダのZip64拡張フィールドには、両方のサイズが入る
+    if (p->size == ZIP64_LIMIT || p->size_compressed == ZIP64_LIMIT) {
+        parse_ext_field(p, ext_field.p, ext_len, ZIP64_SIZE | ZIP64_SIZE_COMPRESSED);
+    } else {
+        parse_ext_field(p, ext_field.p, ext_len, 0);
+    }
     if (!p->time_valid) {
         int modified_time = ptr_read_uint16_le(cbuf + 10 - 4);
         int modified_date = ptr_read_uint16_le(cbuf + 12 - 4);
@@ -292,11 +343,13 @@ int find_central_dir(CentralDir **cdir, Value reader, RefCharset *cs, RefTimeZon
 /**
  * 末尾から22バイトより、遡って探す
  * 最初に見つかったヘッダのオフセットを返す
+ * 直前にZip64終端ロケータがあれば、Zip64終端レコードの位置を*eocd64_posに設定する (無ければ-1)
  */
-static CentralDirEnd *find_central_dir_end(char *buf, int size, int offset)
+static CentralDirEnd *find_central_dir_end(char *buf, int size, int64_t offset, int64_t *eocd64_pos)
 {
     int i;
 
+    *eocd64_pos = -1;
     if (size < EOCD_SIZE) {
         return NULL;
     }
@@ -306,161 +359,347 @@ static CentralDirEnd *find_central_dir_end(char *buf, int size, int offset)
             int com_end = i + EOCD_SIZE + ptr_read_uint16_le(buf + i + 20);
 
             if (com_end <= size && com_end + 4 > size) {
-                // 分割書庫には対応しないため、0になる
-                if (ptr_read_uint32_le(buf + i + 4) == 0) {
-                    // オフセットがだいたい合っているか調べる
-                    int cdir_size = ptr_read_uint32_le(buf + i + 12);
-                    int cdir_offset = ptr_read_uint32_le(buf + i + 16);
-                    if (cdir_size < MAX_ALLOC && cdir_offset + cdir_size <= offset + i && cdir_offset + cdir_size + 4 > offset + i) {
-                        CentralDirEnd *cd = malloc(sizeof(CentralDirEnd));
-                        cd->offset_of_cdir = cdir_offset;
-                        cd->size_of_cdir = cdir_size;
-                        cd->cdir_size = ptr_read_uint16_le(buf + i + 10);
-                        cd->cdir_max = align_pow2(cd->cdir_size, 16);
-                        cd->cdir = NULL;
-                        return cd;
+                int64_t cdir_size = ptr_read_uint32_le(buf + i + 12);
+                int64_t cdir_offset = ptr_read_uint32_le(buf + i + 16);
+                int zip64 = FALSE;
+
+                if (i >= EOCD64_LOCATOR_SIZE && memcmp(buf + i - EOCD64_LOCATOR_SIZE, EOCD64_LOCATOR_MAGIC, 4) == 0) {
+                    // 分割書庫には対応しない
+                    const char *loc = buf + i - EOCD64_LOCATOR_SIZE;
+                    int64_t pos = ptr_read_uint64_le(loc + 8);
+                    if (ptr_read_uint32_le(loc + 4) != 0 || pos < 0 || pos + EOCD64_SIZE > offset + i - EOCD64_LOCATOR_SIZE) {
+                        continue;
                     }
+                    *eocd64_pos = pos;
+                    zip64 = TRUE;
+                } else if (ptr_read_uint32_le(buf + i + 4) != 0) {
+                    // 分割書庫には対応しないため、0になる
+                    continue;
+                }
+                // オフセットがだいたい合っているか調べる (Zip64の場合は後で調べる)
+                if (zip64 || (cdir_offset + cdir_size <= offset + i && cdir_offset + cdir_size + 4 > offset + i)) {
+                    CentralDirEnd *cd = malloc(sizeof(CentralDirEnd));
+                    memset(cd, 0, sizeof(CentralDirEnd));
+                    cd->offset_of_cdir = cdir_offset;
+                    cd->size_of_cdir = cdir_size;
+                    cd->cdir_size = ptr_read_uint16_le(buf + i + 10);
+                    return cd;
                 }
             }
         }
     }
     return NULL;
 }
-static CentralDir *read_central_dirs(CentralDirEnd *cdir_end, char *cbuf, RefCharset *cs, RefTimeZone *tz)
+/**
+ * Zip64終端レコードから、エントリ数とセントラルディレクトリの位置を読む
+ */
+static int read_central_dir_end64(CentralDirEnd *cdir, Value reader, int64_t eocd64_pos)
 {
-    int dir_num = cdir_end->cdir_size;
-    CentralDir *cd = malloc(sizeof(CentralDir) * cdir_end->cdir_max);
-    int i;
-    int offset = 0;
+    char cbuf[EOCD64_SIZE];
+    int read_to = EOCD64_SIZE;
+    uint64_t num, cdir_size, cdir_offset;
+
+    if (!fs->stream_seek_sub(reader, eocd64_pos)) {
+        return FALSE;
+    }
+    if (!fs->stream_read_data(reader, NULL, cbuf, &read_to, FALSE, TRUE)) {
+        return FALSE;
+    }
+    if (read_to < EOCD64_SIZE || memcmp(cbuf, EOCD64_MAGIC, 4) != 0) {
+        goto FORMAT_ERROR;
+    }
+    num = ptr_read_uint64_le(cbuf + 32);
+    cdir_size = ptr_read_uint64_le(cbuf + 40);
+    cdir_offset = ptr_read_uint64_le(cbuf + 48);
+
+    // セントラルディレクトリはZip64終端レコードの直前にある
+    if (num > INT32_MAX || cdir_offset > (uint64_t)eocd64_pos || cdir_size > (uint64_t)eocd64_pos - cdir_offset) {
+        goto FORMAT_ERROR;
+    }
+    if (cdir_offset + cdir_size + 4 <= (uint64_t)eocd64_pos) {
+        goto FORMAT_ERROR;
+    }
+    cdir->cdir_size = num;
+    cdir->size_of_cdir = cdir_size;
+    cdir->offset_of_cdir = cdir_offset;
+
+    return TRUE;
+
+FORMAT_ERROR:
+    fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
+    return FALSE;
+}
+
+/*
+ * セントラルディレクトリを少しずつ読み込む
+ */
+typedef struct {
+    Value reader;
+    char *buf;
+    int max;
+    int pos;
+    int size;
+    int64_t rest;   // まだ読み込んでいないバイト数
+} CDirReader;
+
+/**
+ * buf + posから少なくともneedバイト読める状態にする
+ */
+static int cdir_reader_fill(CDirReader *cr, int need)
+{
+    int read_to;
 
-    memset(cd, 0, sizeof(CentralDir) * cdir_end->cdir_max);
-    for (i = 0; i < dir_num; i++) {
-        CentralDir *p = &cd[i];
+    if (cr->size - cr->pos >= need) {
+        return TRUE;
+    }
+    if ((cr->size - cr->pos) + cr->rest < need) {
+        fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
+        return FALSE;
+    }
+    // 未処理の部分を先頭に詰める
+    memmove(cr->buf, cr->buf + cr->pos, cr->size - cr->pos);
+    cr->size -= cr->pos;
+    cr->pos = 0;
+    if (need > cr->max) {
+        cr->max = align_pow2(need, cr->max);
+        cr->buf = realloc(cr->buf, cr->max);
+    }
+
+    read_to = cr->max - cr->size;
+    if (read_to > cr->rest) {
+        read_to = cr->rest;
+    }
+    if (!fs->stream_read_data(cr->reader, NULL, cr->buf + cr->size, &read_to, FALSE, TRUE)) {
+        return FALSE;
+    }
+    cr->size += read_to;
+    cr->rest -= read_to;
+    if (cr->size < need) {
+        fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
+        return FALSE;
+    }
+    return TRUE;
+}
+/**
+ * セントラルディレクトリを先頭から読みながら、cdir->cdirに追加する
+ * エントリ数はcdir->cdir_sizeで、0xFFFFで打ち切られている場合があるため、セントラルディレクトリの終わりまで読む
+ */
+static int read_central_dirs(CentralDirEnd *cdir, Value reader, RefCharset *cs, RefTimeZone *tz)
+{
+    int dir_num = cdir->cdir_size;
+    int64_t max = cdir->size_of_cdir / CENTRAL_SIZE;
+    CDirReader cr;
+
+    if (!fs->stream_seek_sub(reader, cdir->offset_of_cdir)) {
+        return FALSE;
+    }
+
+    // エントリ数は信用せず、セントラルディレクトリのサイズで制限する
+    if (max > dir_num) {
+        max = dir_num;
+    }
+    cdir->cdir_max = align_pow2(max, 16);
+    cdir->cdir_size = 0;
+    if (cdir->cdir_max > 0) {
+        cdir->cdir = malloc(sizeof(CentralDir) * cdir->cdir_max);
+        memset(cdir->cdir, 0, sizeof(CentralDir) * cdir->cdir_max);
+    }
+
+    cr.reader = reader;
+    cr.max = MAX_ZIP_BUF;
+    cr.buf = malloc(cr.max);
+    cr.pos = 0;
+    cr.size = 0;
+    cr.rest = cdir->size_of_cdir;
+
+    while ((cr.size - cr.pos) + cr.rest >= CENTRAL_SIZE) {
+        CentralDir *p;
+        const char *cbuf;
         int filename_len, ext_len, comment_len;
+        int zip64 = 0;
 
-        if (offset + CENTRAL_SIZE > cdir_end->size_of_cdir) {
+        if (!cdir_reader_fill(&cr, CENTRAL_SIZE)) {
             goto ERROR_END;
         }
-        if (memcmp(cbuf + offset, CENTRAL_MAGIC, 4) != 0) {
+        cbuf = cr.buf + cr.pos;
+        if (memcmp(cbuf, CENTRAL_MAGIC, 4) != 0) {
+            break;
+        }
+        filename_len = ptr_read_uint16_le(cbuf + 28);
+        ext_len = ptr_read_uint16_le(cbuf + 30);
+        comment_len = ptr_read_uint16_le(cbuf + 32);
+        if (!cdir_reader_fill(&cr, CENTRAL_SIZE + filename_len + ext_len + comment_len)) {
             goto ERROR_END;
         }
-        p->flags = ptr_read_uint16_le(cbuf + offset + 8);
-        p->method = ptr_read_uint16_le(cbuf + offset + 10);
-
+        cbuf = cr.buf + cr.pos;
 
-        p->crc32 = ptr_read_uint32_le(cbuf + offset + 16);
-        p->size_compressed = ptr_read_uint32_le(cbuf + offset + 20);
-        p->size = ptr_read_uint32_le(cbuf + offset + 24);
+        p = CentralDirEnd_new_entry(cdir);
+        p->flags = ptr_read_uint16_le(cbuf + 8);
+        p->method = ptr_read_uint16_le(cbuf + 10);
 
-        filename_len = ptr_read_uint16_le(cbuf + offset + 28);
-        ext_len = ptr_read_uint16_le(cbuf + offset + 30);
-        comment_len = ptr_read_uint16_le(cbuf + offset + 32);
-        if (offset + CENTRAL_SIZE + filename_len + ext_len + comment_len > cdir_end->size_of_cdir) {
-            goto ERROR_END;
-        }
+        p->crc32 = ptr_read_uint32_le(cbuf + 16);
+        p->size_compressed = ptr_read_uint32_le(cbuf + 20);
+        p->size = ptr_read_uint32_le(cbuf + 24);
+        p->offset = ptr_read_uint32_le(cbuf + 42);
 
         fs->StrBuf_init(&p->filename, filename_len);
-        fs->StrBuf_add(&p->filename, cbuf + offset + CENTRAL_SIZE, filename_len);
+        fs->StrBuf_add(&p->filename, cbuf + CENTRAL_SIZE, filename_len);
 
-        parse_ext_field(p, cbuf + offset + CENTRAL_SIZE + filename_len, ext_len);
+        if (p->size == ZIP64_LIMIT) {
+            zip64 |= ZIP64_SIZE;
+        }
+        if (p->size_compressed == ZIP64_LIMIT) {
+            zip64 |= ZIP64_SIZE_COMPRESSED;
+        }
+        if (p->offset == ZIP64_LIMIT) {
+            zip64 |= ZIP64_OFFSET;
+        }
+        parse_ext_field(p, cbuf + CENTRAL_SIZE + filename_len, ext_len, zip64);
+        if (p->size < 0 || p->size_compressed < 0 || p->offset < 0) {
+            fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
+            goto ERROR_END;
+        }
         if (!p->time_valid) {
-            int modified_time = ptr_read_uint16_le(cbuf + offset + 12);
-            int modified_date = ptr_read_uint16_le(cbuf + offset + 14);
+            int modified_time = ptr_read_uint16_le(cbuf + 12);
+            int modified_date = ptr_read_uint16_le(cbuf + 14);
             if (modified_date != 0) {
                 p->modified = dostime_to_timestamp(modified_date, modified_time, tz);
                 p->time_valid = TRUE;
             }
         }
-
         p->cs = cs;
-        p->offset = ptr_read_uint32_le(cbuf + offset + 42);
 
-        offset += CENTRAL_SIZE + filename_len + ext_len + comment_len;
+        cr.pos += CENTRAL_SIZE + filename_len + ext_len + comment_len;
+    }
+    if (cdir->cdir_size < dir_num) {
+        fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
+        goto ERROR_END;
     }
-    return cd;
+    free(cr.buf);
+    return TRUE;
 
 ERROR_END:
-    free(cd);
-    fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
-    return NULL;
+    free(cr.buf);
+    return FALSE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+
+static uint32_t name_hash(const char *p, int size)
+{
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        h = (h ^ (uint8_t)p[i]) * 16777619U;
+    }
+    return h;
+}
+/**
+ * ファイル名からエントリを探すための表を作る
+ * 同じ名前のエントリは、番号の小さい方が先に見つかる
+ */
+static void CentralDirEnd_build_index(CentralDirEnd *cdir)
+{
+    int size = align_pow2(cdir->cdir_size * 2 + 1, 16);
+    int32_t *idx = malloc(sizeof(int32_t) * size);
+    int i;
+
+    for (i = 0; i < size; i++) {
+        idx[i] = -1;
+    }
+    for (i = 0; i < cdir->cdir_size; i++) {
+        StrBuf *name = &cdir->cdir[i].filename;
+        int pos = name_hash(name->p, name->size) & (size - 1);
+        while (idx[pos] >= 0) {
+            pos = (pos + 1) & (size - 1);
+        }
+        idx[pos] = i;
+    }
+    cdir->name_index = idx;
+    cdir->name_index_size = size;
+}
+/**
+ * ファイル名が一致するエントリの番号を返す (見つからなければ-1)
+ * local_cs : TRUEならUTF-8フラグが立っていないエントリ、FALSEならUTF-8として扱うエントリから探す
+ */
+int CentralDirEnd_find(CentralDirEnd *cdir, const char *name_p, int name_size, int local_cs)
+{
+    int size = cdir->name_index_size;
+    int pos;
+
+    if (cdir->name_index == NULL) {
+        return -1;
+    }
+    pos = name_hash(name_p, name_size) & (size - 1);
+    while (cdir->name_index[pos] >= 0) {
+        int i = cdir->name_index[pos];
+        CentralDir *cd = &cdir->cdir[i];
+
+        if (cd->filename.size == name_size && memcmp(cd->filename.p, name_p, name_size) == 0) {
+            // 設定された文字コードがUTF-8以外で、ファイル名にUTF-8フラグが立っていない
+            int is_local = (cdir->cs != fs->cs_utf8 && (cd->flags & CDIR_FLAG_UTF8) == 0);
+            if (is_local == local_cs) {
+                return i;
+            }
+        }
+        pos = (pos + 1) & (size - 1);
+    }
+    return -1;
 }
 
 /////////////////////////////////////////////////////////////////////////
 
-CentralDirEnd *get_central_dir(Value reader, int size, RefCharset *cs, RefTimeZone *tz)
+CentralDirEnd *get_central_dir(Value reader, int64_t size, RefCharset *cs, RefTimeZone *tz)
 {
     char *cbuf;
     CentralDirEnd *cdir;
-    int offset;
+    int64_t offset;
+    int64_t eocd64_pos;
     int tail_size;
 
     if (size < EOCD_SIZE) {
-        return NULL;
+        goto FORMAT_ERROR;
     }
 
+    // 末尾の64kb (コメントの最大長 + 終端レコード + Zip64ロケータ) を読む
     if (size > MAX_ZIP_BUF) {
-        // 末尾の64kbを読む
-        int seek_to = size - MAX_ZIP_BUF;
-        int read_to;
-        if (seek_to < 0) {
-            seek_to = 0;
-        }
-        if (!fs->stream_seek_sub(reader, seek_to)) {
-            return NULL;
-        }
-        cbuf = malloc(MAX_ZIP_BUF);
-        read_to = MAX_ZIP_BUF;
-        if (!fs->stream_read_data(reader, NULL, cbuf, &read_to, FALSE, TRUE)) {
-            return NULL;
-        }
         tail_size = MAX_ZIP_BUF;
-        offset = size - MAX_ZIP_BUF;
     } else {
-        int read_to;
-        // 全部読む
-        if (!fs->stream_seek_sub(reader, 0)) {
-            return NULL;
-        }
-        cbuf = malloc(size);
-        read_to = size;
-        if (!fs->stream_read_data(reader, NULL, cbuf, &read_to, FALSE, TRUE)) {
-            return NULL;
-        }
         tail_size = size;
-        offset = 0;
     }
-    cdir = find_central_dir_end(cbuf, tail_size, offset);
+    offset = size - tail_size;
+    if (!fs->stream_seek_sub(reader, offset)) {
+        return NULL;
+    }
+    cbuf = malloc(tail_size);
+    if (!fs->stream_read_data(reader, NULL, cbuf, &tail_size, FALSE, TRUE)) {
+        free(cbuf);
+        return NULL;
+    }
+    cdir = find_central_dir_end(cbuf, tail_size, offset, &eocd64_pos);
     free(cbuf);
 
-    if (cdir != NULL) {
-        CentralDir *cd;
-        int read_to;
-
-        cbuf = malloc(cdir->size_of_cdir);
-        memset(cbuf, 0, cdir->size_of_cdir);
-        if (!fs->stream_seek_sub(reader, cdir->offset_of_cdir)) {
-            CentralDirEnd_free(cdir);
-            return NULL;
-        }
-        read_to = cdir->size_of_cdir;
-        if (!fs->stream_read_data(reader, NULL, cbuf, &read_to, FALSE, TRUE)) {
-            return NULL;
-        }
-        cd = read_central_dirs(cdir, cbuf, cs, tz);
-        free(cbuf);
+    if (cdir == NULL) {
+        goto FORMAT_ERROR;
+    }
+    cdir->cs = cs;
+    cdir->tz = tz;
 
-        if (cd == NULL) {
+    if (eocd64_pos >= 0) {
+        if (!read_central_dir_end64(cdir, reader, eocd64_pos)) {
             CentralDirEnd_free(cdir);
             return NULL;
         }
-        cdir->cdir = cd;
-        cdir->cs = cs;
-        cdir->tz = tz;
-
-        return cdir;
-    } else {
-        goto FORMAT_ERROR;
     }
+    if (!read_central_dirs(cdir, reader, cs, tz)) {
+        CentralDirEnd_free(cdir);
+        return NULL;
+    }
+    CentralDirEnd_build_index(cdir);
+
+    return cdir;
 
 FORMAT_ERROR:
     fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
@@ -518,7 +757,8 @@ int write_bin_data(CentralDirEnd *cdir, Value writer, const char *p, int size)
 {
     const RefNode *type = fs->Value_type(writer);
 
-    if (type == fs->cls_bytesio) {
+    // マップしたBytesIOはstream_write_dataでエラーにする
+    if (type == fs->cls_bytesio && !((RefBytesIO*)Value_vp(writer))->mapped) {
         RefBytesIO *mb = Value_vp(writer);
         if (!fs->StrBuf_add(&mb->buf, p, size)) {
             return FALSE;
@@ -531,25 +771,30 @@ int write_bin_data(CentralDirEnd *cdir, Value writer, const char *p, int size)
     cdir->current_offset += size;
     return TRUE;
 }
-int write_bin_from_stream(CentralDirEnd *cdir, Value stream, Value reader, int src_size)
+int write_bin_from_stream(CentralDirEnd *cdir, Value stream, Value reader, int64_t src_size)
 {
     char *cbuf = malloc(BUFFER_SIZE);
-    int read_size = 0;
+    int64_t read_size = 0;
 
     while (read_size < src_size) {
-        int size_r;
-        int size = src_size - read_size;
-        if (size > BUFFER_SIZE) {
-            size = BUFFER_SIZE;
+        int size = BUFFER_SIZE;
+        if (size > src_size - read_size) {
+            size = src_size - read_size;
         }
-        size_r = size;
         if (!fs->stream_read_data(reader, NULL, cbuf, &size, FALSE, TRUE)) {
+            free(cbuf);
+            return FALSE;
+        }
+        if (size <= 0) {
+            free(cbuf);
+            fs->throw_errorf(mod_zip, "ZipError", "Invalid zipfile format");
             return FALSE;
         }
-        if (!fs->stream_write_data(stream, cbuf, size_r)) {
+        if (!fs->stream_write_data(stream, cbuf, size)) {
+            free(cbuf);
             return FALSE;
         }
-        read_size += size_r;
+        read_size += size;
     }
 
     free(cbuf);
@@ -559,13 +804,18 @@ int write_bin_from_stream(CentralDirEnd *cdir, Value stream, Value reader, int s
 
 int write_local_data(CentralDirEnd *cdir, Value writer, Ref *r)
 {
+    enum {
+        EXTRA_ZIP64_SIZE = 20,
+    };
     char local[LOCAL_SIZE];
+    char extra[EXTRA_ZIP64_SIZE];
     CentralDir *cd = Value_ptr(r->v[INDEX_ZIPENTRY_CDIR]);
     Ref *zr;
-    int offset = cdir->current_offset;
+    int64_t offset = cdir->current_offset;
+    int zip64 = (cd->size >= ZIP64_LIMIT || cd->size_compressed >= ZIP64_LIMIT);
 
     memcpy(local, LOCAL_MAGIC, 4);
-    ptr_write_uint16_le(local + 4, 20);         // 要求バージョン
+    ptr_write_uint16_le(local + 4, zip64 ? 45 : 20); // 要求バージョン
     ptr_write_uint16_le(local + 6, cd->flags);  // 汎用フラグ
     ptr_write_uint16_le(local + 8, cd->method); // 圧縮メソッド
     if (cd->time_valid) {
@@ -580,10 +830,20 @@ int write_local_data(CentralDirEnd *cdir, Value writer, Ref *r)
         ptr_write_uint16_le(local + 12, dt);
     }
     ptr_write_uint32_le(local + 14, cd->crc32);
-    ptr_write_uint32_le(local + 18, cd->size_compressed);
-    ptr_write_uint32_le(local + 22, cd->size);
+    if (zip64) {
+        // ローカルヘッダには両方のサイズを書く
+        ptr_write_uint32_le(local + 18, ZIP64_LIMIT);
+        ptr_write_uint32_le(local + 22, ZIP64_LIMIT);
+        ptr_write_uint16_le(extra, 0x0001);
+        ptr_write_uint16_le(extra + 2, 16);
+        ptr_write_uint64_le(extra + 4, cd->size);
+        ptr_write_uint64_le(extra + 12, cd->size_compressed);
+    } else {
+        ptr_write_uint32_le(local + 18, cd->size_compressed);
+        ptr_write_uint32_le(local + 22, cd->size);
+    }
     ptr_write_uint16_le(local + 26, cd->filename.size);
-    ptr_write_uint16_le(local + 28, 0);        // 拡張フィールド
+    ptr_write_uint16_le(local + 28, zip64 ? EXTRA_ZIP64_SIZE : 0); // 拡張フィールド
 
     if (!write_bin_data(cdir, writer, local, LOCAL_SIZE)) {
         return FALSE;
@@ -591,12 +851,29 @@ int write_local_data(CentralDirEnd *cdir, Value writer, Ref *r)
     if (!write_bin_data(cdir, writer, cd->filename.p, cd->filename.size)) {
         return FALSE;
     }
+    if (zip64) {
+        if (!write_bin_data(cdir, writer, extra, EXTRA_ZIP64_SIZE)) {
+            return FALSE;
+        }
+    }
 
     zr = Value_vp(r->v[INDEX_ZIPENTRY_REF]);
     if (zr != NULL) {
         // read
         Value reader = zr->v[INDEX_ZIPREADER_READER];
-        if (!fs->stream_seek_sub(reader, cd->offset)) {
+        int64_t pos_save = cd->pos;
+        int64_t data_pos;
+
+        // 元のローカルヘッダを飛ばして、データの先頭から写す
+        cd->pos = cd->offset;
+        if (!get_local_header_size(reader, cd)) {
+            cd->pos = pos_save;
+            return FALSE;
+        }
+        data_pos = cd->pos;
+        cd->pos = pos_save;
+
+        if (!fs->stream_seek_sub(reader, data_pos)) {
             return FALSE;
         }
         if (!write_bin_from_stream(cdir, writer, reader, cd->size_compressed)) {
@@ -623,24 +900,58 @@ static void make_extra_time(char *p, int64_t tm)
 
     // TODO NTFS time
 }
+/**
+ * 32bitに収まらない値をZip64拡張フィールドに書く
+ * 戻り値は拡張フィールドのサイズ (不要なら0)
+ */
+static int make_extra_zip64(char *p, CentralDir *cd)
+{
+    int size = 4;
+
+    if (cd->size >= ZIP64_LIMIT) {
+        ptr_write_uint64_le(p + size, cd->size);
+        size += 8;
+    }
+    if (cd->size_compressed >= ZIP64_LIMIT) {
+        ptr_write_uint64_le(p + size, cd->size_compressed);
+        size += 8;
+    }
+    if (cd->offset >= ZIP64_LIMIT) {
+        ptr_write_uint64_le(p + size, cd->offset);
+        size += 8;
+    }
+    if (size == 4) {
+        return 0;
+    }
+    ptr_write_uint16_le(p, 0x0001);
+    ptr_write_uint16_le(p + 2, size - 4);
+    return size;
+}
+static uint32_t limit_uint32(int64_t val)
+{
+    return val >= ZIP64_LIMIT ? ZIP64_LIMIT : (uint32_t)val;
+}
 int write_central_dir(CentralDirEnd *cdir, Value writer)
 {
     int i;
     enum {
         EXTRA_SIZE = 9,
+        EXTRA_ZIP64_SIZE = 28,
     };
 
     cdir->offset_of_cdir = cdir->current_offset;
 
     for (i = 0; i < cdir->cdir_size; i++) {
         char central[CENTRAL_SIZE];
-        char extra[EXTRA_SIZE];
-        int extra_size = 0;
+        char extra[EXTRA_ZIP64_SIZE + EXTRA_SIZE];
+        int extra_size;
         CentralDir *cd = &cdir->cdir[i];
 
+        extra_size = make_extra_zip64(extra, cd);
+
         memcpy(central, "PK\x01\x02", 4);
-        ptr_write_uint16_le(central + 4, 30);          // 作成されたバージョン
-        ptr_write_uint16_le(central + 6, 20);          // 要求バージョン
+        ptr_write_uint16_le(central + 4, extra_size > 0 ? 45 : 30); // 作成されたバージョン
+        ptr_write_uint16_le(central + 6, extra_size > 0 ? 45 : 20); // 要求バージョン
         ptr_write_uint16_le(central + 8, cd->flags);   // 汎用フラグ
         ptr_write_uint16_le(central + 10, cd->method); // 圧縮メソッド
 
@@ -657,20 +968,20 @@ int write_central_dir(CentralDirEnd *cdir, Value writer)
         }
 
         if (cd->time_valid) {
-            make_extra_time(extra, cd->modified);
-            extra_size = EXTRA_SIZE;
+            make_extra_time(extra + extra_size, cd->modified);
+            extra_size += EXTRA_SIZE;
         }
 
         ptr_write_uint32_le(central + 16, cd->crc32);
-        ptr_write_uint32_le(central + 20, cd->size_compressed);
-        ptr_write_uint32_le(central + 24, cd->size);
+        ptr_write_uint32_le(central + 20, limit_uint32(cd->size_compressed));
+        ptr_write_uint32_le(central + 24, limit_uint32(cd->size));
         ptr_write_uint16_le(central + 28, cd->filename.size);
         ptr_write_uint16_le(central + 30, extra_size); // 拡張フィールドの長さ
         ptr_write_uint16_le(central + 32, 0);          // ファイルコメントの長さ
         ptr_write_uint16_le(central + 34, 0);          // ファイルが開始するディスク番号
         ptr_write_uint16_le(central + 36, 0);          // 内部ファイル属性
         ptr_write_uint32_le(central + 38, 0);          // 外部ファイル属性
-        ptr_write_uint32_le(central + 42, cd->offset); // ローカルファイルヘッダの相対オフセット
+        ptr_write_uint32_le(central + 42, limit_uint32(cd->offset)); // ローカルファイルヘッダの相対オフセット
 
         if (!write_bin_data(cdir, writer, central, CENTRAL_SIZE)) {
             return FALSE;
@@ -678,8 +989,8 @@ int write_central_dir(CentralDirEnd *cdir, Value writer)
         if (!write_bin_data(cdir, writer, cd->filename.p, cd->filename.size)) {
             return FALSE;
         }
-        if (cd->time_valid) {
-            if (!write_bin_data(cdir, writer, extra, EXTRA_SIZE)) {
+        if (extra_size > 0) {
+            if (!write_bin_data(cdir, writer, extra, extra_size)) {
                 return FALSE;
             }
         }
@@ -689,17 +1000,57 @@ int write_central_dir(CentralDirEnd *cdir, Value writer)
     return TRUE;
 }
 
+/**
+ * エントリ数、サイズ、オフセットのいずれかが収まらない場合は、Zip64終端レコードとロケータを先に書く
+ */
+static int write_end_of_cdir64(CentralDirEnd *cdir, Value writer)
+{
+    char eocd64[EOCD64_SIZE];
+    char loc[EOCD64_LOCATOR_SIZE];
+    int64_t eocd64_pos = cdir->current_offset;
+
+    memcpy(eocd64, EOCD64_MAGIC, 4);
+    ptr_write_uint64_le(eocd64 + 4, EOCD64_SIZE - 12); // 以降のレコードのサイズ
+    ptr_write_uint16_le(eocd64 + 12, 45);              // 作成されたバージョン
+    ptr_write_uint16_le(eocd64 + 14, 45);              // 要求バージョン
+    ptr_write_uint32_le(eocd64 + 16, 0);               // このディスクの数
+    ptr_write_uint32_le(eocd64 + 20, 0);               // セントラルディレクトリが開始するディスク
+    ptr_write_uint64_le(eocd64 + 24, cdir->cdir_size);
+    ptr_write_uint64_le(eocd64 + 32, cdir->cdir_size);
+    ptr_write_uint64_le(eocd64 + 40, cdir->size_of_cdir);
+    ptr_write_uint64_le(eocd64 + 48, cdir->offset_of_cdir);
+
+    memcpy(loc, EOCD64_LOCATOR_MAGIC, 4);
+    ptr_write_uint32_le(loc + 4, 0);                   // Zip64終端レコードがあるディスク
+    ptr_write_uint64_le(loc + 8, eocd64_pos);
+    ptr_write_uint32_le(loc + 16, 1);                  // ディスクの合計数
+
+    if (!write_bin_data(cdir, writer, eocd64, EOCD64_SIZE)) {
+        return FALSE;
+    }
+    if (!write_bin_data(cdir, writer, loc, EOCD64_LOCATOR_SIZE)) {
+        return FALSE;
+    }
+    return TRUE;
+}
 int write_end_of_cdir(CentralDirEnd *cdir, Value writer)
 {
     char eocd[EOCD_SIZE];
+    int num = (cdir->cdir_size >= 0xFFFF ? 0xFFFF : cdir->cdir_size);
+
+    if (num == 0xFFFF || cdir->size_of_cdir >= ZIP64_LIMIT || cdir->offset_of_cdir >= ZIP64_LIMIT) {
+        if (!write_end_of_cdir64(cdir, writer)) {
+            return FALSE;
+        }
+    }
 
     memcpy(eocd, "PK\x05\x06", 4);
     ptr_write_uint16_le(eocd + 4, 0);                // このディスクの数
     ptr_write_uint16_le(eocd + 6, 0);                // セントラルディレクトリが開始するディスク
-    ptr_write_uint16_le(eocd + 8, cdir->cdir_size);  // このディスク上のセントラルディレクトリレコードの数
-    ptr_write_uint16_le(eocd + 10, cdir->cdir_size); // セントラルディレクトリレコードの合計数
-    ptr_write_uint32_le(eocd + 12, cdir->size_of_cdir);
-    ptr_write_uint32_le(eocd + 16, cdir->offset_of_cdir);
+    ptr_write_uint16_le(eocd + 8, num);              // このディスク上のセントラルディレクトリレコードの数
+    ptr_write_uint16_le(eocd + 10, num);             // セントラルディレクトリレコードの合計数
+    ptr_write_uint32_le(eocd + 12, limit_uint32(cdir->size_of_cdir));
+    ptr_write_uint32_le(eocd + 16, limit_uint32(cdir->offset_of_cdir));
     ptr_write_uint16_le(eocd + 20, 0);               // コメントの長さ
 
     if (!write_bin_data(cdir, writer, eocd, EOCD_SIZE)) {
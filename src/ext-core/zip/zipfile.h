@@ -12,7 +12,7 @@ enum {
     CDIR_FLAG_PK0708 = (1 << 2),
     CDIR_FLAG_UTF8 = (1 << 11),
 
-    MAX_ALLOC = 16 * 1024 * 1024,
+    ZIP64_LIMIT = 0xFFFFFFFF,   // これ以上はZip64の拡張フィールドに書く
 };
 enum {
     INDEX_Z_STREAM = INDEX_STREAM_NUM,
@@ -20,6 +20,8 @@ enum {
     INDEX_Z_OUT,
     INDEX_Z_IN_BUF,
     INDEX_Z_LEVEL,
+    INDEX_Z_THREAD,
+    INDEX_Z_PDEFLATE,
     INDEX_Z_NUM,
 };
 enum {
@@ -41,6 +43,11 @@ enum {
     INDEX_ZIPENTRY_IN_BUF_SIZE,
     INDEX_ZIPENTRY_NUM,
 };
+enum {
+    PDEFLATE_RAW,
+    PDEFLATE_ZLIB,
+    PDEFLATE_GZIP,
+};
 enum {
     INDEX_ZIPENTRYITER_REF,
     INDEX_ZIPENTRYITER_INDEX,
@@ -109,19 +116,21 @@ enum {
 46+n    m   拡張フィールド
 46+n+m  k   ファイルコメント
  */
+typedef struct PDeflate PDeflate;
+
 typedef struct {
     RefCharset *cs;
-    int pos;
-    int end_pos;
+    int64_t pos;
+    int64_t end_pos;
 
     uint16_t flags;
     uint16_t method;
     uint32_t crc32;
-    uint32_t size_compressed;
-    uint32_t size;
+    int64_t size_compressed;
+    int64_t size;
     uint16_t attr1;
     uint32_t attr2;
-    int32_t offset;
+    int64_t offset;
 
     int64_t modified;
     int time_valid;
@@ -131,7 +140,9 @@ typedef struct {
 
     int z_init;
     int z_finish;
-    z_stream z;
+    z_stream z;       // 展開用
+    PDeflate *pd;     // 圧縮用
+    int n_thread;
 } CentralDir;
 
 /*
@@ -144,17 +155,37 @@ typedef struct {
 16  4   セントラルディレクトリの開始位置のオフセット
 20  2   ZIP ファイルのコメントの長さ (n)
 22  n   ZIP ファイルのコメント
+
+ Zip64 (いずれかの値が収まらない場合、終端レコードの前に置く)
+ 0  4   Zip64終端レコードのシグネチャ = 0x06064b50
+ 4  8   以降のレコードのサイズ (44)
+12  2   作成されたバージョン
+14  2   展開に必要なバージョン
+16  4   このディスクの数
+20  4   セントラルディレクトリが開始するディスク
+24  8   このディスク上のセントラルディレクトリレコードの数
+32  8   セントラルディレクトリレコードの合計数
+40  8   セントラルディレクトリのサイズ (バイト)
+48  8   セントラルディレクトリの開始位置のオフセット
+
+ 0  4   Zip64終端ロケータのシグネチャ = 0x07064b50
+ 4  4   Zip64終端レコードがあるディスク
+ 8  8   Zip64終端レコードのオフセット
+16  4   ディスクの合計数
  */
 typedef struct {
-    uint32_t size_of_cdir;
-    uint32_t offset_of_cdir;
+    int64_t size_of_cdir;
+    int64_t offset_of_cdir;
 
     RefCharset *cs;
     RefTimeZone *tz;
 
-    int current_offset;       // ZipWriterで使用
+    int64_t current_offset;   // ZipWriterで使用
     int cdir_size, cdir_max;
     CentralDir *cdir;
+
+    int32_t *name_index;      // ファイル名 -> cdirの番号 (開番地法、-1は空き)
+    int name_index_size;
 } CentralDirEnd;
 
 
@@ -175,7 +206,8 @@ extern RefNode *mod_zip;
 
 void CentralDirEnd_free(CentralDirEnd *cdir);
 int find_central_dir(CentralDir **cdir, Value reader, RefCharset *cs, RefTimeZone *tz);
-CentralDirEnd *get_central_dir(Value reader, int size, RefCharset *cs, RefTimeZone *tz);
+CentralDirEnd *get_central_dir(Value reader, int64_t size, RefCharset *cs, RefTimeZone *tz);
+int CentralDirEnd_find(CentralDirEnd *cdir, const char *name_p, int name_size, int local_cs);
 int get_local_header_size(Value reader, CentralDir *cdir);
 int read_cdir_data(char *dst, int *psize, Value reader, CentralDir *cdir);
 int write_bin_data(CentralDirEnd *cdir, Value writer, const char *p, int size);
@@ -186,5 +218,12 @@ int write_end_of_cdir(CentralDirEnd *cdir, Value writer);
 Hash *get_entry_map_static(const char *path, Mem *mem);
 int read_entry(char *buf, const ZipEntry *entry);
 
+// pdeflate.c
+PDeflate *pdeflate_new(int level, int wrap, int n_thread);
+void pdeflate_free(PDeflate *pd);
+const char *pdeflate_error(PDeflate *pd);
+int pdeflate_write(PDeflate *pd, StrBuf *out, const char *p, int size);
+int pdeflate_finish(PDeflate *pd, StrBuf *out, int parallel);
+
 
 #endif /* ZIPFILE_H_INCLUDED */
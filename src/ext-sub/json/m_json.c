@@ -98,7 +98,7 @@ static void JSTok_parse_digit(JSTok *tk)
         char c = *tk->p;
         *tk->p = '\0';
         errno = 0;
-        tk->real_val = strtod(top, NULL);
+        tk->real_val = str_to_double(top, NULL);
         *tk->p = c;
         if (errno != 0) {
             tk->type = JS_RANGE_ERR;
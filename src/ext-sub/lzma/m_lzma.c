@@ -90,7 +90,9 @@ static int lzmaio_new(Value *vret, Value *v, RefNode *node)
     }
 
     if (fs->Value_type(v1) == fs->cls_bytesio) {
-        flags = STREAM_READ|STREAM_WRITE;
+        RefBytesIO *mb = Value_vp(v1);
+        // マップしたファイルは読み込みのみ
+        flags = mb->mapped ? STREAM_READ : STREAM_READ|STREAM_WRITE;
     } else {
         Ref *r1 = Value_ref(v1);
         // 引数のStreamに応じて読み書き可能モードを設定する
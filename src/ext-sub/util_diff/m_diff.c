@@ -1,12 +1,60 @@
 #include "fox.h"
+#include "compat.h"
+#include <stdlib.h>
+#include <string.h>
 
 
+/*
+ * 重複ファイルの検出
+ *
+ * 1. サイズが同じファイルだけを候補にする
+ * 2. 先頭と末尾のブロックのハッシュを比較する
+ * 3. 残った候補だけ全体のハッシュ(XXH64)を比較する
+ * ファイルの読み込みは複数のスレッドで並列に行う
+ * ワーカースレッドからfs->の関数は呼ばないこと
+ */
+
 enum {
     INDEX_COMPFILE_FILE,
-    INDEX_COMPFILE_HASH,
+    INDEX_COMPFILE_HASH,    // 全体のハッシュ (filehashを参照した時に計算)
     INDEX_COMPFILE_SIZE,
     INDEX_COMPFILE_NUM,
 };
+enum {
+    INDEX_COMPFILESET_FILES,
+    INDEX_COMPFILESET_RECURSIVE,
+    INDEX_COMPFILESET_NUM,
+};
+enum {
+    CMPFILE_PARTIAL_SIZE = 4096,        // 先頭と末尾のブロックのサイズ
+    CMPFILE_READ_SIZE = 1024 * 1024,    // 全体を読む時のバッファサイズ
+    CMPFILE_THREAD_MAX = 16,
+};
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    uint8_t mem[32];
+    int mem_size;
+} XXH64State;
+
+typedef struct {
+    const char *path;
+    int64_t size;
+    uint64_t partial;
+    uint64_t full;
+    int full_done;  // 部分ハッシュが全体を含んでいる
+    int error;
+    int index;
+} CmpEntry;
+
+typedef struct {
+    CmpEntry **entry;
+    int n;
+    int full;       // TRUE:全体のハッシュ FALSE:部分ハッシュ
+    int start;      // start, start + step, ... を処理する
+    int step;
+} CmpTask;
 
 static const FoxStatic *fs;
 static FoxGlobal *fg;
@@ -16,53 +64,365 @@ static RefNode *cls_cmpfile;
 static RefNode *cls_cmpfileset;
 
 
-static int load_file(Ref *r, const char *path)
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r)
 {
-    char buf[4096];
-    int read_size = -1;
-    int32_t hash = 0;
-    int64_t size = 0;
-    FileHandle fd = open_fox(path, O_RDONLY);
+    return (x << r) | (x >> (64 - r));
+}
+static uint64_t read64_le(const uint8_t *p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+        | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+static uint32_t read32_le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+static void xxh64_init(XXH64State *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->v[0] = PRIME64_1 + PRIME64_2;
+    st->v[1] = PRIME64_2;
+    st->v[2] = 0;
+    st->v[3] = -PRIME64_1;
+}
+static void xxh64_update(XXH64State *st, const uint8_t *p, int size)
+{
+    const uint8_t *end = p + size;
+
+    st->total += size;
+    if (st->mem_size + size < 32) {
+        memcpy(st->mem + st->mem_size, p, size);
+        st->mem_size += size;
+        return;
+    }
+    if (st->mem_size > 0) {
+        int n = 32 - st->mem_size;
+        memcpy(st->mem + st->mem_size, p, n);
+        st->v[0] = xxh64_round(st->v[0], read64_le(st->mem));
+        st->v[1] = xxh64_round(st->v[1], read64_le(st->mem + 8));
+        st->v[2] = xxh64_round(st->v[2], read64_le(st->mem + 16));
+        st->v[3] = xxh64_round(st->v[3], read64_le(st->mem + 24));
+        p += n;
+        st->mem_size = 0;
+    }
+    while (p + 32 <= end) {
+        st->v[0] = xxh64_round(st->v[0], read64_le(p));
+        st->v[1] = xxh64_round(st->v[1], read64_le(p + 8));
+        st->v[2] = xxh64_round(st->v[2], read64_le(p + 16));
+        st->v[3] = xxh64_round(st->v[3], read64_le(p + 24));
+        p += 32;
+    }
+    if (p < end) {
+        memcpy(st->mem, p, end - p);
+        st->mem_size = end - p;
+    }
+}
+static uint64_t xxh64_digest(XXH64State *st)
+{
+    const uint8_t *p = st->mem;
+    const uint8_t *end = p + st->mem_size;
+    uint64_t h;
+
+    if (st->total >= 32) {
+        h = rotl64(st->v[0], 1) + rotl64(st->v[1], 7) + rotl64(st->v[2], 12) + rotl64(st->v[3], 18);
+        h = xxh64_merge(h, st->v[0]);
+        h = xxh64_merge(h, st->v[1]);
+        h = xxh64_merge(h, st->v[2]);
+        h = xxh64_merge(h, st->v[3]);
+    } else {
+        h = PRIME64_5;
+    }
+    h += st->total;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read64_le(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32_le(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int read_all_fox(FileHandle fd, char *buf, int size)
+{
+    int n = 0;
+    while (n < size) {
+        int r = read_fox(fd, buf + n, size - n);
+        if (r <= 0) {
+            break;
+        }
+        n += r;
+    }
+    return n;
+}
+/*
+ * 先頭と末尾のブロックのハッシュ
+ * ファイルが2ブロック以下なら、全体のハッシュと同じになる
+ */
+static int hash_partial(CmpEntry *e, char *buf)
+{
+    XXH64State st;
+    FileHandle fd = open_fox(e->path, O_RDONLY, DEFAULT_PERMISSION);
+    int n;
+
     if (fd == -1) {
         return FALSE;
     }
-
-    while ((read_size = read_fox(fd, buf, sizeof(buf))) > 0) {
-        int i;
-        for (i = 0; i < read_size; i++) {
-            hash = hash * 31 + buf[i];
+    xxh64_init(&st);
+    if (e->size <= CMPFILE_PARTIAL_SIZE * 2) {
+        n = read_all_fox(fd, buf, (int)e->size);
+        xxh64_update(&st, (uint8_t*)buf, n);
+        e->full = xxh64_digest(&st);
+        e->partial = e->full;
+        e->full_done = TRUE;
+    } else {
+        n = read_all_fox(fd, buf, CMPFILE_PARTIAL_SIZE);
+        xxh64_update(&st, (uint8_t*)buf, n);
+        if (seek_fox(fd, e->size - CMPFILE_PARTIAL_SIZE, SEEK_SET) < 0) {
+            close_fox(fd);
+            return FALSE;
         }
-        size += read_size;
+        n = read_all_fox(fd, buf, CMPFILE_PARTIAL_SIZE);
+        xxh64_update(&st, (uint8_t*)buf, n);
+        e->partial = xxh64_digest(&st);
     }
-    r->v[INDEX_COMPFILE_HASH] = int32_Value(hash & 0x7fffFFFF);
-    r->v[INDEX_COMPFILE_SIZE] = uint62_Value(size);
+    close_fox(fd);
+    return TRUE;
+}
+static int hash_full(CmpEntry *e, char *buf)
+{
+    XXH64State st;
+    FileHandle fd = open_fox(e->path, O_RDONLY, DEFAULT_PERMISSION);
+    int n;
 
+    if (fd == -1) {
+        return FALSE;
+    }
+    xxh64_init(&st);
+    while ((n = read_fox(fd, buf, CMPFILE_READ_SIZE)) > 0) {
+        xxh64_update(&st, (uint8_t*)buf, n);
+    }
+    close_fox(fd);
+    if (n < 0) {
+        return FALSE;
+    }
+    e->full = xxh64_digest(&st);
+    e->full_done = TRUE;
     return TRUE;
 }
+static void cmp_task(void *arg)
+{
+    CmpTask *t = arg;
+    char *buf = malloc(t->full ? CMPFILE_READ_SIZE : CMPFILE_PARTIAL_SIZE * 2);
+    int i;
 
-static int cmpfile_new(Value *vret, Value *v, RefNode *node)
+    for (i = t->start; i < t->n; i += t->step) {
+        CmpEntry *e = t->entry[i];
+        if (t->full) {
+            if (!e->full_done && !hash_full(e, buf)) {
+                e->error = TRUE;
+            }
+        } else {
+            if (!hash_partial(e, buf)) {
+                e->error = TRUE;
+            }
+        }
+    }
+    free(buf);
+}
+/*
+ * entryのハッシュを並列に計算する
+ */
+static void cmp_hash_entries(CmpEntry **entry, int n, int full)
+{
+    int n_thread = get_cpu_count() * 2;
+    CmpTask *task;
+    int i;
+
+    if (n_thread > CMPFILE_THREAD_MAX) {
+        n_thread = CMPFILE_THREAD_MAX;
+    }
+    if (n_thread > n) {
+        n_thread = n;
+    }
+    if (n_thread <= 0) {
+        return;
+    }
+    task = malloc(sizeof(CmpTask) * n_thread);
+    for (i = 0; i < n_thread; i++) {
+        task[i].entry = entry;
+        task[i].n = n;
+        task[i].full = full;
+        task[i].start = i;
+        task[i].step = n_thread;
+    }
+    run_parallel(cmp_task, task, sizeof(CmpTask), n_thread);
+    free(task);
+}
+
+static int key_size(const CmpEntry *e1, const CmpEntry *e2)
+{
+    if (e1->size != e2->size) {
+        return e1->size < e2->size ? -1 : 1;
+    }
+    return 0;
+}
+static int key_partial(const CmpEntry *e1, const CmpEntry *e2)
+{
+    int ret = key_size(e1, e2);
+    if (ret == 0 && e1->partial != e2->partial) {
+        ret = e1->partial < e2->partial ? -1 : 1;
+    }
+    return ret;
+}
+static int key_full(const CmpEntry *e1, const CmpEntry *e2)
+{
+    int ret = key_size(e1, e2);
+    if (ret == 0 && e1->full != e2->full) {
+        ret = e1->full < e2->full ? -1 : 1;
+    }
+    return ret;
+}
+static int sort_size(const void *p1, const void *p2)
+{
+    const CmpEntry *e1 = *(const CmpEntry**)p1;
+    const CmpEntry *e2 = *(const CmpEntry**)p2;
+    int ret = key_size(e1, e2);
+    return ret != 0 ? ret : e1->index - e2->index;
+}
+static int sort_partial(const void *p1, const void *p2)
+{
+    const CmpEntry *e1 = *(const CmpEntry**)p1;
+    const CmpEntry *e2 = *(const CmpEntry**)p2;
+    int ret = key_partial(e1, e2);
+    return ret != 0 ? ret : e1->index - e2->index;
+}
+static int sort_full(const void *p1, const void *p2)
+{
+    const CmpEntry *e1 = *(const CmpEntry**)p1;
+    const CmpEntry *e2 = *(const CmpEntry**)p2;
+    int ret = key_full(e1, e2);
+    return ret != 0 ? ret : e1->index - e2->index;
+}
+/*
+ * 並べ替えた後、keyが等しい要素が2つ以上続くものだけを残す
+ */
+static int cmp_keep_groups(CmpEntry **entry, int n, int (*sort)(const void*, const void*),
+        int (*key)(const CmpEntry*, const CmpEntry*))
+{
+    int i, j;
+    int ret = 0;
+
+    qsort(entry, n, sizeof(CmpEntry*), sort);
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && key(entry[i], entry[j]) == 0; j++) {
+        }
+        if (j - i >= 2) {
+            int k;
+            for (k = i; k < j; k++) {
+                entry[ret++] = entry[k];
+            }
+        }
+    }
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static Ref *cmpfile_new_sub(Value file, int64_t size)
 {
     Ref *r = fs->ref_new(cls_cmpfile);
-    RefNode *v_type = fs->Value_type(v[1]);
+    r->v[INDEX_COMPFILE_FILE] = file;
+    r->v[INDEX_COMPFILE_SIZE] = fs->int64_Value(size);
+    return r;
+}
+/*
+ * ファイルを開いてサイズを取得する
+ * ファイルの中身はここでは読まない
+ */
+static int get_size_of_file(int64_t *psize, const char *path)
+{
+    FileHandle fd = open_fox(path, O_RDONLY, DEFAULT_PERMISSION);
+
+    if (fd == -1) {
+        fs->throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(path, -1));
+        return FALSE;
+    }
+    *psize = get_file_size(fd);
+    close_fox(fd);
+    if (*psize < 0) {
+        fs->throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(path, -1));
+        return FALSE;
+    }
+    return TRUE;
+}
+static int value_to_file(Value *vret, Value v)
+{
+    RefNode *v_type = fs->Value_type(v);
 
-    *vret = vp_Value(r);
-    
     if (v_type == fs->cls_str) {
-        fs->Value_push("rv", fs->cls_file, v[1]);
+        fs->Value_push("rv", fs->cls_file, v);
         if (!fs->call_member_func(fs->str_new, 1, TRUE)) {
             return FALSE;
         }
-        r->v[INDEX_COMPFILE_FILE] = fg->stk_top[-1];
+        *vret = fg->stk_top[-1];
         fg->stk_top--;
     } else if (fs->is_subclass(v_type, fs->cls_file)) {
-        r->v[INDEX_COMPFILE_FILE] = fs->Value_cp(v[1]);
+        *vret = fs->Value_cp(v);
     } else {
-        fs->throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, fs->cls_str, fs->cls_file, v_type);
+        fs->throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, fs->cls_str, fs->cls_file, v_type, 1);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int cmpfile_new(Value *vret, Value *v, RefNode *node)
+{
+    Value file;
+    int64_t size;
+
+    if (!value_to_file(&file, v[1])) {
         return FALSE;
     }
-    if (!load_file(r, Value_cstr(r->v[INDEX_COMPFILE_FILE]))) {
+    if (!get_size_of_file(&size, Value_cstr(file))) {
+        fs->unref(file);
         return FALSE;
     }
+    *vret = vp_Value(cmpfile_new_sub(file, size));
 
     return TRUE;
 }
@@ -82,11 +442,10 @@ static int cmpfile_hash(Value *vret, Value *v, RefNode *node)
     for (i = 0; fname[i] != '\0'; i++) {
         hash = hash * 31 + fname[i];
     }
-    hash += r->v[INDEX_COMPFILE_SIZE];
-    hash += r->v[INDEX_COMPFILE_HASH];
+    hash += fs->Value_int64(r->v[INDEX_COMPFILE_SIZE], NULL);
 
     *vret = int32_Value(hash & 0x7fffFFFF);
- 
+
     return TRUE;
 }
 static int cmpfile_file(Value *vret, Value *v, RefNode *node)
@@ -105,7 +464,22 @@ static int cmpfile_size(Value *vret, Value *v, RefNode *node)
 static int cmpfile_filehash(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
-    *vret = r->v[INDEX_COMPFILE_HASH];
+
+    if (r->v[INDEX_COMPFILE_HASH] == VALUE_NULL) {
+        CmpEntry e;
+        char *buf = malloc(CMPFILE_READ_SIZE);
+
+        memset(&e, 0, sizeof(e));
+        e.path = Value_cstr(r->v[INDEX_COMPFILE_FILE]);
+        if (!hash_full(&e, buf)) {
+            free(buf);
+            fs->throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(e.path, -1));
+            return FALSE;
+        }
+        free(buf);
+        r->v[INDEX_COMPFILE_HASH] = fs->int64_Value((int64_t)(e.full & INT64_MAX));
+    }
+    *vret = fs->Value_cp(r->v[INDEX_COMPFILE_HASH]);
     return TRUE;
 }
 
@@ -113,8 +487,167 @@ static int cmpfile_filehash(Value *vret, Value *v, RefNode *node)
 
 static int cmpfileset_new(Value *vret, Value *v, RefNode *node)
 {
+    Ref *r = fs->ref_new(cls_cmpfileset);
+    *vret = vp_Value(r);
+
+    r->v[INDEX_COMPFILESET_FILES] = vp_Value(fs->refarray_new(0));
+    r->v[INDEX_COMPFILESET_RECURSIVE] = (fg->stk_top > v + 1 ? v[1] : VALUE_FALSE);
+
     return TRUE;
 }
+static int cmpfileset_add_file(RefArray *ra, Value file)
+{
+    int64_t size;
+    Ref *r;
+
+    if (!get_size_of_file(&size, Value_cstr(file))) {
+        fs->unref(file);
+        return FALSE;
+    }
+    r = cmpfile_new_sub(file, size);
+    *fs->refarray_push(ra) = vp_Value(r);
+    return TRUE;
+}
+/*
+ * ディレクトリ内のファイルを追加する
+ */
+static int cmpfileset_add_dir(RefArray *ra, RefStr *dir, int recursive)
+{
+    DIR *d = opendir_fox(dir->c);
+    struct dirent *dh;
+
+    if (d == NULL) {
+        fs->throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(dir->c, dir->size));
+        return FALSE;
+    }
+    while ((dh = readdir_fox(d)) != NULL) {
+        Value vf;
+        if (strcmp(dh->d_name, ".") == 0 || strcmp(dh->d_name, "..") == 0) {
+            continue;
+        }
+        if (dh->d_type == DT_REG) {
+            vf = fs->printf_Value("%r" SEP_S "%s", dir, dh->d_name);
+            Value_ref_header(vf)->type = fs->cls_file;
+            if (!cmpfileset_add_file(ra, vf)) {
+                closedir_fox(d);
+                return FALSE;
+            }
+        } else if (dh->d_type == DT_DIR && recursive) {
+            int ret;
+            vf = fs->printf_Value("%r" SEP_S "%s", dir, dh->d_name);
+            ret = cmpfileset_add_dir(ra, Value_vp(vf), recursive);
+            fs->unref(vf);
+            if (!ret) {
+                closedir_fox(d);
+                return FALSE;
+            }
+        }
+    }
+    closedir_fox(d);
+    return TRUE;
+}
+/*
+ * add(file) : ファイルかディレクトリを追加する
+ */
+static int cmpfileset_add(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefArray *ra = Value_vp(r->v[INDEX_COMPFILESET_FILES]);
+    Value file;
+    DIR *d;
+
+    if (!value_to_file(&file, v[1])) {
+        return FALSE;
+    }
+    d = opendir_fox(Value_cstr(file));
+    if (d != NULL) {
+        int ret;
+        closedir_fox(d);
+        ret = cmpfileset_add_dir(ra, Value_vp(file), Value_bool(r->v[INDEX_COMPFILESET_RECURSIVE]));
+        fs->unref(file);
+        return ret;
+    }
+    return cmpfileset_add_file(ra, file);
+}
+static int cmpfileset_size(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefArray *ra = Value_vp(r->v[INDEX_COMPFILESET_FILES]);
+    *vret = int32_Value(ra->size);
+    return TRUE;
+}
+static int cmpfileset_files(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    *vret = fs->Value_cp(r->v[INDEX_COMPFILESET_FILES]);
+    return TRUE;
+}
+/*
+ * 同じ内容のファイルの組をList<List<CmpFile>>で返す
+ */
+static int cmpfileset_duplicates(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefArray *ra = Value_vp(r->v[INDEX_COMPFILESET_FILES]);
+    RefArray *ret = fs->refarray_new(0);
+    CmpEntry *ent = malloc(sizeof(CmpEntry) * (ra->size + 1));
+    CmpEntry **pent = malloc(sizeof(CmpEntry*) * (ra->size + 1));
+    int n = ra->size;
+    int i, j;
+
+    *vret = vp_Value(ret);
+    for (i = 0; i < n; i++) {
+        Ref *rf = Value_ref(ra->p[i]);
+        CmpEntry *e = &ent[i];
+        memset(e, 0, sizeof(*e));
+        e->path = Value_cstr(rf->v[INDEX_COMPFILE_FILE]);
+        e->size = fs->Value_int64(rf->v[INDEX_COMPFILE_SIZE], NULL);
+        e->index = i;
+        pent[i] = e;
+    }
+
+    // サイズが同じものだけ残す
+    n = cmp_keep_groups(pent, n, sort_size, key_size);
+
+    // 先頭と末尾のブロックが同じものだけ残す
+    cmp_hash_entries(pent, n, FALSE);
+    for (i = 0; i < n; i++) {
+        if (pent[i]->error) {
+            goto ERROR_END;
+        }
+    }
+    n = cmp_keep_groups(pent, n, sort_partial, key_partial);
+
+    // 全体のハッシュが同じもの
+    cmp_hash_entries(pent, n, TRUE);
+    for (i = 0; i < n; i++) {
+        if (pent[i]->error) {
+            goto ERROR_END;
+        }
+    }
+    n = cmp_keep_groups(pent, n, sort_full, key_full);
+
+    for (i = 0; i < n; i = j) {
+        RefArray *group = fs->refarray_new(0);
+        *fs->refarray_push(ret) = vp_Value(group);
+        for (j = i; j < n && key_full(pent[i], pent[j]) == 0; j++) {
+            Ref *rf = Value_ref(ra->p[pent[j]->index]);
+            if (rf->v[INDEX_COMPFILE_HASH] == VALUE_NULL) {
+                rf->v[INDEX_COMPFILE_HASH] = fs->int64_Value((int64_t)(pent[j]->full & INT64_MAX));
+            }
+            *fs->refarray_push(group) = fs->Value_cp(ra->p[pent[j]->index]);
+        }
+    }
+    free(pent);
+    free(ent);
+    return TRUE;
+
+ERROR_END:
+    fs->throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(pent[i]->path, -1));
+    free(pent);
+    free(ent);
+    return FALSE;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
 
@@ -146,8 +679,17 @@ static void define_class(RefNode *m)
 
     cls = cls_cmpfileset;
     n = fs->define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
-    fs->define_native_func_a(n, cmpfileset_new, 1, 1, NULL, fs->cls_bool);
-    
+    fs->define_native_func_a(n, cmpfileset_new, 0, 1, NULL, fs->cls_bool);
+
+    n = fs->define_identifier(m, cls, "add", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, cmpfileset_add, 1, 1, NULL, NULL);
+    n = fs->define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, cmpfileset_size, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "files", NODE_FUNC_N, NODEOPT_PROPERTY);
+    fs->define_native_func_a(n, cmpfileset_files, 0, 0, NULL);
+    n = fs->define_identifier(m, cls, "duplicates", NODE_FUNC_N, 0);
+    fs->define_native_func_a(n, cmpfileset_duplicates, 0, 0, NULL);
+    cls->u.c.n_memb = INDEX_COMPFILESET_NUM;
     fs->extends_method(cls, fs->cls_obj);
 }
 
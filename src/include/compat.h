@@ -97,5 +97,10 @@ typedef int FileHandle;
 
 int64_t get_file_size(FileHandle fh);
 
+typedef void (*ParallelFunc)(void *arg);
+
+int get_cpu_count(void);
+void run_parallel(ParallelFunc fn, void *args, int arg_size, int n);
+
 
 #endif /* COMPAT_H_INCLUDED */
@@ -700,4 +700,9 @@ uint32_t ptr_read_uint32(const char *p);
 void ptr_write_uint16(char *p, uint32_t val);
 void ptr_write_uint32(char *p, uint32_t val);
 
+// dtoa.c
+int double_to_digits(char *buf, int *pex, double d);
+int double_to_str(char *buf, double d);
+double str_to_double(const char *src, char **end);
+
 #endif /* FOX_H_INCLUDED */
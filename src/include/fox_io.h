@@ -54,6 +54,7 @@ typedef struct {
     Value dummy[INDEX_STREAM_NUM];
     int cur;
     StrBuf buf;
+    int mapped;     // ファイルをマップしている (読み込み専用)
 } RefBytesIO;
 
 #endif /* FOX_IO_H_INCLUDED */
@@ -126,6 +126,11 @@ struct Tok
     RefNode *arg_type; // 引数の型を覚えておく
     int arg_type_max;
 
+    int lazy;          // 関数本体を遅延コンパイルする (-1:プラグマで未指定)
+    const char *lazy_src; // 書き換え前のソース (lazy_baseの位置から末尾まで)
+    int lazy_base;
+    PtrList *lazy_var; // 宣言済みのメンバ変数 (先頭に追加)
+
     Mem *st_mem;
     Mem *cmp_mem;
 #ifdef DEBUGGER
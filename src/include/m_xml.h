@@ -7,6 +7,7 @@ enum {
     INDEX_ELEM_NAME,
     INDEX_ELEM_ATTR,
     INDEX_ELEM_CHILDREN,
+    INDEX_ELEM_INDEX,   // CSSセレクタ用の索引 (selectを呼んだ要素のみ)
     INDEX_ELEM_NUM,
 };
 enum {
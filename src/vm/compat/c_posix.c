@@ -64,3 +64,12 @@ int64_t get_now_time()
     clock_gettime(CLOCK_REALTIME, &ts);
     return (int64_t)ts.tv_sec * 1000 + (ts.tv_nsec / 1000000);
 }
+/*
+ * 経過時間の計測用 (マイクロ秒)
+ */
+int64_t get_tick_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + (ts.tv_nsec / 1000);
+}
@@ -4,7 +4,12 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 
 int get_file_mtime(int64_t *tm, const char *fname)
@@ -23,6 +28,30 @@ int get_file_mtime(int64_t *tm, const char *fname)
     return TRUE;
 }
 
+/**
+ * サイズ、更新日時、種類(EXISTS_*)をまとめて取得する
+ * シンボリックリンクはたどらない
+ */
+int get_file_info(int64_t *size, int64_t *tm, const char *fname)
+{
+    struct stat st;
+
+    if (lstat(fname, &st) == -1) {
+        return EXISTS_NONE;
+    }
+    *size = st.st_size;
+#if defined __USE_MISC || defined __USE_XOPEN2K8
+    *tm = (int64_t)st.st_mtim.tv_sec * 1000 + (st.st_mtim.tv_nsec / 1000000);
+#else
+    *tm = (int64_t)st.st_mtimespec.tv_sec * 1000 + (st.st_mtimespec.tv_nsec / 1000000);
+#endif
+    if (S_ISDIR(st.st_mode)) {
+        return EXISTS_DIR;
+    } else {
+        return EXISTS_FILE;
+    }
+}
+
 int exists_file(const char *file)
 {
     struct stat st;
@@ -37,6 +66,124 @@ int exists_file(const char *file)
     }
 }
 
+/**
+ * ファイル全体を読み込み専用でマップする
+ * 空のファイルの場合は*ppにNULLを設定する
+ */
+int mmap_file(char **pp, int64_t *psize, const char *fname)
+{
+    struct stat st;
+    void *p;
+    int fd = open(fname, O_RDONLY);
+
+    if (fd == -1) {
+        return FALSE;
+    }
+    if (fstat(fd, &st) == -1 || S_ISDIR(st.st_mode)) {
+        close(fd);
+        return FALSE;
+    }
+    *psize = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        *pp = NULL;
+        return TRUE;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // マップした後はファイルを閉じてもよい
+    close(fd);
+    if (p == MAP_FAILED) {
+        return FALSE;
+    }
+    *pp = p;
+    return TRUE;
+}
+void munmap_file(char *p, int64_t size)
+{
+    if (p != NULL) {
+        munmap(p, size);
+    }
+}
+
+/**
+ * srcからdstへ最大sizeバイトコピーする (size < 0の場合は終端まで)
+ * Linuxではsendfileを使い、使えない場合はバッファを経由する
+ * コピーしたサイズを返す (エラーの場合は-1)
+ */
+int64_t copy_fd_data(FileHandle dst, FileHandle src, int64_t size)
+{
+    enum {
+        COPY_CHUNK_SIZE = 1024 * 1024 * 1024,
+        COPY_BUF_SIZE = 256 * 1024,
+    };
+    int64_t total = 0;
+    char *buf;
+
+#ifdef __linux__
+    // 入力が通常のファイルならsendfileでカーネル内でコピーする
+    // 使えない場合 (パイプ、ソケットからの入力など) はEINVALになる
+    while (size < 0 || total < size) {
+        size_t req = COPY_CHUNK_SIZE;
+        ssize_t n;
+
+        if (size >= 0 && size - total < req) {
+            req = size - total;
+        }
+        n = sendfile(dst, src, NULL, req);
+        if (n > 0) {
+            total += n;
+        } else if (n == 0) {
+            // /procなどはサイズが0になるので、readで読み直す
+            if (total > 0) {
+                return total;
+            }
+            break;
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    if (size >= 0 && total >= size) {
+        return total;
+    }
+#endif
+
+    buf = malloc(COPY_BUF_SIZE);
+    while (size < 0 || total < size) {
+        int req = COPY_BUF_SIZE;
+        int rd, wr;
+
+        if (size >= 0 && size - total < req) {
+            req = size - total;
+        }
+        rd = read(src, buf, req);
+        if (rd == 0) {
+            break;
+        } else if (rd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto ERROR_END;
+        }
+        for (wr = 0; wr < rd; ) {
+            int n = write(dst, buf + wr, rd - wr);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                goto ERROR_END;
+            }
+            wr += n;
+        }
+        total += rd;
+    }
+    free(buf);
+    return total;
+
+ERROR_END:
+    free(buf);
+    return -1;
+}
+
 int is_root_dir(const char *path_p, int path_size)
 {
     if (path_size < 0) {
@@ -109,6 +109,20 @@ int64_t get_now_time()
     // 1601-01-01から1969-01-01までの秒数を引く
     return i64 / 10000 - 11644473600000LL;
 }
+/*
+ * 経過時間の計測用 (マイクロ秒)
+ */
+int64_t get_tick_usec()
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER cnt;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&cnt);
+    return cnt.QuadPart / freq.QuadPart * 1000000 + cnt.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
@@ -164,6 +178,27 @@ int get_file_mtime(int64_t *tm, const char *fname)
     return TRUE;
 }
 
+/**
+ * サイズ、更新日時、種類(EXISTS_*)をまとめて取得する
+ */
+int get_file_info(int64_t *size, int64_t *tm, const char *fname)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fa;
+    wchar_t *wtmp = filename_to_utf16(fname, NULL);
+    int ret = GetFileAttributesExW(wtmp, GetFileExInfoStandard, &fa);
+    int64_t i64;
+    free(wtmp);
+
+    if (!ret) {
+        return EXISTS_NONE;
+    }
+    *size = (int64_t)((uint64_t)fa.nFileSizeLow | ((uint64_t)fa.nFileSizeHigh << 32));
+    i64 = (uint64_t)fa.ftLastWriteTime.dwLowDateTime | ((uint64_t)fa.ftLastWriteTime.dwHighDateTime << 32);
+    *tm = i64 / 10000 - 11644473600000LL;
+
+    return (fa.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 ? EXISTS_DIR : EXISTS_FILE;
+}
+
 int exists_file(const char *file)
 {
     WIN32_FIND_DATAW fd;
@@ -179,6 +214,93 @@ int exists_file(const char *file)
     return (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 ? EXISTS_DIR : EXISTS_FILE;
 }
 
+/**
+ * ファイル全体を読み込み専用でマップする
+ * 空のファイルの場合は*ppにNULLを設定する
+ */
+int mmap_file(char **pp, int64_t *psize, const char *fname)
+{
+    wchar_t *wtmp = filename_to_utf16(fname, NULL);
+    HANDLE hFile = CreateFileW(wtmp, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE hMap;
+    LARGE_INTEGER li;
+    void *p;
+    free(wtmp);
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    if (!GetFileSizeEx(hFile, &li)) {
+        CloseHandle(hFile);
+        return FALSE;
+    }
+    *psize = li.QuadPart;
+    if (li.QuadPart == 0) {
+        CloseHandle(hFile);
+        *pp = NULL;
+        return TRUE;
+    }
+    hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMap == NULL) {
+        return FALSE;
+    }
+    p = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    // ビューが残っていればマッピングは解放されない
+    CloseHandle(hMap);
+    if (p == NULL) {
+        return FALSE;
+    }
+    *pp = p;
+    return TRUE;
+}
+void munmap_file(char *p, int64_t size)
+{
+    if (p != NULL) {
+        UnmapViewOfFile(p);
+    }
+}
+
+/**
+ * srcからdstへ最大sizeバイトコピーする (size < 0の場合は終端まで)
+ * コピーしたサイズを返す (エラーの場合は-1)
+ */
+int64_t copy_fd_data(FileHandle dst, FileHandle src, int64_t size)
+{
+    enum {
+        COPY_BUF_SIZE = 256 * 1024,
+    };
+    char *buf = malloc(COPY_BUF_SIZE);
+    int64_t total = 0;
+
+    while (size < 0 || total < size) {
+        DWORD req = COPY_BUF_SIZE;
+        DWORD rd, wr;
+
+        if (size >= 0 && size - total < req) {
+            req = (DWORD)(size - total);
+        }
+        if (!ReadFile((HANDLE)src, buf, req, &rd, NULL)) {
+            // パイプの終端
+            if (GetLastError() == ERROR_BROKEN_PIPE) {
+                break;
+            }
+            free(buf);
+            return -1;
+        }
+        if (rd == 0) {
+            break;
+        }
+        if (!WriteFile((HANDLE)dst, buf, rd, &wr, NULL) || wr != rd) {
+            free(buf);
+            return -1;
+        }
+        total += rd;
+    }
+    free(buf);
+    return total;
+}
+
 void get_random(void *buf, int len)
 {
     HCRYPTPROV hProv;
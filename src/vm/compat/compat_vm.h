@@ -54,7 +54,11 @@ int win_write_console(FileHandle fd, const char *str, int size);
 #endif  /* WIN32 */
 
 int get_file_mtime(int64_t *tm, const char *fname);
+int get_file_info(int64_t *size, int64_t *tm, const char *fname);
 int exists_file(const char *file);
+int mmap_file(char **pp, int64_t *psize, const char *fname);
+void munmap_file(char *p, int64_t size);
+int64_t copy_fd_data(FileHandle dst, FileHandle src, int64_t size);
 int is_root_dir(const char *path_p, int path_size);
 int is_absolute_path(const char *path_p, int path_size);
 Str get_root_name(const char *path_p, int path_size);
@@ -63,6 +67,7 @@ void native_sleep(int ms);
 const char *get_default_locale(void);
 void get_local_timezone_name(char *buf, int max);
 int64_t get_now_time(void);
+int64_t get_tick_usec(void);
 void get_random(void *buf, int len);
 
 void init_stdio(void);
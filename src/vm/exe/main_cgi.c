@@ -387,6 +387,23 @@ static void show_configure(void)
     stream_write_data(fg->v_cio, ctmp, -1);
     stream_write_data(fg->v_cio, tlend, -1);
 
+    stream_write_data(fg->v_cio, "FOX_MAX_CALL</th><td>", -1);
+    if (defs[ENVSET_MAX_CALL]) {
+        sprintf(ctmp, "%d", fv->max_callfunc);
+    } else {
+        sprintf(ctmp, "<span class=\"def\">%d</span>", fv->max_callfunc);
+    }
+    stream_write_data(fg->v_cio, ctmp, -1);
+    stream_write_data(fg->v_cio, tlend, -1);
+
+    stream_write_data(fg->v_cio, "FOX_COMPILE</th><td>", -1);
+    if (defs[ENVSET_COMPILE]) {
+        stream_write_data(fg->v_cio, fv->lazy_compile ? "lazy" : "strict", -1);
+    } else {
+        stream_write_data(fg->v_cio, "<span class=\"def\">strict</span>", -1);
+    }
+    stream_write_data(fg->v_cio, tlend, -1);
+
     show_configure_path(fs->import_path, "FOX_IMPORT</th><td>");
     show_configure_path(fs->resource_path, "FOX_RESOURCE</th><td>");
 
@@ -301,6 +301,21 @@ static void show_configure(void)
     }
     stream_write_data(fg->v_cio, ctmp, -1);
 
+    stream_write_data(fg->v_cio, "\nFOX_MAX_CALL: ", -1);
+    if (defs[ENVSET_MAX_CALL]) {
+        sprintf(ctmp, "%d", fv->max_callfunc);
+    } else {
+        sprintf(ctmp, "(%d)", fv->max_callfunc);
+    }
+    stream_write_data(fg->v_cio, ctmp, -1);
+
+    stream_write_data(fg->v_cio, "\nFOX_COMPILE: ", -1);
+    if (defs[ENVSET_COMPILE]) {
+        stream_write_data(fg->v_cio, fv->lazy_compile ? "lazy" : "strict", -1);
+    } else {
+        stream_write_data(fg->v_cio, "(strict)", -1);
+    }
+
     show_configure_path(fs->import_path, "\nFOX_IMPORT: ");
     show_configure_path(fs->resource_path, "\nFOX_RESOURCE: ");
 
@@ -786,7 +786,8 @@ int BigInt_int64(const BigInt *bi, int64_t *value)
     case 1:
     case 2:
     case 3:
-        for (i = 0; i < bi->size; i++) {
+        // 上位の桁から
+        for (i = bi->size - 1; i >= 0; i--) {
             v = (v << BIGINT_DIGIT_BITS) | bi->d[i];
         }
         break;
@@ -218,6 +218,8 @@ static RefTimeZone *RefTimeZone_new(int count, const char *name)
     ptz->rh.weak_ref = NULL;
     ptz->name = name;
     ptz->count = count;
+    ptz->last = 0;
+    ptz->local_sorted = TRUE;
 
     return ptz;
 }
@@ -270,6 +272,13 @@ RefTimeZone *load_timezone(const char *name_p, int name_size)
             off->is_dst = line_data >> 31;
             off->abbr = tzdata_abbr + ((line_data >> 18) & 0x1FFF);
         }
+        // off[0].beginはINT64_MINなので比較しない
+        for (i = 2; i < n; i++) {
+            if (tz->off[i].begin + tz->off[i].offset < tz->off[i - 1].begin + tz->off[i - 1].offset) {
+                tz->local_sorted = FALSE;
+                break;
+            }
+        }
 
         alias->tz = tz;
     }
@@ -287,20 +296,48 @@ RefTimeZone *get_machine_localtime(void)
     return tz;
 }
 
+#define TZ_KEY(tz, i, local) ((tz)->off[i].begin + ((local) ? (tz)->off[i].offset : 0))
+
 /**
- * tm(UTC)に対応するオフセットを返す
+ * TZ_KEY(i) <= tm となる最大のi (1 <= i < count) を返す。なければ0
+ * 変更が終わった後の時刻と、前回と同じ区間の時刻は二分探索しない
  */
-TimeOffset *TimeZone_offset_utc(RefTimeZone *tz, int64_t tm)
+static int TimeZone_search(RefTimeZone *tz, int64_t tm, int local)
 {
-    int i;
+    int n = tz->count;
+    int i = tz->last;
+    int lo, hi;
 
-    for (i = tz->count - 1; i > 0; i--) {
-        TimeOffset *off = &tz->off[i];
-        if (tm >= off->begin) {
-            return off;
+    if (n <= 1) {
+        return 0;
+    }
+    if (tm >= TZ_KEY(tz, n - 1, local)) {
+        return n - 1;
+    }
+    if (i < n - 1 && (i == 0 || tm >= TZ_KEY(tz, i, local)) && tm < TZ_KEY(tz, i + 1, local)) {
+        return i;
+    }
+
+    // TZ_KEY(lo) <= tm < TZ_KEY(hi)  (TZ_KEY(0)は-∞とみなす)
+    lo = 0;
+    hi = n - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (tm >= TZ_KEY(tz, mid, local)) {
+            lo = mid;
+        } else {
+            hi = mid;
         }
     }
-    return &tz->off[0];
+    tz->last = lo;
+    return lo;
+}
+/**
+ * tm(UTC)に対応するオフセットを返す
+ */
+TimeOffset *TimeZone_offset_utc(RefTimeZone *tz, int64_t tm)
+{
+    return &tz->off[TimeZone_search(tz, tm, FALSE)];
 }
 /**
  * tm(local)に対応するオフセットを返す
@@ -310,6 +347,9 @@ TimeOffset *TimeZone_offset_local(RefTimeZone *tz, int64_t tm)
 {
     int i;
 
+    if (tz->local_sorted) {
+        return &tz->off[TimeZone_search(tz, tm, TRUE)];
+    }
     for (i = tz->count - 1; i > 0; i--) {
         TimeOffset *off = &tz->off[i];
         if (tm >= off->begin + off->offset) {
@@ -25,6 +25,8 @@ struct RefTimeZone {
 
     const char *name;   // ex. Asia/Tokyo
     int count;
+    int last;           // 前回見つかったoff[]の位置
+    int local_sorted;   // off[].begin + off[].offsetが昇順
     TimeOffset off[0];
 };
 
@@ -173,6 +173,11 @@ void Value_release_ref(Value v)
     Ref *r = (Ref*)(uintptr_t)v;
     RefNode *type = r->rh.type;
 
+    // デストラクタ実行中に循環参照の回収対象にならないように、先に外す
+    // (生成後に型を差し替えるものがあるので、型では判定しない)
+    if (fv->gc.count > 0) {
+        gc_untrack(&r->rh);
+    }
     if (type != NULL) {
         call_dispose(v, type);
     }
@@ -299,6 +304,7 @@ int call_property(RefStr *name)
             } else {
                 // 内部変数なしのFunctionオブジェクトを生成
                 Ref *r = ref_new_n(fs->cls_fn, INDEX_FUNC_LOCAL);
+                gc_track(&r->rh, GC_KIND_REF);
                 r->v[INDEX_FUNC_FN] = Value_cp(vp_Value(memb));
                 r->v[INDEX_FUNC_THIS] = *v;
                 r->v[INDEX_FUNC_N_LOCAL] = int32_Value(0);
@@ -333,16 +339,18 @@ int call_property(RefStr *name)
     return TRUE;
 }
 /**
- * メンバ関数を呼び出す
- * raise_exception == FALSEの場合は、メンバが見つからなくても例外を投げない
- * (メンバ関数中で例外が発生した場合は伝える)
+ * 呼び出すメンバ関数を探す
+ * _method_missingを呼ぶ場合は引数の先頭に名前を挿入し、*pargcを増やす
+ * 見つからない場合はNULLを返す (raise_exception == FALSEかつ例外を投げていなければ*perrはFALSE)
  */
-int call_member_func(RefStr *name, int argc, int raise_exception)
+static RefNode *get_member_func(RefStr *name, int *pargc, int raise_exception, int *perr)
 {
-    Value *v = fg->stk_top - argc - 1;
+    Value *v = fg->stk_top - *pargc - 1;
     RefNode *klass = Value_type(*v);
     RefNode *memb;
 
+    *perr = TRUE;
+
 CLASS_NEW:
     if (klass == fs->cls_class) {
         // コンストラクタを探す
@@ -354,7 +362,7 @@ CLASS_NEW:
             switch (memb->type) {
             case NODE_NEW:
             case NODE_NEW_N:
-                return call_function(memb, argc);
+                return memb;
             default:
                 // 見つからない
                 break;
@@ -368,10 +376,10 @@ CLASS_NEW:
         if (memb == NULL) {
             if (raise_exception) {
                 throw_error_select(THROW_NO_MEMBER_EXISTS__NODE_REFSTR, mod, name);
-                return FALSE;
             } else {
-                return TRUE;
+                *perr = FALSE;
             }
+            return NULL;
         }
         // メンバがクラスだった場合、コンストラクタ呼び出しのお膳立てをする
         if (memb->type == NODE_CLASS) {
@@ -391,20 +399,20 @@ CLASS_NEW:
                 if (memb != NULL) {
                     // 引数の先頭に名前を挿入
                     RefStr *name2 = prop ? intern(name->c, name->size - 1) : name;
-                    Value *arg_base = fg->stk_top - argc;
-                    memmove(arg_base + 1, arg_base, argc * sizeof(Value));
+                    Value *arg_base = fg->stk_top - *pargc;
+                    memmove(arg_base + 1, arg_base, *pargc * sizeof(Value));
                     *arg_base = (Value)(uintptr_t)name2;
                     fg->stk_top++;
-                    argc++;
+                    (*pargc)++;
                 }
             }
             if (memb == NULL) {
                 if (raise_exception) {
                     throw_error_select(THROW_NO_MEMBER_EXISTS__NODE_REFSTR, (klass == fs->cls_class ? Value_vp(*v) : klass), name);
-                    return FALSE;
                 } else {
-                    return TRUE;
+                    *perr = FALSE;
                 }
+                return NULL;
             }
         }
     }
@@ -414,22 +422,37 @@ CLASS_NEW:
     case NODE_FUNC_N:
         if ((memb->opt & NODEOPT_PROPERTY) != 0){
             throw_errorf(fs->mod_lang, "TypeError", "%r is property", name);
-            return FALSE;
+            return NULL;
         }
-        return call_function(memb, argc);
+        return memb;
     case NODE_CLASS: {
         RefNode *construct = Hash_get_p(&memb->u.c.h, fs->str_new);
         if (construct != NULL) {
-            return call_function(construct, argc);
+            return construct;
         } else {
             throw_errorf(fs->mod_lang, "NameError", "%n has no constructor named %r", klass, name);
-            return FALSE;
+            return NULL;
         }
     }
     default:
         throw_errorf(fs->mod_lang, "NameError", "%r is not a member function", name);
-        return FALSE;
+        return NULL;
+    }
+}
+/**
+ * メンバ関数を呼び出す
+ * raise_exception == FALSEの場合は、メンバが見つからなくても例外を投げない
+ * (メンバ関数中で例外が発生した場合は伝える)
+ */
+int call_member_func(RefStr *name, int argc, int raise_exception)
+{
+    int err;
+    RefNode *memb = get_member_func(name, &argc, raise_exception, &err);
+
+    if (memb == NULL) {
+        return !err;
     }
+    return call_function(memb, argc);
 }
 
 /**
@@ -470,25 +493,138 @@ static int call_super_constructor(RefStr *name, int argc)
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 
-int invoke_code(RefNode *func, int pc)
+static int validate_arguments(RefNode *node, int argc);
+static void setup_code_args(RefNode *node, int argc);
+static void setup_closure_args(Ref *r, RefNode *node, int argc);
+
+#define GC_SAFE_POINT() if (fv->gc.pending) { gc_collect(); }
+
+// Generatorの実行中は、スタックがGeneratorオブジェクトの中にある
+#define in_generator_stack(p) ((p) < fg->stk || (p) >= fg->stk + fs->max_stack)
+
+/**
+ * Generatorのスタックから関数を呼び出す場合、thisと引数をメインのスタックに移す
+ * 移す前の位置を返す
+ */
+static Value *move_args_to_main(int argc)
 {
-    OpCode *code = func->u.f.u.op;
-    OpCode *p;
+    Value *args = fg->stk_top - argc - 1;
+    memcpy(fv->stk_main_top, args, (argc + 1) * sizeof(Value));
+    fg->stk_top = fv->stk_main_top + argc + 1;
+    return args;
+}
+/**
+ * 呼び出しが終わったら、戻り値をGeneratorのスタックに戻す
+ * 失敗した場合は残りを除去する
+ */
+static void return_to_generator_stack(Value *args, int ret)
+{
+    Value *top = fv->stk_main_top;
 
-    fv->n_callfunc++;
-    if (fv->n_callfunc > MAX_CALLFUNC_NUM || fg->stk_top + func->u.f.max_stack > fg->stk_max) {
-        while (fg->stk_top > fg->stk_base + 1) {
+    if (ret) {
+        *args = *top;
+        fg->stk_top = args + 1;
+    } else {
+        while (fg->stk_top > top) {
             Value_pop();
         }
-        if (fv->n_callfunc > MAX_CALLFUNC_NUM) {
-            throw_errorf(fs->mod_lang, "StackOverflowError", "Too many function calls (%d)", MAX_CALLFUNC_NUM);
-        } else {
-            throw_errorf(fs->mod_lang, "StackOverflowError", "Stack overflow");
+        fg->stk_top = args;
+    }
+}
+/**
+ * 呼び出しの深さとスタックの残りを調べる
+ * 遅延コンパイルの関数は、ここで本体をコンパイルする
+ */
+static int check_call_limit(RefNode *func)
+{
+    if (func->u.f.u.op == NULL && !compile_lazy_function(func)) {
+        // コンパイルエラー
+    } else if (fv->n_callfunc >= fv->max_callfunc) {
+        throw_errorf(fs->mod_lang, "StackOverflowError", "Too many function calls (%d)", fv->max_callfunc);
+    } else if (fv->n_invoke > MAX_INVOKE_NEST) {
+        throw_errorf(fs->mod_lang, "StackOverflowError", "Too many nested function calls (%d)", MAX_INVOKE_NEST);
+    } else if (!in_generator_stack(fg->stk_top) && fg->stk_top + func->u.f.max_stack > fg->stk_max) {
+        throw_errorf(fs->mod_lang, "StackOverflowError", "Stack overflow");
+    } else {
+        return TRUE;
+    }
+    while (fg->stk_top > fg->stk_base + 1) {
+        Value_pop();
+    }
+    add_stack_trace(NULL, func, func->defined_line);
+    return FALSE;
+}
+/**
+ * fox関数の呼び出しをフレームとして積む
+ * invoke_codeを再帰呼び出しせずに、同じループで実行を続ける
+ * closure != NULLの場合は関数オブジェクトの呼び出し
+ */
+static int push_call_frame(RefNode *caller, int pc, RefNode *node, Ref *closure, int argc)
+{
+    Value *stk_base = fg->stk_base;
+    Value *genr_args = NULL;
+    CallFrame *cf;
+
+    GC_SAFE_POINT();
+    if (in_generator_stack(fg->stk_top)) {
+        genr_args = move_args_to_main(argc);
+    }
+    if (closure != NULL) {
+        // 両者が同じオブジェクトを指している場合を考慮
+        fg->stk_top[-argc - 1] = Value_cp(closure->v[INDEX_FUNC_THIS]);
+    }
+    // 最初の1つはthis
+    fg->stk_base = fg->stk_top - argc - 1;
+
+    if (!validate_arguments(node, argc)) {
+        if (closure != NULL) {
+            unref(vp_Value(closure));
         }
-        add_stack_trace(NULL, func, func->defined_line);
-        fv->n_callfunc--;
+        goto ERROR_END;
+    }
+    if (closure != NULL) {
+        setup_closure_args(closure, node, argc);
+    } else {
+        setup_code_args(node, argc);
+    }
+    if (!check_call_limit(node)) {
+        goto ERROR_END;
+    }
+
+    if (fv->n_frames >= fv->max_frames) {
+        fv->max_frames = (fv->max_frames > 0 ? fv->max_frames * 2 : 64);
+        fv->frames = realloc(fv->frames, sizeof(CallFrame) * fv->max_frames);
+    }
+    cf = &fv->frames[fv->n_frames++];
+    cf->func = caller;
+    cf->pc = pc;
+    cf->stk_base = stk_base;
+    cf->genr_args = genr_args;
+    fv->n_callfunc++;
+
+    return TRUE;
+
+ERROR_END:
+    fg->stk_base = stk_base;
+    if (genr_args != NULL) {
+        return_to_generator_stack(genr_args, FALSE);
+    }
+    return FALSE;
+}
+
+int invoke_code(RefNode *func, int pc)
+{
+    OpCode *code;
+    OpCode *p = NULL;
+    int frame_bottom = fv->n_frames;
+
+    fv->n_invoke++;
+    if (!check_call_limit(func)) {
+        fv->n_invoke--;
         return FALSE;
     }
+    code = func->u.f.u.op;
+    fv->n_callfunc++;
 
 NORMAL:
     for (;;) {
@@ -496,29 +632,26 @@ NORMAL:
 
         switch (p->type) {
         case OP_INIT_GENR: {  // Generatorインスタンスを返す
-            Ref *r = ref_new_n(fv->cls_generator, func->u.f.max_stack + INDEX_GENERATOR_LOCAL);
-            Value v = vp_Value(r);
+            // 以降はGeneratorオブジェクト内に移したフレームの上で実行する
+            int nstack = fg->stk_top - fg->stk_base;
+            Ref *r = ref_new_n(fv->cls_generator, func->u.f.max_stack + GENERATOR_STACK_MARGIN + INDEX_GENERATOR_LOCAL);
 
             r->v[INDEX_GENERATOR_PC] = int32_Value(1);
-            r->v[INDEX_GENERATOR_NSTACK] = int32_Value(fg->stk_top - fg->stk_base);
+            r->v[INDEX_GENERATOR_NSTACK] = int32_Value(nstack);
             r->v[INDEX_GENERATOR_FUNC] = Value_cp(vp_Value(func));
-            memcpy(&r->v[INDEX_GENERATOR_LOCAL], fg->stk_base, (fg->stk_top - fg->stk_base) * sizeof(Value));
+            memcpy(&r->v[INDEX_GENERATOR_LOCAL], fg->stk_base, nstack * sizeof(Value));
             fg->stk_top = fg->stk_base + 1;
-            *fg->stk_base = v;
-            fv->n_callfunc--;
-
-            return TRUE;
+            *fg->stk_base = vp_Value(r);
+            goto RETURN_FRAME;
         }
         case OP_YIELD_VAL: { // yield value
-            // スタックの値を退避
-            Ref *r = Value_ref(fg->stk_base[-1]);
+            // フレームはGeneratorオブジェクト内にあるので退避は不要
+            // 値はstk_topの位置に残し、pcとスタックの深さをフレームの直前に書き込む
             fg->stk_top--;
-            r->v[INDEX_GENERATOR_PC] = int32_Value(pc + 1);
-            r->v[INDEX_GENERATOR_NSTACK] = int32_Value(fg->stk_top - fg->stk_base);
-            memcpy(&r->v[INDEX_GENERATOR_LOCAL], fg->stk_base, (fg->stk_top - fg->stk_base) * sizeof(Value));
-            *fg->stk_base = *fg->stk_top;
-            fg->stk_top = fg->stk_base + 1;
+            fg->stk_base[INDEX_GENERATOR_PC - INDEX_GENERATOR_LOCAL] = int32_Value(pc + 1);
+            fg->stk_base[INDEX_GENERATOR_NSTACK - INDEX_GENERATOR_LOCAL] = int32_Value(fg->stk_top - fg->stk_base);
             fv->n_callfunc--;
+            fv->n_invoke--;
             return TRUE;
         }
         case OP_RETURN: // return
@@ -544,9 +677,9 @@ NORMAL:
                 }
                 fg->stk_top = v;
             }
-            fv->n_callfunc--;
-            return TRUE;
+            goto RETURN_FRAME;
         case OP_SUSPEND:
+            fv->n_invoke--;
             return TRUE;
         case OP_THROW: {
             Value v;
@@ -570,8 +703,7 @@ NORMAL:
 
         case OP_END:
             // catch/finally節から戻る
-            fv->n_callfunc--;
-            return TRUE;
+            goto RETURN_FRAME;
         case OP_FUNC:
         case OP_CLASS:
         case OP_MODULE:
@@ -605,7 +737,11 @@ NORMAL:
             Value *v = fg->stk_base;
             RefHeader *rh = Value_ref_header(*v);
             if (rh->type == fs->cls_fn || rh->type == fs->cls_class) {
-                *v = vp_Value(ref_new(Value_vp(p->op[0])));
+                Ref *r = ref_new(Value_vp(p->op[0]));
+                if (r->rh.n_memb > 0) {
+                    gc_track(&r->rh, GC_KIND_REF);
+                }
+                *v = vp_Value(r);
             }
             pc += 2;
             break;
@@ -613,6 +749,7 @@ NORMAL:
         case OP_NEW_FN: {
             Ref *r = ref_new_n(fs->cls_fn, INDEX_FUNC_LOCAL + p->s);
 
+            gc_track(&r->rh, GC_KIND_REF);
             r->v[INDEX_FUNC_THIS] = Value_cp(fg->stk_base[0]);
             r->v[INDEX_FUNC_FN] = Value_cp(p->op[0]);
             r->v[INDEX_FUNC_N_LOCAL] = int32_Value(p->s);
@@ -710,19 +847,34 @@ NORMAL:
             pc += 2;
             break;
         }
-        case OP_CALL_M:    // メソッド呼び出し
-            if (!call_member_func(Value_vp(p->op[1]), p->s, TRUE)) {
+        case OP_CALL_M:      // メソッド呼び出し
+        case OP_CALL_M_POP: {
+            int argc = p->s;
+            int err;
+            RefNode *fn = get_member_func(Value_vp(p->op[1]), &argc, TRUE, &err);
+
+            if (fn == NULL) {
                 goto THROW;
             }
-            pc += 3;
-            break;
-        case OP_CALL_M_POP:  // メソッド呼び出し
-            if (!call_member_func(Value_vp(p->op[1]), p->s, TRUE)) {
+            if ((fn->type & NODEMASK_FUNC) != 0) {
+                // fox関数はこのループで実行する
+                if (!push_call_frame(func, pc, fn, NULL, argc)) {
+                    goto THROW;
+                }
+                func = fn;
+                code = fn->u.f.u.op;
+                pc = 0;
+                break;
+            }
+            if (!call_function(fn, argc)) {
                 goto THROW;
             }
-            Value_pop();
+            if (p->type == OP_CALL_M_POP) {
+                Value_pop();
+            }
             pc += 3;
             break;
+        }
         case OP_CALL_NEXT: {  // for文でnext呼び出し
             Value *v = fg->stk_top;
             if (!call_member_func(fs->str_next, 0, TRUE)) {
@@ -784,41 +936,57 @@ NORMAL:
 
         case OP_CALL:
         case OP_CALL_POP: { // 関数呼び出し
-            Value v = fg->stk_top[-p->s - 1];
+            int argc = p->s;
+            Value v = fg->stk_top[-argc - 1];
+            Ref *closure = NULL;
+            RefNode *fn;
+            int err;
+
             if (Value_isref(v)) {
                 RefHeader *rh = Value_ref_header(v);
                 if (rh->n_memb > 0) {
-                    if (!call_function_obj(p->s)) {
-                        goto THROW;
-                    }
+                    closure = Value_ref(v);
+                    fn = Value_vp(closure->v[INDEX_FUNC_FN]);
                 } else {
                     RefNode *r = Value_vp(v);
                     switch (r->type) {
                     case NODE_CLASS:
-                        if (!call_member_func(fs->str_new, p->s, TRUE)) {
-                            goto THROW;
-                        }
+                        fn = get_member_func(fs->str_new, &argc, TRUE, &err);
                         break;
                     case NODE_MODULE:
-                        if (!call_member_func(fs->str_toplevel, p->s, TRUE)) {
-                            goto THROW;
-                        }
+                        fn = get_member_func(fs->str_toplevel, &argc, TRUE, &err);
                         break;
                     case NODE_FUNC: case NODE_FUNC_N:
                     case NODE_NEW:  case NODE_NEW_N:
-                        if (!call_function(r, p->s)) {
-                            goto THROW;
-                        }
+                        fn = r;
                         break;
                     default:
-                        if (!call_member_func(fs->symbol_stock[T_LP], p->s, TRUE)) {
-                            goto THROW;
-                        }
+                        fn = get_member_func(fs->symbol_stock[T_LP], &argc, TRUE, &err);
                         break;
                     }
                 }
             } else {
-                if (!call_member_func(fs->symbol_stock[T_LP], p->s, TRUE)) {
+                fn = get_member_func(fs->symbol_stock[T_LP], &argc, TRUE, &err);
+            }
+            if (fn == NULL) {
+                goto THROW;
+            }
+            if ((fn->type & NODEMASK_FUNC) != 0) {
+                // fox関数はこのループで実行する
+                if (!push_call_frame(func, pc, fn, closure, argc)) {
+                    goto THROW;
+                }
+                func = fn;
+                code = fn->u.f.u.op;
+                pc = 0;
+                break;
+            }
+            if (closure != NULL) {
+                if (!call_function_obj(argc)) {
+                    goto THROW;
+                }
+            } else {
+                if (!call_function(fn, argc)) {
                     goto THROW;
                 }
             }
@@ -858,6 +1026,8 @@ NORMAL:
                         } else {
                             result = neq;
                         }
+                        unref(v1);
+                        unref(v2);
                         fg->stk_top--;
                     } else {
                         RefNode *fn_eq = Hash_get_p(&type->u.c.h, fs->symbol_stock[T_EQ]);
@@ -987,6 +1157,10 @@ NORMAL:
             break;
         }
         case OP_JMP: // 無条件ジャンプ
+            if ((int)p->op[0] < pc) {
+                // ループの末尾
+                GC_SAFE_POINT();
+            }
             pc = (int)p->op[0];
             break;
         case OP_POP_IF_J: { // stk_topを取り出して真ならjmp
@@ -1063,8 +1237,7 @@ NORMAL:
             } else {
                 fg->stk_top--;
                 // 例外を上に伝える
-                fv->n_callfunc--;
-                return FALSE;
+                goto THROW_FRAME;
             }
             break;
 
@@ -1093,6 +1266,42 @@ NORMAL:
         }
     }
 
+RETURN_FRAME:
+    // 呼び出し元のフレームに戻る
+    fv->n_callfunc--;
+    if (fv->n_frames > frame_bottom) {
+        CallFrame *cf = &fv->frames[--fv->n_frames];
+
+        if (cf->genr_args != NULL) {
+            return_to_generator_stack(cf->genr_args, TRUE);
+        }
+        fg->stk_base = cf->stk_base;
+        func = cf->func;
+        code = func->u.f.u.op;
+        pc = cf->pc;
+        p = &code[pc];
+
+        switch (p->type) {
+        case OP_CALL_POP:
+            Value_pop();
+            pc += 2;
+            break;
+        case OP_CALL_M_POP:
+            Value_pop();
+            pc += 3;
+            break;
+        case OP_CALL_M:
+            pc += 3;
+            break;
+        default:
+            pc += 2;
+            break;
+        }
+        goto NORMAL;
+    }
+    fv->n_invoke--;
+    return TRUE;
+
 THROW:
     // 例外を発生させる可能性のある命令は必ず行番号を持っている
     if (p != NULL) {
@@ -1123,7 +1332,24 @@ THROW:
         }
         fg->stk_top = v;
     }
+
+THROW_FRAME:
+    // 呼び出し元のフレームに例外を伝える
     fv->n_callfunc--;
+    if (fv->n_frames > frame_bottom) {
+        CallFrame *cf = &fv->frames[--fv->n_frames];
+
+        if (cf->genr_args != NULL) {
+            return_to_generator_stack(cf->genr_args, FALSE);
+        }
+        fg->stk_base = cf->stk_base;
+        func = cf->func;
+        code = func->u.f.u.op;
+        pc = cf->pc;
+        p = &code[pc];
+        goto THROW;
+    }
+    fv->n_invoke--;
     return FALSE;
 }
 
@@ -1221,7 +1447,51 @@ static int validate_arguments(RefNode *node, int argc)
     return TRUE;
 }
 
-int call_function(RefNode *node, int argc)
+/**
+ * 可変長引数は配列にまとめ、不足した引数はnullで埋める
+ */
+static void setup_code_args(RefNode *node, int argc)
+{
+    int argc_max = node->u.f.arg_max;
+    if (argc_max < 0) {
+        // argc_minより多い引数はarrayにする
+        int i;
+        int argc_min = node->u.f.arg_min;
+        int n = argc - argc_min;
+        RefArray *arr = refarray_new(n);
+        for (i = 0; i < n; i++) {
+            arr->p[i] = fg->stk_base[argc_min + i + 1];
+        }
+        fg->stk_base[argc_min + 1] = vp_Value(arr);
+        fg->stk_top = fg->stk_base + argc_min + 2;
+    } else {
+        // 引数が不足した分はnullで埋める
+        while (argc < argc_max) {
+            *fg->stk_top++ = VALUE_NULL;
+            argc++;
+        }
+    }
+}
+/**
+ * 関数オブジェクトの場合、引数の後ろに内部変数を積む
+ */
+static void setup_closure_args(Ref *r, RefNode *node, int argc)
+{
+    int i;
+    int argc_max = node->u.f.arg_max;
+    int n_memb = Value_integral(r->v[INDEX_FUNC_N_LOCAL]);
+
+    // 不足している引数にnullを代入
+    while (argc < argc_max) {
+        *fg->stk_top++ = VALUE_NULL;
+        argc++;
+    }
+    for (i = 0; i < n_memb; i++) {
+        *fg->stk_top++ = Value_cp(r->v[INDEX_FUNC_LOCAL + i]);
+    }
+    unref(vp_Value(r));
+}
+static int call_function_sub(RefNode *node, int argc)
 {
     Value *stk_base = fg->stk_base;
     int ret;
@@ -1235,25 +1505,7 @@ int call_function(RefNode *node, int argc)
     }
 
     if ((node->type & NODEMASK_FUNC) != 0) {
-        int argc_max = node->u.f.arg_max;
-        if (argc_max < 0) {
-            // argc_minより多い引数はarrayにする
-            int i;
-            int argc_min = node->u.f.arg_min;
-            int n = argc - argc_min;
-            RefArray *arr = refarray_new(n);
-            for (i = 0; i < n; i++) {
-                arr->p[i] = fg->stk_base[argc_min + i + 1];
-            }
-            fg->stk_base[argc_min + 1] = vp_Value(arr);
-            fg->stk_top = fg->stk_base + argc_min + 2;
-        } else {
-            // 引数が不足した分はnullで埋める
-            while (argc < argc_max) {
-                *fg->stk_top++ = VALUE_NULL;
-                argc++;
-            }
-        }
+        setup_code_args(node, argc);
         ret = invoke_code(node, 0);
     } else if ((node->type & NODEMASK_FUNC_N) != 0) {
         ret = invoke_native(node);
@@ -1265,54 +1517,64 @@ int call_function(RefNode *node, int argc)
     fg->stk_base = stk_base;
     return ret;
 }
+int call_function(RefNode *node, int argc)
+{
+    if (in_generator_stack(fg->stk_top)) {
+        Value *args = move_args_to_main(argc);
+        int ret = call_function_sub(node, argc);
+        return_to_generator_stack(args, ret);
+        return ret;
+    }
+    return call_function_sub(node, argc);
+}
 
-int call_function_obj(int argc)
+static int call_function_obj_sub(int argc)
 {
     Value *v = fg->stk_top - argc - 1;
     Ref *r = Value_ref(*v);
+    RefNode *node = Value_vp(r->v[INDEX_FUNC_FN]);
+    Value *stk_base = fg->stk_base;
+    int ret;
 
-    if (r->rh.n_memb > 0) {
-        RefNode *node = Value_vp(r->v[INDEX_FUNC_FN]);
-        Value *stk_base = fg->stk_base;
-        int n_memb = Value_integral(r->v[INDEX_FUNC_N_LOCAL]);
-        int ret;
+    // 両者が同じオブジェクトを指している場合を考慮
+    *v = Value_cp(r->v[INDEX_FUNC_THIS]);
 
-        // 両者が同じオブジェクトを指している場合を考慮
-        *v = Value_cp(r->v[INDEX_FUNC_THIS]);
+    // 最初の1つはthis
+    fg->stk_base = fg->stk_top - argc - 1;
 
-        // 最初の1つはthis
-        fg->stk_base = fg->stk_top - argc - 1;
+    if (!validate_arguments(node, argc)) {
+        unref(vp_Value(r));
+        fg->stk_base = stk_base;
+        return FALSE;
+    }
 
-        if (!validate_arguments(node, argc)) {
-            unref(vp_Value(r));
-            fg->stk_base = stk_base;
-            return FALSE;
-        }
+    if ((node->type & NODEMASK_FUNC) != 0) {
+        setup_closure_args(r, node, argc);
+        ret = invoke_code(node, 0);
+    } else if ((node->type & NODEMASK_FUNC_N) != 0) {
+        unref(vp_Value(r));
+        ret = invoke_native(node);
+    } else {
+        fatal_errorf("invoke_function_obj : unknown node type : %d (%n)", node->type, node);
+        return FALSE;
+    }
 
-        if ((node->type & NODEMASK_FUNC) != 0) {
-            int i;
-            int argc_max = node->u.f.arg_max;
-            // 不足している引数にnullを代入
-            while (argc < argc_max) {
-                *fg->stk_top++ = VALUE_NULL;
-                argc++;
-            }
-            // 引数の後ろに内部変数を積む
-            for (i = 0; i < n_memb; i++) {
-                *fg->stk_top++ = Value_cp(r->v[INDEX_FUNC_LOCAL + i]);
-            }
-            unref(vp_Value(r));
-            ret = invoke_code(node, 0);
-        } else if ((node->type & NODEMASK_FUNC_N) != 0) {
-            unref(vp_Value(r));
-            ret = invoke_native(node);
-        } else {
-            fatal_errorf("invoke_function_obj : unknown node type : %d (%n)", node->type, node);
-            return FALSE;
-        }
+    fg->stk_base = stk_base;
+    return ret;
+}
+int call_function_obj(int argc)
+{
+    Value *v = fg->stk_top - argc - 1;
+    Ref *r = Value_ref(*v);
 
-        fg->stk_base = stk_base;
-        return ret;
+    if (r->rh.n_memb > 0) {
+        if (in_generator_stack(fg->stk_top)) {
+            Value *args = move_args_to_main(argc);
+            int ret = call_function_obj_sub(argc);
+            return_to_generator_stack(args, ret);
+            return ret;
+        }
+        return call_function_obj_sub(argc);
     } else {
         return call_function(Value_vp(*v), argc);
     }
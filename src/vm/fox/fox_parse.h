@@ -133,6 +133,18 @@ typedef struct Block
     int continue_p;  // continueでのジャンプ先
 } Block;
 
+typedef struct LazyFunc
+{
+    const char *src; // {から}まで
+    int size;
+    int line;
+    int n_args;
+    RefNode **args;  // 引数のローカル変数
+    RefNode *construct;
+    int genr;
+    PtrList *m_var;  // 関数定義の時点で宣言済みのメンバ変数
+} LazyFunc;
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 
 #define VALUE_ISCONST_U(v)  ((v) != 0ULL && ((v) & 3ULL) == 3ULL)
@@ -140,6 +152,7 @@ typedef struct Block
 
 // lex.c
 void Tok_init(Tok *tk, RefNode *module, char *buf);
+void Tok_init_line(Tok *tk, RefNode *module, char *buf, int line);
 void Tok_close(Tok *tk);
 void Tok_next(Tok *tk);
 void Tok_next_skip(Tok *tk);
@@ -13,7 +13,8 @@
 
 enum {
     MAX_EXPR_STACK = 1024,
-    MAX_CALLFUNC_NUM = 1024,
+    MAX_CALLFUNC_NUM = 65536,  // FOX_MAX_CALLの既定値
+    MAX_INVOKE_NEST = 1024,    // ネイティブ関数を経由した呼び出しのCスタック上の深さ
     MAX_STACKTRACE_NUM = 64,
 
     MAX_UNRSLV_NUM = 256,
@@ -31,6 +32,8 @@ enum {
     ENVSET_ERROR,
     ENVSET_MAX_ALLOC,
     ENVSET_MAX_STACK,
+    ENVSET_MAX_CALL,
+    ENVSET_COMPILE,
     ENVSET_NUM,
 };
 enum {
@@ -40,12 +43,26 @@ enum {
 };
 
 // class Generator
+// LOCAL以降をフレームとしてそのまま実行するため、PC,NSTACKはその直前に置く
 enum {
-    INDEX_GENERATOR_PC,
-    INDEX_GENERATOR_NSTACK,
     INDEX_GENERATOR_FUNC,
+    INDEX_GENERATOR_NSTACK,
+    INDEX_GENERATOR_PC,
     INDEX_GENERATOR_LOCAL,
 };
+enum {
+    GENERATOR_STACK_MARGIN = 16,
+};
+
+// 循環参照の回収対象
+enum {
+    GC_KIND_REF = 1,   // Ref (ユーザー定義クラス、関数オブジェクト)
+    GC_KIND_ARRAY,     // RefArray
+    GC_KIND_MAP,       // RefMap (Map, Set)
+};
+enum {
+    GC_THRESHOLD_MIN = 10000,
+};
 // class MimeData
 enum {
     INDEX_MIMEDATA_HEADER = INDEX_STREAM_NUM,
@@ -123,6 +140,36 @@ typedef struct {
     char bidi;   // 'L':ltr, 'R':rtl
 } LocaleData;
 
+typedef struct {
+    RefHeader *p;
+    int32_t kind;
+    int32_t gc_refs;
+} GCEntry;
+
+typedef struct {
+    GCEntry *entry;      // オープンアドレス法
+    int count, entry_num;
+
+    int enabled;
+    int pending;         // 次の安全な位置で回収する
+    int running;
+    int n_alloc;         // 前回の回収以降に追跡を始めた数
+    int threshold;
+
+    int64_t n_collect;
+    int64_t n_freed;
+    int64_t pause_total; // マイクロ秒
+    int64_t pause_last;
+} GCState;
+
+// invoke_code内でのfox関数呼び出し
+typedef struct {
+    RefNode *func;      // 呼び出し元の関数
+    int pc;             // 呼び出し元のOP_CALL*の位置
+    Value *stk_base;    // 呼び出し元のstk_base
+    Value *genr_args;   // Generatorのスタックから呼び出した場合、戻り値を書き戻す位置
+} CallFrame;
+
 typedef struct
 {
     int argc;
@@ -134,6 +181,7 @@ typedef struct
 
     RefNode *cls_fileio;
     RefNode *cls_strio;
+    RefNode *cls_lineiter;
     RefNode *cls_generator;
     RefNode *cls_mimeheader;
     RefNode *cls_mimedata;
@@ -151,6 +199,16 @@ typedef struct
     uint32_t hash_seed;
     int heap_count;
     int n_callfunc;
+    int max_callfunc;
+    int lazy_compile;  // 関数本体を最初の呼び出し時にコンパイルする
+    int n_invoke;
+
+    CallFrame *frames;    // invoke_code内で呼び出したfox関数の呼び出し元
+    int n_frames;
+    int max_frames;
+    Value *stk_main_top;  // Generatorの実行中、メインのスタックの先頭
+
+    GCState gc;
 
     RefNode **integral;  // 整数型互換クラス
     int integral_num;
@@ -332,6 +390,14 @@ int load_htfox(void);
 RefNode *get_module_from_src(const char *src_p, int src_size);
 RefNode *get_module_by_name(const char *name_p, int name_size, int syslib, int initialize);
 RefNode *get_module_by_file(const char *path_p);
+int compile_lazy_function(RefNode *func);
+
+
+// gc.c
+void gc_init(void);
+void gc_track(RefHeader *rh, int kind);
+void gc_untrack(RefHeader *rh);
+int gc_collect(void);
 
 
 // exec.c
@@ -421,12 +487,15 @@ char *file_value_to_path(Str *ret, Value v, int argn);
 int value_to_streamio(Value *stream, Value v, int writemode, int argn, int accept_textio);
 
 RefBytesIO *bytesio_new_sub(const char *src, int size);
+RefBytesIO *bytesio_new_mapped(char *p, int size);
 int bytesio_gets_sub(Str *result, Value v);
 StrBuf *bytesio_get_strbuf(Value v);
 
 void init_stream_ref(Ref *r, int mode);
 
 int stream_read_data(Value r, StrBuf *sb, char *p, int *psize, int keep, int read_all);
+int stream_read_direct(Value v, Value vmb, int size);
+int stream_copy_to_handle(FileHandle fd_out, Value v1, int64_t last, int *pdone);
 int stream_read_uint8(Value r, uint8_t *val);
 int stream_read_uint16(Value r, uint16_t *val);
 int stream_read_uint32(Value r, uint32_t *val);
@@ -448,6 +517,7 @@ void init_io_module_1(void);
 
 
 // m_io_text.c
+int lineiter_new(Value *vret, Value stream, int translit, Value *v);
 void init_io_text_module_1(void);
 
 
@@ -0,0 +1,378 @@
+#include "fox_vm.h"
+
+
+/*
+ * 循環参照の回収 (試行削除)
+ *
+ * List, Map, Set, ユーザー定義クラスのオブジェクト, 関数オブジェクトを追跡する
+ * 1. 追跡しているオブジェクトの参照カウントから、追跡しているオブジェクト同士の参照を引く
+ * 2. 残りが正のものは外部から参照されているので、そこから辿れるものを生存とする
+ * 3. 辿れなかったものは循環参照のみで保持されているので、参照を切って解放する
+ *
+ * ネイティブ関数がC言語のローカル変数で保持している値も参照カウントに含まれるので、
+ * 外部から参照されているものとして扱われる
+ */
+
+enum {
+    GC_ALIVE = INT32_MAX,
+};
+
+typedef struct {
+    RefHeader *p;
+    int kind;
+} GCGarbage;
+
+static GCEntry **gc_stack;
+static int gc_stack_n;
+static int gc_stack_max;
+
+
+static uint32_t gc_hash(RefHeader *rh)
+{
+    uintptr_t i = (uintptr_t)rh >> 4;
+    return (uint32_t)(i * 2654435761U);
+}
+static GCEntry *gc_find(RefHeader *rh)
+{
+    GCState *gc = &fv->gc;
+    uint32_t mask = gc->entry_num - 1;
+    uint32_t i;
+
+    if (gc->count == 0) {
+        return NULL;
+    }
+    for (i = gc_hash(rh) & mask; gc->entry[i].p != NULL; i = (i + 1) & mask) {
+        if (gc->entry[i].p == rh) {
+            return &gc->entry[i];
+        }
+    }
+    return NULL;
+}
+static void gc_insert(GCEntry *entry, int entry_num, RefHeader *rh, int kind)
+{
+    uint32_t mask = entry_num - 1;
+    uint32_t i = gc_hash(rh) & mask;
+
+    while (entry[i].p != NULL) {
+        i = (i + 1) & mask;
+    }
+    entry[i].p = rh;
+    entry[i].kind = kind;
+    entry[i].gc_refs = 0;
+}
+static void gc_grow(void)
+{
+    GCState *gc = &fv->gc;
+    int entry_num = gc->entry_num * 2;
+    GCEntry *entry = malloc(sizeof(GCEntry) * entry_num);
+    int i;
+
+    memset(entry, 0, sizeof(GCEntry) * entry_num);
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL) {
+            gc_insert(entry, entry_num, e->p, e->kind);
+        }
+    }
+    free(gc->entry);
+    gc->entry = entry;
+    gc->entry_num = entry_num;
+}
+
+void gc_init(void)
+{
+    GCState *gc = &fv->gc;
+
+    memset(gc, 0, sizeof(*gc));
+    gc->entry_num = 256;
+    gc->entry = malloc(sizeof(GCEntry) * gc->entry_num);
+    memset(gc->entry, 0, sizeof(GCEntry) * gc->entry_num);
+    gc->enabled = TRUE;
+    gc->threshold = GC_THRESHOLD_MIN;
+}
+/**
+ * 生成直後のオブジェクトを追跡対象に加える
+ */
+void gc_track(RefHeader *rh, int kind)
+{
+    GCState *gc = &fv->gc;
+
+    if ((gc->count + 1) * 2 > gc->entry_num) {
+        gc_grow();
+    }
+    gc_insert(gc->entry, gc->entry_num, rh, kind);
+    gc->count++;
+
+    gc->n_alloc++;
+    if (gc->enabled && gc->n_alloc >= gc->threshold) {
+        gc->pending = TRUE;
+    }
+}
+/**
+ * 解放するオブジェクトを追跡対象から外す
+ */
+void gc_untrack(RefHeader *rh)
+{
+    GCState *gc = &fv->gc;
+    GCEntry *e = gc_find(rh);
+    uint32_t mask = gc->entry_num - 1;
+    uint32_t i, j;
+
+    if (e == NULL) {
+        return;
+    }
+    gc->count--;
+
+    // 後ろの要素を詰める
+    i = e - gc->entry;
+    j = i;
+    for (;;) {
+        uint32_t k;
+        gc->entry[i].p = NULL;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (gc->entry[j].p == NULL) {
+                return;
+            }
+            k = gc_hash(gc->entry[j].p) & mask;
+            // kが(i, j]の範囲外なら移動できる
+            if (i <= j ? (i >= k || k > j) : (i >= k && k > j)) {
+                break;
+            }
+        }
+        gc->entry[i] = gc->entry[j];
+        i = j;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void gc_push(GCEntry *e)
+{
+    if (gc_stack_n >= gc_stack_max) {
+        gc_stack_max = (gc_stack_max > 0 ? gc_stack_max * 2 : 256);
+        gc_stack = realloc(gc_stack, sizeof(GCEntry*) * gc_stack_max);
+    }
+    gc_stack[gc_stack_n++] = e;
+}
+
+static void gc_visit_subtract(Value v)
+{
+    if (Value_isref(v)) {
+        GCEntry *e = gc_find(Value_ref_header(v));
+        if (e != NULL) {
+            e->gc_refs--;
+        }
+    }
+}
+static void gc_visit_alive(Value v)
+{
+    if (Value_isref(v)) {
+        GCEntry *e = gc_find(Value_ref_header(v));
+        if (e != NULL && e->gc_refs != GC_ALIVE) {
+            e->gc_refs = GC_ALIVE;
+            gc_push(e);
+        }
+    }
+}
+/**
+ * 保持している値をすべて辿る
+ */
+static void gc_traverse(RefHeader *rh, int kind, void (*visit)(Value))
+{
+    int i;
+
+    switch (kind) {
+    case GC_KIND_REF: {
+        Ref *r = (Ref*)rh;
+        for (i = 0; i < r->rh.n_memb; i++) {
+            visit(r->v[i]);
+        }
+        break;
+    }
+    case GC_KIND_ARRAY: {
+        RefArray *ra = (RefArray*)rh;
+        for (i = 0; i < ra->size; i++) {
+            visit(ra->p[i]);
+        }
+        break;
+    }
+    case GC_KIND_MAP: {
+        RefMap *rm = (RefMap*)rh;
+        for (i = 0; i < rm->entry_num; i++) {
+            HashValueEntry *he;
+            for (he = rm->entry[i]; he != NULL; he = he->next) {
+                visit(he->key);
+                visit(he->val);
+            }
+        }
+        break;
+    }
+    }
+}
+static void gc_propagate(void)
+{
+    while (gc_stack_n > 0) {
+        GCEntry *e = gc_stack[--gc_stack_n];
+        gc_traverse(e->p, e->kind, gc_visit_alive);
+    }
+}
+/**
+ * fox言語で書かれたデストラクタを持つ
+ * 参照を切った後で呼び出すことはできないので回収しない
+ */
+static int gc_has_dispose(RefNode *type)
+{
+    while (type != NULL && type != fs->cls_obj) {
+        RefNode *fn = Hash_get_p(&type->u.c.h, fs->str_dtor);
+        if (fn != NULL && fn->type == NODE_FUNC) {
+            return TRUE;
+        }
+        type = type->u.c.super;
+    }
+    return FALSE;
+}
+/**
+ * 保持している値を取り除く
+ */
+static void gc_clear(RefHeader *rh, int kind)
+{
+    int i;
+
+    switch (kind) {
+    case GC_KIND_REF: {
+        Ref *r = (Ref*)rh;
+        for (i = 0; i < r->rh.n_memb; i++) {
+            Value v = r->v[i];
+            r->v[i] = VALUE_NULL;
+            unref(v);
+        }
+        break;
+    }
+    case GC_KIND_ARRAY: {
+        RefArray *ra = (RefArray*)rh;
+        int size = ra->size;
+        ra->size = 0;
+        for (i = 0; i < size; i++) {
+            Value v = ra->p[i];
+            ra->p[i] = VALUE_NULL;
+            unref(v);
+        }
+        break;
+    }
+    case GC_KIND_MAP: {
+        RefMap *rm = (RefMap*)rh;
+        rm->count = 0;
+        for (i = 0; i < rm->entry_num; i++) {
+            HashValueEntry *he = rm->entry[i];
+            rm->entry[i] = NULL;
+            while (he != NULL) {
+                HashValueEntry *prev = he;
+                unref(he->key);
+                unref(he->val);
+                he = he->next;
+                free(prev);
+            }
+        }
+        break;
+    }
+    }
+}
+static void gc_clear_weak_ref(RefHeader *rh)
+{
+    if (rh->weak_ref != NULL) {
+        Ref *r2 = rh->weak_ref;
+        r2->v[1] = VALUE_FALSE;
+        rh->weak_ref = NULL;
+
+        if (r2->rh.nref > 0 && --r2->rh.nref == 0) {
+            free(r2);
+        }
+    }
+}
+
+/**
+ * 回収したオブジェクトの数を返す
+ */
+int gc_collect(void)
+{
+    GCState *gc = &fv->gc;
+    GCGarbage *garbage;
+    int n_garbage = 0;
+    int64_t start;
+    int i;
+
+    if (gc->running) {
+        return 0;
+    }
+    gc->running = TRUE;
+    gc->pending = FALSE;
+    start = get_tick_usec();
+
+    // 追跡しているオブジェクト同士の参照を引く
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL) {
+            e->gc_refs = e->p->nref;
+        }
+    }
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL) {
+            gc_traverse(e->p, e->kind, gc_visit_subtract);
+        }
+    }
+
+    // 外部から参照されているものから辿る
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL && e->gc_refs > 0 && e->gc_refs != GC_ALIVE) {
+            e->gc_refs = GC_ALIVE;
+            gc_push(e);
+        }
+    }
+    gc_propagate();
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL && e->gc_refs != GC_ALIVE && e->kind == GC_KIND_REF && gc_has_dispose(e->p->type)) {
+            e->gc_refs = GC_ALIVE;
+            gc_push(e);
+        }
+    }
+    gc_propagate();
+
+    // 辿れなかったものを回収する
+    garbage = malloc(sizeof(GCGarbage) * (gc->count + 1));
+    for (i = 0; i < gc->entry_num; i++) {
+        GCEntry *e = &gc->entry[i];
+        if (e->p != NULL && e->gc_refs != GC_ALIVE) {
+            garbage[n_garbage].p = e->p;
+            garbage[n_garbage].kind = e->kind;
+            n_garbage++;
+        }
+    }
+    // 参照を切っている間に解放されないようにする
+    for (i = 0; i < n_garbage; i++) {
+        garbage[i].p->nref++;
+        gc_clear_weak_ref(garbage[i].p);
+    }
+    for (i = 0; i < n_garbage; i++) {
+        gc_clear(garbage[i].p, garbage[i].kind);
+    }
+    for (i = 0; i < n_garbage; i++) {
+        unref(vp_Value(garbage[i].p));
+    }
+    free(garbage);
+
+    gc->n_collect++;
+    gc->n_freed += n_garbage;
+    gc->pause_last = get_tick_usec() - start;
+    gc->pause_total += gc->pause_last;
+
+    // 生存しているオブジェクト数に比例させる
+    gc->n_alloc = 0;
+    gc->threshold = (gc->count > GC_THRESHOLD_MIN ? gc->count : GC_THRESHOLD_MIN);
+    gc->running = FALSE;
+
+    return n_garbage;
+}
@@ -1583,7 +1583,7 @@ void Tok_next(Tok *tk)
         *tk->v.u.end = '\0';
 
         errno = 0;
-        tk->real_val = strtod(tk->v.p, NULL);
+        tk->real_val = str_to_double(tk->v.p, NULL);
         if (errno != 0) {
             throw_errorf(fs->mod_lang, "TokenError", "Float riteral out of range");
             add_stack_trace(tk->module, NULL, tk->v.line);
@@ -1636,13 +1636,24 @@ RefStr *Tok_intern(Tok *tk)
 }
 
 void Tok_init(Tok *tk, RefNode *module, char *buf)
+{
+    Tok_init_line(tk, module, buf, 1);
+}
+/**
+ * bufの先頭をline行目として解析する
+ */
+void Tok_init_line(Tok *tk, RefNode *module, char *buf, int line)
 {
     tk->top = buf;
     tk->p = buf;
-    tk->head_line = 1;
+    tk->head_line = line;
     tk->prev_id = FALSE;
     tk->parse_cls = NULL;
     tk->parse_genr = FALSE;
+    tk->lazy = FALSE;
+    tk->lazy_src = NULL;
+    tk->lazy_base = 0;
+    tk->lazy_var = NULL;
     tk->v.type = T_NL;
     tk->simple_mode = FALSE;
     tk->module = module;
@@ -1737,7 +1748,7 @@ void Tok_simple_next(Tok *tk)
         *tk->v.u.end = '\0';
 
         errno = 0;
-        tk->real_val = strtod(tk->v.p, NULL);
+        tk->real_val = str_to_double(tk->v.p, NULL);
         if (errno != 0) {
             throw_errorf(fs->mod_lang, "TokenError", "Float riteral out of range");
             add_stack_trace(tk->module, NULL, tk->v.line);
@@ -521,6 +521,7 @@ int list_cmp(Value *vret, Value *v, RefNode *node)
 RefArray *refarray_new(int size)
 {
     RefArray *r = buf_new(fs->cls_list, sizeof(RefArray));
+    gc_track(&r->rh, GC_KIND_ARRAY);
 
     if (size > 0) {
         int alloc_size = align_pow2(size, 32);
@@ -2757,33 +2758,53 @@ static int iterlimit_next(Value *vret, Value *v, RefNode *node)
         return FALSE;
     }
 }
+/*
+ * Generatorオブジェクト内のフレームをそのままスタックとして再開する
+ */
 static int generator_next(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     int pc = Value_integral(r->v[INDEX_GENERATOR_PC]);
     int nstack = Value_integral(r->v[INDEX_GENERATOR_NSTACK]);
     RefNode *func = Value_vp(r->v[INDEX_GENERATOR_FUNC]);
+    Value *frame = &r->v[INDEX_GENERATOR_LOCAL];
+    Value *frame_end = r->v + r->rh.n_memb;
     Value *stk_base = fg->stk_base;
+    Value *stk_main_top = fv->stk_main_top;
+    int ret;
 
     if (pc == 0) {
         throw_stopiter();
         return FALSE;
     }
 
-    fg->stk_base = fg->stk_top;
-    memcpy(fg->stk_base, &r->v[INDEX_GENERATOR_LOCAL], nstack * sizeof(Value));
-    memset(&r->v[INDEX_GENERATOR_LOCAL], 0, nstack * sizeof(Value));
-    fg->stk_top = fg->stk_base + nstack;
+    // yieldでPCが書き込まれなければ終了
+    r->v[INDEX_GENERATOR_PC] = int32_Value(0);
+    fv->stk_main_top = fg->stk_top;
+    fg->stk_base = frame;
+    fg->stk_top = frame + nstack;
 
-    if (!invoke_code(func, pc)) {
-        r->v[INDEX_GENERATOR_PC] = int32_Value(0);
-        return FALSE;
+    ret = invoke_code(func, pc);
+    if (ret) {
+        if (Value_integral(r->v[INDEX_GENERATOR_PC]) != 0) {
+            // yieldした値はstk_topの位置にある
+            *vret = *fg->stk_top;
+        } else {
+            // return
+            *vret = *frame;
+            fg->stk_top = frame;
+        }
+    } else {
+        fg->stk_top = frame;
     }
-    *vret = *fg->stk_base;
+    // 取り除いた値が残っているので消去
+    memset(fg->stk_top, 0, (frame_end - fg->stk_top) * sizeof(Value));
+
+    fv->stk_main_top = stk_main_top;
     fg->stk_base = stk_base;
     fg->stk_top = stk_base + 1;
 
-    return TRUE;
+    return ret;
 }
 static int iterable_new(Value *vret, Value *v, RefNode *node)
 {
@@ -42,7 +42,71 @@ typedef struct {
     DirGlob *dir_stk;
 } RefDirIter;
 
+enum {
+    WALK_MAX_SEGMENT = 63,
+    WALK_CHUNK_DIRS = 256,      // 1回に並列で読むディレクトリ数の上限
+    WALK_BATCH_DEFAULT = 1024,
+    WALK_THREAD_MAX = 256,
+};
+enum {
+    INDEX_WALKENTRY_FILE,
+    INDEX_WALKENTRY_SIZE,
+    INDEX_WALKENTRY_MTIME,
+    INDEX_WALKENTRY_IS_DIR,
+    INDEX_WALKENTRY_NUM,
+};
+
+typedef struct {
+    char *path;
+    uint64_t state;     // globの位置 (ビット集合)
+    int depth;
+} WalkDir;
+typedef struct {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+    int is_dir;
+} WalkItem;
+// 1ディレクトリ分の結果
+typedef struct {
+    WalkItem *item;
+    int item_num, item_max;
+    WalkDir *sub;
+    int sub_num, sub_max;
+} WalkResult;
+
+typedef struct {
+    RefHeader rh;
+
+    char *glob;                             // 区切り文字を\0に置き換えたパターン
+    const char *seg[WALK_MAX_SEGMENT];
+    const char *seg_end[WALK_MAX_SEGMENT];
+    int n_seg;
+    uint64_t dstar;                         // "**"のセグメント
+    int with_dirs;
+    int with_stat;
+    int max_depth;
+    int n_thread;
+    int batch;
+
+    WalkDir *dir;                           // 未読のディレクトリ (幅優先)
+    int dir_top, dir_num, dir_max;
+    WalkItem *item;                         // 未出力の結果
+    int item_top, item_num, item_max;
+} RefFileWalker;
+
+typedef struct {
+    const RefFileWalker *w;
+    const WalkDir *dir;
+    WalkResult *res;
+    int n;
+    int start;
+    int step;
+} WalkTask;
+
 static RefNode *cls_diriter;
+static RefNode *cls_walker;
+static RefNode *cls_walkentry;
 
 
 /**
@@ -376,6 +440,33 @@ static int file_size(Value *vret, Value *v, RefNode *node)
     *vret = int64_Value(size);
     return TRUE;
 }
+/**
+ * ファイル全体をマップした読み込み専用のBytesIOを返す
+ * マップはBytesIOが解放されるまで有効
+ */
+static int file_mmap(Value *vret, Value *v, RefNode *node)
+{
+    RefStr *path = Value_vp(*v);
+    char *p = NULL;
+    int64_t size = 0;
+
+    if (!mmap_file(&p, &size, path->c)) {
+        throw_error_select(THROW_CANNOT_OPEN_FILE__STR, Str_new(path->c, path->size));
+        return FALSE;
+    }
+    if (p == NULL) {
+        // 空のファイル
+        *vret = vp_Value(bytesio_new_sub(NULL, 0));
+        return TRUE;
+    }
+    if (size > INT32_MAX) {
+        munmap_file(p, size);
+        throw_errorf(fs->mod_lang, "ValueError", "File too large to map (max 2GB)");
+        return FALSE;
+    }
+    *vret = vp_Value(bytesio_new_mapped(p, size));
+    return TRUE;
+}
 static int file_exists(Value *vret, Value *v, RefNode *node)
 {
     RefStr *path = Value_vp(*v);
@@ -431,6 +522,22 @@ FINALLY:
     throw_errorf(fs->mod_file, "DirOpenError", "Cannot open directory %q", path->c);
     return FALSE;
 }
+/**
+ * ファイルを開いて、1行ずつ読むIteratorを返す
+ */
+static int file_lines(Value *vret, Value *v, RefNode *node)
+{
+    Value stream;
+    int ret;
+
+    if (!value_to_streamio(&stream, *v, FALSE, 0, FALSE)) {
+        return FALSE;
+    }
+    ret = lineiter_new(vret, stream, FALSE, v);
+    unref(stream);
+
+    return ret;
+}
 static int file_marshal_read(Value *vret, Value *v, RefNode *node)
 {
     Value r = Value_ref(v[1])->v[INDEX_MARSHALDUMPER_SRC];
@@ -743,6 +850,269 @@ static int diriter_close(Value *vret, Value *v, RefNode *node)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// ワーカースレッドからfs->の関数は呼ばないこと
+
+/*
+ * "**"は0個のディレクトリにも一致する
+ */
+static uint64_t walk_glob_closure(const RefFileWalker *w, uint64_t st)
+{
+    int i;
+
+    for (i = 0; i < w->n_seg; i++) {
+        if ((st & w->dstar & (1ULL << i)) != 0) {
+            st |= 1ULL << (i + 1);
+        }
+    }
+    return st;
+}
+/*
+ * stの各位置からnameを1つ進めた位置
+ */
+static uint64_t walk_glob_next(const RefFileWalker *w, uint64_t st, const char *name)
+{
+    const char *end = name + strlen(name);
+    uint64_t next = 0;
+    int i;
+
+    for (i = 0; i < w->n_seg; i++) {
+        uint64_t bit = 1ULL << i;
+        if ((st & bit) == 0) {
+            continue;
+        }
+        if ((w->dstar & bit) != 0) {
+            next |= bit;
+        } else if (match_glob_sub(name, end, w->seg[i], w->seg_end[i])) {
+            next |= bit << 1;
+        }
+    }
+    return walk_glob_closure(w, next);
+}
+static void walk_add_item(WalkItem **pitem, int *pnum, int *pmax, const WalkItem *src)
+{
+    if (*pnum >= *pmax) {
+        *pmax = (*pmax == 0 ? 16 : *pmax * 2);
+        *pitem = realloc(*pitem, sizeof(WalkItem) * *pmax);
+    }
+    (*pitem)[(*pnum)++] = *src;
+}
+static void walk_add_dir(WalkDir **pdir, int *pnum, int *pmax, const WalkDir *src)
+{
+    if (*pnum >= *pmax) {
+        *pmax = (*pmax == 0 ? 16 : *pmax * 2);
+        *pdir = realloc(*pdir, sizeof(WalkDir) * *pmax);
+    }
+    (*pdir)[(*pnum)++] = *src;
+}
+static void walk_read_dir(const RefFileWalker *w, const WalkDir *wd, WalkResult *res)
+{
+    uint64_t done = 1ULL << w->n_seg;
+    DIR *d = opendir_fox(wd->path[0] != '\0' ? wd->path : SEP_S);
+    struct dirent *dh;
+
+    if (d == NULL) {
+        // 読めないディレクトリは飛ばす
+        return;
+    }
+    while ((dh = readdir_except_self(d)) != NULL) {
+        uint64_t st = 0;
+        int is_dir = (dh->d_type == DT_DIR);
+        int has_stat = FALSE;
+        int match, descend;
+        WalkItem it;
+
+        if (w->glob != NULL) {
+            st = walk_glob_next(w, wd->state, dh->d_name);
+            if (st == 0) {
+                continue;
+            }
+        }
+        it.path = str_printf("%s" SEP_S "%s", wd->path, dh->d_name);
+        it.size = 0;
+        it.mtime = 0;
+#ifdef DT_UNKNOWN
+        if (dh->d_type == DT_UNKNOWN) {
+            // d_typeを返さないファイルシステム
+            int type = get_file_info(&it.size, &it.mtime, it.path);
+            if (type == EXISTS_NONE) {
+                free(it.path);
+                continue;
+            }
+            is_dir = (type == EXISTS_DIR);
+            has_stat = TRUE;
+        }
+#endif
+        match = (w->glob == NULL || (st & done) != 0) && (!is_dir || w->with_dirs);
+        descend = is_dir && wd->depth + 1 < w->max_depth && (w->glob == NULL || (st & (done - 1)) != 0);
+
+        if (match && w->with_stat && !has_stat) {
+            if (get_file_info(&it.size, &it.mtime, it.path) == EXISTS_NONE) {
+                // 列挙した後に削除された
+                free(it.path);
+                continue;
+            }
+        }
+        if (descend) {
+            WalkDir sub;
+            sub.path = match ? str_dup_p(it.path, -1, NULL) : it.path;
+            sub.state = st;
+            sub.depth = wd->depth + 1;
+            walk_add_dir(&res->sub, &res->sub_num, &res->sub_max, &sub);
+        }
+        if (match) {
+            it.is_dir = is_dir;
+            walk_add_item(&res->item, &res->item_num, &res->item_max, &it);
+        } else if (!descend) {
+            free(it.path);
+        }
+    }
+    closedir_fox(d);
+}
+static void walk_task(void *arg)
+{
+    WalkTask *t = arg;
+    int i;
+
+    for (i = t->start; i < t->n; i += t->step) {
+        walk_read_dir(t->w, &t->dir[i], &t->res[i]);
+    }
+}
+/*
+ * 未出力の結果がbatch個以上になるまで、ディレクトリを並列に読む
+ * 結果の順序はスレッド数によらない
+ */
+static void walk_fill(RefFileWalker *w)
+{
+    while (w->item_num - w->item_top < w->batch && w->dir_top < w->dir_num) {
+        int n = w->dir_num - w->dir_top;
+        int n_task = w->n_thread;
+        WalkResult *res;
+        WalkTask *task;
+        int i, j;
+
+        if (n > WALK_CHUNK_DIRS) {
+            n = WALK_CHUNK_DIRS;
+        }
+        if (n_task > n) {
+            n_task = n;
+        }
+        res = malloc(sizeof(WalkResult) * n);
+        memset(res, 0, sizeof(WalkResult) * n);
+        task = malloc(sizeof(WalkTask) * n_task);
+        for (i = 0; i < n_task; i++) {
+            task[i].w = w;
+            task[i].dir = w->dir + w->dir_top;
+            task[i].res = res;
+            task[i].n = n;
+            task[i].start = i;
+            task[i].step = n_task;
+        }
+        run_parallel(walk_task, task, sizeof(WalkTask), n_task);
+        free(task);
+
+        for (i = 0; i < n; i++) {
+            free(w->dir[w->dir_top + i].path);
+        }
+        w->dir_top += n;
+        // 読み終わった分を詰める
+        memmove(w->dir, w->dir + w->dir_top, sizeof(WalkDir) * (w->dir_num - w->dir_top));
+        w->dir_num -= w->dir_top;
+        w->dir_top = 0;
+        if (w->item_top > 0) {
+            memmove(w->item, w->item + w->item_top, sizeof(WalkItem) * (w->item_num - w->item_top));
+            w->item_num -= w->item_top;
+            w->item_top = 0;
+        }
+
+        for (i = 0; i < n; i++) {
+            WalkResult *r = &res[i];
+            for (j = 0; j < r->item_num; j++) {
+                walk_add_item(&w->item, &w->item_num, &w->item_max, &r->item[j]);
+            }
+            for (j = 0; j < r->sub_num; j++) {
+                walk_add_dir(&w->dir, &w->dir_num, &w->dir_max, &r->sub[j]);
+            }
+            free(r->item);
+            free(r->sub);
+        }
+        free(res);
+    }
+}
+static Value walk_entry_new(const RefFileWalker *w, const WalkItem *it)
+{
+    Ref *r = ref_new(cls_walkentry);
+
+    r->v[INDEX_WALKENTRY_FILE] = cstr_Value(fs->cls_file, it->path, -1);
+    if (w->with_stat) {
+        RefInt64 *tm = buf_new(fs->cls_timestamp, sizeof(RefInt64));
+        tm->u.i = it->mtime;
+        r->v[INDEX_WALKENTRY_SIZE] = int64_Value(it->size);
+        r->v[INDEX_WALKENTRY_MTIME] = vp_Value(tm);
+    }
+    r->v[INDEX_WALKENTRY_IS_DIR] = bool_Value(it->is_dir);
+
+    return vp_Value(r);
+}
+/*
+ * 最大batch個のWalkEntryをListで返す
+ */
+static int walker_next(Value *vret, Value *v, RefNode *node)
+{
+    RefFileWalker *w = Value_vp(*v);
+    RefArray *ra;
+    int i, n;
+
+    walk_fill(w);
+    n = w->item_num - w->item_top;
+    if (n <= 0) {
+        throw_stopiter();
+        return FALSE;
+    }
+    if (n > w->batch) {
+        n = w->batch;
+    }
+    ra = refarray_new(n);
+    *vret = vp_Value(ra);
+    for (i = 0; i < n; i++) {
+        WalkItem *it = &w->item[w->item_top + i];
+        ra->p[i] = walk_entry_new(w, it);
+        free(it->path);
+    }
+    w->item_top += n;
+
+    return TRUE;
+}
+static int walker_close(Value *vret, Value *v, RefNode *node)
+{
+    RefFileWalker *w = Value_vp(*v);
+    int i;
+
+    for (i = w->dir_top; i < w->dir_num; i++) {
+        free(w->dir[i].path);
+    }
+    for (i = w->item_top; i < w->item_num; i++) {
+        free(w->item[i].path);
+    }
+    free(w->dir);
+    free(w->item);
+    free(w->glob);
+    w->dir = NULL;
+    w->item = NULL;
+    w->glob = NULL;
+    w->dir_top = w->dir_num = w->dir_max = 0;
+    w->item_top = w->item_num = w->item_max = 0;
+
+    return TRUE;
+}
+static int walkentry_get(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    *vret = Value_cp(r->v[FUNC_INT(node)]);
+    return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 // class FileIO
 
 static int fileio_new(Value *vret, Value *v, RefNode *node)
@@ -876,6 +1246,28 @@ static int fileio_write(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
+/*
+ * ストリーム間の直接コピーに使うOSのハンドル
+ * コンソールの場合はnull
+ */
+static int fileio_handle(Value *vret, Value *v, RefNode *node)
+{
+    Ref *r = Value_ref(*v);
+    RefFileHandle *fh = Value_vp(r->v[INDEX_FILEIO_HANDLE]);
+    int write = Value_bool(v[1]);
+    FileHandle fd = (write ? fh->fd_write : fh->fd_read);
+
+#ifdef WIN32
+    if (write ? (fd == STDOUT_FILENO && fv->console_write) : (fh->fd_write == STDIN_FILENO && fv->console_read)) {
+        fd = -1;
+    }
+#endif
+    if (fd != -1) {
+        *vret = int64_Value(fd);
+    }
+
+    return TRUE;
+}
 static int fileio_empty(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
@@ -1119,9 +1511,6 @@ FINALLY:
 }
 static int file_copy(Value *vret, Value *v, RefNode *node)
 {
-    enum {
-        COPY_BUF_SIZE = 32 * 1024,
-    };
     Value v1 = v[1];
     Value v2 = v[2];
 
@@ -1160,13 +1549,9 @@ static int file_copy(Value *vret, Value *v, RefNode *node)
         } else if ((f2 = open_fox(path2, O_CREAT|O_WRONLY|O_TRUNC, DEFAULT_PERMISSION)) == -1) {
             throw_errorf(fs->mod_io, "WriteError", "Fault to copy file %q", path2);
             result = FALSE;
-        } else {
-            char *buf = malloc(COPY_BUF_SIZE);
-            int rd;
-            while ((rd = read_fox(f1, buf, COPY_BUF_SIZE)) > 0) {
-                write_fox(f2, buf, rd);
-            }
-            free(buf);
+        } else if (copy_fd_data(f2, f1, -1) < 0) {
+            throw_errorf(fs->mod_io, "WriteError", "Fault to copy file %q", path2);
+            result = FALSE;
         }
         if (f1 != -1) {
             close_fox(f1);
@@ -1259,7 +1644,11 @@ ERROR_END:
 
 static int file_write_stream_sub(const char *path, Value v1, int append)
 {
+    enum {
+        WRITE_BUF_SIZE = 64 * 1024,
+    };
     char *dbuf;    // 出力先バッファ
+    int done;
 
     int fd = open_fox(path, (append ? O_CREAT|O_WRONLY|O_APPEND : O_CREAT|O_WRONLY|O_TRUNC), DEFAULT_PERMISSION);
     if (fd == -1) {
@@ -1267,13 +1656,25 @@ static int file_write_stream_sub(const char *path, Value v1, int append)
         return FALSE;
     }
 
-    dbuf = malloc(BUFFER_SIZE);
+    // v1がOSのハンドルを持っていれば直接コピーする
+    if (!stream_copy_to_handle(fd, v1, INT64_MAX, &done)) {
+        close_fox(fd);
+        return FALSE;
+    }
+    if (done) {
+        close_fox(fd);
+        return TRUE;
+    }
+
+    dbuf = malloc(WRITE_BUF_SIZE);
 
     for (;;) {
-        int read_size = BUFFER_SIZE;
+        int read_size = WRITE_BUF_SIZE;
 
         // r1から読んで、直接dbufのバッファに入れる
         if (!stream_read_data(v1, NULL, dbuf, &read_size, FALSE, FALSE)) {
+            free(dbuf);
+            close_fox(fd);
             return FALSE;
         }
         // r1が終端に達した
@@ -1282,6 +1683,7 @@ static int file_write_stream_sub(const char *path, Value v1, int append)
         }
         write_fox(fd, dbuf, read_size);
     }
+    free(dbuf);
     close_fox(fd);
 
     return TRUE;
@@ -1353,10 +1755,9 @@ static int file_writefile(Value *vret, Value *v, RefNode *node)
             write_p = bio->buf.p;
             write_size = bio->buf.size;
         } else if (is_subclass(type, fs->cls_streamio)) {
-            if (!file_write_stream_sub(path, v2, FUNC_INT(node))) {
-                return FALSE;
-            }
-            return TRUE;
+            int ret = file_write_stream_sub(path, v2, FUNC_INT(node));
+            free(path);
+            return ret;
         } else {
             throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, fs->cls_bytes, fs->cls_streamio, type, 2);
             return FALSE;
@@ -1501,6 +1902,168 @@ static int file_glob(Value *vret, Value *v, RefNode *node)
     return TRUE;
 }
 
+/*
+ * パターンを/で区切って、セグメントごとに分ける
+ */
+static int walk_compile_glob(RefFileWalker *w, RefStr *rs)
+{
+    char *p;
+
+    if (str_has0(rs->c, rs->size)) {
+        throw_errorf(fs->mod_lang, "ValueError", "Pattern contains '\\0'");
+        return FALSE;
+    }
+    w->glob = str_dup_p(rs->c, rs->size, NULL);
+    p = w->glob;
+
+    while (*p != '\0') {
+        char *top = p;
+        while (*p != '\0') {
+#ifdef WIN32
+            if (*p == '/' || *p == '\\') {
+                break;
+            }
+#else
+            if (*p == '/') {
+                break;
+            }
+            if (*p == '\\' && p[1] != '\0') {
+                p++;
+            }
+#endif
+            p++;
+        }
+        if (p > top) {
+            if (w->n_seg >= WALK_MAX_SEGMENT) {
+                throw_errorf(fs->mod_lang, "ValueError", "Too many pattern segments (max:%d)", WALK_MAX_SEGMENT);
+                return FALSE;
+            }
+            if (p - top == 2 && top[0] == '*' && top[1] == '*') {
+                w->dstar |= 1ULL << w->n_seg;
+            }
+            w->seg[w->n_seg] = top;
+            w->seg_end[w->n_seg] = p;
+            w->n_seg++;
+        }
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+    }
+    return TRUE;
+}
+/*
+ * optionsからkeyの値を取り出す
+ * 無い場合はVALUE_NULL
+ */
+static int walk_option(Value *ret, RefMap *rm, const char *key, RefNode *type)
+{
+    HashValueEntry *he = refmap_get_strkey(rm, key, -1);
+
+    *ret = VALUE_NULL;
+    if (he != NULL && he->val != VALUE_NULL) {
+        RefNode *vt = Value_type(he->val);
+        if (vt != type) {
+            throw_errorf(fs->mod_lang, "TypeError", "%n required but %n (options[%q])", type, vt, key);
+            return FALSE;
+        }
+        *ret = he->val;
+    }
+    return TRUE;
+}
+static int walk_option_int(int *ret, RefMap *rm, const char *key, int min, int max)
+{
+    Value val;
+    int64_t i;
+
+    if (!walk_option(&val, rm, key, fs->cls_int)) {
+        return FALSE;
+    }
+    if (val == VALUE_NULL) {
+        return TRUE;
+    }
+    i = Value_int64(val, NULL);
+    if (i < min || i > max) {
+        throw_errorf(fs->mod_lang, "ValueError", "Illigal %s value %v (%d - %d)", key, val, min, max);
+        return FALSE;
+    }
+    *ret = (int)i;
+    return TRUE;
+}
+static int walk_parse_options(RefFileWalker *w, RefMap *rm)
+{
+    Value val;
+
+    if (!walk_option(&val, rm, "glob", fs->cls_str)) {
+        return FALSE;
+    }
+    if (val != VALUE_NULL && !walk_compile_glob(w, Value_vp(val))) {
+        return FALSE;
+    }
+    if (!walk_option(&val, rm, "dirs", fs->cls_bool)) {
+        return FALSE;
+    }
+    if (val != VALUE_NULL) {
+        w->with_dirs = Value_bool(val);
+    }
+    if (!walk_option(&val, rm, "stat", fs->cls_bool)) {
+        return FALSE;
+    }
+    if (val != VALUE_NULL) {
+        w->with_stat = Value_bool(val);
+    }
+    if (!walk_option_int(&w->max_depth, rm, "depth", 1, DIRGLOB_MAX_STACK)) {
+        return FALSE;
+    }
+    // 0:CPU数
+    if (!walk_option_int(&w->n_thread, rm, "threads", 0, WALK_THREAD_MAX)) {
+        return FALSE;
+    }
+    if (!walk_option_int(&w->batch, rm, "batch", 1, INT32_MAX)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * walk(root, options) : rootの下を幅優先で列挙し、WalkEntryのListを返すIteratorを返す
+ */
+static int file_walk(Value *vret, Value *v, RefNode *node)
+{
+    RefFileWalker *w;
+    WalkDir root;
+
+    root.path = file_value_to_path(NULL, v[1], 0);
+    if (root.path == NULL) {
+        return FALSE;
+    }
+    if (exists_file(root.path[0] != '\0' ? root.path : SEP_S) != EXISTS_DIR) {
+        throw_errorf(fs->mod_file, "DirOpenError", "Cannot open directory %q", root.path);
+        free(root.path);
+        return FALSE;
+    }
+    w = buf_new(cls_walker, sizeof(RefFileWalker));
+    *vret = vp_Value(w);
+
+    w->with_dirs = FALSE;
+    w->with_stat = TRUE;
+    w->max_depth = DIRGLOB_MAX_STACK;
+    w->n_thread = 0;
+    w->batch = WALK_BATCH_DEFAULT;
+    root.state = 0;
+    root.depth = 0;
+    walk_add_dir(&w->dir, &w->dir_num, &w->dir_max, &root);
+
+    if (fg->stk_top > v + 2 && !walk_parse_options(w, Value_vp(v[2]))) {
+        return FALSE;
+    }
+    if (w->n_thread == 0) {
+        w->n_thread = get_cpu_count();
+    }
+    if (w->glob != NULL) {
+        w->dir[0].state = walk_glob_closure(w, 1);
+    }
+    return TRUE;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void define_file_const(RefNode *m)
@@ -1552,6 +2115,9 @@ static void define_file_func(RefNode *m)
 
     n = define_identifier(m, m, "glob", NODE_FUNC_N, 0);
     define_native_func_a(n, file_glob, 1, 1, NULL, fs->cls_str);
+
+    n = define_identifier(m, m, "walk", NODE_FUNC_N, 0);
+    define_native_func_a(n, file_walk, 1, 2, NULL, NULL, fs->cls_map);
 }
 static void define_file_class(RefNode *m)
 {
@@ -1593,6 +2159,8 @@ static void define_file_class(RefNode *m)
     define_native_func_a(n, file_path, 0, 0, (void*) FILEPATH_SUFFIX);
     n = define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, file_size, 0, 0, NULL);
+    n = define_identifier(m, cls, "mmap", NODE_FUNC_N, 0);
+    define_native_func_a(n, file_mmap, 0, 0, NULL);
     n = define_identifier(m, cls, "exists", NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, file_exists, 0, 0, (void*) (EXISTS_FILE | EXISTS_DIR));
     n = define_identifier(m, cls, "is_file", NODE_FUNC_N, NODEOPT_PROPERTY);
@@ -1607,6 +2175,8 @@ static void define_file_class(RefNode *m)
     define_native_func_a(n, file_iter, 0, 0, (void*)DIRITER_DIRS);
     n = define_identifier(m, cls, "files", NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, file_iter, 0, 0, (void*)DIRITER_FILES);
+    n = define_identifier(m, cls, "lines", NODE_FUNC_N, 0);
+    define_native_func_a(n, file_lines, 0, 1, NULL, fs->cls_int);
     n = define_identifier(m, cls, "relative", NODE_FUNC_N, 0);
     define_native_func_a(n, file_relative, 0, 1, NULL, NULL);
     n = define_identifier(m, cls, "to_uri", NODE_FUNC_N, 0);
@@ -1623,6 +2193,29 @@ static void define_file_class(RefNode *m)
     extends_method(cls, fs->cls_iterator);
 
 
+    // FileWalker
+    cls = cls_walker;
+    n = define_identifier_p(m, cls, fs->str_next, NODE_FUNC_N, 0);
+    define_native_func_a(n, walker_next, 0, 0, NULL);
+    n = define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    define_native_func_a(n, walker_close, 0, 0, NULL);
+    extends_method(cls, fs->cls_iterator);
+
+
+    // WalkEntry
+    cls = cls_walkentry;
+    cls->u.c.n_memb = INDEX_WALKENTRY_NUM;
+    n = define_identifier(m, cls, "file", NODE_FUNC_N, NODEOPT_PROPERTY);
+    define_native_func_a(n, walkentry_get, 0, 0, (void*) INDEX_WALKENTRY_FILE);
+    n = define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
+    define_native_func_a(n, walkentry_get, 0, 0, (void*) INDEX_WALKENTRY_SIZE);
+    n = define_identifier(m, cls, "mtime", NODE_FUNC_N, NODEOPT_PROPERTY);
+    define_native_func_a(n, walkentry_get, 0, 0, (void*) INDEX_WALKENTRY_MTIME);
+    n = define_identifier(m, cls, "is_dir", NODE_FUNC_N, NODEOPT_PROPERTY);
+    define_native_func_a(n, walkentry_get, 0, 0, (void*) INDEX_WALKENTRY_IS_DIR);
+    extends_method(cls, fs->cls_obj);
+
+
     // FileIO
     cls = fv->cls_fileio;
     cls->u.c.n_memb = INDEX_FILEIO_NUM;
@@ -1642,6 +2235,8 @@ static void define_file_class(RefNode *m)
     define_native_func_a(n, fileio_seek, 1, 1, NULL, fs->cls_int);
     n = define_identifier(m, cls, "size", NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, fileio_size, 0, 0, NULL);
+    n = define_identifier(m, cls, "_handle", NODE_FUNC_N, 0);
+    define_native_func_a(n, fileio_handle, 1, 1, NULL, fs->cls_bool);
     extends_method(cls, fs->cls_streamio);
 
 
@@ -1662,6 +2257,8 @@ void init_file_module_stubs()
 
     fv->cls_fileio = define_identifier(m, m, "FileIO", NODE_CLASS, 0);
     cls_diriter = define_identifier(m, m, "DirIterator", NODE_CLASS, 0);
+    cls_walker = define_identifier(m, m, "FileWalker", NODE_CLASS, 0);
+    cls_walkentry = define_identifier(m, m, "WalkEntry", NODE_CLASS, 0);
 
     fs->mod_file = m;
 }
@@ -5,6 +5,10 @@
 #include <math.h>
 
 
+enum {
+    STREAM_COPY_SIZE = 64 * 1024,
+};
+
 enum {
     PACK_NONE,
     PACK_NIL,
@@ -18,6 +22,7 @@ static RefStr *str__read;
 static RefStr *str__write;
 static RefStr *str__seek;
 static RefStr *str__close;
+static RefStr *str__handle;
 
 
 
@@ -445,11 +450,9 @@ int stream_gets_sub(StrBuf *sb, Value v, int sep)
         mb = Value_vp(v);
         sz = mb->buf.size - mb->cur;
         // sepの次まで読む
-        for (i = 0; i < sz; i++) {
-            if (mb->buf.p[mb->cur + i] == sep) {
-                i++;
-                break;
-            }
+        {
+            const char *pos = memchr(mb->buf.p + mb->cur, sep, sz);
+            i = (pos != NULL ? pos - (mb->buf.p + mb->cur) + 1 : sz);
         }
         if (sb != NULL) {
             StrBuf_add(sb, mb->buf.p + mb->cur, i);
@@ -487,17 +490,14 @@ int stream_gets_sub(StrBuf *sb, Value v, int sep)
                 int top = cur;
                 int limit = fs->max_alloc - sb->size;  // 改行が見つからない場合はMAX_ALLOCに制限
                 if (sep >= 0) {
-                    while (cur < max) {
-                        if (cur >= limit) {
-                            found = TRUE;
-                            break;
-                        }
-                        if (buf[cur] == sep) {
-                            found = TRUE;
-                            cur++;
-                            break;
-                        }
-                        cur++;
+                    int end = (max < limit ? max : limit);
+                    const char *pos = memchr(buf + cur, sep, end - cur);
+                    if (pos != NULL) {
+                        found = TRUE;
+                        cur = pos - buf + 1;
+                    } else {
+                        found = (end < max);
+                        cur = end;
                     }
                 } else {
                     cur = (max < limit ? max : limit);
@@ -507,13 +507,12 @@ int stream_gets_sub(StrBuf *sb, Value v, int sep)
                 }
             } else {
                 if (sep >= 0) {
-                    while (cur < max) {
-                        if (buf[cur] == sep) {
-                            found = TRUE;
-                            cur++;
-                            break;
-                        }
-                        cur++;
+                    const char *pos = memchr(buf + cur, sep, max - cur);
+                    if (pos != NULL) {
+                        found = TRUE;
+                        cur = pos - buf + 1;
+                    } else {
+                        cur = max;
                     }
                 } else {
                     cur = max;
@@ -549,6 +548,55 @@ int stream_gets_sub16(StrBuf *sb, Value v, int sep_u, int sep_l)
 {
     return TRUE;
 }
+/**
+ * ストリームのバッファを経由せずに、vmbの末尾に最大sizeバイト読み込む
+ * バッファに残っている分があれば、先にそれを返す
+ * 読み込んだサイズを返す (エラーの場合は-1)
+ */
+int stream_read_direct(Value v, Value vmb, int size)
+{
+    Ref *r = Value_ref(v);
+    RefBytesIO *mb = Value_vp(vmb);
+    int cur = Value_integral(r->v[INDEX_READ_CUR]);
+    int max = Value_integral(r->v[INDEX_READ_MAX]);
+    int prev = mb->buf.size;
+
+    if (max == -1) {
+        throw_error_select(THROW_NOT_OPENED_FOR_READ);
+        return -1;
+    }
+    if (!stream_flush_sub(v)) {
+        return -1;
+    }
+    if (!StrBuf_alloc(&mb->buf, prev + size)) {
+        return -1;
+    }
+    mb->buf.size = prev;
+
+    if (cur < max) {
+        RefBytesIO *rb = Value_vp(r->v[INDEX_READ_MEMIO]);
+        int n = max - cur;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(mb->buf.p + prev, rb->buf.p + cur, n);
+        mb->buf.size = prev + n;
+        r->v[INDEX_READ_CUR] = int32_Value(cur + n);
+        return n;
+    }
+
+    Value_push("vvd", v, vmb, size);
+    if (!call_member_func(str__read, 2, TRUE)) {
+        return -1;
+    }
+    Value_pop();
+    // キャッシュを経由しなかった分だけ進める
+    {
+        uint64_t offs = Value_uint62(r->v[INDEX_READ_OFFSET]);
+        r->v[INDEX_READ_OFFSET] = uint62_Value(offs + (mb->buf.size - prev));
+    }
+    return mb->buf.size - prev;
+}
 static int stream_read(Value *vret, Value *v, RefNode *node)
 {
     StrBuf buf;
@@ -668,6 +716,17 @@ int stream_flush_sub(Value v)
     }
     return TRUE;
 }
+/**
+ * ファイルをマップしたBytesIOは書き換えできない
+ */
+static int bytesio_check_writable(RefBytesIO *mb)
+{
+    if (mb->mapped) {
+        throw_errorf(fs->mod_io, "WriteError", "BytesIO is read-only (mapped file)");
+        return FALSE;
+    }
+    return TRUE;
+}
 int stream_write_data(Value v, const char *s_p, int s_size)
 {
     Ref *r = Value_ref(v);
@@ -683,6 +742,9 @@ int stream_write_data(Value v, const char *s_p, int s_size)
 
     if (Value_type(v) == fs->cls_bytesio) {
         RefBytesIO *mb = Value_vp(v);
+        if (!bytesio_check_writable(mb)) {
+            return FALSE;
+        }
         return StrBuf_add(&mb->buf, s_p, s_size);
     }
 
@@ -757,6 +819,96 @@ int stream_write_uint32(Value w, uint32_t val)
     }
     return TRUE;
 }
+/**
+ * _handleからOSのハンドルを取得する (取得できない場合は-1)
+ * _read / _writeをスクリプトで上書きしている場合は使わない
+ */
+static int stream_get_handle(FileHandle *pfd, Value v, int write)
+{
+    RefNode *type = Value_type(v);
+    RefNode *fn = Hash_get_p(&type->u.c.h, str__handle);
+    RefNode *fn_io = Hash_get_p(&type->u.c.h, write ? str__write : str__read);
+    Value ret;
+
+    *pfd = -1;
+    if (fn == NULL || fn->type != NODE_FUNC_N || fn_io == NULL || fn_io->type != NODE_FUNC_N) {
+        return TRUE;
+    }
+    Value_push("vb", v, write);
+    if (!call_member_func(str__handle, 1, TRUE)) {
+        return FALSE;
+    }
+    ret = fg->stk_top[-1];
+    if (Value_type(ret) == fs->cls_int) {
+        *pfd = (FileHandle)Value_int64(ret, NULL);
+    }
+    Value_pop();
+
+    return TRUE;
+}
+/**
+ * v1の残りを最大lastバイト、fd_outに直接書き込む
+ * v1がOSのハンドルを持たない場合は、何もせずに*pdone = FALSE
+ */
+int stream_copy_to_handle(FileHandle fd_out, Value v1, int64_t last, int *pdone)
+{
+    Ref *r1 = Value_ref(v1);
+    int cur = Value_integral(r1->v[INDEX_READ_CUR]);
+    int max = Value_integral(r1->v[INDEX_READ_MAX]);
+    FileHandle fd_in;
+    int64_t copied = 0;
+
+    *pdone = FALSE;
+    if (max == -1) {
+        return TRUE;
+    }
+    if (!stream_get_handle(&fd_in, v1, FALSE)) {
+        return FALSE;
+    }
+    if (fd_in == -1) {
+        return TRUE;
+    }
+    if (!stream_flush_sub(v1)) {
+        return FALSE;
+    }
+
+    // バッファに残っている分を先に書き込む
+    if (cur < max) {
+        RefBytesIO *mb = Value_vp(r1->v[INDEX_READ_MEMIO]);
+        int n = max - cur;
+        if (n > last) {
+            n = last;
+        }
+        if (write_fox(fd_out, mb->buf.p + cur, n) != n) {
+            throw_errorf(fs->mod_io, "WriteError", "Failed to write data");
+            return FALSE;
+        }
+        cur += n;
+        last -= n;
+        r1->v[INDEX_READ_CUR] = int32_Value(cur);
+    }
+    if (last > 0) {
+        copied = copy_fd_data(fd_out, fd_in, last == INT64_MAX ? -1 : last);
+        if (copied < 0) {
+            throw_errorf(fs->mod_io, "WriteError", "Failed to write data");
+            return FALSE;
+        }
+    }
+    // キャッシュを経由しなかった分だけ進めて、キャッシュを空にする
+    if (copied > 0) {
+        uint64_t offs = Value_uint62(r1->v[INDEX_READ_OFFSET]);
+        r1->v[INDEX_READ_OFFSET] = uint62_Value(offs + cur + copied);
+        r1->v[INDEX_READ_CUR] = int32_Value(0);
+        r1->v[INDEX_READ_MAX] = int32_Value(0);
+        if (r1->v[INDEX_READ_MEMIO] != VALUE_NULL) {
+            RefBytesIO *mb = Value_vp(r1->v[INDEX_READ_MEMIO]);
+            mb->buf.size = 0;
+        }
+    }
+    *pdone = TRUE;
+
+    return TRUE;
+}
 /**
  * v <- v1
  * Stream (Not BytesIO) <- Stream (Not BytesIO)
@@ -781,22 +933,43 @@ static int stream_write_stream_sub(Value v, Value v1, int64_t last)
             }
         }
     }
+
+    // 両方がOSのハンドルを持っていれば、バッファを経由せずにコピーする
+    {
+        FileHandle fd_out;
+        int done;
+        if (!stream_get_handle(&fd_out, v, TRUE)) {
+            return FALSE;
+        }
+        if (fd_out != -1) {
+            if (!stream_flush_sub(v)) {
+                return FALSE;
+            }
+            if (!stream_copy_to_handle(fd_out, v1, last, &done)) {
+                return FALSE;
+            }
+            if (done) {
+                return TRUE;
+            }
+        }
+    }
+
     for (;;) {
         RefBytesIO *mb = Value_vp(*vmb);
-        int read_size = BUFFER_SIZE - mb->buf.size;
+        int read_size = STREAM_COPY_SIZE - mb->buf.size;
         if (read_size > last) {
             read_size = last;
         }
 
         // r1から読んで、直接rのバッファに入れる
-        if (!stream_read_data(v1, NULL, mb->buf.p + mb->buf.size, &read_size, FALSE, FALSE)) {
+        read_size = stream_read_direct(v1, *vmb, read_size);
+        if (read_size < 0) {
             return FALSE;
         }
         // r1が終端に達した
-        if (read_size <= 0) {
+        if (read_size == 0) {
             break;
         }
-        mb->buf.size += read_size;
         last -= read_size;
         if (!stream_flush_sub(v)) {
             return FALSE;
@@ -1576,6 +1749,21 @@ RefBytesIO *bytesio_new_sub(const char *src, int size)
     mb->cur = 0;
     return mb;
 }
+/**
+ * マップしたメモリをそのまま参照する (コピーしない)
+ * 解放時にunmapする
+ */
+RefBytesIO *bytesio_new_mapped(char *p, int size)
+{
+    RefBytesIO *mb = buf_new(fs->cls_bytesio, sizeof(RefBytesIO));
+
+    mb->buf.p = p;
+    mb->buf.size = size;
+    mb->buf.alloc_size = size;
+    mb->cur = 0;
+    mb->mapped = TRUE;
+    return mb;
+}
 static int bytesio_new(Value *vret, Value *v, RefNode *node)
 {
     RefStr *src;
@@ -1623,7 +1811,13 @@ static int bytesio_new_sized(Value *vret, Value *v, RefNode *node)
 static int bytesio_dispose(Value *vret, Value *v, RefNode *node)
 {
     RefBytesIO *mb = Value_vp(*v);
-    StrBuf_close(&mb->buf);
+    if (mb->mapped) {
+        munmap_file(mb->buf.p, mb->buf.size);
+        mb->buf.p = NULL;
+        mb->mapped = FALSE;
+    } else {
+        StrBuf_close(&mb->buf);
+    }
 
     return TRUE;
 }
@@ -1641,6 +1835,10 @@ static int bytesio_set_size(Value *vret, Value *v, RefNode *node)
     RefBytesIO *mb = Value_vp(*v);
     int64_t size = Value_int64(v[1], NULL);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (size < 0) {
         throw_errorf(fs->mod_lang, "ValueError", "size must be a positive value");
         goto ERROR_END;
@@ -1697,6 +1895,10 @@ static int bytesio_index_set(Value *vret, Value *v, RefNode *node)
     int64_t idx = Value_int64(v[1], NULL);
     int64_t val = Value_int64(v[2], NULL);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (idx < 0) {
         idx += size;
     }
@@ -1720,6 +1922,10 @@ static int bytesio_fill(Value *vret, Value *v, RefNode *node)
     int64_t begin = Value_int64(v[2], NULL);
     int64_t end = Value_int64(v[3], NULL);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (begin > end) {
         int tmp = end;
         end = begin;
@@ -1836,6 +2042,10 @@ static int bytesio_write(Value *vret, Value *v, RefNode *node)
     RefBytesIO *mb = Value_vp(*v);
     RefStr *rs = Value_vp(v[1]);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (!StrBuf_add_r(&mb->buf, rs)) {
         return FALSE;
     }
@@ -1849,6 +2059,10 @@ static int bytesio_write_stream(Value *vret, Value *v, RefNode *node)
     Value v1 = v[1];
     RefNode *v1_type = Value_type(v1);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (v1_type == fs->cls_bytesio) {
         RefBytesIO *bio = Value_vp(v1);
         int size = bio->buf.size;
@@ -1882,6 +2096,10 @@ static int bytesio_pack(Value *vret, Value *v, RefNode *node)
     RefStr *fmt = Value_vp(v[1]);
     int argc = (fg->stk_top - fg->stk_base) - 1;
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (!stream_pack_sub(v, &mb->buf, argc, fmt->c, fmt->size)) {
         return FALSE;
     }
@@ -1959,6 +2177,10 @@ static int bytesio_set_pos(Value *vret, Value *v, RefNode *node)
 static int bytesio_clear(Value *vret, Value *v, RefNode *node)
 {
     RefBytesIO *mb = Value_vp(*v);
+
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
     mb->buf.size = 0;
     mb->cur = 0;
     return TRUE;
@@ -1999,6 +2221,10 @@ static int bytesio_push(Value *vret, Value *v, RefNode *node)
     int prev_size = mb->buf.size;
     int i;
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (!validate_arguments_as_char(v1, argc)) {
         return FALSE;
     }
@@ -2019,6 +2245,9 @@ static int bytesio_pop(Value *vret, Value *v, RefNode *node)
 {
     RefBytesIO *mb = Value_vp(*v);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
     if (mb->buf.size >= 1) {
         *vret = int32_Value(mb->buf.p[mb->buf.size - 1] & 0xFF);
         mb->buf.size--;
@@ -2040,6 +2269,10 @@ static int bytesio_unshift(Value *vret, Value *v, RefNode *node)
     int prev_size = mb->buf.size;
     int i;
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (!validate_arguments_as_char(v1, argc)) {
         return FALSE;
     }
@@ -2061,6 +2294,9 @@ static int bytesio_shift(Value *vret, Value *v, RefNode *node)
 {
     RefBytesIO *mb = Value_vp(*v);
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
     if (mb->buf.size >= 1) {
         *vret= int32_Value(mb->buf.p[0] & 0xFF);
         mb->buf.size--;
@@ -2078,6 +2314,10 @@ static int bytesio_splice(Value *vret, Value *v, RefNode *node)
     Str append;
     char ch;
 
+    if (!bytesio_check_writable(mb)) {
+        return FALSE;
+    }
+
     if (fg->stk_top > v + 3) {
         RefNode *v3_type = Value_type(v[3]);
         if (v3_type == fs->cls_bytes) {
@@ -2194,6 +2434,7 @@ static void define_io_class(RefNode *m)
     str__write = intern("_write", -1);
     str__seek = intern("_seek", -1);
     str__close = intern("_close", -1);
+    str__handle = intern("_handle", -1);
 
 
     // StreamIO
@@ -2343,6 +2584,7 @@ void init_io_module_stubs()
     fs->cls_textio = define_identifier(m, m, "TextIO", NODE_CLASS, NODEOPT_ABSTRACT);
     fs->cls_utf8io = define_identifier(m, m, "Utf8IO", NODE_CLASS, 0);
     fv->cls_strio = define_identifier(m, m, "StrIO", NODE_CLASS, 0);
+    fv->cls_lineiter = define_identifier(m, m, "LineIterator", NODE_CLASS, 0);
 
     fs->mod_io = m;
 }
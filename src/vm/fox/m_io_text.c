@@ -15,6 +15,21 @@ enum {
     TEXTIO_S_STDIO,
     TEXTIO_S_STR,
 };
+enum {
+    LINEITER_BLOCK_SIZE = 1024 * 1024,
+};
+
+typedef struct {
+    RefHeader rh;
+
+    Value stream;
+    Value vmb;      // 読み込んだブロック (streamがBytesIOならstreamと同じ)
+    int pos;        // 次の行の先頭
+    int checked;    // ここまではUTF-8として正しい
+    int block_size;
+    int eof;
+    int translit;
+} RefLineIter;
 
 static Value s_std_textio;
 
@@ -202,15 +217,9 @@ static int strio_gets(Value *vret, Value *v, RefNode *node)
     int gets_type = FUNC_INT(node);
     const char *mbuf = mb->buf.p + mb->cur;
     int sz = mb->buf.size - mb->cur;
-    int i;
+    const char *nl = memchr(mbuf, '\n', sz);
+    int i = (nl != NULL ? nl - mbuf + 1 : sz);
 
-    // sepの次まで読む
-    for (i = 0; i < sz; i++) {
-        if (mbuf[i] == '\n') {
-            i++;
-            break;
-        }
-    }
     if (i > 0) {
         if (gets_type == TEXTIO_M_GETS) {
             *vret = cstr_Value(fs->cls_str, mbuf, i);
@@ -253,6 +262,183 @@ static int strio_write(Value *vret, Value *v, RefNode *node)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * 1行ずつ取り出す
+ * 大きなブロック単位で読み込み、改行はmemchrで探す
+ * UTF-8の検査はブロック単位で1回だけ行う
+ */
+/**
+ * lines([block_size])
+ * v[1]があればブロックサイズ
+ */
+int lineiter_new(Value *vret, Value stream, int translit, Value *v)
+{
+    RefLineIter *it;
+    int block_size = LINEITER_BLOCK_SIZE;
+
+    if (fg->stk_top > v + 1) {
+        int64_t size = Value_int64(v[1], NULL);
+        if (size < 1 || size > fs->max_alloc) {
+            throw_errorf(fs->mod_lang, "ValueError", "Illigal range (1 - %d)", fs->max_alloc);
+            return FALSE;
+        }
+        block_size = (int)size;
+    }
+    it = buf_new(fv->cls_lineiter, sizeof(RefLineIter));
+    *vret = vp_Value(it);
+
+    it->stream = Value_cp(stream);
+    it->translit = translit;
+    it->block_size = block_size;
+
+    if (Value_type(stream) == fs->cls_bytesio) {
+        // 読み込み済みのデータを直接使う
+        RefBytesIO *mb = Value_vp(stream);
+        it->vmb = Value_cp(stream);
+        it->pos = mb->cur;
+        it->checked = mb->cur;
+        it->eof = TRUE;
+    } else {
+        it->vmb = vp_Value(bytesio_new_sub(NULL, 0));
+    }
+    return TRUE;
+}
+/**
+ * 読み込み済みの部分を先頭に詰めて、続きを読む
+ */
+static int lineiter_fill(RefLineIter *it)
+{
+    RefBytesIO *mb = Value_vp(it->vmb);
+    int rest = mb->buf.size - it->pos;
+    int size = it->block_size;
+    int n;
+
+    if (it->pos > 0) {
+        memmove(mb->buf.p, mb->buf.p + it->pos, rest);
+        mb->buf.size = rest;
+        it->checked -= it->pos;
+        it->pos = 0;
+    }
+    // 1行がブロックより長い場合は広げる
+    if (rest >= size / 2) {
+        size = rest * 2;
+        if (size > fs->max_alloc || size < 0) {
+            size = fs->max_alloc;
+        }
+        size -= rest;
+        if (size <= 0) {
+            throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+            return FALSE;
+        }
+    }
+    n = stream_read_direct(it->stream, it->vmb, size);
+    if (n < 0) {
+        return FALSE;
+    }
+    if (n == 0) {
+        it->eof = TRUE;
+    }
+    return TRUE;
+}
+static int lineiter_next(Value *vret, Value *v, RefNode *node)
+{
+    RefLineIter *it = Value_vp(*v);
+    RefBytesIO *mb = Value_vp(it->vmb);
+    const char *top;
+    const char *nl;
+    int line_end;
+    int size;
+
+    for (;;) {
+        top = mb->buf.p + it->pos;
+        nl = memchr(top, '\n', mb->buf.size - it->pos);
+        if (nl != NULL) {
+            line_end = nl - mb->buf.p + 1;
+            break;
+        }
+        if (it->eof) {
+            line_end = mb->buf.size;
+            break;
+        }
+        if (!lineiter_fill(it)) {
+            return FALSE;
+        }
+        mb = Value_vp(it->vmb);
+    }
+    if (line_end <= it->pos) {
+        throw_stopiter();
+        return FALSE;
+    }
+
+    if (it->checked < line_end) {
+        // 読み込み済みの最後の改行までをまとめて検査する
+        const char *p = mb->buf.p + it->checked;
+        int end = mb->buf.size;
+        int invalid;
+
+        if (!it->eof) {
+            while (mb->buf.p[end - 1] != '\n') {
+                end--;
+            }
+        }
+        invalid = invalid_utf8_pos(p, end - it->checked);
+        it->checked = (invalid >= 0 ? it->checked + invalid : end);
+    }
+
+    // 末尾の改行を取り除く
+    size = line_end - it->pos;
+    if (size > 0 && top[size - 1] == '\n') {
+        size--;
+        if (size > 0 && top[size - 1] == '\r') {
+            size--;
+        }
+    }
+    if (line_end <= it->checked) {
+        RefStr *rs = refstr_new_n(fs->cls_str, size);
+        memcpy(rs->c, top, size);
+        rs->c[size] = '\0';
+        *vret = vp_Value(rs);
+    } else if (it->translit) {
+        // 不正な文字をU+FFFDに置き換える
+        *vret = cstr_Value(NULL, top, size);
+        it->checked = line_end;
+    } else {
+        throw_error_select(THROW_INVALID_UTF8);
+        it->pos = line_end;
+        it->checked = line_end;
+        return FALSE;
+    }
+    it->pos = line_end;
+    if (it->vmb == it->stream) {
+        mb->cur = line_end;
+    }
+
+    return TRUE;
+}
+static int lineiter_dispose(Value *vret, Value *v, RefNode *node)
+{
+    RefLineIter *it = Value_vp(*v);
+
+    unref(it->stream);
+    it->stream = VALUE_NULL;
+    unref(it->vmb);
+    it->vmb = VALUE_NULL;
+
+    return TRUE;
+}
+static int utf8io_lines(Value *vret, Value *v, RefNode *node)
+{
+    Ref *ref = Value_ref(*v);
+    return lineiter_new(vret, ref->v[INDEX_TEXTIO_STREAM], Value_bool(ref->v[INDEX_UTF8IO_TRANS]), v);
+}
+static int strio_lines(Value *vret, Value *v, RefNode *node)
+{
+    Ref *ref = Value_ref(*v);
+    return lineiter_new(vret, ref->v[INDEX_TEXTIO_STREAM], FALSE, v);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 static int nulltextio_new(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = ref_new(FUNC_VP(node));
@@ -613,6 +799,8 @@ static void define_io_text_class(RefNode *m)
     define_native_func_a(n, utf8io_gets, 0, 0, (void*)TEXTIO_M_GETLN);
     n = define_identifier(m, cls, "next", NODE_FUNC_N, 0);
     define_native_func_a(n, utf8io_gets, 0, 0, (void*)TEXTIO_M_NEXT);
+    n = define_identifier(m, cls, "lines", NODE_FUNC_N, 0);
+    define_native_func_a(n, utf8io_lines, 0, 1, NULL, fs->cls_int);
     n = define_identifier(m, cls, "_write", NODE_FUNC_N, 0);
     define_native_func_a(n, utf8io_write, 0, -1, NULL);
     n = define_identifier(m, cls, "translit", NODE_FUNC_N, NODEOPT_PROPERTY);
@@ -649,6 +837,8 @@ static void define_io_text_class(RefNode *m)
     define_native_func_a(n, strio_gets, 0, 0, (void*)TEXTIO_M_GETLN);
     n = define_identifier(m, cls, "next", NODE_FUNC_N, 0);
     define_native_func_a(n, strio_gets, 0, 0, (void*)TEXTIO_M_NEXT);
+    n = define_identifier(m, cls, "lines", NODE_FUNC_N, 0);
+    define_native_func_a(n, strio_lines, 0, 1, NULL, fs->cls_int);
     n = define_identifier(m, cls, "_write", NODE_FUNC_N, 0);
     define_native_func_a(n, strio_write, 0, -1, NULL);
     n = define_identifier(m, cls, "flush", NODE_FUNC_N, 0);
@@ -656,6 +846,15 @@ static void define_io_text_class(RefNode *m)
     extends_method(cls, fs->cls_textio);
 
 
+    // LineIterator
+    cls = fv->cls_lineiter;
+    n = define_identifier_p(m, cls, fs->str_next, NODE_FUNC_N, 0);
+    define_native_func_a(n, lineiter_next, 0, 0, NULL);
+    n = define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    define_native_func_a(n, lineiter_dispose, 0, 0, NULL);
+    extends_method(cls, fs->cls_iterator);
+
+
     // NullTextIO(R,W) なにもしない
     cls = define_identifier(m, m, "NullTextIO", NODE_CLASS, 0);
     n = define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
@@ -162,6 +162,42 @@ static int lang_heap_count(Value *vret, Value *v, RefNode *node)
     *vret = int32_Value(fv->heap_count);
     return TRUE;
 }
+/**
+ * 循環参照を回収し、解放したオブジェクトの数を返す
+ */
+static int lang_gc_collect(Value *vret, Value *v, RefNode *node)
+{
+    *vret = int32_Value(gc_collect());
+    return TRUE;
+}
+static int lang_gc_enable(Value *vret, Value *v, RefNode *node)
+{
+    fv->gc.enabled = Value_bool(v[1]);
+    if (!fv->gc.enabled) {
+        fv->gc.pending = FALSE;
+    }
+    return TRUE;
+}
+static void gc_stats_add(RefMap *rm, const char *name, Value val)
+{
+    HashValueEntry *ve = refmap_add(rm, cstr_Value(fs->cls_str, name, -1), TRUE, FALSE);
+    ve->val = val;
+}
+static int lang_gc_stats(Value *vret, Value *v, RefNode *node)
+{
+    GCState *gc = &fv->gc;
+    RefMap *rm = refmap_new(0);
+
+    *vret = vp_Value(rm);
+    gc_stats_add(rm, "collections", int64_Value(gc->n_collect));
+    gc_stats_add(rm, "freed", int64_Value(gc->n_freed));
+    gc_stats_add(rm, "pause_ms", float_Value(fs->cls_float, (double)gc->pause_total / 1000.0));
+    gc_stats_add(rm, "last_pause_ms", float_Value(fs->cls_float, (double)gc->pause_last / 1000.0));
+    gc_stats_add(rm, "tracked", int32_Value(gc->count));
+    gc_stats_add(rm, "threshold", int32_Value(gc->threshold));
+
+    return TRUE;
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -338,6 +374,7 @@ static int lang_ref_new(Value *vret, Value *v, RefNode *node)
     RefNode *cls_ref = FUNC_VP(node);
     Ref *r = ref_new(cls_ref);
 
+    gc_track(&r->rh, GC_KIND_REF);
     *vret = vp_Value(r);
     r->v[0] = v[1];
     v[1] = VALUE_NULL;
@@ -780,6 +817,14 @@ static void define_lang_func(RefNode *m)
     // ヒープオブジェクトの数を取得
     n = define_identifier(m, m, "heap_count", NODE_FUNC_N, 0);
     define_native_func_a(n, lang_heap_count, 0, 0, NULL);
+
+    // 循環参照の回収
+    n = define_identifier(m, m, "gc_collect", NODE_FUNC_N, 0);
+    define_native_func_a(n, lang_gc_collect, 0, 0, NULL);
+    n = define_identifier(m, m, "gc_enable", NODE_FUNC_N, 0);
+    define_native_func_a(n, lang_gc_enable, 1, 1, NULL, fs->cls_bool);
+    n = define_identifier(m, m, "gc_stats", NODE_FUNC_N, 0);
+    define_native_func_a(n, lang_gc_stats, 0, 0, NULL);
 }
 static void define_lang_const(RefNode *m)
 {
@@ -675,7 +675,9 @@ static Ref *get_locale_from_name(const char *name, int name_size, int loose)
 static Ref *get_locale_neutral(void)
 {
     Ref *r = ref_new(fs->cls_locale);
-    fv->loc_neutral = get_locale_from_ref(r);
+    if (fv->loc_neutral == NULL) {
+        fv->loc_neutral = get_locale_from_ref(r);
+    }
     r->v[INDEX_LOCALE_LANGTAG] = vp_Value(fs->str_0);
     r->v[INDEX_LOCALE_LOCALE] = ptr_Value(fv->loc_neutral);
     return r;
@@ -746,7 +748,8 @@ static int locale_dispose(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
     LocaleData *loc = Value_ptr(r->v[INDEX_LOCALE_LOCALE]);
-    if (loc != NULL) {
+    // loc_neutralは共有しているので解放しない
+    if (loc != NULL && loc != fv->loc_neutral) {
         Mem_close(&loc->mem);
         r->v[INDEX_LOCALE_LOCALE] = VALUE_NULL;
     }
@@ -230,6 +230,7 @@ RefMap *refmap_new(int size)
     int max = align_pow2(size == 0 ? 32 : size, 32);
     HashValueEntry **entry = malloc(sizeof(HashValueEntry*) * max);
 
+    gc_track(&rm->rh, GC_KIND_MAP);
     memset(entry, 0, sizeof(HashValueEntry*) * max);
     rm->entry = entry;
     rm->entry_num = max;
@@ -627,6 +628,9 @@ int map_dup(Value *vret, Value *v, RefNode *node)
     int max = src->entry_num;
     RefMap *dst = buf_new(type, sizeof(RefMap));
 
+    if (type == fs->cls_map || type == fs->cls_set) {
+        gc_track(&dst->rh, GC_KIND_MAP);
+    }
     *vret = vp_Value(dst);
     dst->count = src->count;
     dst->entry_num = max;
@@ -1,8 +1,41 @@
 #include "fox_vm.h"
+#include "bigint.h"
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 
 
+/*
+ * バージョン1の形式
+ *
+ * 値 : タグ(1byte) + 内容
+ * 整数はLEB128の可変長
+ * 文字列、クラスはストリームごとの表に登録し、2回目以降は番号で参照する
+ * List, Map, Set, Bytes, その他のオブジェクトは出現順に番号を振り、同じ参照はMTAG_REFで表す
+ */
+enum {
+    MARSHAL_VERSION = 1,
+    MARSHAL_MAX_DEPTH = 4096,
+    MARSHAL_MAX_SIZE = 0xffffff,
+};
+enum {
+    MTAG_NULL,
+    MTAG_FALSE,
+    MTAG_TRUE,
+    MTAG_INT,       // zigzag
+    MTAG_BIGINT,    // 符号(1byte) + 桁数 + 16bit * 桁数 (BigEndian)
+    MTAG_FLOAT,     // 8byte (BigEndian)
+    MTAG_STR,       // 文字列
+    MTAG_BYTES,     // 長さ + データ
+    MTAG_LIST,      // 要素数 + 要素
+    MTAG_MAP,       // 要素数 + (key, value) * 要素数
+    MTAG_SET,       // 要素数 + key * 要素数
+    MTAG_OBJECT,    // クラス + _marshal_writeで書き込んだデータ
+    MTAG_REF,       // 番号
+    MTAG_CLASS,     // クラス
+    MTAG_MODULE,    // モジュール名(文字列)
+};
+
 typedef struct {
     RefHeader rh;
 
@@ -10,16 +43,38 @@ typedef struct {
     Hash hash;
 } RefLoopValidator;
 
+typedef struct {
+    RefHeader rh;
+
+    Mem mem;
+    Hash obj_hash;      // 書き込み: Ref -> 番号 + 1
+    Hash cls_hash;      // 書き込み: クラス -> 番号 + 1
+    int32_t *str_slot;  // 書き込み: 文字列の内容 -> 番号 (オープンアドレス)
+    int str_slot_size;
+    int depth;
+
+    Value *str;         // 番号順の文字列
+    int str_num, str_max;
+    RefNode **cls;      // 番号順のクラス
+    int cls_num, cls_max;
+    Value *obj;         // 番号順のオブジェクト (処理中はVALUE_NULL)
+    int obj_num, obj_max;
+} RefMarshalTable;
+
 
 static RefNode *mod_marshal;
 static RefNode *cls_loopvalidator;
+static RefNode *cls_marshaltable;
 
 #define FOX_OBJECT_MAGIC_SIZE 8
 static const char *FOX_OBJECT_MAGIC = "\x89\x66\x6f\x78\r\n\0\0";
 
 
 
-static int validate_fox_object(Value src)
+/*
+ * 最後の1byteがバージョン
+ */
+static int validate_fox_object(Value src, int *version)
 {
     char magic[8];
     int size = FOX_OBJECT_MAGIC_SIZE;
@@ -27,37 +82,58 @@ static int validate_fox_object(Value src)
     if (!stream_read_data(src, NULL, magic, &size, FALSE, FALSE)) {
         return FALSE;
     }
-    if (size != 8 || memcmp(magic, FOX_OBJECT_MAGIC, FOX_OBJECT_MAGIC_SIZE) != 0) {
+    if (size != 8 || memcmp(magic, FOX_OBJECT_MAGIC, FOX_OBJECT_MAGIC_SIZE - 1) != 0) {
         throw_errorf(fs->mod_io, "FileTypeError", "Not a fox object file");
         return FALSE;
     }
+    *version = magic[FOX_OBJECT_MAGIC_SIZE - 1];
+    if (*version > MARSHAL_VERSION) {
+        throw_errorf(fs->mod_io, "FileTypeError", "Unsupported fox object version %d", *version);
+        return FALSE;
+    }
     return TRUE;
 }
-static void init_marshaldumper(Value *v, Value *src)
+static int write_fox_object_magic(Value w)
+{
+    char magic[8];
+
+    memcpy(magic, FOX_OBJECT_MAGIC, FOX_OBJECT_MAGIC_SIZE);
+    magic[FOX_OBJECT_MAGIC_SIZE - 1] = MARSHAL_VERSION;
+    return stream_write_data(w, magic, FOX_OBJECT_MAGIC_SIZE);
+}
+static void init_marshaldumper(Value *v, Value *src, int version)
 {
-    RefLoopValidator *lv;
     Ref *r = ref_new(fs->cls_marshaldumper);
     *v = vp_Value(r);
     r->v[INDEX_MARSHALDUMPER_SRC] = *src;
 
-    lv = buf_new(cls_loopvalidator, sizeof(RefLoopValidator));
-    r->v[INDEX_MARSHALDUMPER_CYCLREF] = vp_Value(lv);
-    Mem_init(&lv->mem, 256);
-    Hash_init(&lv->hash, &lv->mem, 16);
+    if (version == 0) {
+        RefLoopValidator *lv = buf_new(cls_loopvalidator, sizeof(RefLoopValidator));
+        r->v[INDEX_MARSHALDUMPER_CYCLREF] = vp_Value(lv);
+        Mem_init(&lv->mem, 256);
+        Hash_init(&lv->hash, &lv->mem, 16);
+    } else {
+        RefMarshalTable *mt = buf_new(cls_marshaltable, sizeof(RefMarshalTable));
+        r->v[INDEX_MARSHALDUMPER_CYCLREF] = vp_Value(mt);
+        Mem_init(&mt->mem, 1024);
+        Hash_init(&mt->obj_hash, &mt->mem, 64);
+        Hash_init(&mt->cls_hash, &mt->mem, 16);
+    }
 }
 static int marshal_load(Value *vret, Value *v, RefNode *node)
 {
     Value reader;
+    int version;
 
     if (!value_to_streamio(&reader, v[1], FALSE, 0, FALSE)) {
         return FALSE;
     }
-    if (!validate_fox_object(reader)) {
+    if (!validate_fox_object(reader, &version)) {
         unref(reader);
         return FALSE;
     }
     // readerの所有権がMarshalWriterに移る
-    init_marshaldumper(fg->stk_top, &reader);
+    init_marshaldumper(fg->stk_top, &reader, version);
     fg->stk_top++;
 
     if (!call_member_func(fs->str_read, 0, TRUE)) {
@@ -75,10 +151,10 @@ static int marshal_save(Value *vret, Value *v, RefNode *node)
     if (!value_to_streamio(&writer, v[1], TRUE, 0, FALSE)) {
         return FALSE;
     }
-    stream_write_data(writer, FOX_OBJECT_MAGIC, FOX_OBJECT_MAGIC_SIZE);
+    write_fox_object_magic(writer);
 
     // writerの所有権がMarshalWriterに移る
-    init_marshaldumper(fg->stk_top, &writer);
+    init_marshaldumper(fg->stk_top, &writer, MARSHAL_VERSION);
     fg->stk_top++;
     Value_push("v", v[2]);
     if (!call_member_func(fs->str_write, 1, TRUE)) {
@@ -92,10 +168,10 @@ static int marshal_bytes(Value *vret, Value *v, RefNode *node)
 {
     RefBytesIO *mb = bytesio_new_sub(NULL, 256);
     Value writer = vp_Value(mb);
-    stream_write_data(writer, FOX_OBJECT_MAGIC, FOX_OBJECT_MAGIC_SIZE);
+    write_fox_object_magic(writer);
 
     // writerの所有権がMarshalWriterに移る
-    init_marshaldumper(fg->stk_top, &writer);
+    init_marshaldumper(fg->stk_top, &writer, MARSHAL_VERSION);
     addref(writer);
     fg->stk_top++;
     Value_push("v", v[1]);
@@ -202,6 +278,699 @@ static int write_str(RefStr *rs, Value w)
     return TRUE;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int write_tag(Value w, int tag)
+{
+    char c = tag;
+    return stream_write_data(w, &c, 1);
+}
+/*
+ * tag < 0 の場合はタグを書かない
+ */
+static int write_varint(Value w, int tag, uint64_t val)
+{
+    char buf[12];
+    int n = 0;
+
+    if (tag >= 0) {
+        buf[n++] = tag;
+    }
+    do {
+        int b = val & 0x7F;
+        val >>= 7;
+        if (val != 0) {
+            b |= 0x80;
+        }
+        buf[n++] = b;
+    } while (val != 0);
+
+    return stream_write_data(w, buf, n);
+}
+static int read_byte(Value r, int *val)
+{
+    uint8_t c;
+    int rd_size = 1;
+
+    if (!stream_read_data(r, NULL, (char*)&c, &rd_size, FALSE, TRUE)) {
+        return FALSE;
+    }
+    *val = c;
+    return TRUE;
+}
+static int read_varint(Value r, uint64_t *val)
+{
+    uint64_t ret = 0;
+    int shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+        int b;
+        if (!read_byte(r, &b)) {
+            return FALSE;
+        }
+        ret |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *val = ret;
+            return TRUE;
+        }
+    }
+    throw_errorf(mod_marshal, "MarshalLoadError", "Broken integer");
+    return FALSE;
+}
+static int read_size(Value r, int *size, int elem_size)
+{
+    uint64_t val;
+
+    if (!read_varint(r, &val)) {
+        return FALSE;
+    }
+    if (val > MARSHAL_MAX_SIZE) {
+        throw_errorf(fs->mod_lang, "ValueError", "Invalid size number");
+        return FALSE;
+    }
+    if (val * elem_size > fs->max_alloc) {
+        throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+        return FALSE;
+    }
+    *size = (int)val;
+    return TRUE;
+}
+
+static void mtable_push(Value **pv, int *pnum, int *pmax, Value v)
+{
+    if (*pnum >= *pmax) {
+        *pmax = (*pmax == 0 ? 64 : *pmax * 2);
+        *pv = realloc(*pv, sizeof(Value) * *pmax);
+    }
+    (*pv)[(*pnum)++] = v;
+}
+static void mtable_str_grow(RefMarshalTable *mt)
+{
+    int size = (mt->str_slot_size == 0 ? 64 : mt->str_slot_size * 2);
+    int i;
+
+    free(mt->str_slot);
+    mt->str_slot = malloc(sizeof(int32_t) * size);
+    mt->str_slot_size = size;
+    for (i = 0; i < size; i++) {
+        mt->str_slot[i] = -1;
+    }
+    for (i = 0; i < mt->str_num; i++) {
+        RefStr *rs = Value_vp(mt->str[i]);
+        int pos = str_hash(rs->c, rs->size) & (size - 1);
+        while (mt->str_slot[pos] >= 0) {
+            pos = (pos + 1) & (size - 1);
+        }
+        mt->str_slot[pos] = i;
+    }
+}
+/*
+ * 同じ内容の文字列があればその番号を返す
+ * 無ければ登録して-1を返す
+ */
+static int mtable_str_index(RefMarshalTable *mt, RefStr *rs)
+{
+    int pos;
+
+    if (mt->str_num * 2 >= mt->str_slot_size) {
+        mtable_str_grow(mt);
+    }
+    pos = str_hash(rs->c, rs->size) & (mt->str_slot_size - 1);
+    while (mt->str_slot[pos] >= 0) {
+        int idx = mt->str_slot[pos];
+        RefStr *rs2 = Value_vp(mt->str[idx]);
+        if (rs2->size == rs->size && memcmp(rs2->c, rs->c, rs->size) == 0) {
+            return idx;
+        }
+        pos = (pos + 1) & (mt->str_slot_size - 1);
+    }
+    mt->str_slot[pos] = mt->str_num;
+    mtable_push(&mt->str, &mt->str_num, &mt->str_max, Value_cp(vp_Value(rs)));
+    return -1;
+}
+
+/*
+ * 0 : 新しい文字列 (長さ + データ)
+ * n : n - 1番目の文字列
+ */
+static int mwrite_str(RefMarshalTable *mt, Value w, RefStr *rs)
+{
+    int idx = mtable_str_index(mt, rs);
+
+    if (idx >= 0) {
+        return write_varint(w, -1, idx + 1);
+    }
+    if (!write_varint(w, -1, 0)) {
+        return FALSE;
+    }
+    if (!write_varint(w, -1, rs->size)) {
+        return FALSE;
+    }
+    return stream_write_data(w, rs->c, rs->size);
+}
+/*
+ * 0 : 新しいクラス (モジュール名 + クラス名)
+ * n : n - 1番目のクラス
+ */
+static int mwrite_class(RefMarshalTable *mt, Value w, RefNode *cls)
+{
+    RefStr *mod_name = cls->defined_module->name;
+    HashEntry *he;
+
+    if (mod_name == fs->str_toplevel) {
+        throw_errorf(fs->mod_lang, "ValueError", "Cannot save object which belongs no modules");
+        return FALSE;
+    }
+    he = Hash_get_add_entry(&mt->cls_hash, &mt->mem, (RefStr*)cls);
+    if (he->p != NULL) {
+        return write_varint(w, -1, (intptr_t)he->p);
+    }
+    he->p = (void*)(intptr_t)(++mt->cls_num);
+
+    if (!write_varint(w, -1, 0)) {
+        return FALSE;
+    }
+    if (!mwrite_str(mt, w, mod_name)) {
+        return FALSE;
+    }
+    return mwrite_str(mt, w, cls->name);
+}
+static int mwrite_bigint(Value w, RefInt *mp)
+{
+    int n = mp->bi.size;
+    char *buf = malloc(n * 2);
+    char head[2];
+    int i, ret;
+
+    head[0] = MTAG_BIGINT;
+    head[1] = (mp->bi.sign < 0 ? 1 : 0);
+    for (i = 0; i < n; i++) {
+        uint16_t d = mp->bi.d[n - i - 1];
+        buf[i * 2] = d >> 8;
+        buf[i * 2 + 1] = d & 0xFF;
+    }
+    ret = stream_write_data(w, head, 2) && write_varint(w, -1, n) && stream_write_data(w, buf, n * 2);
+    free(buf);
+
+    return ret;
+}
+static int mwrite_float(Value w, double d)
+{
+    union {
+        uint64_t i;
+        double d;
+    } u;
+    char data[9];
+    int i;
+
+    u.d = d;
+    data[0] = MTAG_FLOAT;
+    for (i = 0; i < 8; i++) {
+        data[i + 1] = (u.i >> ((7 - i) * 8)) & 0xFF;
+    }
+    return stream_write_data(w, data, 9);
+}
+static int mwrite_value(Value dumper, RefMarshalTable *mt, Value w, Value v);
+
+static int mwrite_list(Value dumper, RefMarshalTable *mt, Value w, RefArray *ra)
+{
+    int i;
+
+    if (!write_varint(w, MTAG_LIST, ra->size)) {
+        return FALSE;
+    }
+    ra->lock_count++;
+    for (i = 0; i < ra->size; i++) {
+        if (!mwrite_value(dumper, mt, w, ra->p[i])) {
+            ra->lock_count--;
+            return FALSE;
+        }
+    }
+    ra->lock_count--;
+    return TRUE;
+}
+static int mwrite_map(Value dumper, RefMarshalTable *mt, Value w, RefMap *rm, int is_map)
+{
+    int i;
+
+    if (!write_varint(w, is_map ? MTAG_MAP : MTAG_SET, rm->count)) {
+        return FALSE;
+    }
+    rm->lock_count++;
+    for (i = 0; i < rm->entry_num; i++) {
+        HashValueEntry *ep = rm->entry[i];
+        for (; ep != NULL; ep = ep->next) {
+            if (!mwrite_value(dumper, mt, w, ep->key)) {
+                goto ERROR_END;
+            }
+            if (is_map && !mwrite_value(dumper, mt, w, ep->val)) {
+                goto ERROR_END;
+            }
+        }
+    }
+    rm->lock_count--;
+    return TRUE;
+
+ERROR_END:
+    rm->lock_count--;
+    return FALSE;
+}
+/*
+ * 組み込みの型はVMを経由せずに書き込む
+ */
+static int mwrite_value_sub(Value dumper, RefMarshalTable *mt, Value w, Value v)
+{
+    RefNode *type = Value_type(v);
+    int idx;
+
+    if (v == VALUE_NULL) {
+        return write_tag(w, MTAG_NULL);
+    } else if (type == fs->cls_bool) {
+        return write_tag(w, Value_bool(v) ? MTAG_TRUE : MTAG_FALSE);
+    } else if (type == fs->cls_int) {
+        if (Value_isref(v)) {
+            return mwrite_bigint(w, Value_vp(v));
+        } else {
+            int32_t ival = Value_integral(v);
+            return write_varint(w, MTAG_INT, ((uint32_t)ival << 1) ^ (uint32_t)(ival >> 31));
+        }
+    } else if (type == fs->cls_float) {
+        return mwrite_float(w, Value_float(v));
+    } else if (type == fs->cls_str) {
+        return write_tag(w, MTAG_STR) && mwrite_str(mt, w, Value_vp(v));
+    } else if (type == fs->cls_class) {
+        return write_tag(w, MTAG_CLASS) && mwrite_class(mt, w, Value_vp(v));
+    } else if (type == fs->cls_module) {
+        RefNode *mod = Value_vp(v);
+        return write_tag(w, MTAG_MODULE) && mwrite_str(mt, w, mod->name);
+    }
+
+    // 2回目以降は番号で参照する
+    if (Value_isref(v)) {
+        HashEntry *he = Hash_get_add_entry(&mt->obj_hash, &mt->mem, Value_vp(v));
+        if (he->p != NULL) {
+            idx = (intptr_t)he->p - 1;
+            if (mt->obj[idx] == VALUE_NULL) {
+                // _marshal_writeの中から自分自身を参照している
+                throw_error_select(THROW_LOOP_REFERENCE);
+                return FALSE;
+            }
+            return write_varint(w, MTAG_REF, idx);
+        }
+        he->p = (void*)(intptr_t)(mt->obj_num + 1);
+    }
+    idx = mt->obj_num;
+
+    if (type == fs->cls_list || type == fs->cls_map || type == fs->cls_set || type == fs->cls_bytes) {
+        // 書き込んだ後に解放されて、同じアドレスが再利用されないように参照を保持する
+        mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, Value_cp(v));
+        if (type == fs->cls_list) {
+            return mwrite_list(dumper, mt, w, Value_vp(v));
+        } else if (type == fs->cls_bytes) {
+            RefStr *rs = Value_vp(v);
+            return write_varint(w, MTAG_BYTES, rs->size) && stream_write_data(w, rs->c, rs->size);
+        } else {
+            return mwrite_map(dumper, mt, w, Value_vp(v), type == fs->cls_map);
+        }
+    }
+
+    mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, VALUE_NULL);
+    if (!write_tag(w, MTAG_OBJECT)) {
+        return FALSE;
+    }
+    if (!mwrite_class(mt, w, type)) {
+        return FALSE;
+    }
+    Value_push("vv", v, dumper);
+    if (!call_member_func(fs->str_marshal_write, 1, TRUE)) {
+        return FALSE;
+    }
+    Value_pop();
+    mt->obj[idx] = Value_cp(v);
+
+    return TRUE;
+}
+static int mwrite_value(Value dumper, RefMarshalTable *mt, Value w, Value v)
+{
+    int ret;
+
+    if (mt->depth >= MARSHAL_MAX_DEPTH) {
+        throw_errorf(fs->mod_lang, "ValueError", "Nesting too deep (max:%d)", MARSHAL_MAX_DEPTH);
+        return FALSE;
+    }
+    mt->depth++;
+    ret = mwrite_value_sub(dumper, mt, w, v);
+    mt->depth--;
+
+    return ret;
+}
+
+static RefStr *mread_str(RefMarshalTable *mt, Value r)
+{
+    uint64_t n;
+    int size;
+    RefStr *rs;
+
+    if (!read_varint(r, &n)) {
+        return NULL;
+    }
+    if (n > 0) {
+        if (n > mt->str_num) {
+            throw_errorf(mod_marshal, "MarshalLoadError", "Invalid string reference");
+            return NULL;
+        }
+        return Value_vp(mt->str[n - 1]);
+    }
+    if (!read_size(r, &size, 1)) {
+        return NULL;
+    }
+    rs = refstr_new_n(fs->cls_str, size);
+    mtable_push(&mt->str, &mt->str_num, &mt->str_max, vp_Value(rs));
+    if (!stream_read_data(r, NULL, rs->c, &size, FALSE, TRUE)) {
+        return NULL;
+    }
+    rs->c[size] = '\0';
+    if (invalid_utf8_pos(rs->c, size) >= 0) {
+        throw_error_select(THROW_INVALID_UTF8);
+        return NULL;
+    }
+    return rs;
+}
+static RefNode *mread_class(RefMarshalTable *mt, Value r)
+{
+    uint64_t n;
+    RefStr *name;
+    RefNode *mod;
+    RefNode *cls;
+
+    if (!read_varint(r, &n)) {
+        return NULL;
+    }
+    if (n > 0) {
+        if (n > mt->cls_num) {
+            throw_errorf(mod_marshal, "MarshalLoadError", "Invalid class reference");
+            return NULL;
+        }
+        return mt->cls[n - 1];
+    }
+
+    name = mread_str(mt, r);
+    if (name == NULL) {
+        return NULL;
+    }
+    if (!validate_module_name(Str_new(name->c, name->size))) {
+        throw_errorf(mod_marshal, "MarshalLoadError", "Invalid module name %Q", Str_new(name->c, name->size));
+        return NULL;
+    }
+    mod = get_module_by_name(name->c, name->size, FALSE, TRUE);
+    if (mod == NULL) {
+        return NULL;
+    }
+    name = mread_str(mt, r);
+    if (name == NULL) {
+        return NULL;
+    }
+    if (!validate_class_name(Str_new(name->c, name->size))) {
+        throw_errorf(mod_marshal, "MarshalLoadError", "Invalid class name %Q", Str_new(name->c, name->size));
+        return NULL;
+    }
+    name = intern(name->c, name->size);
+    cls = Hash_get_p(&mod->u.m.h, name);
+    if (cls == NULL) {
+        throw_error_select(THROW_NO_MEMBER_EXISTS__NODE_REFSTR, mod, name);
+        return NULL;
+    }
+
+    if (mt->cls_num >= mt->cls_max) {
+        mt->cls_max = (mt->cls_max == 0 ? 16 : mt->cls_max * 2);
+        mt->cls = realloc(mt->cls, sizeof(RefNode*) * mt->cls_max);
+    }
+    mt->cls[mt->cls_num++] = cls;
+
+    return cls;
+}
+static int mread_bigint(Value *vret, Value r)
+{
+    RefInt *mp;
+    int sign, size;
+    uint8_t *buf;
+    int i;
+
+    if (!read_byte(r, &sign)) {
+        return FALSE;
+    }
+    if (!read_size(r, &size, 2)) {
+        return FALSE;
+    }
+    if (size == 0 || size > 0xffff) {
+        throw_errorf(fs->mod_lang, "ValueError", "Invalid size number");
+        return FALSE;
+    }
+    mp = buf_new(fs->cls_int, sizeof(RefInt));
+    *vret = vp_Value(mp);
+    BigInt_init(&mp->bi);
+    if (!BigInt_reserve(&mp->bi, size)) {
+        throw_error_select(THROW_MAX_ALLOC_OVER__INT, fs->max_alloc);
+        return FALSE;
+    }
+
+    buf = malloc(size * 2);
+    i = size * 2;
+    if (!stream_read_data(r, NULL, (char*)buf, &i, FALSE, TRUE)) {
+        free(buf);
+        return FALSE;
+    }
+    for (i = 0; i < size; i++) {
+        mp->bi.d[size - i - 1] = (buf[i * 2] << 8) | buf[i * 2 + 1];
+    }
+    free(buf);
+    mp->bi.size = size;
+    mp->bi.sign = (sign ? -1 : 1);
+
+    return TRUE;
+}
+static int mread_float(Value *vret, Value r)
+{
+    union {
+        uint64_t i;
+        double d;
+    } u;
+    uint8_t data[8];
+    int rd_size = 8;
+    int i;
+
+    if (!stream_read_data(r, NULL, (char*)data, &rd_size, FALSE, TRUE)) {
+        return FALSE;
+    }
+    u.i = 0ULL;
+    for (i = 0; i < 8; i++) {
+        u.i |= ((uint64_t)data[i]) << ((7 - i) * 8);
+    }
+    if (isnan(u.d)) {
+        throw_error_select(THROW_FLOAT_DOMAIN_ERROR);
+        return FALSE;
+    }
+    *vret = float_Value(fs->cls_float, u.d);
+    return TRUE;
+}
+static int mread_value(Value *vret, Value dumper, RefMarshalTable *mt, Value r);
+
+static int mread_map(Value *vret, Value dumper, RefMarshalTable *mt, Value r, int is_map)
+{
+    RefMap *rm;
+    int size;
+    int i;
+
+    if (!read_size(r, &size, sizeof(HashValueEntry))) {
+        return FALSE;
+    }
+    rm = refmap_new(size);
+    if (!is_map) {
+        rm->rh.type = fs->cls_set;
+    }
+    *vret = vp_Value(rm);
+    // 要素から自分自身を参照できるように、先に登録する
+    mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, Value_cp(*vret));
+
+    for (i = 0; i < size; i++) {
+        Value key = VALUE_NULL;
+        Value val = VALUE_NULL;
+        HashValueEntry *ve;
+
+        if (!mread_value(&key, dumper, mt, r)) {
+            unref(key);
+            return FALSE;
+        }
+        if (is_map && !mread_value(&val, dumper, mt, r)) {
+            unref(key);
+            unref(val);
+            return FALSE;
+        }
+        ve = refmap_add(rm, key, TRUE, FALSE);
+        unref(key);
+        if (ve == NULL) {
+            unref(val);
+            return FALSE;
+        }
+        if (is_map) {
+            ve->val = val;
+        }
+    }
+    return TRUE;
+}
+static int mread_value_sub(Value *vret, Value dumper, RefMarshalTable *mt, Value r)
+{
+    int tag;
+
+    if (!read_byte(r, &tag)) {
+        return FALSE;
+    }
+    switch (tag) {
+    case MTAG_NULL:
+        *vret = VALUE_NULL;
+        return TRUE;
+    case MTAG_FALSE:
+        *vret = VALUE_FALSE;
+        return TRUE;
+    case MTAG_TRUE:
+        *vret = VALUE_TRUE;
+        return TRUE;
+    case MTAG_INT: {
+        uint64_t n;
+        if (!read_varint(r, &n)) {
+            return FALSE;
+        }
+        if (n > 0xFFFFFFFFULL) {
+            throw_errorf(mod_marshal, "MarshalLoadError", "Broken integer");
+            return FALSE;
+        }
+        *vret = int32_Value((int32_t)((uint32_t)(n >> 1) ^ -(uint32_t)(n & 1)));
+        return TRUE;
+    }
+    case MTAG_BIGINT:
+        return mread_bigint(vret, r);
+    case MTAG_FLOAT:
+        return mread_float(vret, r);
+    case MTAG_STR: {
+        RefStr *rs = mread_str(mt, r);
+        if (rs == NULL) {
+            return FALSE;
+        }
+        *vret = Value_cp(vp_Value(rs));
+        return TRUE;
+    }
+    case MTAG_BYTES: {
+        RefStr *rs;
+        int size;
+        if (!read_size(r, &size, 1)) {
+            return FALSE;
+        }
+        rs = refstr_new_n(fs->cls_bytes, size);
+        *vret = vp_Value(rs);
+        mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, Value_cp(*vret));
+        if (!stream_read_data(r, NULL, rs->c, &size, FALSE, TRUE)) {
+            return FALSE;
+        }
+        rs->c[size] = '\0';
+        return TRUE;
+    }
+    case MTAG_LIST: {
+        RefArray *ra;
+        int size;
+        int i;
+        if (!read_size(r, &size, sizeof(Value))) {
+            return FALSE;
+        }
+        ra = refarray_new(size);
+        *vret = vp_Value(ra);
+        // 要素から自分自身を参照できるように、先に登録する
+        mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, Value_cp(*vret));
+        for (i = 0; i < size; i++) {
+            if (!mread_value(&ra->p[i], dumper, mt, r)) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    case MTAG_MAP:
+    case MTAG_SET:
+        return mread_map(vret, dumper, mt, r, tag == MTAG_MAP);
+    case MTAG_OBJECT: {
+        RefNode *cls = mread_class(mt, r);
+        int idx = mt->obj_num;
+        if (cls == NULL) {
+            return FALSE;
+        }
+        // 読み込みが終わるまでは参照できない
+        mtable_push(&mt->obj, &mt->obj_num, &mt->obj_max, VALUE_NULL);
+        Value_push("rv", cls, dumper);
+        if (!call_member_func(fs->str_marshal_read, 1, TRUE)) {
+            return FALSE;
+        }
+        fg->stk_top--;
+        *vret = *fg->stk_top;
+        mt->obj[idx] = Value_cp(*vret);
+        return TRUE;
+    }
+    case MTAG_REF: {
+        uint64_t n;
+        if (!read_varint(r, &n)) {
+            return FALSE;
+        }
+        if (n >= mt->obj_num || mt->obj[n] == VALUE_NULL) {
+            throw_errorf(mod_marshal, "MarshalLoadError", "Invalid object reference");
+            return FALSE;
+        }
+        *vret = Value_cp(mt->obj[n]);
+        return TRUE;
+    }
+    case MTAG_CLASS: {
+        RefNode *cls = mread_class(mt, r);
+        if (cls == NULL) {
+            return FALSE;
+        }
+        *vret = vp_Value(cls);
+        return TRUE;
+    }
+    case MTAG_MODULE: {
+        RefStr *name = mread_str(mt, r);
+        RefNode *mod;
+        if (name == NULL) {
+            return FALSE;
+        }
+        if (!validate_module_name(Str_new(name->c, name->size))) {
+            throw_errorf(mod_marshal, "MarshalLoadError", "Invalid module name %Q", Str_new(name->c, name->size));
+            return FALSE;
+        }
+        mod = get_module_by_name(name->c, name->size, FALSE, TRUE);
+        if (mod == NULL) {
+            return FALSE;
+        }
+        *vret = vp_Value(mod);
+        return TRUE;
+    }
+    default:
+        throw_errorf(mod_marshal, "MarshalLoadError", "Unknown tag %d", tag);
+        return FALSE;
+    }
+}
+static int mread_value(Value *vret, Value dumper, RefMarshalTable *mt, Value r)
+{
+    int ret;
+
+    if (mt->depth >= MARSHAL_MAX_DEPTH) {
+        throw_errorf(mod_marshal, "MarshalLoadError", "Nesting too deep (max:%d)", MARSHAL_MAX_DEPTH);
+        return FALSE;
+    }
+    mt->depth++;
+    ret = mread_value_sub(vret, dumper, mt, r);
+    mt->depth--;
+
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 static int marshaldump_read(Value *vret, Value *v, RefNode *node)
 {
     Ref *r = Value_ref(*v);
@@ -212,6 +981,10 @@ static int marshaldump_read(Value *vret, Value *v, RefNode *node)
     RefNode *cls;
     RefNode *mod;
 
+    if (Value_type(r->v[INDEX_MARSHALDUMPER_CYCLREF]) == cls_marshaltable) {
+        return mread_value(vret, *v, Value_vp(r->v[INDEX_MARSHALDUMPER_CYCLREF]), rd);
+    }
+
     ptr = read_str(&name_s, rd);
     if (ptr == NULL) {
         goto ERROR_END;
@@ -300,6 +1073,9 @@ static int marshaldump_write(Value *vret, Value *v, RefNode *node)
     Value w = r->v[INDEX_MARSHALDUMPER_SRC];
     Value v1 = v[1];
 
+    if (Value_type(r->v[INDEX_MARSHALDUMPER_CYCLREF]) == cls_marshaltable) {
+        return mwrite_value(*v, Value_vp(r->v[INDEX_MARSHALDUMPER_CYCLREF]), w, v1);
+    }
     if (Value_isref(v1)) {
         RefLoopValidator *lv = Value_vp(r->v[INDEX_MARSHALDUMPER_CYCLREF]);
         Ref *r1 = Value_ref(v1);
@@ -496,6 +1272,36 @@ static int loopref_pop(Value *vret, Value *v, RefNode *node)
     return TRUE;
 }
 
+static int marshaltable_dispose(Value *vret, Value *v, RefNode *node)
+{
+    RefMarshalTable *mt = Value_vp(*v);
+    int i;
+
+    for (i = 0; i < mt->str_num; i++) {
+        unref(mt->str[i]);
+    }
+    for (i = 0; i < mt->obj_num; i++) {
+        unref(mt->obj[i]);
+    }
+    free(mt->str);
+    free(mt->str_slot);
+    free(mt->cls);
+    free(mt->obj);
+    mt->str = NULL;
+    mt->str_slot = NULL;
+    mt->cls = NULL;
+    mt->obj = NULL;
+    mt->str_num = 0;
+    mt->obj_num = 0;
+    mt->cls_num = 0;
+
+    if (mt->mem.p != NULL) {
+        Mem_close(&mt->mem);
+        mt->mem.p = NULL;
+    }
+    return TRUE;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void define_marshal_func(RefNode *m)
@@ -536,6 +1342,14 @@ void define_marshal_class(RefNode *m)
     extends_method(cls, fs->cls_obj);
 
 
+    // 文字列、クラス、参照の表
+    cls_marshaltable = define_identifier(m, m, "MarshalTable", NODE_CLASS, 0);
+    cls = cls_marshaltable;
+    n = define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    define_native_func_a(n, marshaltable_dispose, 0, 0, NULL);
+    extends_method(cls, fs->cls_obj);
+
+
     cls = fs->cls_marshaldumper;
     n = define_identifier_p(m, cls, fs->str_read, NODE_FUNC_N, 0);
     define_native_func_a(n, marshaldump_read, 0, 0, NULL);
@@ -1471,7 +1471,7 @@ static int float_new(Value *vret, Value *v, RefNode *node)
 
             *vret = vp_Value(rd);
             errno = 0;
-            rd->d = strtod(rs->c, NULL);
+            rd->d = str_to_double(rs->c, NULL);
             if (errno != 0) {
                 rd->d = 0.0;
             }
@@ -1513,7 +1513,7 @@ static int float_parse(Value *vret, Value *v, RefNode *node)
 
     *vret = vp_Value(rd);
     errno = 0;
-    rd->d = strtod(rs->c, &end);
+    rd->d = str_to_double(rs->c, &end);
     if (errno != 0) {
         throw_errorf(fs->mod_lang, "ValueError", "%s", strerror(errno));
         return FALSE;
@@ -838,14 +838,10 @@ int float_tostr(Value *vret, Value *v, RefNode *node)
             loc = Value_locale_data(v[2]);
         }
     } else {
-        nf.sign = '\0';
-        nf.padding = '\0';
-        nf.other = 'g';
-        nf.base = 10;
-        nf.upper = FALSE;
-        nf.group = FALSE;
-        nf.width = 0;
-        nf.width_f = -1;
+        // 書式指定なし
+        int len = double_to_str(c_buf, rd->d);
+        *vret = cstr_Value(fs->cls_str, c_buf, len);
+        return TRUE;
     }
 
     if (isinf(rd->d)) {
@@ -866,32 +862,45 @@ int float_tostr(Value *vret, Value *v, RefNode *node)
         *vret = cstr_Value(fs->cls_str, c_buf, -1);
         return TRUE;
     }
-    // 精度は16桁
-    if (nf.width_f > 15) {
+    if (nf.width_f > 15 || isnan(rd->d)) {
         sprintf(c_buf, "%.*e", nf.width_f, rd->d);
-    } else {
-        sprintf(c_buf, "%.15e", rd->d);
-    }
-    // 指数部と仮数部に分ける
-    for (i = 0; c_buf[i] != '\0'; i++) {
-        if (c_buf[i] == 'e') {
-            c_buf[i++] = '\0';
-            ex = strtol(&c_buf[i], NULL, 10);
+        // 指数部と仮数部に分ける
+        for (i = 0; c_buf[i] != '\0'; i++) {
+            if (c_buf[i] == 'e') {
+                c_buf[i++] = '\0';
+                ex = strtol(&c_buf[i], NULL, 10);
+            }
         }
-    }
-    {
-        // 末尾の0を除去
-        char *p = c_buf + strlen(c_buf);
-        while (p > c_buf) {
-            if (p[-1] != '0') {
-                if (p[-1] == '.') {
-                    p--;
+        {
+            // 末尾の0を除去
+            char *p = c_buf + strlen(c_buf);
+            while (p > c_buf) {
+                if (p[-1] != '0') {
+                    if (p[-1] == '.') {
+                        p--;
+                    }
+                    *p = '\0';
+                    break;
                 }
-                *p = '\0';
-                break;
+                p--;
             }
-            p--;
         }
+    } else {
+        // 戻すと同じ値になる最短の桁 (-d.ddd)
+        char digits[24];
+        char *p = c_buf;
+        int len = double_to_digits(digits, &ex, rd->d);
+
+        if (signbit(rd->d)) {
+            *p++ = '-';
+        }
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p = '\0';
     }
 
     // Plain formatと指数表記をいい具合に切り替える
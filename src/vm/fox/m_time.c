@@ -909,14 +909,126 @@ static int word_parse_datetime(RefDateTime *dt, const char *src_p, int src_size,
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
+ * DateTimeFormat
  * .NETのフォーマットに近い
+ *
+ * パターンを命令列に変換しておき、書式化と解析の両方に使う
  */
-static void build_datetime_string(StrBuf *buf, const char *fmt_p, int fmt_size, const Date *dt, const Time *tm, const TimeOffset *off, const LocaleData *loc)
+
+enum {
+    DTFMT_LITERAL,      // lit[arg .. arg + size]
+    DTFMT_YEAR,         // y yy yyyy
+    DTFMT_ISOYEAR,      // Y YY YYYY
+    DTFMT_MONTH,        // M MM
+    DTFMT_MONTH_NAME,   // MMM MMMM
+    DTFMT_ISOWEEK,      // w ww
+    DTFMT_WEEKDAY,      // W
+    DTFMT_DAY,          // d dd
+    DTFMT_WEEKDAY_NAME, // ddd dddd
+    DTFMT_HOUR,         // H HH
+    DTFMT_HOUR12,       // h hh
+    DTFMT_AMPM,         // a
+    DTFMT_MINUTE,       // m mm
+    DTFMT_SECOND,       // s ss
+    DTFMT_MILLISEC,     // S SS SSS
+    DTFMT_TIME,         // x (既定の時刻) arg: 含まれる命令の数
+    DTFMT_OFFSET,       // z
+    DTFMT_ZONE_ABBR,    // Z
+
+    DTFMT_NEST_MAX = 4,
+    DTFMT_CACHE_SIZE = 8,
+};
+
+typedef struct {
+    int16_t type;
+    int16_t width;
+    int32_t arg;
+    int32_t size;
+} DateTimeFormatOp;
+
+typedef struct {
+    RefHeader rh;
+
+    Value pattern;
+    Value locale;       // VALUE_NULLならloc_neutral
+    const LocaleData *loc;
+
+    DateTimeFormatOp *op;
+    int n_op;
+    int max_op;
+    StrBuf lit;
+    int max_size;       // 書式化した結果の最大バイト数 (Zを除く)
+    int n_abbr;         // Zの数
+} RefDateTimeFormat;
+
+static RefNode *cls_datetimeformat;
+static RefDateTimeFormat *dtfmt_cache[DTFMT_CACHE_SIZE];
+static int dtfmt_cache_next;
+static RefDateTimeFormat *dtfmt_datetime_default;
+static RefDateTimeFormat *dtfmt_date_default;
+
+
+static DateTimeFormatOp *DateTimeFormat_push(RefDateTimeFormat *f, int type, int width)
+{
+    DateTimeFormatOp *op;
+
+    if (f->n_op >= f->max_op) {
+        f->max_op = (f->max_op > 0 ? f->max_op * 2 : 16);
+        f->op = realloc(f->op, sizeof(DateTimeFormatOp) * f->max_op);
+    }
+    op = &f->op[f->n_op++];
+    op->type = type;
+    op->width = width;
+    op->arg = 0;
+    op->size = 0;
+    return op;
+}
+/**
+ * 直前の命令がリテラルなら連結する
+ */
+static void DateTimeFormat_push_literal(RefDateTimeFormat *f, const char *p, int size)
+{
+    DateTimeFormatOp *op = (f->n_op > 0 ? &f->op[f->n_op - 1] : NULL);
+
+    if (op == NULL || op->type != DTFMT_LITERAL) {
+        op = DateTimeFormat_push(f, DTFMT_LITERAL, 0);
+        op->arg = f->lit.size;
+    }
+    StrBuf_add(&f->lit, p, size);
+    op->size += size;
+}
+static int count_repeat(const char *p, int i, int size, int max)
+{
+    int ch = p[i];
+    int n = 0;
+
+    do {
+        i++;
+        n++;
+    } while (n < max && i < size && p[i] == ch);
+
+    return n;
+}
+static int max_strlen(const char * const *names, int n)
+{
+    int max = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (names[i] != NULL) {
+            int len = strlen(names[i]);
+            if (max < len) {
+                max = len;
+            }
+        }
+    }
+    return max;
+}
+
+static void DateTimeFormat_compile_sub(RefDateTimeFormat *f, const char *fmt_p, int fmt_size, int nest)
 {
+    const LocaleData *loc = f->loc;
     int i = 0;
-    int end;
-    int n;
-    char c_buf[16];
 
     if (fmt_p == NULL) {
         return;
@@ -926,341 +1038,733 @@ static void build_datetime_string(StrBuf *buf, const char *fmt_p, int fmt_size,
     }
 
     while (i < fmt_size) {
-        switch (fmt_p[i]) {
-        case 'y':   // yy yyyy
-        case 'Y': { // YY YYYY (isoweek)
-            int ch = fmt_p[i];
-            int32_t year = (ch == 'y' ? dt->year : dt->isoweek_year);
-            n = 0;
-            end = i + 4;
-            if (end > fmt_size) {
-                end = fmt_size;
-            }
-            do {
-                i++;
-                n++;
-            } while (i < end && fmt_p[i] == ch);
-
-            switch (n) {
+        int ch = fmt_p[i];
+        int n;
+
+        switch (ch) {
+        case 'y':
+        case 'Y':
+            n = count_repeat(fmt_p, i, fmt_size, 4);
+            DateTimeFormat_push(f, ch == 'y' ? DTFMT_YEAR : DTFMT_ISOYEAR, n);
+            f->max_size += 12;
+            i += n;
+            break;
+        case 'M':
+            n = count_repeat(fmt_p, i, fmt_size, 4);
+            if (n <= 2) {
+                DateTimeFormat_push(f, DTFMT_MONTH, n);
+                f->max_size += 11;
+            } else {
+                DateTimeFormat_push(f, DTFMT_MONTH_NAME, n);
+                f->max_size += 11 + max_strlen(n == 3 ? loc->month : loc->month_w, 12);
+            }
+            i += n;
+            break;
+        case 'w':
+            n = count_repeat(fmt_p, i, fmt_size, 2);
+            DateTimeFormat_push(f, DTFMT_ISOWEEK, n);
+            f->max_size += 11;
+            i += n;
+            break;
+        case 'W':
+            DateTimeFormat_push(f, DTFMT_WEEKDAY, 1);
+            f->max_size += 1;
+            i++;
+            break;
+        case 'd':
+            n = count_repeat(fmt_p, i, fmt_size, 4);
+            if (n <= 2) {
+                DateTimeFormat_push(f, DTFMT_DAY, n);
+                f->max_size += 11;
+            } else {
+                DateTimeFormat_push(f, DTFMT_WEEKDAY_NAME, n);
+                f->max_size += max_strlen(n == 3 ? loc->week : loc->week_w, 7);
+            }
+            i += n;
+            break;
+        case 'H':
+        case 'h':
+        case 'm':
+        case 's':
+            n = count_repeat(fmt_p, i, fmt_size, 2);
+            DateTimeFormat_push(f, ch == 'H' ? DTFMT_HOUR : ch == 'h' ? DTFMT_HOUR12 : ch == 'm' ? DTFMT_MINUTE : DTFMT_SECOND, n);
+            f->max_size += 11;
+            i += n;
+            break;
+        case 'a':
+            DateTimeFormat_push(f, DTFMT_AMPM, 1);
+            f->max_size += max_strlen(loc->am_pm, 2) + 1;
+            i++;
+            break;
+        case 'S':
+            n = count_repeat(fmt_p, i, fmt_size, 3);
+            DateTimeFormat_push(f, DTFMT_MILLISEC, n);
+            f->max_size += 11;
+            i += n;
+            break;
+        case 'X':
+            // 既定の日付
+            n = count_repeat(fmt_p, i, fmt_size, 4);
+            if (nest < DTFMT_NEST_MAX) {
+                DateTimeFormat_compile_sub(f, loc->date[n - 1], -1, nest + 1);
+            }
+            i += n;
+            break;
+        case 'x':
+            // 既定の時刻
+            n = count_repeat(fmt_p, i, fmt_size, 4);
+            {
+                int begin = f->n_op;
+                DateTimeFormat_push(f, DTFMT_TIME, n);
+                if (nest < DTFMT_NEST_MAX) {
+                    DateTimeFormat_compile_sub(f, loc->time[n - 1], -1, nest + 1);
+                }
+                f->op[begin].arg = f->n_op - begin - 1;
+                f->max_size += n;
+            }
+            i += n;
+            break;
+        case 'z':
+            DateTimeFormat_push(f, DTFMT_OFFSET, 1);
+            f->max_size += 16;
+            i++;
+            break;
+        case 'Z':
+            DateTimeFormat_push(f, DTFMT_ZONE_ABBR, 1);
+            f->max_size++;
+            f->n_abbr++;
+            i++;
+            break;
+        case '\'': // '任意の文字列'
+            i++;
+            if (i < fmt_size) {
+                if (fmt_p[i] == '\'') {
+                    DateTimeFormat_push_literal(f, "'", 1);
+                    f->max_size++;
+                    i++;
+                } else {
+                    DateTimeFormat_push_literal(f, &fmt_p[i], 1);
+                    f->max_size++;
+                    i++;
+                    while (i < fmt_size) {
+                        char c = fmt_p[i];
+                        if (c == '\'') {
+                            i++;
+                            if (i < fmt_size && fmt_p[i] == '\'') {
+                                DateTimeFormat_push_literal(f, "'", 1);
+                            } else {
+                                break;
+                            }
+                        } else {
+                            DateTimeFormat_push_literal(f, &c, 1);
+                        }
+                        f->max_size++;
+                        i++;
+                    }
+                }
+            }
+            break;
+        default:
+            if (isalpha_fox(ch)) {
+                DateTimeFormat_push_literal(f, "?", 1);
+            } else {
+                DateTimeFormat_push_literal(f, &fmt_p[i], 1);
+            }
+            f->max_size++;
+            i++;
+            break;
+        }
+    }
+}
+/**
+ * locale: VALUE_NULLならneutral
+ */
+static RefDateTimeFormat *DateTimeFormat_new(Value pattern, Value locale)
+{
+    RefDateTimeFormat *f = buf_new(cls_datetimeformat, sizeof(RefDateTimeFormat));
+    RefStr *rs = Value_vp(pattern);
+
+    f->pattern = Value_cp(pattern);
+    f->locale = Value_cp(locale);
+    f->loc = (locale != VALUE_NULL ? Value_locale_data(locale) : fv->loc_neutral);
+    StrBuf_init(&f->lit, 0);
+    DateTimeFormat_compile_sub(f, rs->c, rs->size, 0);
+
+    return f;
+}
+static void DateTimeFormat_close(RefDateTimeFormat *f)
+{
+    free(f->op);
+    f->op = NULL;
+    free(f->lit.p);
+    f->lit.p = NULL;
+    unref(f->pattern);
+    f->pattern = VALUE_NULL;
+    unref(f->locale);
+    f->locale = VALUE_NULL;
+}
+/**
+ * 同じパターンで何度も呼ばれる場合に備えて、最近使ったものを保持する
+ */
+static RefDateTimeFormat *DateTimeFormat_get(Value pattern, Value locale)
+{
+    RefStr *rs = Value_vp(pattern);
+    const LocaleData *loc = (locale != VALUE_NULL ? Value_locale_data(locale) : fv->loc_neutral);
+    RefDateTimeFormat *f;
+    int i;
+
+    for (i = 0; i < DTFMT_CACHE_SIZE; i++) {
+        f = dtfmt_cache[i];
+        if (f != NULL && f->loc == loc) {
+            RefStr *rs2 = Value_vp(f->pattern);
+            if (rs2 == rs || (rs2->size == rs->size && memcmp(rs2->c, rs->c, rs->size) == 0)) {
+                return f;
+            }
+        }
+    }
+    f = DateTimeFormat_new(pattern, locale);
+    i = dtfmt_cache_next;
+    dtfmt_cache_next = (i + 1) % DTFMT_CACHE_SIZE;
+    if (dtfmt_cache[i] != NULL) {
+        unref(vp_Value(dtfmt_cache[i]));
+    }
+    dtfmt_cache[i] = f;
+
+    return f;
+}
+static RefDateTimeFormat *DateTimeFormat_new_cstr(const char *pattern)
+{
+    Value v = cstr_Value(fs->cls_str, pattern, -1);
+    RefDateTimeFormat *f = DateTimeFormat_new(v, VALUE_NULL);
+    unref(v);
+    return f;
+}
+/**
+ * StrならDateTimeFormatに変換する
+ */
+static RefDateTimeFormat *Value_to_datetimeformat(Value v, Value locale, int argn)
+{
+    RefNode *type = Value_type(v);
+
+    if (type == cls_datetimeformat) {
+        return Value_vp(v);
+    } else if (type == fs->cls_str) {
+        return DateTimeFormat_get(v, locale);
+    } else {
+        throw_error_select(THROW_ARGMENT_TYPE2__NODE_NODE_NODE_INT, fs->cls_str, cls_datetimeformat, type, argn + 1);
+        return NULL;
+    }
+}
+
+/**
+ * printfの%0*dと同じ
+ */
+static char *put_int(char *dst, int64_t val, int width)
+{
+    char c_buf[24];
+    char *p = c_buf + sizeof(c_buf);
+    uint64_t uval;
+    int n;
+
+    if (val < 0) {
+        *dst++ = '-';
+        uval = -(uint64_t)val;
+        width--;
+    } else {
+        uval = val;
+    }
+    do {
+        *--p = '0' + (uval % 10);
+        uval /= 10;
+    } while (uval > 0);
+
+    n = c_buf + sizeof(c_buf) - p;
+    for (; width > n; width--) {
+        *dst++ = '0';
+    }
+    memcpy(dst, p, n);
+    return dst + n;
+}
+static char *put_2digits(char *dst, int val)
+{
+    if (val >= 0 && val < 100) {
+        dst[0] = '0' + val / 10;
+        dst[1] = '0' + val % 10;
+        return dst + 2;
+    }
+    return put_int(dst, val, 2);
+}
+static char *put_str(char *dst, const char *s)
+{
+    if (s != NULL) {
+        int len = strlen(s);
+        memcpy(dst, s, len);
+        dst += len;
+    }
+    return dst;
+}
+static char *put_unknown(char *dst, int n)
+{
+    memset(dst, '?', n);
+    return dst + n;
+}
+
+/**
+ * dstにはDateTimeFormat_max_sizeバイト以上必要
+ * tm == NULLなら時刻の部分は'?'
+ * off == NULLならタイムゾーンの部分は'?'
+ */
+static char *DateTimeFormat_format_sub(char *dst, const RefDateTimeFormat *f, const Date *dt, const Time *tm, const TimeOffset *off)
+{
+    const LocaleData *loc = f->loc;
+    int i;
+
+    for (i = 0; i < f->n_op; i++) {
+        const DateTimeFormatOp *op = &f->op[i];
+
+        switch (op->type) {
+        case DTFMT_LITERAL:
+            memcpy(dst, f->lit.p + op->arg, op->size);
+            dst += op->size;
+            break;
+        case DTFMT_YEAR:
+        case DTFMT_ISOYEAR: {
+            int32_t year = (op->type == DTFMT_YEAR ? dt->year : dt->isoweek_year);
+            switch (op->width) {
             case 1:
-                sprintf(c_buf, "%d", year);
+                dst = put_int(dst, year, 0);
                 break;
             case 2: {
                 int32_t y = year % 100;
                 if (y < 0) {
                     y += 100;
                 }
-                sprintf(c_buf, "%02d", y);
+                dst = put_2digits(dst, y);
                 break;
             }
             default:
                 if (dt->year < 0) {
-                    sprintf(c_buf, "-%04d", -year);
+                    *dst++ = '-';
+                    dst = put_int(dst, -(int64_t)year, 4);
                 } else {
-                    sprintf(c_buf, "%04d", year);
+                    dst = put_int(dst, year, 4);
                 }
                 break;
             }
-            StrBuf_add(buf, c_buf, -1);
             break;
         }
-        case 'M':  // M MM MMM MMMM (月、数字と名前)
-            n = 0;
-            end = i + 4;
-            if (end > fmt_size) {
-                end = fmt_size;
-            }
-            do {
-                i++;
-                n++;
-            } while (i < end && fmt_p[i] == 'M');
-
-            switch (n) {
-            case 1:
-                sprintf(c_buf, "%d", dt->month);
-                StrBuf_add(buf, c_buf, -1);
-                break;
-            case 2:
-                sprintf(c_buf, "%02d", dt->month);
-                StrBuf_add(buf, c_buf, -1);
-                break;
-            case 3:
-                {
-                    const char *s = loc->month[dt->month - 1];
-                    if (s != NULL) {
-                        StrBuf_add(buf, s, -1);
-                    } else {
-                        sprintf(c_buf, "%02d", dt->month);
-                        StrBuf_add(buf, c_buf, -1);
-                    }
-                }
-                break;
-            case 4:
-                {
-                    const char *s = loc->month_w[dt->month - 1];
-                    if (s != NULL) {
-                        StrBuf_add(buf, s, -1);
-                    } else {
-                        sprintf(c_buf, "%02d", dt->month);
-                        StrBuf_add(buf, c_buf, -1);
-                    }
-                }
-                break;
-            }
+        case DTFMT_MONTH:
+            dst = (op->width == 2 ? put_2digits(dst, dt->month) : put_int(dst, dt->month, 0));
             break;
-        case 'w':  // ISO week (1 - 53)
-            i++;
-            if (i < fmt_size && fmt_p[i] == 'w') {
-                i++;
-                sprintf(c_buf, "%02d", dt->isoweek);
+        case DTFMT_MONTH_NAME: {
+            const char *s = (op->width == 3 ? loc->month : loc->month_w)[dt->month - 1];
+            if (s != NULL) {
+                dst = put_str(dst, s);
             } else {
-                sprintf(c_buf, "%d", dt->isoweek);
+                dst = put_2digits(dst, dt->month);
             }
-            StrBuf_add(buf, c_buf, -1);
             break;
-        case 'W':  // ISO week number (1:Mon - 7:Sun)
-            i++;
-            StrBuf_add_c(buf, '0' + dt->day_of_week);
+        }
+        case DTFMT_ISOWEEK:
+            dst = (op->width == 2 ? put_2digits(dst, dt->isoweek) : put_int(dst, dt->isoweek, 0));
             break;
-        case 'd':  // d dd ddd dddd (日、曜日)
-            n = 0;
-            end = i + 4;
-            if (end > fmt_size) {
-                end = fmt_size;
-            }
-            do {
-                i++;
-                n++;
-            } while (i < end && fmt_p[i] == 'd');
-
-            switch (n) {
-            case 1:
-                sprintf(c_buf, "%d", dt->day_of_month);
-                StrBuf_add(buf, c_buf, -1);
+        case DTFMT_WEEKDAY:
+            *dst++ = '0' + dt->day_of_week;
+            break;
+        case DTFMT_DAY:
+            dst = (op->width == 2 ? put_2digits(dst, dt->day_of_month) : put_int(dst, dt->day_of_month, 0));
+            break;
+        case DTFMT_WEEKDAY_NAME:
+            dst = put_str(dst, (op->width == 3 ? loc->week : loc->week_w)[dt->day_of_week - 1]);
+            break;
+        case DTFMT_HOUR:
+        case DTFMT_HOUR12:
+        case DTFMT_MINUTE:
+        case DTFMT_SECOND: {
+            int val;
+            if (tm == NULL) {
+                dst = put_unknown(dst, op->width);
                 break;
-            case 2:
-                sprintf(c_buf, "%02d", dt->day_of_month);
-                StrBuf_add(buf, c_buf, -1);
+            }
+            switch (op->type) {
+            case DTFMT_HOUR:
+                val = tm->hour;
                 break;
-            case 3: {
-                const char *s = loc->week[dt->day_of_week - 1];
-                if (s != NULL) {
-                    StrBuf_add(buf, s, -1);
+            case DTFMT_HOUR12:
+                val = tm->hour % 12;
+                if (val == 0) {
+                    val = 12;
                 }
                 break;
-            }
-            case 4: {
-                const char *s = loc->week_w[dt->day_of_week - 1];
-                if (s != NULL) {
-                    StrBuf_add(buf, s, -1);
-                }
+            case DTFMT_MINUTE:
+                val = tm->minute;
+                break;
+            default:
+                val = tm->second;
                 break;
             }
-            }
+            dst = (op->width == 2 ? put_2digits(dst, val) : put_int(dst, val, 0));
             break;
-        case 'H':  // H HH (24時間)
+        }
+        case DTFMT_AMPM:
             if (tm != NULL) {
-                i++;
-                if (i < fmt_size && fmt_p[i] == 'H') {
-                    i++;
-                    sprintf(c_buf, "%02d", tm->hour);
-                } else {
-                    sprintf(c_buf, "%d", tm->hour);
-                }
-                StrBuf_add(buf, c_buf, -1);
+                dst = put_str(dst, loc->am_pm[tm->hour < 12 ? 0 : 1]);
             } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+                *dst++ = '?';
             }
             break;
-        case 'h':   // h hh (12時間)
-            if (tm != NULL) {
-                int hour = tm->hour % 12;
-                if (hour == 0) {
-                    hour = 12;
-                }
-                i++;
-                if (i < fmt_size && fmt_p[i] == 'h') {
-                    i++;
-                    sprintf(c_buf, "%02d", hour);
-                } else {
-                    sprintf(c_buf, "%d", hour);
-                }
-                StrBuf_add(buf, c_buf, -1);
+        case DTFMT_MILLISEC:
+            if (tm == NULL) {
+                dst = put_unknown(dst, op->width);
+            } else if (op->width == 1) {
+                dst = put_int(dst, tm->millisec / 100, 0);
+            } else if (op->width == 2) {
+                dst = put_2digits(dst, tm->millisec / 10);
             } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+                dst = put_int(dst, tm->millisec, 3);
             }
             break;
-        case 'a':   // a AM,PM
-            if (tm != NULL) {
-                const char *s = loc->am_pm[tm->hour < 12 ? 0 : 1];
-                if (s != NULL) {
-                    StrBuf_add(buf, s, -1);
-                }
-                i++;
-            } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+        case DTFMT_TIME:
+            if (tm == NULL) {
+                dst = put_unknown(dst, op->width);
+                i += op->arg;
             }
             break;
-        case 'm':  // m mm 分
-            if (tm != NULL) {
-                i++;
-                if (i < fmt_size && fmt_p[i] == 'm') {
-                    i++;
-                    sprintf(c_buf, "%02d", tm->minute);
+        case DTFMT_OFFSET:
+            if (off != NULL) {
+                int offset = off->offset;
+                if (offset < 0) {
+                    offset = -offset;
+                    *dst++ = '-';
                 } else {
-                    sprintf(c_buf, "%d", tm->minute);
+                    *dst++ = '+';
                 }
-                StrBuf_add(buf, c_buf, -1);
+                dst = put_2digits(dst, offset / 3600000);
+                *dst++ = ':';
+                dst = put_2digits(dst, (offset / 60000) % 60);
             } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+                *dst++ = '?';
             }
             break;
-        case 's':  // s ss 秒
-            if (tm != NULL) {
-                i++;
-                if (i < fmt_size && fmt_p[i] == 's') {
-                    i++;
-                    sprintf(c_buf, "%02d", tm->second);
-                } else {
-                    sprintf(c_buf, "%d", tm->second);
-                }
-                StrBuf_add(buf, c_buf, -1);
+        case DTFMT_ZONE_ABBR:
+            if (off != NULL) {
+                dst = put_str(dst, off->abbr);
             } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+                *dst++ = '?';
             }
             break;
-        case 'S':  // ミリ秒
-            if (tm != NULL) {
-                n = 0;
-                end = i + 3;
-                if (end > fmt_size) {
-                    end = fmt_size;
-                }
-                do {
-                    i++;
-                    n++;
-                } while (i < end && fmt_p[i] == 'S');
-
-                switch (n) {
-                case 1:
-                    sprintf(c_buf, "%d", tm->millisec / 100);
-                    StrBuf_add(buf, c_buf, -1);
-                    break;
-                case 2:
-                    sprintf(c_buf, "%02d", tm->millisec / 10);
-                    StrBuf_add(buf, c_buf, -1);
-                    break;
-                case 3:
-                    sprintf(c_buf, "%03d", tm->millisec);
-                    StrBuf_add(buf, c_buf, -1);
-                    break;
+        }
+    }
+    return dst;
+}
+static int DateTimeFormat_max_size(const RefDateTimeFormat *f, const TimeOffset *off)
+{
+    if (f->n_abbr > 0 && off != NULL) {
+        return f->max_size + f->n_abbr * strlen(off->abbr);
+    }
+    return f->max_size;
+}
+static Value DateTimeFormat_format(const RefDateTimeFormat *f, const Date *dt, const Time *tm, const TimeOffset *off)
+{
+    char c_buf[128];
+    int max_size = DateTimeFormat_max_size(f, off);
+    char *buf = (max_size <= sizeof(c_buf) ? c_buf : malloc(max_size));
+    char *end = DateTimeFormat_format_sub(buf, f, dt, tm, off);
+    Value ret = cstr_Value(fs->cls_str, buf, end - buf);
+
+    if (buf != c_buf) {
+        free(buf);
+    }
+    return ret;
+}
+
+/**
+ * 数字を最大width桁読む (fixed: ちょうどwidth桁)
+ */
+static int parse_fmt_digits(int *ret, const char **pp, const char *end, int width, int fixed, int sign)
+{
+    const char *p = *pp;
+    int neg = FALSE;
+    int val = 0;
+    int n = 0;
+
+    if (sign && p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    while (n < width && p < end && isdigit_fox(*p)) {
+        val = val * 10 + (*p - '0');
+        p++;
+        n++;
+    }
+    if (n == 0 || (fixed && n < width)) {
+        return FALSE;
+    }
+    *ret = (neg ? -val : val);
+    *pp = p;
+    return TRUE;
+}
+/**
+ * 名前の一覧から最も長く一致するものを探す (ASCIIは大文字小文字を区別しない)
+ * 見つからなければ-1
+ */
+static int parse_fmt_names(const char **pp, const char *end, const char * const *names, int n)
+{
+    const char *p = *pp;
+    int found = -1;
+    int found_len = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const char *s = names[i];
+        int len;
+        int j;
+
+        if (s == NULL) {
+            continue;
+        }
+        len = strlen(s);
+        if (len <= found_len || len > end - p) {
+            continue;
+        }
+        for (j = 0; j < len; j++) {
+            if (tolower_fox(p[j]) != tolower_fox(s[j])) {
+                break;
+            }
+        }
+        if (j == len) {
+            found = i;
+            found_len = len;
+        }
+    }
+    if (found >= 0) {
+        *pp = p + found_len;
+    }
+    return found;
+}
+/**
+ * *offsetは時差(ミリ秒)、なければINT32_MIN
+ */
+static int DateTimeFormat_parse_sub(const RefDateTimeFormat *f, Date *dt, Time *tm, int *offset, const char *src_p, int src_size)
+{
+    const LocaleData *loc = f->loc;
+    const char *p = src_p;
+    const char *end = p + src_size;
+    int pm = -1;
+    int hour12 = FALSE;
+    int isoweek = FALSE;
+    int i;
+
+    DateTime_init(dt, tm);
+    dt->isoweek_year = 1;
+    dt->isoweek = 1;
+    dt->day_of_week = 1;
+    *offset = INT32_MIN;
+
+    for (i = 0; i < f->n_op; i++) {
+        const DateTimeFormatOp *op = &f->op[i];
+        int fixed = (op->width >= 2);
+
+        switch (op->type) {
+        case DTFMT_LITERAL:
+            if (end - p < op->size || memcmp(p, f->lit.p + op->arg, op->size) != 0) {
+                return FALSE;
+            }
+            p += op->size;
+            break;
+        case DTFMT_YEAR:
+        case DTFMT_ISOYEAR: {
+            int year;
+            // 数字が続く場合は桁数を固定
+            int adjacent = (i + 1 < f->n_op && f->op[i + 1].type != DTFMT_LITERAL);
+            if (op->width == 2) {
+                if (!parse_fmt_digits(&year, &p, end, 2, TRUE, FALSE)) {
+                    return FALSE;
                 }
+                // POSIXのstrptimeと同じ (69-99: 19xx, 00-68: 20xx)
+                year += (year >= 69 ? 1900 : 2000);
+            } else if (!parse_fmt_digits(&year, &p, end, adjacent ? op->width : 8, adjacent, TRUE)) {
+                return FALSE;
+            }
+            if (op->type == DTFMT_YEAR) {
+                dt->year = year;
             } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+                dt->isoweek_year = year;
+                isoweek = TRUE;
             }
             break;
-        case 'X':  // 既定の日付
-            n = 0;
-            end = i + 4;
-            if (end > fmt_size) {
-                end = fmt_size;
+        }
+        case DTFMT_MONTH_NAME: {
+            int m = parse_fmt_names(&p, end, op->width == 3 ? loc->month : loc->month_w, 12);
+            if (m < 0) {
+                m = parse_fmt_names(&p, end, op->width == 3 ? loc->month_w : loc->month, 12);
+            }
+            if (m >= 0) {
+                dt->month = m + 1;
+                break;
+            }
+            fixed = TRUE;
+            // 名前がなければ数字
+        }
+        // fallthrough
+        case DTFMT_MONTH:
+            if (!parse_fmt_digits(&dt->month, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
+            }
+            if (dt->month < 1 || dt->month > 12) {
+                return FALSE;
             }
-            do {
-                i++;
-                n++;
-            } while (i < end && fmt_p[i] == 'X');
-
-            build_datetime_string(buf, loc->date[n - 1], -1, dt, tm, off, loc);
             break;
-        case 'x':  // 既定の時刻
-            if (tm != NULL) {
-                n = 0;
-                end = i + 4;
-                if (end > fmt_size) {
-                    end = fmt_size;
-                }
-                do {
-                    i++;
-                    n++;
-                } while (i < end && fmt_p[i] == 'x');
-
-                build_datetime_string(buf, loc->time[n - 1], -1, dt, tm, off, loc);
-            } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+        case DTFMT_ISOWEEK:
+            if (!parse_fmt_digits(&dt->isoweek, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
             }
+            if (dt->isoweek < 1 || dt->isoweek > 53) {
+                return FALSE;
+            }
+            isoweek = TRUE;
             break;
-        case 'z':   // 時差(+00:00)
-            if (off != NULL) {
-                int offset = off->offset;
-                int sign = '+';
-                if (offset < 0) {
-                    offset = -offset;
-                    sign = '-';
-                }
-                sprintf(c_buf, "%c%02d:%02d", sign, offset / 3600000, (offset / 60000) % 60);
-                StrBuf_add(buf, c_buf, -1);
-                i++;
-            } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+        case DTFMT_WEEKDAY:
+            if (!parse_fmt_digits(&dt->day_of_week, &p, end, 1, TRUE, FALSE)) {
+                return FALSE;
+            }
+            if (dt->day_of_week < 1 || dt->day_of_week > 7) {
+                return FALSE;
             }
             break;
-        case 'Z':  // タイムゾーン
-            if (off != NULL) {
-                StrBuf_add(buf, off->abbr, -1);
-                i++;
-            } else {
-                StrBuf_add_c(buf, '?');
-                i++;
+        case DTFMT_DAY:
+            if (!parse_fmt_digits(&dt->day_of_month, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
+            }
+            if (dt->day_of_month < 1 || dt->day_of_month > 31) {
+                return FALSE;
             }
             break;
-        case '\'': // '任意の文字列'
-            i++;
-            if (i < fmt_size) {
-                if (fmt_p[i] == '\'') {
-                    StrBuf_add_c(buf, '\'');
-                    i++;
-                } else {
-                    StrBuf_add_c(buf, fmt_p[i]);
-                    i++;
-                    while (i < fmt_size) {
-                        char c = fmt_p[i];
-                        if (c == '\'') {
-                            i++;
-                            if (i < fmt_size) {
-                                if (fmt_p[i] == '\'') {
-                                    StrBuf_add_c(buf, '\'');
-                                } else {
-                                    break;
-                                }
-                            } else {
-                                break;
-                            }
-                        } else {
-                            StrBuf_add_c(buf, c);
-                        }
-                        i++;
-                    }
+        case DTFMT_WEEKDAY_NAME:
+            // 曜日は日付から決まるので読み飛ばす
+            if (parse_fmt_names(&p, end, op->width == 3 ? loc->week : loc->week_w, 7) < 0 &&
+                parse_fmt_names(&p, end, op->width == 3 ? loc->week_w : loc->week, 7) < 0) {
+                return FALSE;
+            }
+            break;
+        case DTFMT_HOUR:
+        case DTFMT_HOUR12:
+            if (!parse_fmt_digits(&tm->hour, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
+            }
+            if (op->type == DTFMT_HOUR12) {
+                if (tm->hour < 1 || tm->hour > 12) {
+                    return FALSE;
                 }
+                hour12 = TRUE;
+            } else if (tm->hour > 24) {
+                return FALSE;
             }
             break;
-        default:
-            if (isalpha_fox(fmt_p[i])) {
-                StrBuf_add_c(buf, '?');
+        case DTFMT_AMPM: {
+            int n = parse_fmt_names(&p, end, loc->am_pm, 2);
+            if (n < 0) {
+                return FALSE;
+            }
+            pm = n;
+            break;
+        }
+        case DTFMT_MINUTE:
+            if (!parse_fmt_digits(&tm->minute, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
+            }
+            if (tm->minute > 59) {
+                return FALSE;
+            }
+            break;
+        case DTFMT_SECOND:
+            if (!parse_fmt_digits(&tm->second, &p, end, 2, fixed, FALSE)) {
+                return FALSE;
+            }
+            if (tm->second > 60) {
+                return FALSE;
+            }
+            break;
+        case DTFMT_MILLISEC: {
+            int val;
+            if (!parse_fmt_digits(&val, &p, end, op->width, TRUE, FALSE)) {
+                return FALSE;
+            }
+            tm->millisec = (op->width == 1 ? val * 100 : op->width == 2 ? val * 10 : val);
+            break;
+        }
+        case DTFMT_TIME:
+            break;
+        case DTFMT_OFFSET:
+            if (p < end && (*p == 'Z' || *p == 'z')) {
+                p++;
+                *offset = 0;
+            } else if (p < end && (*p == '+' || *p == '-')) {
+                int neg = (*p == '-');
+                int h, m;
+                p++;
+                if (!parse_fmt_digits(&h, &p, end, 2, TRUE, FALSE)) {
+                    return FALSE;
+                }
+                if (p < end && *p == ':') {
+                    p++;
+                }
+                if (!parse_fmt_digits(&m, &p, end, 2, TRUE, FALSE)) {
+                    return FALSE;
+                }
+                *offset = (h * 60 + m) * 60000;
+                if (neg) {
+                    *offset = -*offset;
+                }
             } else {
-                StrBuf_add_c(buf, fmt_p[i]);
+                return FALSE;
+            }
+            break;
+        case DTFMT_ZONE_ABBR:
+            // 略称からは時差を決められないので読み飛ばす
+            if (p >= end || !isalpha_fox(*p)) {
+                return FALSE;
+            }
+            while (p < end && isalpha_fox(*p)) {
+                p++;
             }
-            i++;
             break;
         }
     }
+    if (p != end) {
+        return FALSE;
+    }
+    if (hour12) {
+        tm->hour %= 12;
+    }
+    if (pm == 1) {
+        tm->hour += 12;
+    }
+    if (isoweek) {
+        dt->year = INT32_MIN;
+    }
+    return TRUE;
+}
+/**
+ * 解析してdtを設定する
+ * 時差が含まれていなければ、dt->tzの時刻とみなす
+ */
+static int DateTimeFormat_parse(const RefDateTimeFormat *f, RefDateTime *dt, RefStr *src)
+{
+    int offset;
+
+    if (!DateTimeFormat_parse_sub(f, &dt->d, &dt->t, &offset, src->c, src->size)) {
+        throw_errorf(fs->mod_lang, "ParseError", "Invalid time format %Q", Str_new(src->c, src->size));
+        return FALSE;
+    }
+    if (offset != INT32_MIN) {
+        dt->ts = DateTime_to_Timestamp(&dt->d, &dt->t) - offset;
+        dt->off = TimeZone_offset_utc(dt->tz, dt->ts);
+        Timestamp_to_DateTime(&dt->d, &dt->t, dt->ts + dt->off->offset);
+    } else {
+        adjust_timezone(dt);
+    }
+    return TRUE;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1317,20 +1821,50 @@ static int timestamp_add(Value *vret, Value *v, RefNode *node)
     }
     return TRUE;
 }
-static int timestamp_iso8601(Value *vret, Value *v, RefNode *node)
+/**
+ * sep: TRUE  "%04d-%02d-%02dT%02d:%02d:%02d"
+ *      FALSE "%04d%02d%02dT%02d%02d%02d"
+ */
+static char *put_iso8601(char *dst, int64_t ts, int sep, int millisec)
 {
-    RefInt64 *rt = Value_vp(*v);
     Date dt;
     Time tm;
-    char c_buf[48];
-    const char *format = FUNC_VP(node);
 
-    Timestamp_to_DateTime(&dt, &tm, rt->u.i);
-    sprintf(c_buf, format,
-            dt.year, dt.month, dt.day_of_month,
-            tm.hour, tm.minute, tm.second);
+    Timestamp_to_DateTime(&dt, &tm, ts);
+    dst = put_int(dst, dt.year, 4);
+    if (sep) {
+        *dst++ = '-';
+    }
+    dst = put_2digits(dst, dt.month);
+    if (sep) {
+        *dst++ = '-';
+    }
+    dst = put_2digits(dst, dt.day_of_month);
+    *dst++ = 'T';
+    dst = put_2digits(dst, tm.hour);
+    if (sep) {
+        *dst++ = ':';
+    }
+    dst = put_2digits(dst, tm.minute);
+    if (sep) {
+        *dst++ = ':';
+    }
+    dst = put_2digits(dst, tm.second);
+    if (millisec) {
+        *dst++ = '.';
+        dst = put_int(dst, tm.millisec, 3);
+    }
+    *dst++ = 'Z';
+
+    return dst;
+}
+static int timestamp_iso8601(Value *vret, Value *v, RefNode *node)
+{
+    RefInt64 *rt = Value_vp(*v);
+    char c_buf[48];
+    char *end = put_iso8601(c_buf, rt->u.i, FUNC_INT(node), FALSE);
 
-    *vret = cstr_Value(fs->cls_str, c_buf, -1);
+    *vret = cstr_Value(fs->cls_str, c_buf, end - c_buf);
 
     return TRUE;
 }
@@ -1340,13 +1874,26 @@ static int timestamp_rfc2822(Value *vret, Value *v, RefNode *node)
     Date dt;
     Time tm;
     char c_buf[48];
+    char *p = c_buf;
 
     Timestamp_to_DateTime(&dt, &tm, rt->u.i);
-    sprintf(c_buf, "%s, %02d %s %d %02d:%02d:%02d GMT",
-            time_week_str[dt.day_of_week - 1], dt.day_of_month, time_month_str[dt.month - 1], dt.year,
-            tm.hour, tm.minute, tm.second);
-
-    *vret = cstr_Value(fs->cls_str, c_buf, -1);
+    p = put_str(p, time_week_str[dt.day_of_week - 1]);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_2digits(p, dt.day_of_month);
+    *p++ = ' ';
+    p = put_str(p, time_month_str[dt.month - 1]);
+    *p++ = ' ';
+    p = put_int(p, dt.year, 0);
+    *p++ = ' ';
+    p = put_2digits(p, tm.hour);
+    *p++ = ':';
+    p = put_2digits(p, tm.minute);
+    *p++ = ':';
+    p = put_2digits(p, tm.second);
+    p = put_str(p, " GMT");
+
+    *vret = cstr_Value(fs->cls_str, c_buf, p - c_buf);
 
     return TRUE;
 }
@@ -1471,7 +2018,9 @@ static int timestamp_tostr(Value *vret, Value *v, RefNode *node)
     if (fg->stk_top > v + 1) {
         RefStr *fmt = Value_vp(v[1]);
         if (str_eqi(fmt->c, fmt->size, "iso8601", -1)) {
-            return timestamp_iso8601(vret, v, node);
+            char c_buf[48];
+            char *end = put_iso8601(c_buf, VALUE_INT64(*v), FALSE, FALSE);
+            *vret = cstr_Value(fs->cls_str, c_buf, end - c_buf);
         } else if (str_eqi(fmt->c, fmt->size, "rfc2822", -1)) {
             return timestamp_rfc2822(vret, v, node);
         } else {
@@ -1479,17 +2028,9 @@ static int timestamp_tostr(Value *vret, Value *v, RefNode *node)
             return FALSE;
         }
     } else {
-        RefInt64 *rt = Value_vp(*v);
-        Date dt;
-        Time tm;
         char c_buf[48];
-
-        Timestamp_to_DateTime(&dt, &tm, rt->u.i);
-        sprintf(c_buf, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
-                dt.year, dt.month, dt.day_of_month,
-                tm.hour, tm.minute, tm.second, tm.millisec);
-
-        *vret = cstr_Value(fs->cls_str, c_buf, -1);
+        char *end = put_iso8601(c_buf, VALUE_INT64(*v), TRUE, TRUE);
+        *vret = cstr_Value(fs->cls_str, c_buf, end - c_buf);
     }
     return TRUE;
 }
@@ -2140,9 +2681,31 @@ static int datetime_now(Value *vret, Value *v, RefNode *node)
 
     return TRUE;
 }
-// TODO
+/**
+ * DateTime.parse_format(format, src, [timezone])
+ */
 static int datetime_parse_format(Value *vret, Value *v, RefNode *node)
 {
+    RefDateTimeFormat *f = Value_to_datetimeformat(v[1], VALUE_NULL, 0);
+    RefDateTime *dt;
+
+    if (f == NULL) {
+        return FALSE;
+    }
+    dt = buf_new(fs->cls_datetime, sizeof(RefDateTime));
+    *vret = vp_Value(dt);
+
+    if (fg->stk_top > v + 3) {
+        dt->tz = Value_to_tz(v[3], 2);
+        if (dt->tz == NULL) {
+            return FALSE;
+        }
+    } else {
+        dt->tz = get_local_tz();
+    }
+    if (!DateTimeFormat_parse(f, dt, Value_vp(v[2]))) {
+        return FALSE;
+    }
     return TRUE;
 }
 static int datetime_marshal_read(Value *vret, Value *v, RefNode *node)
@@ -2327,25 +2890,20 @@ static int datetime_date(Value *vret, Value *v, RefNode *node)
 static int datetime_tostr(Value *vret, Value *v, RefNode *node)
 {
     RefDateTime *dt = Value_vp(*v);
-    const LocaleData *loc = fv->loc_neutral;
-    const char *fmt_p;
-    int fmt_size;
-    StrBuf buf;
+    RefDateTimeFormat *f;
 
     if (fg->stk_top > v + 1) {
-        RefStr *rs = Value_vp(v[1]);
-        fmt_p = rs->c;
-        fmt_size = rs->size;
-        if (fg->stk_top > v + 2) {
-            loc = Value_locale_data(v[2]);
+        f = Value_to_datetimeformat(v[1], fg->stk_top > v + 2 ? v[2] : VALUE_NULL, 0);
+        if (f == NULL) {
+            return FALSE;
         }
     } else {
-        fmt_p = "yyyy-MM-dd'T'HH:mm:ss.SSSz";
-        fmt_size = -1;
+        if (dtfmt_datetime_default == NULL) {
+            dtfmt_datetime_default = DateTimeFormat_new_cstr("yyyy-MM-dd'T'HH:mm:ss.SSSz");
+        }
+        f = dtfmt_datetime_default;
     }
-    StrBuf_init_refstr(&buf, 0);
-    build_datetime_string(&buf, fmt_p, fmt_size, &dt->d, &dt->t, dt->off, loc);
-    *vret = StrBuf_str_Value(&buf, fs->cls_str);
+    *vret = DateTimeFormat_format(f, &dt->d, &dt->t, dt->off);
 
     return TRUE;
 }
@@ -2478,25 +3036,20 @@ static int date_parse(Value *vret, Value *v, RefNode *node)
 static int date_tostr(Value *vret, Value *v, RefNode *node)
 {
     RefDateTime *dt = Value_vp(*v);
-    const LocaleData *loc = fv->loc_neutral;
-    const char *fmt_p;
-    int fmt_size;
-    StrBuf buf;
+    RefDateTimeFormat *f;
 
     if (fg->stk_top > v + 1) {
-        RefStr *rs = Value_vp(v[1]);
-        fmt_p = rs->c;
-        fmt_size = rs->size;
-        if (fg->stk_top > v + 2) {
-            loc = Value_locale_data(v[2]);
+        f = Value_to_datetimeformat(v[1], fg->stk_top > v + 2 ? v[2] : VALUE_NULL, 0);
+        if (f == NULL) {
+            return FALSE;
         }
     } else {
-        fmt_p = "yyyy-MM-dd";
-        fmt_size = -1;
+        if (dtfmt_date_default == NULL) {
+            dtfmt_date_default = DateTimeFormat_new_cstr("yyyy-MM-dd");
+        }
+        f = dtfmt_date_default;
     }
-    StrBuf_init_refstr(&buf, 0);
-    build_datetime_string(&buf, fmt_p, fmt_size, &dt->d, NULL, NULL, loc);
-    *vret = StrBuf_str_Value(&buf, fs->cls_str);
+    *vret = DateTimeFormat_format(f, &dt->d, NULL, NULL);
 
     return TRUE;
 }
@@ -2554,6 +3107,83 @@ static int date_incdec(Value *vret, Value *v, RefNode *node)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static int datetimeformat_new(Value *vret, Value *v, RefNode *node)
+{
+    Value locale = (fg->stk_top > v + 2 ? v[2] : VALUE_NULL);
+    RefDateTimeFormat *f = DateTimeFormat_new(v[1], locale);
+
+    *vret = vp_Value(f);
+    return TRUE;
+}
+static int datetimeformat_dispose(Value *vret, Value *v, RefNode *node)
+{
+    RefDateTimeFormat *f = Value_vp(*v);
+    DateTimeFormat_close(f);
+    return TRUE;
+}
+static int datetimeformat_pattern(Value *vret, Value *v, RefNode *node)
+{
+    RefDateTimeFormat *f = Value_vp(*v);
+    *vret = Value_cp(f->pattern);
+    return TRUE;
+}
+static int datetimeformat_tostr(Value *vret, Value *v, RefNode *node)
+{
+    RefDateTimeFormat *f = Value_vp(*v);
+    *vret = printf_Value("DateTimeFormat(%r)", Value_vp(f->pattern));
+    return TRUE;
+}
+/**
+ * TimeStampはUTCとして書式化する
+ */
+static int datetimeformat_format(Value *vret, Value *v, RefNode *node)
+{
+    RefDateTimeFormat *f = Value_vp(*v);
+    RefNode *type = Value_type(v[1]);
+
+    if (type == fs->cls_datetime) {
+        RefDateTime *dt = Value_vp(v[1]);
+        *vret = DateTimeFormat_format(f, &dt->d, &dt->t, dt->off);
+    } else if (type == cls_date) {
+        RefDateTime *dt = Value_vp(v[1]);
+        *vret = DateTimeFormat_format(f, &dt->d, NULL, NULL);
+    } else if (type == fs->cls_timestamp) {
+        int64_t ts = VALUE_INT64(v[1]);
+        Date dt;
+        Time tm;
+        Timestamp_to_DateTime(&dt, &tm, ts);
+        *vret = DateTimeFormat_format(f, &dt, &tm, TimeZone_offset_utc(fs->tz_utc, ts));
+    } else {
+        throw_errorf(fs->mod_lang, "TypeError", "DateTime, Date or TimeStamp required but %n (argument #1)", type);
+        return FALSE;
+    }
+    return TRUE;
+}
+/**
+ * parse(src, [timezone])
+ */
+static int datetimeformat_parse(Value *vret, Value *v, RefNode *node)
+{
+    RefDateTimeFormat *f = Value_vp(*v);
+    RefDateTime *dt = buf_new(fs->cls_datetime, sizeof(RefDateTime));
+    *vret = vp_Value(dt);
+
+    if (fg->stk_top > v + 2) {
+        dt->tz = Value_to_tz(v[2], 1);
+        if (dt->tz == NULL) {
+            return FALSE;
+        }
+    } else {
+        dt->tz = get_local_tz();
+    }
+    if (!DateTimeFormat_parse(f, dt, Value_vp(v[1]))) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static int time_sleep(Value *vret, Value *v, RefNode *node)
 {
     int64_t ms;
@@ -2622,9 +3252,9 @@ static void define_time_class(RefNode *m)
     n = define_identifier_p(m, cls, fs->symbol_stock[T_SUB], NODE_FUNC_N, 0);
     define_native_func_a(n, timestamp_add, 1, 1, (void*)TRUE, NULL);
     n = define_identifier(m, cls, "iso8601", NODE_FUNC_N, NODEOPT_PROPERTY);
-    define_native_func_a(n, timestamp_iso8601, 0, 0, (void*)"%04d%02d%02dT%02d%02d%02dZ");
+    define_native_func_a(n, timestamp_iso8601, 0, 0, (void*)FALSE);
     n = define_identifier(m, cls, "isodate", NODE_FUNC_N, NODEOPT_PROPERTY);
-    define_native_func_a(n, timestamp_iso8601, 0, 0, (void*)"%04d-%02d-%02dT%02d:%02d:%02dZ");
+    define_native_func_a(n, timestamp_iso8601, 0, 0, (void*)TRUE);
     n = define_identifier(m, cls, "httpdate", NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, timestamp_rfc2822, 0, 0, NULL);
     n = define_identifier(m, cls, "round", NODE_FUNC_N, 0);
@@ -2717,12 +3347,12 @@ static void define_time_class(RefNode *m)
     n = define_identifier(m, cls, "parse", NODE_NEW_N, 0);
     define_native_func_a(n, datetime_parse, 1, 2, NULL, NULL, fs->cls_str);
     n = define_identifier(m, cls, "parse_format", NODE_NEW_N, 0);
-    define_native_func_a(n, datetime_parse_format, 2, 3, NULL, fs->cls_str, fs->cls_str, NULL);
+    define_native_func_a(n, datetime_parse_format, 2, 3, NULL, NULL, fs->cls_str, NULL);
     n = define_identifier_p(m, cls, fs->str_marshal_read, NODE_NEW_N, 0);
     define_native_func_a(n, datetime_marshal_read, 1, 1, fs->cls_datetime, fs->cls_marshaldumper);
 
     n = define_identifier_p(m, cls, fs->str_tostr, NODE_FUNC_N, 0);
-    define_native_func_a(n, datetime_tostr, 0, 2, NULL, fs->cls_str, fs->cls_locale);
+    define_native_func_a(n, datetime_tostr, 0, 2, NULL, NULL, fs->cls_locale);
     n = define_identifier_p(m, cls, fs->str_hash, NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, datetime_hash, 0, 0, NULL);
     n = define_identifier_p(m, cls, fs->str_marshal_write, NODE_FUNC_N, 0);
@@ -2787,7 +3417,7 @@ static void define_time_class(RefNode *m)
     define_native_func_a(n, datetime_marshal_read, 1, 1, cls_date, fs->cls_marshaldumper);
 
     n = define_identifier_p(m, cls, fs->str_tostr, NODE_FUNC_N, 0);
-    define_native_func_a(n, date_tostr, 0, 2, NULL, fs->cls_str, fs->cls_locale);
+    define_native_func_a(n, date_tostr, 0, 2, NULL, NULL, fs->cls_locale);
     n = define_identifier_p(m, cls, fs->str_hash, NODE_FUNC_N, NODEOPT_PROPERTY);
     define_native_func_a(n, datetime_hash, 0, 0, NULL);
     n = define_identifier_p(m, cls, fs->str_marshal_write, NODE_FUNC_N, 0);
@@ -2822,6 +3452,25 @@ static void define_time_class(RefNode *m)
     extends_method(cls, fs->cls_obj);
 
 
+    // DateTimeFormat
+    // 解析済みの書式
+    cls = cls_datetimeformat;
+    n = define_identifier_p(m, cls, fs->str_new, NODE_NEW_N, 0);
+    define_native_func_a(n, datetimeformat_new, 1, 2, NULL, fs->cls_str, fs->cls_locale);
+    n = define_identifier_p(m, cls, fs->str_dtor, NODE_FUNC_N, 0);
+    define_native_func_a(n, datetimeformat_dispose, 0, 0, NULL);
+
+    n = define_identifier_p(m, cls, fs->str_tostr, NODE_FUNC_N, 0);
+    define_native_func_a(n, datetimeformat_tostr, 0, 2, NULL, fs->cls_str, fs->cls_locale);
+    n = define_identifier(m, cls, "pattern", NODE_FUNC_N, NODEOPT_PROPERTY);
+    define_native_func_a(n, datetimeformat_pattern, 0, 0, NULL);
+    n = define_identifier(m, cls, "format", NODE_FUNC_N, 0);
+    define_native_func_a(n, datetimeformat_format, 1, 1, NULL, NULL);
+    n = define_identifier(m, cls, "parse", NODE_FUNC_N, 0);
+    define_native_func_a(n, datetimeformat_parse, 1, 2, NULL, fs->cls_str, NULL);
+    extends_method(cls, fs->cls_obj);
+
+
     cls = define_identifier(m, m, "TimeRangeError", NODE_CLASS, 0);
     define_error_class(cls, fs->cls_error, m);
 }
@@ -2835,6 +3484,7 @@ RefNode *init_time_module_stubs()
     fs->cls_timezone = define_identifier(m, m, "TimeZone", NODE_CLASS, 0);
     cls_timedelta = define_identifier(m, m, "TimeDelta", NODE_CLASS, 0);
     cls_date = define_identifier(m, m, "Date", NODE_CLASS, 0);
+    cls_datetimeformat = define_identifier(m, m, "DateTimeFormat", NODE_CLASS, 0);
 
     fs->tz_utc = load_timezone("Etc/UTC", -1);
 
@@ -2991,6 +2991,63 @@ static int parse_body_ep(RefNode *node, Tok *tk, Block *bk)
     OpBuf_close(&buf);
     return ret;
 }
+/**
+ * 関数本体をコンパイルせずに、対応する}まで読み飛ばす
+ * 最初に呼び出されたときにcompile_lazy_functionでコンパイルする
+ */
+static int skip_body_lazy(RefNode *node, Tok *tk, RefNode *construct, Block *bk)
+{
+    LazyFunc *lf;
+    const char *begin = tk->p - 1;  // '{'
+    int line = tk->head_line;
+    int nest = 1;
+    int i;
+
+    if (tk->lazy_src == NULL) {
+        // 以降のソースは字句解析で書き換えられるので、その前に複製する
+        tk->lazy_src = str_dup_p(begin, -1, &fg->st_mem);
+        tk->lazy_base = begin - tk->top;
+    }
+    while (nest > 0) {
+        Tok_next(tk);
+        switch (tk->v.type) {
+        case T_LC:
+            nest++;
+            break;
+        case T_RC:
+            nest--;
+            break;
+        case T_ERR:
+            return FALSE;
+        case T_EOF:
+            unexpected_token_error(tk);
+            return FALSE;
+        }
+    }
+
+    lf = Mem_get(&fg->st_mem, sizeof(LazyFunc));
+    lf->src = tk->lazy_src + (begin - tk->top - tk->lazy_base);
+    lf->size = tk->p - begin;
+    lf->line = line;
+    lf->n_args = bk->offset - 1;
+    lf->args = Mem_get(&fg->st_mem, sizeof(RefNode*) * (lf->n_args > 0 ? lf->n_args : 1));
+    for (i = 0; i < bk->h.entry_num; i++) {
+        HashEntry *he;
+        for (he = bk->h.entry[i]; he != NULL; he = he->next) {
+            RefNode *var = he->p;
+            lf->args[var->u.v.offset - 1] = var;
+        }
+    }
+    lf->construct = construct;
+    lf->genr = tk->parse_genr;
+    lf->m_var = tk->lazy_var;
+
+    node->u.f.u.op = NULL;
+    node->u.f.vp = lf;
+    Tok_next(tk);
+
+    return TRUE;
+}
 static int parse_function(RefNode *node, Tok *tk, RefNode *construct)
 {
     Block *bk = Block_new(NULL, node);
@@ -3030,6 +3087,9 @@ static int parse_function(RefNode *node, Tok *tk, RefNode *construct)
         Tok_skip(tk);
         if (tk->v.type == T_LC) {
             // def fn(x){ return x*2 }
+            if (tk->lazy && tk->prev_n == tk->prev_top) {
+                return skip_body_lazy(node, tk, construct, bk);
+            }
             if (!parse_body(node, tk, construct, bk)) {
                 return FALSE;
             }
@@ -3189,6 +3249,7 @@ static int parse_class_statement(RefNode *module, Tok *tk, int abst)
 
     tk->parse_cls = klass;
     Hash_init(&tk->m_var, &fv->cmp_mem, 16);
+    tk->lazy_var = NULL;
 
     for (;;) {
         switch (tk->v.type) {
@@ -3307,7 +3368,8 @@ static int parse_class_statement(RefNode *module, Tok *tk, int abst)
                 throw_already_defined_name_error(tk, he->p);
                 return FALSE;
             }
-            var = Mem_get(&fv->cmp_mem, sizeof(RefNode));
+            // 遅延コンパイルでは関数本体のコンパイル時にも参照する
+            var = Mem_get(tk->lazy ? &fg->st_mem : &fv->cmp_mem, sizeof(RefNode));
             var->uid = NULL;
             var->type = NODE_VAR;
             var->opt = 0;
@@ -3318,6 +3380,9 @@ static int parse_class_statement(RefNode *module, Tok *tk, int abst)
             var->u.v.offset = n_memb;
             n_memb++;
             he->p = var;
+            if (tk->lazy) {
+                PtrList_add_p(&tk->lazy_var, var, &fg->st_mem);
+            }
             Tok_next(tk);
 
             break;
@@ -3492,6 +3557,66 @@ static int load_max_alloc(void)
     }
     return FALSE;
 }
+/*
+ * スタックの大きさ(Valueの個数)
+ * init_fox_stackより前に読み込むこと
+ */
+static int load_max_stack(void)
+{
+    const char *p = Hash_get(&fs->envs, "FOX_MAX_STACK", -1);
+
+    if (p != NULL) {
+        int max_stack = parse_memory_size(Str_new(p, -1));
+        if (max_stack > 0) {
+            if (max_stack < 1024) {
+                fs->max_stack = 1024;
+            } else {
+                fs->max_stack = max_stack;
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/*
+ * fox関数の呼び出しの深さの上限
+ */
+static int load_max_call(void)
+{
+    const char *p = Hash_get(&fs->envs, "FOX_MAX_CALL", -1);
+
+    if (p != NULL) {
+        int max_call = parse_memory_size(Str_new(p, -1));
+        if (max_call > 0) {
+            if (max_call < 256) {
+                fv->max_callfunc = 256;
+            } else {
+                fv->max_callfunc = max_call;
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/*
+ * FOX_COMPILE=lazy : 関数本体を最初の呼び出し時にコンパイルする
+ * FOX_COMPILE=strict : 読み込み時にすべてコンパイルする (デフォルト)
+ */
+static int load_compile_mode(void)
+{
+    const char *p = Hash_get(&fs->envs, "FOX_COMPILE", -1);
+
+    if (p != NULL) {
+        if (strcmp(p, "lazy") == 0) {
+            fv->lazy_compile = TRUE;
+            return TRUE;
+        } else if (strcmp(p, "strict") == 0) {
+            fv->lazy_compile = FALSE;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
 static int load_error_dst(void)
 {
     const char *edst = Hash_get(&fs->envs, "FOX_ERROR", -1);
@@ -3512,9 +3637,18 @@ void load_env_settings(int *defs)
     if (load_max_alloc() && defs != NULL) {
         defs[ENVSET_MAX_ALLOC] = TRUE;
     }
+    if (load_max_stack() && defs != NULL) {
+        defs[ENVSET_MAX_STACK] = TRUE;
+    }
+    if (load_max_call() && defs != NULL) {
+        defs[ENVSET_MAX_CALL] = TRUE;
+    }
     if (load_error_dst() && defs != NULL) {
         defs[ENVSET_ERROR] = TRUE;
     }
+    if (load_compile_mode() && defs != NULL) {
+        defs[ENVSET_COMPILE] = TRUE;
+    }
 }
 static void add_default_path(PtrList **proot, const char *key)
 {
@@ -3575,6 +3709,19 @@ static int parse_pragma(RefNode *module, Tok *tk, Str line)
             }
         }
         break;
+    case 'l':
+        if (str_eq(key.p, key.size, "lazy", -1)) {
+            // このモジュールの関数本体を遅延コンパイルする
+            tk->lazy = TRUE;
+            return TRUE;
+        }
+        break;
+    case 's':
+        if (str_eq(key.p, key.size, "strict", -1)) {
+            tk->lazy = FALSE;
+            return TRUE;
+        }
+        break;
     default:
         break;
     }
@@ -3591,11 +3738,13 @@ static int parse_source(RefNode *module, Tok *tk, RefNode *top, Block *bk)
 {
     OpBuf buf;
     int is_cont;
+    int is_static = FALSE;
 
     if (top == NULL) {
         top = init_toplevel(module);
         bk = Block_new(NULL, top);
         is_cont = FALSE;
+        is_static = TRUE;
     } else if (bk == NULL) {
         bk = Block_new(NULL, top);
         is_cont = FALSE;
@@ -3607,6 +3756,7 @@ static int parse_source(RefNode *module, Tok *tk, RefNode *top, Block *bk)
 
     // プラグマ
     tk->mode_pragma = FALSE;
+    tk->lazy = -1;
     for (;;) {
         switch (tk->v.type) {
         case TL_PRAGMA: {
@@ -3632,6 +3782,11 @@ BREAK1:
         add_default_path(&fs->resource_path, "res");
         set_neutral_locale();
     }
+    if (!is_static || fv->cmp_dynamic) {
+        tk->lazy = FALSE;
+    } else if (tk->lazy == -1) {
+        tk->lazy = fv->lazy_compile;
+    }
 
     // import宣言
     for (;;) {
@@ -4136,3 +4291,91 @@ RefNode *get_module_by_file(const char *path_p)
 
     return module;
 }
+
+/**
+ * コンパイルに失敗した場合に、未解決の識別子を破棄する
+ */
+static void discard_unresolved(void)
+{
+    int i;
+
+    for (i = 0; i < fg->mod_root.entry_num; i++) {
+        HashEntry *entry;
+
+        for (entry = fg->mod_root.entry[i]; entry != NULL; entry = entry->next) {
+            RefNode *m = entry->p;
+            int j;
+
+            m->u.m.unresolved.entry_num = 0;
+            for (j = 0; j < m->u.m.h.entry_num; j++) {
+                HashEntry *entry2;
+                for (entry2 = m->u.m.h.entry[j]; entry2 != NULL; entry2 = entry2->next) {
+                    RefNode *node = entry2->p;
+                    node->uid = NULL;
+                }
+            }
+        }
+    }
+}
+/**
+ * 遅延コンパイルの関数本体をコンパイルする
+ * 最初の呼び出し時に実行される
+ * エラーの場合は例外をセットしてFALSEを返す
+ */
+int compile_lazy_function(RefNode *func)
+{
+    LazyFunc *lf = func->u.f.vp;
+    RefNode *module = func->defined_module;
+    Value error = fg->error;
+    int dynamic = fv->cmp_dynamic;
+    char *src;
+    Block *bk;
+    PtrList *pl;
+    Tok tk;
+    int i;
+    int ret;
+
+    fox_init_compile(FALSE);
+    Hash_init(&module->u.m.unresolved, &fv->cmp_mem, 32);
+
+    src = malloc(lf->size + 1);
+    memcpy(src, lf->src, lf->size);
+    src[lf->size] = '\0';
+    Tok_init_line(&tk, module, src, lf->line);
+
+    tk.parse_cls = func->u.f.klass;
+    tk.parse_genr = lf->genr;
+    if (tk.parse_cls != NULL) {
+        Hash_init(&tk.m_var, &fv->cmp_mem, 16);
+        for (pl = lf->m_var; pl != NULL; pl = pl->next) {
+            RefNode *var = pl->u.p;
+            Hash_add_p(&tk.m_var, &fv->cmp_mem, var->name, var);
+        }
+    }
+    bk = Block_new(NULL, func);
+    for (i = 0; i < lf->n_args; i++) {
+        RefNode *var = lf->args[i];
+        Hash_add_p(&bk->h, &fv->cmp_mem, var->name, var);
+    }
+    bk->offset += lf->n_args;
+
+    ret = parse_body(func, &tk, lf->construct, bk);
+    Tok_close(&tk);
+    free(src);
+
+    if (ret) {
+        ret = fox_link();
+    }
+    fv->cmp_dynamic = dynamic;
+
+    if (!ret) {
+        // 次の呼び出しで再度コンパイルする
+        func->u.f.u.op = NULL;
+        discard_unresolved();
+        Mem_close(&fv->cmp_mem);
+        unref(error);
+        return FALSE;
+    }
+    fg->error = error;
+    return TRUE;
+}
@@ -495,6 +495,12 @@ int StrBuf_add_v(StrBuf *s, Value v)
             StrBuf_add_r(s, rs);
         } else if (type == fs->cls_bool) {
             StrBuf_add(s, Value_bool(v) ? "true" : "false", -1);
+        } else if (type == fs->cls_float) {
+            char cbuf[32];
+            int len = double_to_str(cbuf, Value_float2(v));
+            if (!StrBuf_add(s, cbuf, len)) {
+                return FALSE;
+            }
         } else if (type == fs->cls_module) {
             RefNode *nd = Value_type(v);
             StrBuf_add(s, "Module(", -1);
@@ -693,7 +693,16 @@ int invalid_utf8_pos(const char *src_p, int size)
         int c = *p;
 
         if ((c & 0x80) == 0) {
+            // ASCIIが続く部分は8バイトずつ調べる
             p++;
+            while (end - p >= 8) {
+                uint64_t w;
+                memcpy(&w, p, 8);
+                if ((w & 0x8080808080808080ULL) != 0) {
+                    break;
+                }
+                p += 8;
+            }
             continue;
         } else if ((c & 0xE0) == 0xC0) {
             // 非最短型
@@ -203,6 +203,8 @@ void init_fox_vm(int running_mode)
 
     fs->revision = FOX_INTERFACE_REVISION;
     fs->max_alloc = 64 * 1024 * 1024;  // 一時的
+    fv->max_callfunc = MAX_CALLFUNC_NUM;
+    gc_init();
     init_first_classes();
     g_intern_init();
 
@@ -290,6 +292,9 @@ void init_fox_stack()
     fg->stk_top = fg->stk + 1;
     fg->stk[0] = VALUE_NULL;
     fv->n_callfunc = 0;
+    fv->n_invoke = 0;
+    fv->n_frames = 0;
+    fv->stk_main_top = NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////